@@ -0,0 +1,76 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include "bench.h"
+
+// In a file of its own, so that the compiler can't see that it isn't read.
+static volatile uint32_t bench_sunk;
+
+static bool bench_json_first;
+
+double bench_now (
+    void
+)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+uint64_t bench_now_ns (
+    void
+)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+void bench_sink (
+    uint32_t value
+)
+{
+    bench_sunk += value;
+}
+
+
+void bench_json_begin (
+    const char * name
+)
+{
+    printf("{\"bench\": \"%s\", \"results\": [", name);
+    bench_json_first = true;
+}
+
+
+void bench_json_result (
+    const char * name,
+    uint32_t pixels,
+    const char * variant,
+    uint64_t iterations,
+    double ns_per_op,
+    double ns_min,
+    uint32_t batches
+)
+{
+    printf("%s\n    {\"name\": \"%s\", \"pixels\": %u, \"variant\": \"%s\", \"iterations\": %llu, "
+            "\"ns_per_op\": %.2f, \"ns_min\": %.2f, \"batches\": %u}",
+            bench_json_first ? "" : ",", name, pixels, variant, (unsigned long long)iterations,
+            ns_per_op, ns_min, batches);
+    bench_json_first = false;
+}
+
+
+void bench_json_end (
+    void
+)
+{
+    printf("\n]}\n");
+    fflush(stdout);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// What the benches have in common: a clock, a sink that keeps the compiler
+// from throwing work away, and the JSON they write their results as.
+//
+// Every bench writes one JSON object to stdout, and everything else it has
+// to say (what it checked, WRONG when that didn't hold, the same numbers
+// for people) to stderr, so that runs can be kept and compared:
+//
+//   {"bench": "bench_dither", "results": [
+//       {"name": "encode", "pixels": 49, "variant": "rgb8", "iterations": 2386000,
+//        "ns_per_op": 312.50, "ns_min": 312.50, "batches": 1},
+//       ...
+//   ]}
+//
+// name is what was timed, and variant tells cases with the same name apart.
+// An op is one call of what was timed, on pixels pixels (0 where pixels
+// don't come into it), done iterations times in all. ns_per_op is the
+// median over batches of them and ns_min the fastest batch; a bench that
+// times everything in one batch gives the same for both. A bench that only
+// checks things has no results.
+
+#include <stdint.h>
+
+// CLOCK_MONOTONIC, in seconds and in ns.
+double bench_now (
+    void
+);
+
+uint64_t bench_now_ns (
+    void
+);
+
+
+// Takes a result that nothing else reads, so that the work behind it
+// isn't optimized away.
+void bench_sink (
+    uint32_t value
+);
+
+
+// Starts the JSON object of the bench called name.
+void bench_json_begin (
+    const char * name
+);
+
+
+// Writes one result, see above.
+void bench_json_result (
+    const char * name,
+    uint32_t pixels,
+    const char * variant,
+    uint64_t iterations,
+    double ns_per_op,
+    double ns_min,
+    uint32_t batches
+);
+
+
+// Ends the JSON object.
+void bench_json_end (
+    void
+);
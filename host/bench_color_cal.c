@@ -0,0 +1,125 @@
+// Compares the per-pixel cost of the encoder with and without color
+// calibration, for 8 and 16 bit frames. The calibration uses a different
+// matrix for every 64 pixels, to look like a wall built from a few reels.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "matrix_encode.h"
+
+// Times the encoder on len pixels, writes the result as variant, and returns
+// the time per pixel.
+static double bench (
+    const char * variant,
+    const struct matrix_encode_s * enc,
+    const struct matrix_rgb_s * buf,
+    const struct matrix_rgb16_s * buf16,
+    uint32_t len,
+    uint8_t * out
+)
+{
+    uint64_t pixels = 0;
+    double start, elapsed;
+
+    start = bench_now();
+    do {
+        for (uint32_t i = 0; i < len; i++) {
+            if (NULL != buf16) {
+                matrix_encode_rgb16(enc, buf16, i, &out[i*3]);
+            } else {
+                matrix_encode_rgb(enc, buf, i, &out[i*3]);
+            }
+        }
+        pixels += len;
+        elapsed = bench_now() - start;
+    } while (elapsed < 0.5);
+    bench_json_result("encode", len, variant, pixels / len, elapsed / pixels * len * 1e9,
+            elapsed / pixels * len * 1e9, 1);
+
+    return elapsed / pixels * 1e9;
+}
+
+
+int main (
+    void
+)
+{
+    static struct color_lut_s lut;
+    static struct color_cal_s plain, cal;
+    static const uint32_t sizes[] = { 49, 1024, 16384 };
+    static const uint16_t gamma[3] = { 220, 220, 220 };
+    static uint8_t data[1 + COLOR_CAL_MAX_MATRICES * 18 + 16384];
+    struct matrix_encode_s enc = { .lut = &lut };
+    struct matrix_rgb_s * buf;
+    struct matrix_rgb16_s * buf16;
+    uint16_t * map;
+    uint8_t * out;
+    uint32_t len, sum;
+    int16_t coeff;
+
+    color_lut_init(&lut);
+    color_lut_set_gamma(&lut, gamma);
+
+    bench_json_begin("bench_color_cal");
+
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        len = sizes[s];
+        buf = malloc(len * sizeof(*buf));
+        buf16 = malloc(len * sizeof(*buf16));
+        map = malloc(len * sizeof(*map));
+        out = malloc(len * 3);
+        enc.map = map;
+        enc.dither = calloc(len, sizeof(*enc.dither));
+        for (uint32_t i = 0; i < len; i++) {
+            map[i] = i;
+            buf[i] = (struct matrix_rgb_s){ i, i * 3, i * 7 };
+            buf16[i] = (struct matrix_rgb16_s){ i * 13, i * 59, i * 101 };
+        }
+
+        // Mostly diagonal, with a bit of crosstalk.
+        data[0] = COLOR_CAL_MAX_MATRICES;
+        for (uint32_t i = 0; i < COLOR_CAL_MAX_MATRICES * 9; i++) {
+            coeff = (0 == i % 4) ? COLOR_CAL_ONE - 64 * (i / 9) : 32 * (i % 3);
+            data[1 + i*2] = coeff & 0xff;
+            data[2 + i*2] = (uint16_t)coeff >> 8;
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            data[1 + COLOR_CAL_MAX_MATRICES * 18 + i] = (i / 64) % COLOR_CAL_MAX_MATRICES;
+        }
+
+        color_cal_init(&plain, malloc(len));
+        color_cal_init(&cal, malloc(len));
+        if (0 != color_cal_load(&cal, len, data, 1 + COLOR_CAL_MAX_MATRICES * 18 + len)) {
+            fprintf(stderr, "color_cal_load failed\n");
+            return 1;
+        }
+
+        enc.cal = &plain;
+        fprintf(stderr, "encode_rgb   %5u pixels: %6.2f ns/pixel plain, ", len, bench("rgb8", &enc, buf, NULL, len, out));
+        enc.cal = &cal;
+        fprintf(stderr, "%6.2f ns/pixel calibrated\n", bench("rgb8_cal", &enc, buf, NULL, len, out));
+
+        enc.cal = &plain;
+        fprintf(stderr, "encode_rgb16 %5u pixels: %6.2f ns/pixel plain, ", len, bench("rgb16", &enc, NULL, buf16, len, out));
+        enc.cal = &cal;
+        fprintf(stderr, "%6.2f ns/pixel calibrated\n", bench("rgb16_cal", &enc, NULL, buf16, len, out));
+
+        // Keep the compiler from throwing the work away.
+        sum = 0;
+        for (uint32_t i = 0; i < len * 3; i++) {
+            sum += out[i];
+        }
+        bench_sink(sum);
+
+        free(buf);
+        free(buf16);
+        free(map);
+        free(out);
+        free(enc.dither);
+        free(plain.segment);
+        free(cal.segment);
+    }
+    bench_json_end();
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+// Compares the per-pixel cost of 16 bit frames (interpolated lookup plus
+// temporal dithering) with plain 8 bit frames. Sending a pixel to a WS2812
+// takes 30 us, so anything well below that keeps up with the strip.
+//
+// Checks first that the 16 bit lookup comes out as gamma and brightness
+// say it should, and exits with 1 if not.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "matrix_encode.h"
+
+// How far color_lut_lookup16 may be from the curve: a unit for rounding
+// the table, and one for interpolating between its entries.
+#define LOOKUP16_TOLERANCE 2
+
+// Compares color_lut_lookup16 with gamma(v) * brightness, worked out here
+// in double, at entries of the table, between them and at both ends.
+static int check_lookup16 (
+    const struct color_lut_s * lut,
+    double gamma,
+    double brightness
+)
+{
+    static const uint16_t inputs[] = {
+        0, 1, 128, 257, 1000, 12336, 12345, 32768, 40000, 51400, 54321, 65021, 65278, 65400, 65534, 65535
+    };
+    double want;
+    uint16_t got;
+    int errors = 0;
+
+    for (uint32_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        want = 65535 * pow(inputs[i] / 65535.0, gamma) * brightness;
+        got = color_lut_lookup16(lut, 0, inputs[i]);
+        if (fabs(got - want) > LOOKUP16_TOLERANCE) {
+            errors++;
+            fprintf(stderr, "lookup16(%u) is %u, should be %.1f: WRONG\n", inputs[i], got, want);
+        }
+    }
+
+    return errors;
+}
+
+
+int main (
+    void
+)
+{
+    static struct color_lut_s lut;
+    static struct color_cal_s cal;
+    static const uint32_t sizes[] = { 49, 1024, 16384 };
+    static const uint16_t gamma[3] = { 220, 220, 220 };
+    struct matrix_encode_s enc = { .lut = &lut, .cal = &cal };
+    struct matrix_rgb_s * buf;
+    struct matrix_rgb16_s * buf16;
+    uint16_t * map;
+    uint8_t * out;
+    uint32_t len, sum;
+    uint64_t pixels;
+    double start, elapsed;
+    int errors = 0;
+
+    color_lut_init(&lut);
+    errors += check_lookup16(&lut, 1.0, 1.0);
+    color_lut_set_gamma(&lut, gamma);
+    errors += check_lookup16(&lut, 2.2, 1.0);
+    color_lut_set_brightness(&lut, 64, 0, 0);
+    errors += check_lookup16(&lut, 2.2, 64 / 255.0);
+
+    bench_json_begin("bench_dither");
+
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        len = sizes[s];
+        buf = malloc(len * sizeof(*buf));
+        buf16 = malloc(len * sizeof(*buf16));
+        map = malloc(len * sizeof(*map));
+        out = malloc(len * 3);
+        enc.map = map;
+        enc.dither = calloc(len, sizeof(*enc.dither));
+        for (uint32_t i = 0; i < len; i++) {
+            map[i] = i;
+            buf[i] = (struct matrix_rgb_s){ i, i * 3, i * 7 };
+            buf16[i] = (struct matrix_rgb16_s){ i * 13, i * 59, i * 101 };
+        }
+
+        pixels = 0;
+        start = bench_now();
+        do {
+            for (uint32_t i = 0; i < len; i++) {
+                matrix_encode_rgb(&enc, buf, i, &out[i*3]);
+            }
+            pixels += len;
+            elapsed = bench_now() - start;
+        } while (elapsed < 0.5);
+        bench_json_result("encode", len, "rgb8", pixels / len, elapsed / pixels * len * 1e9,
+                elapsed / pixels * len * 1e9, 1);
+        fprintf(stderr, "encode_rgb   %5u pixels: %6.2f ns/pixel\n", len, elapsed / pixels * 1e9);
+
+        pixels = 0;
+        start = bench_now();
+        do {
+            for (uint32_t i = 0; i < len; i++) {
+                matrix_encode_rgb16(&enc, buf16, i, &out[i*3]);
+            }
+            pixels += len;
+            elapsed = bench_now() - start;
+        } while (elapsed < 0.5);
+        bench_json_result("encode", len, "rgb16", pixels / len, elapsed / pixels * len * 1e9,
+                elapsed / pixels * len * 1e9, 1);
+        fprintf(stderr, "encode_rgb16 %5u pixels: %6.2f ns/pixel\n", len, elapsed / pixels * 1e9);
+
+        // Keep the compiler from throwing the work away.
+        sum = 0;
+        for (uint32_t i = 0; i < len * 3; i++) {
+            sum += out[i];
+        }
+        bench_sink(sum);
+
+        free(buf);
+        free(buf16);
+        free(map);
+        free(out);
+        free(enc.dither);
+    }
+    bench_json_end();
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+// Measures how encoding a frame scales when it's split between two cores,
+// the way matrix_display_draw_rgb does it: both encode their part of the
+// strip (see matrix_encode.h), the power limit is worked out from both
+// sums, and then both write their part of the SPI frame. Two threads stand
+// in for the cores, handing work over with semaphores in place of task
+// notifications.
+//
+// Checks that the frames come out the same either way, and prints the time
+// per frame for a few sizes of wall.
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "matrix_encode.h"
+#include "led_driver.h"
+
+#define MAX_PIXELS 8192
+
+// The share of the second core, in 256ths, as in matrix.c.
+#define CORE0_SHARE 112
+
+struct shard_s {
+    void (* fn)(uint32_t first, uint32_t len);
+    uint32_t first;
+    uint32_t len;
+};
+
+static struct led_driver_s drv;
+static struct matrix_encode_s enc;
+static struct matrix_rgb_s frame[MAX_PIXELS];
+static uint8_t wire[MAX_PIXELS][3];
+static uint8_t * out;
+static uint32_t sum[2][3];
+static uint16_t scale;
+
+static struct shard_s shard;
+static sem_t go;
+static sem_t done;
+
+static void *core0 (
+    void * arg
+)
+{
+    (void)arg;
+
+    while (1) {
+        sem_wait(&go);
+        if (NULL == shard.fn) {
+            return NULL;
+        }
+        shard.fn(shard.first, shard.len);
+        sem_post(&done);
+    }
+}
+
+
+// Like matrix_shard_run.
+static void shard_run (
+    void (* fn)(uint32_t first, uint32_t len),
+    uint32_t num_pixels,
+    int cores
+)
+{
+    uint32_t split;
+
+    if (1 == cores) {
+        fn(0, num_pixels);
+        return;
+    }
+
+    split = num_pixels - num_pixels * CORE0_SHARE / 256;
+    shard = (struct shard_s) {
+        .fn = fn,
+        .first = split,
+        .len = num_pixels - split
+    };
+    sem_post(&go);
+    fn(0, split);
+    sem_wait(&done);
+}
+
+
+static void encode (
+    uint32_t first,
+    uint32_t len
+)
+{
+    matrix_encode_range(&enc, frame, NULL, wire, first, len, sum[0 != first]);
+}
+
+
+static void write_pixels (
+    uint32_t first,
+    uint32_t len
+)
+{
+    led_driver_write_pixels(&drv, out, (const uint8_t (*)[3])wire, first, len, scale);
+}
+
+
+// Draws a frame of num_pixels into out, returns its length.
+static uint32_t draw (
+    uint32_t num_pixels,
+    int cores
+)
+{
+    uint32_t total;
+
+    memset(sum, 0, sizeof(sum));
+    shard_run(encode, num_pixels, cores);
+
+    // Stands in for power_limit_scale: anything that needs both sums.
+    total = sum[0][0] + sum[1][0] + sum[0][1] + sum[1][1] + sum[0][2] + sum[1][2];
+    scale = total > 3 * 200 * num_pixels ? 200 : 256;
+
+    shard_run(write_pixels, num_pixels, cores);
+
+    return led_driver_write_ends(&drv, out, num_pixels);
+}
+
+
+int main (
+    void
+)
+{
+    static uint16_t map[MAX_PIXELS];
+    static struct color_lut_s lut;
+    static struct color_cal_s cal;
+    static const uint32_t sizes[] = { 256, 1024, 4096, 8192 };
+    uint8_t * reference;
+    pthread_t thread;
+    uint32_t n, len;
+    uint64_t frames;
+    double start, elapsed, ms[2];
+    int errors = 0;
+
+    srand(1);
+    for (uint32_t i = 0; i < MAX_PIXELS; i++) {
+        frame[i].r = rand();
+        frame[i].g = rand();
+        frame[i].b = rand();
+    }
+    color_lut_init(&lut);
+    color_lut_set_gamma(&lut, (const uint16_t[3]){ 220, 220, 220 });
+    color_cal_init(&cal, NULL);
+    enc.map = map;
+    enc.lut = &lut;
+    enc.cal = &cal;
+    led_driver_init(&drv, LED_DRIVER_WS2812, NULL);
+
+    out = malloc(LED_DRIVER_MAX_FRAME_LEN(MAX_PIXELS));
+    reference = malloc(LED_DRIVER_MAX_FRAME_LEN(MAX_PIXELS));
+    sem_init(&go, 0, 0);
+    sem_init(&done, 0, 0);
+    pthread_create(&thread, NULL, core0, NULL);
+
+    bench_json_begin("bench_encode_shard");
+
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        n = sizes[s];
+
+        // Scattered, like a serpentine wall, but inside the frame.
+        for (uint32_t i = 0; i < n; i++) {
+            map[i] = (i * 7919) % n;
+        }
+
+        len = draw(n, 1);
+        memcpy(reference, out, len);
+        memset(out, 0xaa, len);
+        if (len != draw(n, 2) || 0 != memcmp(reference, out, len)) {
+            errors++;
+            fprintf(stderr, "%5u pixels: WRONG\n", n);
+        }
+
+        for (int cores = 1; cores <= 2; cores++) {
+            frames = 0;
+            start = bench_now();
+            do {
+                draw(n, cores);
+                frames++;
+                elapsed = bench_now() - start;
+            } while (elapsed < 0.5);
+            ms[cores - 1] = elapsed / frames * 1e3;
+            bench_json_result("draw", n, 1 == cores ? "one_core" : "two_cores", frames,
+                    elapsed / frames * 1e9, elapsed / frames * 1e9, 1);
+        }
+        fprintf(stderr, "%5u pixels: %7.3f ms on one core, %7.3f ms on two, %.2fx\n",
+                n, ms[0], ms[1], ms[0] / ms[1]);
+    }
+
+    bench_json_end();
+
+    shard.fn = NULL;
+    sem_post(&go);
+    pthread_join(thread, NULL);
+    free(out);
+    free(reference);
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+// Plays a looped show through frame_cache, the way matrix_display_draw_rgb
+// uses it: every frame is looked up by its hash, and encoded (and added)
+// only if it isn't there. Checks that whatever comes out of the cache is
+// what encoding would have given, and prints the hit rate, what it saved,
+// and the time per frame for a few budgets, against encoding every frame.
+//
+// The show is longer than some of the budgets on purpose: LRU keeps
+// nothing useful when a loop doesn't fit.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "frame_cache.h"
+#include "led_driver.h"
+
+#define NUM_PIXELS 1024
+#define SHOW_LEN 120
+#define LOOPS 5
+
+int main (
+    void
+)
+{
+    static uint8_t show[SHOW_LEN][NUM_PIXELS][3];
+    static const uint32_t budgets_pct[] = { 0, 50, 100, 110 };
+    struct led_driver_s drv;
+    struct frame_cache_s cache;
+    const struct frame_cache_entry_s * entry;
+    uint8_t * out;
+    uint32_t frame_len, entry_size, hash, hits, sum = 0;
+    uint64_t bytes_saved;
+    double start, elapsed;
+    char variant[16];
+    int errors = 0;
+
+    led_driver_init(&drv, LED_DRIVER_WS2812, NULL);
+    frame_len = led_driver_frame_len(&drv, NUM_PIXELS);
+    entry_size = sizeof(struct frame_cache_entry_s) + sizeof(show[0]) + frame_len;
+    out = malloc(frame_len);
+
+    // A slow rainbow, so that no two frames are the same.
+    for (uint32_t f = 0; f < SHOW_LEN; f++) {
+        for (uint32_t i = 0; i < NUM_PIXELS; i++) {
+            show[f][i][0] = i + f * 2;
+            show[f][i][1] = i * 3 + f;
+            show[f][i][2] = 255 - i - f;
+        }
+    }
+
+    bench_json_begin("bench_frame_cache");
+    for (uint32_t b = 0; b < sizeof(budgets_pct) / sizeof(budgets_pct[0]); b++) {
+        frame_cache_init(&cache, malloc, free);
+        frame_cache_set_budget(&cache, (uint64_t)entry_size * SHOW_LEN * budgets_pct[b] / 100);
+
+        start = bench_now();
+        for (int loop = 0; loop < LOOPS; loop++) {
+            for (uint32_t f = 0; f < SHOW_LEN; f++) {
+                if (0 == cache.budget) {
+                    led_driver_write(&drv, out, (const uint8_t (*)[3])show[f], NUM_PIXELS, 256);
+                    sum += out[frame_len / 2];
+                    continue;
+                }
+
+                hash = frame_cache_hash(show[f], sizeof(show[f]));
+                entry = frame_cache_get(&cache, show[f], sizeof(show[f]), hash);
+                if (NULL != entry) {
+                    sum += entry->data[frame_len / 2];
+                    continue;
+                }
+                led_driver_write(&drv, out, (const uint8_t (*)[3])show[f], NUM_PIXELS, 256);
+                frame_cache_put(&cache, show[f], sizeof(show[f]), hash, out, frame_len, 256, 0);
+                sum += out[frame_len / 2];
+            }
+        }
+        elapsed = bench_now() - start;
+        hits = cache.hits;
+        bytes_saved = cache.bytes_saved;
+
+        // Whatever is left in the cache has to be right.
+        for (uint32_t f = 0; f < SHOW_LEN && 0 != cache.budget; f++) {
+            entry = frame_cache_get(&cache, show[f], sizeof(show[f]), frame_cache_hash(show[f], sizeof(show[f])));
+            if (NULL == entry) {
+                continue;
+            }
+            led_driver_write(&drv, out, (const uint8_t (*)[3])show[f], NUM_PIXELS, 256);
+            if (entry->len != frame_len || 0 != memcmp(entry->data, out, frame_len)) {
+                errors++;
+                fprintf(stderr, "frame %u from the cache: WRONG\n", f);
+            }
+        }
+
+        snprintf(variant, sizeof(variant), "budget%u", budgets_pct[b]);
+        bench_json_result("frame", NUM_PIXELS, variant, LOOPS * SHOW_LEN, elapsed / (LOOPS * SHOW_LEN) * 1e9,
+                elapsed / (LOOPS * SHOW_LEN) * 1e9, 1);
+        if (0 == cache.budget) {
+            fprintf(stderr, "no cache:         %7.1f us per frame\n", elapsed / (LOOPS * SHOW_LEN) * 1e6);
+        } else {
+            fprintf(stderr, "%3u%% of the show: %7.1f us per frame, %3u%% hits, %6.1f MB saved, %u kB used\n",
+                    budgets_pct[b],
+                    elapsed / (LOOPS * SHOW_LEN) * 1e6,
+                    hits * 100 / (LOOPS * SHOW_LEN),
+                    bytes_saved / 1e6,
+                    cache.used / 1024);
+        }
+
+        frame_cache_set_budget(&cache, 0);
+    }
+    bench_json_end();
+
+    bench_sink(sum);
+    free(out);
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+// Runs frame_clock against simulated time, the way led_task does: wait for
+// the tick, draw, record it. Drawing takes as long as the frame takes on
+// the wire, and every so often a lot longer, as if a burst of frames came
+// in. Checks that the rate is held down to what the strip can take, that
+// ticks stay on their grid, and that late ticks are counted as missed
+// rather than sent in a burst.
+
+#include <stdio.h>
+#include "bench.h"
+#include "frame_clock.h"
+#include "led_driver.h"
+
+#define TICKS 10000
+#define HICCUP_EVERY 50
+
+static int errors = 0;
+
+static void expect (
+    const char * what,
+    uint32_t got,
+    uint32_t want
+)
+{
+    if (got != want) {
+        errors++;
+        fprintf(stderr, "%s: %u, should be %u: WRONG\n", what, got, want);
+    }
+}
+
+
+// Runs TICKS ticks at rate_hz on num_pixels, returns the number of ticks
+// that were scheduled off the grid. A late tick starts whenever it can, but
+// the one after it should be back on time.
+static uint32_t run (
+    struct frame_clock_s * clock,
+    const struct led_driver_s * drv,
+    uint16_t rate_hz,
+    uint32_t num_pixels
+)
+{
+    uint32_t frame_us = led_driver_frame_us(drv, num_pixels);
+    uint32_t took_us, off_grid = 0;
+    int64_t now_us = 1000;
+    int64_t start_us;
+    uint16_t rate;
+
+    rate = frame_clock_set_rate(clock, rate_hz, frame_us, now_us);
+    frame_clock_reset_stats(clock);
+
+    for (uint32_t n = 0; n < TICKS; n++) {
+        now_us += frame_clock_wait_us(clock, now_us);
+        start_us = now_us;
+        if (!frame_clock_due(clock, start_us)) {
+            errors++;
+            fprintf(stderr, "tick %u not due after waiting for it: WRONG\n", n);
+        }
+
+        // Three and a half periods means two ticks missed.
+        took_us = 0 == n % HICCUP_EVERY ? clock->period_us * 7 / 2 : frame_us;
+        frame_clock_tick(clock, start_us, took_us);
+        now_us += took_us;
+        if (0 != (clock->next_us - 1000) % clock->period_us) {
+            off_grid++;
+        }
+    }
+
+    fprintf(stderr, "%4u pixels at %3u Hz: runs at %3u Hz (%5u us, %5u us on the wire), %u missed, %u over\n",
+            num_pixels, rate_hz, rate, clock->period_us, frame_us, clock->missed, clock->overruns);
+
+    return off_grid;
+}
+
+
+int main (
+    void
+)
+{
+    struct frame_clock_s clock;
+    struct led_driver_s drv;
+
+    // Nothing here is timed, so there are no results.
+    bench_json_begin("bench_frame_clock");
+    bench_json_end();
+
+    frame_clock_init(&clock);
+    led_driver_init(&drv, LED_DRIVER_WS2812, NULL);
+
+    expect("off grid", run(&clock, &drv, 60, 256), 0);
+    expect("period", clock.period_us, 1000000 / 60);
+    expect("missed", clock.missed, TICKS / HICCUP_EVERY * 2);
+    expect("overruns", clock.overruns, TICKS / HICCUP_EVERY);
+
+    // Too fast for the strip: a frame has to go out and latch first. With
+    // no time to spare, a tick that's late never catches up, and misses
+    // more after every hiccup.
+    expect("off grid", run(&clock, &drv, 60, 1024), 0);
+    expect("period", clock.period_us, led_driver_frame_us(&drv, 1024));
+
+    frame_clock_set_rate(&clock, 0, 0, 0);
+    expect("stopped", frame_clock_due(&clock, 1000000000), 0);
+
+    fprintf(stderr, "frame clock: %s\n", errors ? "WRONG" : "ok");
+
+    return errors ? 1 : 0;
+}
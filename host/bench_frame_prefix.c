@@ -0,0 +1,165 @@
+// Checks that frame_prefix cuts frames right: that only the pixels up to
+// the last one that changed go out, that everything goes out again when
+// the scale changes, after frame_prefix_invalidate or with truncating off,
+// and that the SPI frames come out as long as they should. Then plays a
+// progress bar and a wipe over a long strip, and prints how long they take
+// on the wire with and without truncating.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "frame_prefix.h"
+#include "led_driver.h"
+
+#define NUM_PIXELS 1024
+
+static uint8_t wire[NUM_PIXELS][3];
+static uint8_t last[NUM_PIXELS][3];
+static uint8_t * out;
+static int errors = 0;
+
+static void expect (
+    const char * what,
+    uint32_t got,
+    uint32_t want
+)
+{
+    if (got != want) {
+        errors++;
+        fprintf(stderr, "%s: %u, should be %u: WRONG\n", what, got, want);
+    }
+}
+
+
+// Sends wire and returns how long it takes on the wire, in us.
+static double send (
+    struct frame_prefix_s * prefix,
+    const struct led_driver_s * drv,
+    uint32_t * len_out
+)
+{
+    uint32_t len = frame_prefix_len(prefix, (const uint8_t (*)[3])wire, NUM_PIXELS, 256);
+    uint32_t frame_len = 0;
+
+    if (0 != len) {
+        frame_len = led_driver_write(drv, out, (const uint8_t (*)[3])wire, len, 256);
+        expect("frame length", frame_len, led_driver_frame_len(drv, len));
+    }
+    if (NULL != len_out) {
+        *len_out = len;
+    }
+
+    return frame_len * 8e6 / drv->spi_clock_hz;
+}
+
+
+// Plays an animation of NUM_PIXELS frames, where frame n sets wire for
+// step n, and returns the average time on the wire per frame.
+static double play (
+    struct frame_prefix_s * prefix,
+    const struct led_driver_s * drv,
+    void (* step)(uint32_t n)
+)
+{
+    double us = 0;
+
+    memset(wire, 0, sizeof(wire));
+    frame_prefix_invalidate(prefix);
+    send(prefix, drv, NULL);
+    for (uint32_t n = 0; n < NUM_PIXELS; n++) {
+        step(n);
+        us += send(prefix, drv, NULL);
+    }
+
+    return us / NUM_PIXELS;
+}
+
+
+// A bar that grows by a pixel per frame.
+static void progress_bar (
+    uint32_t n
+)
+{
+    wire[n][1] = 255;
+}
+
+
+// A soft edge, 16 pixels wide, that sweeps down the strip.
+static void wipe (
+    uint32_t n
+)
+{
+    for (uint32_t i = n; i < n + 16 && i < NUM_PIXELS; i++) {
+        wire[i][2] = 255 - (i - n) * 16;
+    }
+}
+
+
+int main (
+    void
+)
+{
+    struct frame_prefix_s prefix;
+    struct led_driver_s drv;
+    uint32_t len, changed;
+    double full_us, bar_us, wipe_us;
+
+    // Nothing here is timed, so there are no results.
+    bench_json_begin("bench_frame_prefix");
+    bench_json_end();
+
+    led_driver_init(&drv, LED_DRIVER_WS2812, NULL);
+    out = malloc(LED_DRIVER_MAX_FRAME_LEN(NUM_PIXELS));
+    frame_prefix_init(&prefix, last);
+    prefix.enabled = true;
+
+    srand(1);
+    for (uint32_t i = 0; i < NUM_PIXELS; i++) {
+        wire[i][0] = rand();
+        wire[i][1] = rand();
+        wire[i][2] = rand();
+    }
+
+    // The first frame has nothing to compare against.
+    send(&prefix, &drv, &len);
+    expect("first frame", len, NUM_PIXELS);
+    send(&prefix, &drv, &len);
+    expect("same frame", len, 0);
+
+    for (int n = 0; n < 10000; n++) {
+        changed = rand() % NUM_PIXELS;
+        wire[changed][rand() % 3] ^= 1 + rand() % 255;
+        send(&prefix, &drv, &len);
+        expect("one pixel changed", len, changed + 1);
+    }
+
+    wire[0][0] ^= 1;
+    len = frame_prefix_len(&prefix, (const uint8_t (*)[3])wire, NUM_PIXELS, 200);
+    expect("new scale", len, NUM_PIXELS);
+
+    wire[0][0] ^= 1;
+    frame_prefix_invalidate(&prefix);
+    len = frame_prefix_len(&prefix, (const uint8_t (*)[3])wire, NUM_PIXELS, 200);
+    expect("after frame_prefix_invalidate", len, NUM_PIXELS);
+
+    prefix.enabled = false;
+    wire[0][0] ^= 1;
+    send(&prefix, &drv, &len);
+    expect("truncating off", len, NUM_PIXELS);
+    send(&prefix, &drv, &len);
+    expect("truncating off, same frame", len, NUM_PIXELS);
+
+    fprintf(stderr, "frame lengths: %s\n", errors ? "WRONG" : "ok");
+
+    full_us = play(&prefix, &drv, progress_bar);
+    prefix.enabled = true;
+    bar_us = play(&prefix, &drv, progress_bar);
+    wipe_us = play(&prefix, &drv, wipe);
+    fprintf(stderr, "%u pixels: %.0f us per frame whole, %.0f us for a progress bar, %.0f us for a wipe\n",
+            NUM_PIXELS, full_us, bar_us, wipe_us);
+
+    free(out);
+
+    return errors ? 1 : 0;
+}
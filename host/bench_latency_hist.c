@@ -0,0 +1,99 @@
+// Checks which bucket latency_hist puts latencies in and that the JSON adds
+// up the cores, then measures what recording one costs, since it's done
+// from ISRs and for every frame.
+
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "latency_hist.h"
+
+#define ITERATIONS 10000000
+
+static int errors = 0;
+
+static void expect_bucket (
+    int64_t us,
+    uint32_t want
+)
+{
+    struct latency_hist_s hist;
+
+    latency_hist_init(&hist);
+    latency_hist_record(&hist, 1, LATENCY_WIRE, us);
+    if (1 != hist.count[1][LATENCY_WIRE][want]) {
+        errors++;
+        fprintf(stderr, "%lld us not in bucket %u: WRONG\n", (long long)us, want);
+    }
+}
+
+
+int main (
+    void
+)
+{
+    static struct latency_hist_s hist;
+    static char json[LATENCY_HIST_JSON_LEN];
+    const char * want;
+    uint32_t len;
+    double start, elapsed;
+
+    bench_json_begin("bench_latency_hist");
+    expect_bucket(-5, 0);
+    expect_bucket(0, 0);
+    expect_bucket(1, 0);
+    expect_bucket(2, 1);
+    expect_bucket(3, 1);
+    expect_bucket(4, 2);
+    expect_bucket(1000, 9);
+    expect_bucket(1024, 10);
+    expect_bucket((1 << (LATENCY_HIST_BUCKETS - 1)) - 1, LATENCY_HIST_BUCKETS - 2);
+    expect_bucket(1 << (LATENCY_HIST_BUCKETS - 1), LATENCY_HIST_BUCKETS - 1);
+    expect_bucket(INT64_MAX, LATENCY_HIST_BUCKETS - 1);
+
+    latency_hist_init(&hist);
+    latency_hist_record(&hist, 0, LATENCY_PARSE, 1);
+    latency_hist_record(&hist, 1, LATENCY_PARSE, 1);
+    latency_hist_record(&hist, 1, LATENCY_TOTAL, 1 << 30);
+    len = latency_hist_json(&hist, json, sizeof(json));
+    want = "{\"parse\":[2,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0],"
+            "\"queue\":[0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0],"
+            "\"draw\":[0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0],"
+            "\"wire\":[0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0],"
+            "\"total\":[0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1]}";
+    if (len != strlen(want) || 0 != strcmp(json, want)) {
+        errors++;
+        fprintf(stderr, "JSON: %s: WRONG\n", json);
+    }
+    if (0 != latency_hist_json(&hist, json, 100)) {
+        errors++;
+        fprintf(stderr, "JSON in 100 bytes: WRONG, it doesn't fit\n");
+    }
+
+    // The longest it can get.
+    for (int c = 0; c < LATENCY_HIST_CORES; c++) {
+        for (int s = 0; s < LATENCY_STAGES; s++) {
+            for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+                hist.count[c][s][b] = UINT32_MAX / 2;
+            }
+        }
+    }
+    if (0 == latency_hist_json(&hist, json, sizeof(json))) {
+        errors++;
+        fprintf(stderr, "JSON in LATENCY_HIST_JSON_LEN: WRONG, it doesn't fit\n");
+    }
+
+    fprintf(stderr, "buckets and JSON: %s\n", errors ? "WRONG" : "ok");
+
+    latency_hist_init(&hist);
+    start = bench_now();
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        latency_hist_record(&hist, i & 1, i % LATENCY_STAGES, i * 2654435761u >> 12);
+    }
+    elapsed = bench_now() - start;
+    bench_json_result("latency_hist", 0, "record", ITERATIONS, elapsed / ITERATIONS * 1e9,
+            elapsed / ITERATIONS * 1e9, 1);
+    bench_json_end();
+    fprintf(stderr, "latency_hist_record: %.1f ns\n", elapsed / ITERATIONS * 1e9);
+
+    return errors ? 1 : 0;
+}
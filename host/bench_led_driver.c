@@ -0,0 +1,213 @@
+// Checks each chipset's frames against what its datasheet says goes on the
+// wire, then times how long each driver takes to write out a frame, per
+// pixel, and how many bytes a pixel takes on the wire. The expanded chipsets
+// write 32 bytes per channel, the clocked ones 4 bytes per pixel.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "led_driver.h"
+
+// Two pixels, one with some white in it for the SK6812 to take out.
+static const uint8_t golden_rgb[2][3] = {
+    { 0x11, 0x22, 0x33 },
+    { 0x80, 0x00, 0xff },
+};
+
+// For the expanded chipsets, the channels in the order they go out, the SPI
+// word for a 0 and a 1 bit at their clock, and how many bytes of reset
+// follow.
+struct golden_expanded_s {
+    enum led_driver_type_e type;
+    uint8_t channels[8];
+    uint32_t num_channels;
+    uint8_t zero[4];
+    uint8_t one[4];
+    uint32_t reset_len;
+};
+
+static const struct golden_expanded_s golden_expanded[] = {
+    // RGB, 6 of 32 clocks high for a 0, 15 for a 1, 50 us of reset at 12.8 MHz.
+    { LED_DRIVER_WS2811,
+      { 0x11, 0x22, 0x33,   0x80, 0x00, 0xff }, 6,
+      { 0xfc, 0x00, 0x00, 0x00 }, { 0xff, 0xfe, 0x00, 0x00 }, 80 },
+    // GRB, 7 and 16 clocks high, 280 us at 26.67 MHz.
+    { LED_DRIVER_WS2812,
+      { 0x22, 0x11, 0x33,   0x00, 0x80, 0xff }, 6,
+      { 0xfe, 0x00, 0x00, 0x00 }, { 0xff, 0xff, 0x00, 0x00 }, 934 },
+    // GRBW, with what r, g and b have in common on the white LED; 8 and 15
+    // clocks high, 80 us at 25.64 MHz.
+    { LED_DRIVER_SK6812_RGBW,
+      { 0x11, 0x00, 0x22, 0x11,   0x00, 0x80, 0xff, 0x00 }, 8,
+      { 0xff, 0x00, 0x00, 0x00 }, { 0xff, 0xfe, 0x00, 0x00 }, 257 },
+};
+
+// APA102: a 32 bit start frame of zeros, 0xe0 | brightness (always 31, the
+// scale goes into the channels) and BGR for every pixel, and an end frame of
+// zeros.
+static const uint8_t golden_apa102[] = {
+    0x00, 0x00, 0x00, 0x00,
+    0xff, 0x33, 0x22, 0x11,
+    0xff, 0xff, 0x00, 0x80,
+    0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t golden_apa102_half[] = {
+    0x00, 0x00, 0x00, 0x00,
+    0xff, 0x19, 0x11, 0x08,
+    0xff, 0x7f, 0x00, 0x40,
+    0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+
+static int check_frame (
+    const char * name,
+    const uint8_t * out,
+    uint32_t len,
+    const uint8_t * want,
+    uint32_t want_len
+)
+{
+    if (len != want_len) {
+        fprintf(stderr, "%s golden frame: %u bytes, not %u: WRONG\n", name, len, want_len);
+        return 1;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        if (out[i] != want[i]) {
+            fprintf(stderr, "%s golden frame: byte %u is 0x%02x, not 0x%02x: WRONG\n", name, i, out[i], want[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int check_golden (
+    void
+)
+{
+    static uint8_t out[LED_DRIVER_MAX_FRAME_LEN(1024)];
+    static uint8_t want[LED_DRIVER_MAX_FRAME_LEN(2)];
+    static const uint32_t apa102_sizes[] = { 1, 2, 16, 17, 49, 1000, 1024 };
+    const struct golden_expanded_s * g;
+    struct led_driver_s drv;
+    uint32_t len, want_len, end_len;
+    int errors = 0;
+
+    for (uint32_t i = 0; i < sizeof(golden_expanded) / sizeof(golden_expanded[0]); i++) {
+        g = &golden_expanded[i];
+        led_driver_init(&drv, g->type, NULL);
+
+        // Every bit, most significant first, becomes one SPI word.
+        want_len = 0;
+        for (uint32_t c = 0; c < g->num_channels; c++) {
+            for (int bit = 7; bit >= 0; bit--) {
+                memcpy(&want[want_len], (g->channels[c] >> bit) & 1 ? g->one : g->zero, 4);
+                want_len += 4;
+            }
+        }
+        memset(&want[want_len], 0, g->reset_len);
+        want_len += g->reset_len;
+
+        memset(out, 0xaa, sizeof(out));
+        len = led_driver_write(&drv, out, golden_rgb, 2, 256);
+        errors += check_frame(drv.name, out, len, want, want_len);
+    }
+
+    led_driver_init(&drv, LED_DRIVER_APA102, NULL);
+    memset(out, 0xaa, sizeof(out));
+    len = led_driver_write(&drv, out, golden_rgb, 2, 256);
+    errors += check_frame(drv.name, out, len, golden_apa102, sizeof(golden_apa102));
+    memset(out, 0xaa, sizeof(out));
+    len = led_driver_write(&drv, out, golden_rgb, 2, 128);
+    errors += check_frame("apa102 at half", out, len, golden_apa102_half, sizeof(golden_apa102_half));
+
+    // However long the strip, the end frame is zeros, and at least one clock
+    // for every two pixels.
+    for (uint32_t i = 0; i < sizeof(apa102_sizes) / sizeof(apa102_sizes[0]); i++) {
+        memset(out, 0xaa, sizeof(out));
+        len = led_driver_write_ends(&drv, out, apa102_sizes[i]);
+        end_len = len - 4 - apa102_sizes[i] * 4;
+        if (0 != out[0] || 0 != out[1] || 0 != out[2] || 0 != out[3]) {
+            fprintf(stderr, "apa102 %u pixels: start frame isn't zeros: WRONG\n", apa102_sizes[i]);
+            errors++;
+        }
+        if (end_len * 8 < (apa102_sizes[i] + 1) / 2) {
+            fprintf(stderr, "apa102 %u pixels: end frame of %u bits: WRONG\n", apa102_sizes[i], end_len * 8);
+            errors++;
+        }
+        for (uint32_t b = len - end_len; b < len; b++) {
+            if (0 != out[b]) {
+                fprintf(stderr, "apa102 %u pixels: end frame isn't zeros: WRONG\n", apa102_sizes[i]);
+                errors++;
+                break;
+            }
+        }
+    }
+
+    return errors;
+}
+
+int main (
+    void
+)
+{
+    static const uint32_t sizes[] = { 49, 1024 };
+    struct led_driver_s drv;
+    uint8_t (* rgb)[3];
+    uint8_t * out;
+    uint32_t len, frame_len, sum;
+    uint64_t pixels;
+    double start, elapsed;
+    int errors = 0;
+
+    errors += check_golden();
+
+    bench_json_begin("bench_led_driver");
+
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        len = sizes[s];
+        rgb = malloc(len * sizeof(*rgb));
+        out = malloc(LED_DRIVER_MAX_FRAME_LEN(len));
+        for (uint32_t i = 0; i < len; i++) {
+            rgb[i][0] = i;
+            rgb[i][1] = i * 3;
+            rgb[i][2] = i * 7;
+        }
+
+        for (int type = 0; type < LED_DRIVER_COUNT; type++) {
+            led_driver_init(&drv, type, NULL);
+
+            // Scaled, as with the power limit on, which is the slower path.
+            pixels = 0;
+            frame_len = 0;
+            start = bench_now();
+            do {
+                frame_len = led_driver_write(&drv, out, (const uint8_t (*)[3])rgb, len, 200);
+                pixels += len;
+                elapsed = bench_now() - start;
+            } while (elapsed < 0.5);
+
+            bench_json_result("led_driver", len, drv.name, pixels / len, elapsed / pixels * len * 1e9,
+                    elapsed / pixels * len * 1e9, 1);
+            fprintf(stderr, "%-12s %5u pixels: %6.2f ns/pixel, %6.1f bytes/pixel, %7.1f us on the wire\n",
+                    drv.name, len, elapsed / pixels * 1e9, (double)frame_len / len,
+                    frame_len * 8e6 / drv.spi_clock_hz);
+
+            // Keep the compiler from throwing the work away.
+            sum = 0;
+            for (uint32_t i = 0; i < frame_len; i++) {
+                sum += out[i];
+            }
+            bench_sink(sum);
+        }
+
+        free(rgb);
+        free(out);
+    }
+    bench_json_end();
+
+    return errors ? 1 : 0;
+}
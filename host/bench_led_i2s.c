@@ -0,0 +1,176 @@
+// Checks the I2S parallel frames: that the transpose kernel agrees with a
+// plain bit-at-a-time loop, and that every lane of a written frame decodes
+// back to its segment. Then measures both against each other, per pixel of
+// the whole frame, for 8 and 16 lanes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "led_i2s.h"
+
+#define NUM_PIXELS 8192
+
+static uint64_t transpose8_naive (
+    const uint8_t * lane
+)
+{
+    uint64_t x = 0;
+
+    for (int b = 0; b < 8; b++) {
+        for (int k = 0; k < 8; k++) {
+            x |= (uint64_t)((lane[k] >> b) & 1) << (8 * b + k);
+        }
+    }
+
+    return x;
+}
+
+
+// Reads lane k back out of the samples, returns the number of wrong bytes.
+static int decode (
+    const struct led_driver_s * drv,
+    const uint8_t * samples,
+    const uint8_t * frame,
+    uint32_t num_pixels,
+    uint32_t lanes
+)
+{
+    struct led_i2s_shape_s shape;
+    uint32_t segment_len = (num_pixels + lanes - 1) / lanes;
+    uint32_t width = lanes / 8;
+    uint32_t pixel, s, sample, bit;
+    uint8_t v, expect;
+    int errors = 0;
+
+    led_i2s_shape(drv, &shape);
+
+    for (uint32_t k = 0; k < lanes; k++) {
+        for (uint32_t i = 0; i < segment_len * drv->channels; i++) {
+            v = 0;
+            for (int b = 0; b < 8; b++) {
+                s = ((i * 8 + b) * shape.samples) * width;
+                for (int n = 0; n < shape.samples; n++) {
+                    sample = samples[s + n * width] | (2 == width ? samples[s + n * width + 1] << 8 : 0);
+                    bit = (sample >> k) & 1;
+                    if (n < shape.high0 && !bit) errors++;
+                    if (n >= shape.high1 && bit) errors++;
+                    if (n == shape.high0) v = (v << 1) | bit;
+                    if (n > shape.high0 && n < shape.high1 && bit != (v & 1)) errors++;
+                }
+            }
+            pixel = k * segment_len + i / drv->channels;
+            expect = pixel < num_pixels ? frame[pixel * drv->channels + i % drv->channels] : 0;
+            if (v != expect) {
+                errors++;
+            }
+        }
+    }
+
+    return errors;
+}
+
+
+int main (
+    void
+)
+{
+    static uint8_t frame[NUM_PIXELS * 3];
+    static uint8_t lane[8];
+    static const uint32_t lane_counts[] = { 8, 16 };
+    struct led_driver_s drv;
+    struct led_i2s_shape_s shape;
+    uint8_t * samples;
+    uint32_t lanes, len, sum;
+    uint64_t pixels, groups, x;
+    double start, elapsed;
+    int errors = 0;
+    bool wrong;
+
+    bench_json_begin("bench_led_i2s");
+    srand(1);
+    for (int i = 0; i < 100000; i++) {
+        for (int k = 0; k < 8; k++) {
+            lane[k] = rand();
+        }
+        if (led_i2s_transpose8(lane) != transpose8_naive(lane)) {
+            errors++;
+        }
+    }
+    fprintf(stderr, "transpose8: %s\n", errors ? "WRONG" : "ok");
+
+    for (uint32_t i = 0; i < sizeof(frame); i++) {
+        frame[i] = rand();
+    }
+    samples = malloc(LED_DRIVER_MAX_FRAME_LEN(NUM_PIXELS) * 4);
+
+    // The shape of a bit for every chipset, and a frame of each.
+    for (enum led_driver_type_e type = 0; type < LED_DRIVER_COUNT; type++) {
+        led_driver_init(&drv, type, NULL);
+        if (0 != led_i2s_shape(&drv, &shape)) {
+            fprintf(stderr, "%s: no shape%s\n", drv.name, drv.expand ? ": WRONG" : "");
+            errors += drv.expand;
+            continue;
+        }
+        led_i2s_write(&drv, samples, frame, 49, 8);
+        wrong = 0 != decode(&drv, samples, frame, 49, 8);
+        errors += wrong;
+        fprintf(stderr, "%s: %u samples of %u ns, %u high for a 0, %u for a 1: %s\n", drv.name, shape.samples,
+                1000000000 / led_i2s_clock_hz(&drv), shape.high0, shape.high1, wrong ? "WRONG" : "ok");
+    }
+
+    led_driver_init(&drv, LED_DRIVER_WS2812, NULL);
+
+    for (uint32_t l = 0; l < sizeof(lane_counts) / sizeof(lane_counts[0]); l++) {
+        lanes = lane_counts[l];
+
+        // An odd number of pixels, so the last segment is short.
+        led_i2s_write(&drv, samples, frame, 49, lanes);
+        if (0 != decode(&drv, samples, frame, 49, lanes)) {
+            errors++;
+            fprintf(stderr, "%2u lanes, 49 pixels: WRONG\n", lanes);
+        }
+        len = led_i2s_write(&drv, samples, frame, NUM_PIXELS, lanes);
+        if (0 != decode(&drv, samples, frame, NUM_PIXELS, lanes)) {
+            errors++;
+            fprintf(stderr, "%2u lanes, %u pixels: WRONG\n", lanes, NUM_PIXELS);
+        }
+
+        pixels = 0;
+        start = bench_now();
+        do {
+            led_i2s_write(&drv, samples, frame, NUM_PIXELS, lanes);
+            pixels += NUM_PIXELS;
+            elapsed = bench_now() - start;
+        } while (elapsed < 0.5);
+
+        bench_json_result("i2s_write", NUM_PIXELS, 8 == lanes ? "lanes8" : "lanes16", pixels / NUM_PIXELS,
+                elapsed / pixels * NUM_PIXELS * 1e9, elapsed / pixels * NUM_PIXELS * 1e9, 1);
+        fprintf(stderr, "%2u lanes, %u pixels: %6.2f ns/pixel, %u bytes, %.1f ms on the wire\n",
+                lanes, NUM_PIXELS, elapsed / pixels * 1e9, len,
+                len / (lanes / 8) * 1e3 / led_i2s_clock_hz(&drv));
+    }
+
+    // The kernel on its own, against the naive loop.
+    for (int naive = 0; naive < 2; naive++) {
+        sum = 0;
+        groups = 0;
+        start = bench_now();
+        do {
+            for (uint32_t i = 0; i + 8 <= sizeof(frame); i += 8) {
+                x = naive ? transpose8_naive(&frame[i]) : led_i2s_transpose8(&frame[i]);
+                sum += x ^ (x >> 32);
+            }
+            groups += sizeof(frame) / 8;
+            elapsed = bench_now() - start;
+        } while (elapsed < 0.5);
+        bench_json_result("transpose8", 0, naive ? "bit" : "word", groups, elapsed / groups * 1e9,
+                elapsed / groups * 1e9, 1);
+        fprintf(stderr, "transpose8 %s: %6.2f ns per 8 bytes\n", naive ? "bit at a time " : "word at a time", elapsed / groups * 1e9);
+        bench_sink(sum);
+    }
+    bench_json_end();
+
+    free(samples);
+
+    return errors ? 1 : 0;
+}
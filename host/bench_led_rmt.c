@@ -0,0 +1,137 @@
+// Stands in for the RMT driver: feeds frames through the translator half a
+// memory block at a time, the way the driver's interrupt handler does, and
+// checks the items that come out against the chipset's timing. Then
+// measures how long the translator takes per pixel, which is the CPU time
+// the RMT output costs (compare with bench_led_driver for SPI).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "led_rmt.h"
+
+// What the firmware uses: 50 ns ticks, and 4 memory blocks of 64 items.
+#define TICK_NS 50
+#define HALF_MEM_ITEMS (4 * 64 / 2)
+
+#define NUM_PIXELS 1024
+
+static uint32_t translate (
+    const struct led_rmt_s * rmt,
+    const uint8_t * src,
+    uint32_t src_size,
+    uint32_t * items
+)
+{
+    size_t done = 0, num = 0;
+    size_t translated, item_num;
+
+    while (done < src_size) {
+        led_rmt_translate(rmt, src + done, items + num, src_size - done, HALF_MEM_ITEMS, &translated, &item_num);
+        if (0 == translated) {
+            return 0;
+        }
+        done += translated;
+        num += item_num;
+    }
+
+    return num;
+}
+
+
+// Checks that items are the bits of frame followed by the reset, with the
+// chipset's timing to within half a tick. Returns the number of problems.
+static int check (
+    const struct led_driver_s * drv,
+    const uint8_t * frame,
+    uint32_t frame_len,
+    const uint32_t * items,
+    uint32_t num
+)
+{
+    uint32_t high, low, bit;
+    int errors = 0;
+
+    if (num != frame_len * 8 + 1) {
+        fprintf(stderr, "  %u items, expected %u\n", num, frame_len * 8 + 1);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < frame_len * 8; i++) {
+        bit = (frame[i / 8] >> (7 - i % 8)) & 1;
+        high = (items[i] & 0x7fff) * TICK_NS;
+        low = ((items[i] >> 16) & 0x7fff) * TICK_NS;
+
+        if (!(items[i] & 0x8000) || (items[i] & 0x80000000)) {
+            errors++;
+        }
+        if (2 * abs((int)high - (bit ? drv->t1h_ns : drv->t0h_ns)) > TICK_NS) {
+            errors++;
+        }
+        if (2 * abs((int)(high + low) - drv->bit_ns) > TICK_NS) {
+            errors++;
+        }
+    }
+
+    high = (items[num - 1] & 0x7fff) * TICK_NS;
+    low = ((items[num - 1] >> 16) & 0x7fff) * TICK_NS;
+    if ((items[num - 1] & 0x80008000) || high + low < drv->reset_us * 1000U) {
+        errors++;
+    }
+
+    return errors;
+}
+
+
+int main (
+    void
+)
+{
+    static uint8_t rgb[NUM_PIXELS][3];
+    static uint8_t frame[NUM_PIXELS * 4 + 1];
+    static uint32_t items[NUM_PIXELS * 4 * 8 + 1];
+    struct led_driver_s drv;
+    struct led_rmt_s rmt;
+    uint32_t len, num;
+    uint64_t pixels;
+    double start, elapsed;
+    int errors, failed = 0;
+
+    for (uint32_t i = 0; i < NUM_PIXELS; i++) {
+        rgb[i][0] = i;
+        rgb[i][1] = i * 3;
+        rgb[i][2] = i * 7;
+    }
+
+    bench_json_begin("bench_led_rmt");
+    for (int type = 0; type < LED_DRIVER_COUNT; type++) {
+        led_driver_init(&drv, type, NULL);
+        if (0 != led_rmt_init(&rmt, &drv, TICK_NS)) {
+            fprintf(stderr, "%-12s no rmt\n", drv.name);
+            continue;
+        }
+
+        len = led_driver_pack(&drv, frame, (const uint8_t (*)[3])rgb, NUM_PIXELS, 256);
+        rmt.frame = frame;
+        rmt.frame_len = len;
+
+        num = translate(&rmt, frame, len + 1, items);
+        errors = check(&drv, frame, len, items, num);
+        failed |= errors;
+
+        pixels = 0;
+        start = bench_now();
+        do {
+            translate(&rmt, frame, len + 1, items);
+            pixels += NUM_PIXELS;
+            elapsed = bench_now() - start;
+        } while (elapsed < 0.5);
+
+        bench_json_result("rmt_translate", NUM_PIXELS, drv.name, pixels / NUM_PIXELS,
+                elapsed / pixels * NUM_PIXELS * 1e9, elapsed / pixels * NUM_PIXELS * 1e9, 1);
+        fprintf(stderr, "%-12s %5u pixels: %6.2f ns/pixel, timing %s\n",
+                drv.name, NUM_PIXELS, elapsed / pixels * 1e9, errors ? "WRONG" : "ok");
+    }
+    bench_json_end();
+
+    return failed ? 1 : 0;
+}
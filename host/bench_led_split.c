@@ -0,0 +1,219 @@
+// Sends split frames (see led_split.h) the way the firmware does, through
+// matrix_split_send and the shims' SPI2, SPI3 and RMT, and checks that the
+// segments start within SKEW_LIMIT_US of each other, which is what keeps
+// the wall from tearing. When a segment starts is when the sim's line was
+// handed its transfer, in the CPU time of the thread that did it, see
+// sim_line_queue.
+//
+// It's built like bench_matrix, and includes matrix.c. The shims queue a
+// transfer a lot faster than spi_device_queue_trans and rmt_write_sample
+// do on the ESP32, so the skew here is what the firmware adds on top.
+//
+// For comparison, it also prints the skew when every segment is started as
+// soon as it's encoded, and how long a frame of WIRE_PIXELS takes on the
+// wire split and unsplit.
+//
+// It also checks that a frame is done once every segment that started is,
+// when one doesn't: matrix_latency has to be back to nothing going out.
+
+#include "matrix.c"
+#include "sim_internal.h"
+#include "bench.h"
+
+#define ITERATIONS 500
+#define SKEW_LIMIT_US 100
+#define WIRE_PIXELS 1200
+
+static int errors = 0;
+
+// Interleaved: each segment is started right after it's encoded.
+static void bench_prepare_and_start (
+    void * arg,
+    int i,
+    uint32_t first,
+    uint32_t len
+)
+{
+    matrix_split_prepare(arg, i, first, len);
+    matrix_split_start(arg, i);
+}
+
+
+static void bench_nothing (
+    void * arg,
+    int i
+)
+{
+    (void)arg;
+    (void)i;
+}
+
+
+static int compare (
+    const void * a,
+    const void * b
+)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+// Runs ITERATIONS frames through ops and writes how long starting them
+// took as variant. Returns the 99th percentile skew in microseconds, and
+// the worst one in worst_us.
+static double run (
+    const char * variant,
+    const struct led_split_ops_s * ops,
+    const uint8_t (* rgb)[3],
+    double * worst_us
+)
+{
+    static double skew[ITERATIONS];
+    static double ns[ITERATIONS];
+    struct matrix_split_ctx_s ctx = {
+        .items = rmt_items,
+        .rgb = rgb,
+        .scale = 256
+    };
+    uint32_t count = led_split_count(&led_split);
+    int64_t first, last, started;
+    uint64_t start;
+
+    for (int n = 0; n < ITERATIONS; n++) {
+        matrix_latency_sent();
+        start = bench_now_ns();
+        matrix_latency.pending = count;
+        led_split_send(&led_split, ops, &ctx);
+        ns[n] = bench_now_ns() - start;
+        matrix_split_wait();
+
+        first = last = sim_line_queued_ns(SIM_LINE_SPI2);
+        for (enum sim_line_e line = SIM_LINE_SPI3; line < SIM_LINE_SPI2 + count; line++) {
+            started = sim_line_queued_ns(line);
+            if (started < first) first = started;
+            if (started > last) last = started;
+        }
+        skew[n] = (last - first) / 1e3;
+
+        if (0 != matrix_latency.sent_us) {
+            errors++;
+            fprintf(stderr, "%s, frame %d: still going out once it's done: WRONG\n", variant, n);
+            break;
+        }
+    }
+
+    qsort(ns, ITERATIONS, sizeof(ns[0]), compare);
+    bench_json_result("split_send", NUM_PIXELS, variant, ITERATIONS, ns[ITERATIONS / 2], ns[0], ITERATIONS);
+
+    qsort(skew, ITERATIONS, sizeof(skew[0]), compare);
+    *worst_us = skew[ITERATIONS - 1];
+
+    return skew[ITERATIONS * 99 / 100];
+}
+
+
+// A segment that can't be started mustn't leave the frame going out for
+// good, or every frame after it unaccounted for.
+static void check_failed_start (
+    const uint8_t (* rgb)[3]
+)
+{
+    uint32_t send_errors = telemetry.send_errors;
+
+    rmt_translator_init(RMT_CHANNEL, NULL);
+    matrix_latency_sent();
+    matrix_split_send(rmt_items, rgb, NUM_PIXELS, 256);
+    matrix_split_wait();
+    rmt_translator_init(RMT_CHANNEL, matrix_rmt_translate);
+
+    fprintf(stderr, "with the RMT segment failing to start: %u send errors, frame %s\n",
+            telemetry.send_errors - send_errors, 0 == matrix_latency.sent_us ? "done" : "still going out");
+    if (1 != telemetry.send_errors - send_errors || 0 != matrix_latency.sent_us) {
+        errors++;
+        fprintf(stderr, "  WRONG\n");
+    }
+
+    // And the frame after it goes out as usual.
+    matrix_latency_sent();
+    matrix_split_send(rmt_items, rgb, NUM_PIXELS, 256);
+    matrix_split_wait();
+    if (0 != matrix_latency.sent_us) {
+        errors++;
+        fprintf(stderr, "the next frame is still going out once it's done: WRONG\n");
+    }
+}
+
+
+int main (
+    void
+)
+{
+    static uint8_t rgb[NUM_PIXELS][3];
+    static const struct led_split_ops_s split_ops = {
+        .prepare = matrix_split_prepare,
+        .start = matrix_split_start
+    };
+    static const struct led_split_ops_s interleaved_ops = {
+        .prepare = bench_prepare_and_start,
+        .start = bench_nothing
+    };
+    struct led_split_s split;
+    double p99, worst;
+    esp_err_t ret;
+
+    // What app_main and led_task set up, minus wifi, with the split output.
+    setenv("SIM_RENDER", "none", 1);
+    esp_timer_get_time();
+    sim_leds_init();
+    latency_hist_init(&latency_hist);
+    telemetry_init(&telemetry);
+    telemetry.period_ms = 0;
+    log_ring_init(&log_ring);
+    task_stats_init(&task_stats);
+    trace_init(&trace);
+    led_driver_init(&led_driver, LED_DRIVER_WS2812, "rgb");
+    ret = matrix_output_split.open();
+    if (ESP_OK != ret) {
+        fprintf(stderr, "could not open the split output: %d\n", ret);
+        return 1;
+    }
+
+    srand(1);
+    for (int i = 0; i < NUM_PIXELS; i++) {
+        rgb[i][0] = rand();
+        rgb[i][1] = rand();
+        rgb[i][2] = rand();
+    }
+
+    bench_json_begin("bench_led_split");
+    p99 = run("prepared", &split_ops, (const uint8_t (*)[3])rgb, &worst);
+    fprintf(stderr, "prepared, then started: skew %6.1f us p99, %6.1f us worst\n", p99, worst);
+    if (p99 > SKEW_LIMIT_US) {
+        errors++;
+        fprintf(stderr, "  WRONG, over %d us\n", SKEW_LIMIT_US);
+    }
+
+    p99 = run("interleaved", &interleaved_ops, (const uint8_t (*)[3])rgb, &worst);
+    fprintf(stderr, "started as encoded:     skew %6.1f us p99, %6.1f us worst\n", p99, worst);
+
+    split = led_split;
+    led_split = (struct led_split_s){ .end = { NUM_PIXELS, NUM_PIXELS, NUM_PIXELS }, .pin = SPLIT_PINS };
+    run("whole", &split_ops, (const uint8_t (*)[3])rgb, &worst);
+    led_split = split;
+    bench_json_end();
+
+    check_failed_start((const uint8_t (*)[3])rgb);
+
+    // The strip latches once the longest segment has gone out, followed by
+    // its reset.
+    fprintf(stderr, "%u pixels on the wire: %.2f ms split %d ways, %.2f ms in one piece\n",
+            WIRE_PIXELS, led_driver_frame_us(&led_driver, (WIRE_PIXELS + LED_SPLIT_SEGMENTS - 1) / LED_SPLIT_SEGMENTS) / 1e3,
+            LED_SPLIT_SEGMENTS, led_driver_frame_us(&led_driver, WIRE_PIXELS) / 1e3);
+
+    matrix_output_split.close();
+
+    return errors ? 1 : 0;
+}
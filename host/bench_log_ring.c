@@ -0,0 +1,198 @@
+// Measures what a log call costs led_task when a burst of late frames
+// comes in, the way the "missed event" line used to go out: a printf to a
+// console that the UART drains at 115200 baud, which blocks once its 128
+// byte FIFO is full.
+//
+// Then the same burst through log_ring, with log_task's drain in another
+// thread, once without a rate limit and once with the one matrix.c uses.
+// Checks that every line either comes out or is counted as dropped, and
+// prints the 99th percentile and worst time per call.
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench.h"
+#include "log_ring.h"
+
+#define CALLS 400
+#define BAUD 115200
+#define UART_FIFO 128
+#define MISSED_PER_S 5
+
+static double uart_busy_until;
+static struct log_ring_s ring;
+static volatile int draining;
+static uint32_t drained;
+static uint32_t drained_dropped;
+
+// Writes a line to the UART, 10 bits per byte. Waits until it fits in the
+// FIFO, like printf on the console does.
+static void uart_printf (
+    const char * fmt,
+    ...
+)
+{
+    static const double byte_s = 10.0 / BAUD;
+    char line[LOG_RING_LINE_LEN + 32];
+    va_list ap;
+    double t;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    t = bench_now();
+    if (uart_busy_until < t) {
+        uart_busy_until = t;
+    }
+    while (uart_busy_until - (UART_FIFO - n) * byte_s > bench_now());
+    uart_busy_until += n * byte_s;
+}
+
+
+// Like log_task.
+static void *drain_thread (
+    void * arg
+)
+{
+    struct log_entry_s entry;
+    char line[LOG_RING_LINE_LEN];
+
+    (void)arg;
+    while (1) {
+        while (log_ring_read(&ring, &entry)) {
+            log_ring_format(&entry, line, sizeof(line));
+            uart_printf("W (led_task) %s\n", line);
+            drained++;
+            drained_dropped += entry.dropped;
+        }
+        if (!draining) {
+            return NULL;
+        }
+        usleep(50000);
+    }
+}
+
+
+static int compare (
+    const void * a,
+    const void * b
+)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+static void report (
+    const char * what,
+    const char * variant,
+    double * us
+)
+{
+    qsort(us, CALLS, sizeof(us[0]), compare);
+    bench_json_result("log", 0, variant, CALLS, us[CALLS / 2] * 1e3, us[0] * 1e3, CALLS);
+    fprintf(stderr, "%-24s %8.1f us p99, %8.1f us worst\n", what, us[CALLS * 99 / 100], us[CALLS - 1]);
+}
+
+
+// A burst of CALLS late frames, one every 100 us.
+static void burst (
+    struct log_site_s * site,
+    double * us
+)
+{
+    double start;
+
+    for (int n = 0; n < CALLS; n++) {
+        start = bench_now();
+        if (NULL == site) {
+            uart_printf("missed event - supposed to be at %d, but we're at %d\n", 1000 + n, 1001 + n);
+        } else {
+            log_ring_printf(&ring, site, (uint32_t)(start * 1000), 'W', "led_task",
+                    "missed event - supposed to be at %d, but we're at %d", 1000 + n, 1001 + n);
+        }
+        us[n] = (bench_now() - start) * 1e6;
+        usleep(100);
+    }
+}
+
+
+// Runs a burst through log_ring, returns the number of lines that got lost.
+static uint32_t ring_burst (
+    uint32_t per_s,
+    double * us
+)
+{
+    struct log_site_s site = LOG_SITE(per_s);
+    pthread_t drain;
+
+    log_ring_init(&ring);
+    drained = drained_dropped = 0;
+    draining = 1;
+    pthread_create(&drain, NULL, drain_thread, NULL);
+    burst(&site, us);
+    draining = 0;
+    pthread_join(drain, NULL);
+
+    // The last lines that were dropped have nothing to report them.
+    return CALLS - drained - drained_dropped - site.dropped;
+}
+
+
+int main (
+    void
+)
+{
+    static double us[CALLS];
+    struct log_entry_s entry;
+    struct log_site_s site = LOG_SITE(1);
+    char line[LOG_RING_LINE_LEN];
+    int errors = 0;
+
+    bench_json_begin("bench_log_ring");
+    burst(NULL, us);
+    report("printf:", "printf", us);
+
+    if (0 != ring_burst(CALLS, us)) {
+        errors++;
+        fprintf(stderr, "lines lost without a limit: WRONG\n");
+    }
+    report("log_ring, no limit:", "ring", us);
+    fprintf(stderr, "  %u lines out, %u didn't fit\n", drained, ring.full);
+
+    if (0 != ring_burst(MISSED_PER_S, us)) {
+        errors++;
+        fprintf(stderr, "lines lost with a limit: WRONG\n");
+    }
+    report("log_ring, 5 per second:", "ring_limited", us);
+    bench_json_end();
+    fprintf(stderr, "  %u lines out, %u over the limit\n", drained, ring.limited);
+
+    // What comes out has to be what went in.
+    log_ring_init(&ring);
+    log_ring_printf(&ring, &site, 0, 'E', "t", "a %d %c %x", -1, 'b', 0xc);
+    log_ring_printf(&ring, &site, 1, 'E', "t", "dropped");
+    log_ring_printf(&ring, &site, 1000, 'E', "t", "no args");
+    log_ring_read(&ring, &entry);
+    log_ring_format(&entry, line, sizeof(line));
+    if (0 != strcmp(line, "a -1 b c")) {
+        errors++;
+        fprintf(stderr, "\"%s\": WRONG\n", line);
+    }
+    log_ring_read(&ring, &entry);
+    log_ring_format(&entry, line, sizeof(line));
+    if (0 != strcmp(line, "no args (1 more dropped)") || log_ring_read(&ring, &entry)) {
+        errors++;
+        fprintf(stderr, "\"%s\": WRONG\n", line);
+    }
+    fprintf(stderr, "lines: %s\n", errors ? "WRONG" : "ok");
+
+    return errors ? 1 : 0;
+}
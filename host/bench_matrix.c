@@ -0,0 +1,686 @@
+// The firmware's hot paths, timed one by one, with the results as JSON so
+// that runs can be kept and compared:
+//
+//   ./build/bench_matrix > before.json
+//   (change something)
+//   ./build/bench_matrix -b before.json > after.json
+//
+// It's built like matrix_sim, against the shims in sim/, and includes
+// matrix.c, so that what's timed is the firmware's own code:
+//
+//   draw_rgb   matrix_display_draw_rgb, 8 and 16 bit frames, into an output
+//              that doesn't send anything, so only the encoding is timed
+//   encode     the same stages at sizes of wall NUM_PIXELS doesn't allow yet:
+//              matrix_encode_range, the power limit and led_driver
+//   queue      nats_queue_display_event and the xQueueReceive of led_task
+//   frame_clock  a tick of the refresh clock, the way led_task handles it
+//   nats       nats_task's parser, fed matrix1.in (the fast path of the
+//              grammar) or matrix1.frame16 (the generic one) over a socket,
+//              with a task standing in for led_task taking the frames
+//
+// Every case runs in batches of about -t ms (20 by default); ns_per_op is
+// the median of the batches, ns_min the fastest, as in every bench (see
+// bench.h). With -b, each result is also compared to the same case in an
+// earlier run, on stderr, where the rest of what's printed goes too.
+//
+// The queue and the tasks are the shims' here, so queue and nats say how
+// the firmware's code compares between runs, not what FreeRTOS and lwIP
+// take on the ESP32.
+//
+// Checks that draw_rgb comes out the same as the encode stages, that a
+// frame out of the frame cache counts for the power limit, and that the
+// parser gets every frame and gets it right; exits with 1 if not.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include "matrix.c"
+#include "sim_internal.h"
+#include "bench.h"
+
+#define BENCH_BATCHES 7
+#define BENCH_MAX_PIXELS 8192
+#define BENCH_MAX_BASELINE 64
+#define BENCH_NATS_MSGS 64        // half of event_queue
+
+struct bench_result_s {
+    char name[16];
+    uint32_t pixels;
+    char variant[16];
+    double ns_per_op;
+};
+
+// What the case being run works on, set before bench_case.
+static uint32_t bench_pixels;
+static bool bench_wide;
+static uint8_t (* bench_frames)[NUM_PIXELS][3];
+
+static struct bench_result_s bench_baseline[BENCH_MAX_BASELINE];
+static uint32_t bench_baseline_len;
+static int errors = 0;
+
+static int bench_compare (
+    const void * a,
+    const void * b
+)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+// Reads the results of an earlier run, one per line, as bench_json_result
+// writes them.
+static void bench_read_baseline (
+    const char * path
+)
+{
+    struct bench_result_s * r;
+    char line[256];
+    const char * p;
+    FILE * f;
+
+    f = fopen(path, "r");
+    if (NULL == f) {
+        perror(path);
+        exit(2);
+    }
+    while (NULL != fgets(line, sizeof(line), f) && bench_baseline_len < BENCH_MAX_BASELINE) {
+        p = strstr(line, "{\"name\"");
+        r = &bench_baseline[bench_baseline_len];
+        if (NULL != p && 4 == sscanf(p, "{\"name\": \"%15[^\"]\", \"pixels\": %u, \"variant\": \"%15[^\"]\", "
+                    "\"iterations\": %*u, \"ns_per_op\": %lf", r->name, &r->pixels, r->variant, &r->ns_per_op))
+        {
+            bench_baseline_len++;
+        }
+    }
+    fclose(f);
+}
+
+
+// Runs run(n) in batches of n, with n as big as it takes for a batch to
+// last batch_ns, and prints how long one op took.
+static void bench_case (
+    const char * name,
+    const char * variant,
+    void (* run)(uint32_t n),
+    uint64_t batch_ns
+)
+{
+    double ns[BENCH_BATCHES];
+    uint64_t start;
+    uint64_t took;
+    uint32_t n = 1;
+    const struct bench_result_s * base = NULL;
+
+    run(1);
+    while (1) {
+        start = bench_now_ns();
+        run(n);
+        took = bench_now_ns() - start;
+        if (took >= batch_ns || n >= (1U << 30)) {
+            break;
+        }
+        n *= took < batch_ns / 16 ? 16 : 2;
+    }
+    for (int i = 0; i < BENCH_BATCHES; i++) {
+        start = bench_now_ns();
+        run(n);
+        ns[i] = (double)(bench_now_ns() - start) / n;
+    }
+    qsort(ns, BENCH_BATCHES, sizeof(ns[0]), bench_compare);
+
+    bench_json_result(name, bench_pixels, variant, (uint64_t)n * BENCH_BATCHES, ns[BENCH_BATCHES / 2], ns[0], BENCH_BATCHES);
+
+    for (uint32_t i = 0; i < bench_baseline_len; i++) {
+        if (0 == strcmp(bench_baseline[i].name, name) && bench_baseline[i].pixels == bench_pixels &&
+            0 == strcmp(bench_baseline[i].variant, variant))
+        {
+            base = &bench_baseline[i];
+        }
+    }
+    fprintf(stderr, "%-12s %5u %-8s %12.1f ns", name, bench_pixels, variant, ns[BENCH_BATCHES / 2]);
+    if (NULL != base) {
+        fprintf(stderr, ", was %.1f ns, %+.1f%%", base->ns_per_op,
+                (ns[BENCH_BATCHES / 2] - base->ns_per_op) * 100 / base->ns_per_op);
+    }
+    fprintf(stderr, "\n");
+}
+
+
+// Stands in for the SPI output, without the SPI: matrix_spi_write and
+// led_driver_write_ends still run, nothing is waited for or sent.
+static void bench_output_wait (
+    void
+)
+{
+}
+
+
+static esp_err_t bench_output_send (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    if (NULL != rgb) {
+        led_driver_write_pixels(&led_driver, (uint8_t *)items, rgb, 0, num_pixels, scale);
+    }
+    led_driver_write_ends(&led_driver, (uint8_t *)items, num_pixels);
+
+    return ESP_OK;
+}
+
+
+static const struct matrix_output_s bench_output = {
+    .name = "bench",
+    .chain = true,
+    .wait = bench_output_wait,
+    .send = bench_output_send,
+    .write = matrix_spi_write
+};
+
+
+static esp_err_t bench_output_send_frame (
+    const uint8_t * frame,
+    uint32_t len
+)
+{
+    return ESP_OK;
+}
+
+
+// The same, with frames out of the frame cache.
+static const struct matrix_output_s bench_cache_output = {
+    .name = "bench",
+    .chain = true,
+    .wait = bench_output_wait,
+    .send = bench_output_send,
+    .write = matrix_spi_write,
+    .send_frame = bench_output_send_frame
+};
+
+// What led_task encodes with, set up the way it does.
+static uint16_t draw_map[NUM_PIXELS];
+static struct color_lut_s draw_lut;
+static struct color_cal_s draw_cal;
+static uint8_t draw_segment[NUM_PIXELS];
+static uint8_t draw_dither[NUM_PIXELS][3];
+static uint8_t draw_wire[NUM_PIXELS][3];
+static struct power_limit_s draw_power;
+static struct frame_prefix_s draw_prefix;
+static uint8_t draw_prefix_last[NUM_PIXELS][3];
+static struct frame_cache_s draw_cache;
+static const struct matrix_encode_s draw_enc = {
+    .map = draw_map,
+    .lut = &draw_lut,
+    .cal = &draw_cal,
+    .dither = draw_dither,
+    .wire = draw_wire,
+    .power = &draw_power,
+    .prefix = &draw_prefix,
+    .cache = &draw_cache
+};
+static struct matrix_rgb_s draw_buf[2][NUM_PIXELS];
+static struct matrix_rgb16_s draw_buf16[2][NUM_PIXELS];
+
+// A frame that goes out of the frame cache has to count for the power
+// limit the way it did when it was encoded.
+static void bench_check_cache_power (
+    void
+)
+{
+    struct power_limit_s encoded;
+
+    matrix_output = &bench_cache_output;
+    frame_cache_set_budget(&draw_cache, 4 * LED_DRIVER_MAX_FRAME_LEN(NUM_PIXELS));
+    draw_power.budget_ma = NUM_PIXELS * 10;
+    power_limit_reset_stats(&draw_power);
+
+    matrix_display_draw_rgb(rmt_items, &draw_enc, draw_buf[0], NULL, NUM_PIXELS);
+    encoded = draw_power;
+    matrix_display_draw_rgb(rmt_items, &draw_enc, draw_buf[0], NULL, NUM_PIXELS);
+    fprintf(stderr, "a frame encoded, then out of the cache: %u hits, %u frames, %u limited, scale sum %u\n",
+            draw_cache.hits, draw_power.frames, draw_power.limited_frames, draw_power.scale_sum);
+    if (1 != draw_cache.hits || 1 != encoded.limited_frames ||
+        2 != draw_power.frames || 2 != draw_power.limited_frames ||
+        2 * encoded.scale_sum != draw_power.scale_sum ||
+        encoded.min_scale != draw_power.min_scale || encoded.max_ma != draw_power.max_ma)
+    {
+        errors++;
+        fprintf(stderr, "  WRONG\n");
+    }
+
+    draw_power.budget_ma = 0;
+    power_limit_reset_stats(&draw_power);
+    frame_cache_set_budget(&draw_cache, 0);
+    frame_cache_reset_stats(&draw_cache);
+    matrix_output = &bench_output;
+}
+
+
+// Two frames, every other call, so that frame_prefix doesn't leave any of
+// the strip out.
+static void bench_draw_rgb (
+    uint32_t n
+)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        if (bench_wide) {
+            matrix_display_draw_rgb(rmt_items, &draw_enc, NULL, draw_buf16[i & 1], bench_pixels);
+        } else {
+            matrix_display_draw_rgb(rmt_items, &draw_enc, draw_buf[i & 1], NULL, bench_pixels);
+        }
+    }
+}
+
+
+// The same, without matrix.c, for walls of up to BENCH_MAX_PIXELS.
+static struct matrix_encode_s encode_enc;
+static uint16_t encode_map[BENCH_MAX_PIXELS];
+static uint8_t encode_dither[BENCH_MAX_PIXELS][3];
+static struct power_limit_s encode_power;
+static struct matrix_rgb_s encode_buf[BENCH_MAX_PIXELS];
+static struct matrix_rgb16_s encode_buf16[BENCH_MAX_PIXELS];
+static uint8_t encode_wire[BENCH_MAX_PIXELS][3];
+static uint8_t encode_out[LED_DRIVER_MAX_FRAME_LEN(BENCH_MAX_PIXELS)];
+
+static uint32_t bench_encode_frame (
+    void
+)
+{
+    uint32_t sum[3] = { 0 };
+    uint16_t scale;
+
+    matrix_encode_range(&encode_enc, encode_buf, bench_wide ? encode_buf16 : NULL, encode_wire, 0,
+            bench_pixels, sum);
+    scale = power_limit_scale(&encode_power, bench_pixels, sum);
+    led_driver_write_pixels(&led_driver, encode_out, (const uint8_t (*)[3])encode_wire, 0, bench_pixels, scale);
+
+    return led_driver_write_ends(&led_driver, encode_out, bench_pixels);
+}
+
+
+static void bench_encode (
+    uint32_t n
+)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        bench_encode_frame();
+    }
+}
+
+
+static void bench_queue (
+    uint32_t n
+)
+{
+    static struct display_event_s in;
+    static struct display_event_s out;
+
+    for (uint32_t i = 0; i < n; i++) {
+        in.read_us = esp_timer_get_time();
+        nats_queue_display_event(&in);
+        xQueueReceive(event_queue, &out, 0);
+    }
+}
+
+
+// Time moves on by a period per tick, as if every tick was on time.
+static void bench_frame_clock (
+    uint32_t n
+)
+{
+    static struct frame_clock_s clock;
+    static int64_t now_us;
+
+    if (0 == clock.period_us) {
+        frame_clock_set_rate(&clock, 100, led_driver_frame_us(&led_driver, NUM_PIXELS), now_us);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (0 == frame_clock_wait_us(&clock, now_us) && frame_clock_due(&clock, now_us)) {
+            frame_clock_tick(&clock, now_us, 50);
+        }
+        now_us += clock.period_us;
+    }
+}
+
+
+// The other end of nats_task's socket: BENCH_NATS_MSGS messages at a time,
+// over and over. Each time, the frames are taken off event_queue before
+// more are sent, so that none are dropped, which would be quicker than
+// queueing them.
+static int nats_fd;
+static uint8_t nats_msgs[BENCH_NATS_MSGS * (32 + 16 + 6 * NUM_PIXELS + 2)];
+static uint32_t nats_msgs_len;
+static uint32_t nats_msg_len;
+
+// What the stand-in for led_task got.
+static uint32_t nats_received;
+static uint32_t nats_wrong;
+
+static uint32_t bench_nats_parsed (
+    void
+)
+{
+    return __atomic_load_n(&telemetry.frames, __ATOMIC_RELAXED) +
+        __atomic_load_n(&telemetry.queue_full, __ATOMIC_RELAXED);
+}
+
+
+// Builds the messages of the case about to run.
+static void bench_nats_build (
+    void
+)
+{
+    uint8_t * p = nats_msgs;
+    int64_t tv_sec = 0x7fffffff;
+
+    for (uint32_t m = 0; m < BENCH_NATS_MSGS; m++) {
+        if (bench_wide) {
+            p += sprintf((char *)p, "MSG matrix1.frame16 3 %u\r\n", 16 + 6 * NUM_PIXELS);
+            for (int i = 0; i < 8; i++) {
+                *p++ = tv_sec >> (8 * i);
+            }
+            memset(p, 0, 8);
+            p += 8;
+            for (int i = 0; i < NUM_PIXELS; i++) {
+                for (int c = 0; c < 3; c++) {
+                    *p++ = bench_frames[0][i][c];
+                    *p++ = bench_frames[0][i][c];
+                }
+            }
+        } else {
+            p += sprintf((char *)p, "MSG matrix1.in 1 %u\r\n", 16 + 3 * NUM_PIXELS);
+            memcpy(p, &(long){ tv_sec }, 8);
+            memset(p + 8, 0, 8);
+            p += 16;
+            memcpy(p, bench_frames[0], 3 * NUM_PIXELS);
+            p += 3 * NUM_PIXELS;
+        }
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+    nats_msgs_len = p - nats_msgs;
+    nats_msg_len = nats_msgs_len / BENCH_NATS_MSGS;
+}
+
+
+// Writes n messages, and waits for nats_task to have parsed them, and
+// the frames to have been taken.
+static void bench_nats (
+    uint32_t n
+)
+{
+    uint32_t len;
+    uint32_t until;
+    ssize_t ret;
+
+    while (0 != n) {
+        len = n < BENCH_NATS_MSGS ? n : BENCH_NATS_MSGS;
+        until = bench_nats_parsed() + len;
+        n -= len;
+        len *= nats_msg_len;
+        for (uint32_t done = 0; done < len; done += ret) {
+            ret = write(nats_fd, nats_msgs + done, len - done);
+            if (ret <= 0) {
+                perror("bench_nats");
+                exit(2);
+            }
+        }
+        while (bench_nats_parsed() < until ||
+            __atomic_load_n(&nats_received, __ATOMIC_RELAXED) < __atomic_load_n(&telemetry.frames, __ATOMIC_RELAXED))
+        {
+            sched_yield();
+        }
+    }
+}
+
+
+// Takes the frames off event_queue, like led_task, and checks them.
+static void bench_nats_drain (
+    void * arg
+)
+{
+    static struct display_event_s event;
+    bool wrong;
+
+    while (1) {
+        xQueueReceive(event_queue, &event, portMAX_DELAY);
+        wrong = false;
+        for (int i = 0; i < NUM_PIXELS; i++) {
+            if (event.wide) {
+                wrong |= event.display_buf16[i].r != bench_frames[0][i][0] * 257 ||
+                    event.display_buf16[i].g != bench_frames[0][i][1] * 257 ||
+                    event.display_buf16[i].b != bench_frames[0][i][2] * 257;
+            } else {
+                wrong |= event.display_buf[i].r != bench_frames[0][i][0] ||
+                    event.display_buf[i].g != bench_frames[0][i][1] ||
+                    event.display_buf[i].b != bench_frames[0][i][2];
+            }
+        }
+        __atomic_add_fetch(&nats_wrong, wrong, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&nats_received, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+// Starts nats_task on a socket to here, and gets it past the handshake.
+static void bench_nats_connect (
+    void
+)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    socklen_t addr_len = sizeof(addr);
+    char port[8];
+    char sub[64];
+    int listen_fd;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (-1 == listen_fd || 0 != bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        0 != listen(listen_fd, 1) || 0 != getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len))
+    {
+        perror("bench_nats_connect");
+        exit(2);
+    }
+    snprintf(port, sizeof(port), "%u", ntohs(addr.sin_port));
+    setenv("SIM_NATS_HOST", "127.0.0.1", 1);
+    setenv("SIM_NATS_PORT", port, 1);
+
+    s_wifi_event_group = xEventGroupCreate();
+    xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT | TIME_SYNC_BIT);
+    xTaskCreatePinnedToCore(nats_task, "natstask", 4096, NULL, 0, NULL, 0);
+    xTaskCreatePinnedToCore(bench_nats_drain, "ledtask", 2096, NULL, 1, NULL, 1);
+    sim_start_tasks();
+
+    // Every batch ends with a short write, which shouldn't wait for the
+    // one before to be acked.
+    nats_fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    if (-1 == nats_fd || 0 != setsockopt(nats_fd, IPPROTO_TCP, TCP_NODELAY, &(int){ 1 }, sizeof(int))) {
+        perror("bench_nats_connect");
+        exit(2);
+    }
+    write(nats_fd, "INFO {} \r\n+OK\r\n", strlen("INFO {} \r\n+OK\r\n"));
+
+    // The three SUBs, which say the handshake is through. Nothing else
+    // comes back, stats are off.
+    for (int i = 0; i < 3; ) {
+        for (ssize_t j = 0, ret = read(nats_fd, sub, sizeof(sub)); j < ret; j++) {
+            i += '\n' == sub[j];
+        }
+    }
+}
+
+
+static void bench_nats_check (
+    const char * variant
+)
+{
+    uint32_t parse_errors = 0;
+
+    while (__atomic_load_n(&nats_received, __ATOMIC_RELAXED) < telemetry.frames) {
+        sched_yield();
+    }
+    for (int i = 0; i < TELEMETRY_NATS_MACHINES; i++) {
+        parse_errors += telemetry.parse_errors[i];
+    }
+    if (0 != parse_errors || 0 != nats_wrong) {
+        errors++;
+        fprintf(stderr, "nats %s: %u parse errors, %u of %u frames wrong: WRONG\n",
+                variant, parse_errors, nats_wrong, nats_received);
+    }
+    if (0 != telemetry.queue_full) {
+        fprintf(stderr, "nats %s: the stand-in for led_task fell behind, %u of %u frames dropped\n",
+                variant, telemetry.queue_full, telemetry.queue_full + telemetry.frames);
+    }
+}
+
+
+static int usage (
+    const char * name
+)
+{
+    fprintf(stderr, "usage: %s [-t ms] [-b baseline.json]\n", name);
+
+    return 2;
+}
+
+
+int main (
+    int argc,
+    char ** argv
+)
+{
+    static const uint32_t draw_sizes[] = { 7, NUM_PIXELS / 2, NUM_PIXELS };
+    static const uint32_t encode_sizes[] = { NUM_PIXELS, 256, 1024, 4096, BENCH_MAX_PIXELS };
+    static uint8_t frames[2][NUM_PIXELS][3];
+    static uint8_t reference[LED_DRIVER_MAX_FRAME_LEN(NUM_PIXELS)];
+    uint64_t batch_ns = 20000000;
+    uint32_t len;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "t:b:"))) {
+        switch (opt) {
+            case 't': batch_ns = strtoull(optarg, NULL, 0) * 1000000; break;
+            case 'b': bench_read_baseline(optarg); break;
+            default: return usage(argv[0]);
+        }
+    }
+    if (optind != argc || 0 == batch_ns) {
+        return usage(argv[0]);
+    }
+
+    // What app_main and led_task set up, minus wifi and the outputs.
+    esp_timer_get_time();
+    event_queue = xQueueCreate(128, sizeof(struct display_event_s));
+    control_queue = xQueueCreate(4, sizeof(struct control_event_s));
+    latency_hist_init(&latency_hist);
+    telemetry_init(&telemetry);
+    telemetry.period_ms = 0;
+    log_ring_init(&log_ring);
+    task_stats_init(&task_stats);
+    trace_init(&trace);
+    led_driver_init(&led_driver, LED_DRIVER_WS2812, "rgb");
+    matrix_output = &bench_output;
+
+    pixel_map_build(draw_map, MATRIX_WIDTH, MATRIX_HEIGHT, &(struct pixel_map_layout_s){0});
+    color_lut_init(&draw_lut);
+    color_lut_set_gamma(&draw_lut, (const uint16_t[3]){ 220, 220, 220 });
+    color_cal_init(&draw_cal, draw_segment);
+    power_limit_init(&draw_power);
+    frame_prefix_init(&draw_prefix, draw_prefix_last);
+    frame_cache_init(&draw_cache, matrix_cache_alloc, heap_caps_free);
+
+    encode_enc = draw_enc;
+    encode_enc.map = encode_map;
+    encode_enc.dither = encode_dither;
+    encode_enc.power = &encode_power;
+    power_limit_init(&encode_power);
+
+    srand(1);
+    for (int f = 0; f < 2; f++) {
+        for (int i = 0; i < NUM_PIXELS; i++) {
+            for (int c = 0; c < 3; c++) {
+                frames[f][i][c] = rand();
+            }
+            draw_buf[f][i] = (struct matrix_rgb_s){ frames[f][i][0], frames[f][i][1], frames[f][i][2] };
+            draw_buf16[f][i] = (struct matrix_rgb16_s){ frames[f][i][0] * 257, frames[f][i][1] * 257,
+                frames[f][i][2] * 257 };
+        }
+    }
+    for (int i = 0; i < BENCH_MAX_PIXELS; i++) {
+        encode_buf[i] = draw_buf[i % 2][i % NUM_PIXELS];
+        encode_buf16[i] = draw_buf16[i % 2][i % NUM_PIXELS];
+    }
+    bench_frames = frames;
+
+    fprintf(stderr, "%u pixels of %s\n", NUM_PIXELS, led_driver.name);
+    bench_json_begin("bench_matrix");
+
+    // draw_rgb has to come out the way the encode stages do, from the
+    // same map, tables and frame.
+    bench_pixels = NUM_PIXELS;
+    bench_wide = false;
+    memcpy(encode_map, draw_map, sizeof(draw_map));
+    memcpy(encode_buf, draw_buf[0], sizeof(draw_buf[0]));
+    frame_prefix_invalidate(&draw_prefix);
+    matrix_display_draw_rgb(rmt_items, &draw_enc, draw_buf[0], NULL, NUM_PIXELS);
+    len = bench_encode_frame();
+    memcpy(reference, encode_out, len);
+    if (0 != memcmp(rmt_items, reference, len)) {
+        errors++;
+        fprintf(stderr, "draw_rgb and encode differ: WRONG\n");
+    }
+    for (int i = 0; i < NUM_PIXELS; i++) {
+        encode_buf[i] = draw_buf[i % 2][i];
+    }
+    bench_check_cache_power();
+
+    for (int wide = 0; wide < 2; wide++) {
+        bench_wide = wide;
+        for (uint32_t s = 0; s < sizeof(draw_sizes) / sizeof(draw_sizes[0]); s++) {
+            bench_pixels = draw_sizes[s];
+            frame_prefix_invalidate(&draw_prefix);
+            bench_case("draw_rgb", wide ? "rgb16" : "rgb8", bench_draw_rgb, batch_ns);
+        }
+    }
+
+    // Scattered, like a serpentine wall, but inside the frame.
+    for (int wide = 0; wide < 2; wide++) {
+        bench_wide = wide;
+        for (uint32_t s = 0; s < sizeof(encode_sizes) / sizeof(encode_sizes[0]); s++) {
+            bench_pixels = encode_sizes[s];
+            for (uint32_t i = 0; i < bench_pixels; i++) {
+                encode_map[i] = (i * 7919) % bench_pixels;
+            }
+            bench_case("encode", wide ? "rgb16" : "rgb8", bench_encode, batch_ns);
+        }
+    }
+
+    bench_pixels = NUM_PIXELS;
+    bench_case("queue", "display", bench_queue, batch_ns);
+    bench_case("frame_clock", "tick", bench_frame_clock, batch_ns);
+
+    // The grammar only takes NUM_PIXELS pixels. The queue case counted
+    // frames too.
+    telemetry.frames = 0;
+    telemetry.queue_full = 0;
+    bench_nats_connect();
+    for (int wide = 0; wide < 2; wide++) {
+        bench_wide = wide;
+        bench_nats_build();
+        bench_case("nats", wide ? "frame16" : "in", bench_nats, batch_ns);
+        bench_nats_check(wide ? "frame16" : "in");
+    }
+
+    bench_json_end();
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,525 @@
+// nats_task against the NATS server of nats_stub.h, first one that behaves
+// and then ones that don't:
+//
+//   clean      frames, 8 and 16 bit, and PINGs, from the server's side and
+//              the test's, and how many frames a second get through
+//   split      the same, with everything the server sends cut into pieces
+//              of 1 to 7 bytes, and then of 1, so that reads end everywhere
+//              in the grammar
+//   slow       stats every 5 ms to a server that reads 512 bytes every
+//              2 ms, so that the wall's writes back up; the frames have to
+//              get through all the same, and the stats come out whole
+//   malformed  messages the parser has to reject, each followed by frames
+//              and a PING, which have to get through
+//   drop       the connection closed between messages, and in the middle
+//              of one: the wall has to have taken the frames before, and
+//              restart
+//
+// It's built like bench_matrix, and includes matrix.c: the one ragel makes
+// of matrix.c.rl when it's installed, see the Makefile. Every scenario runs
+// in a process of its own, forked before anything starts, so that each
+// starts from a fresh boot and esp_restart, which exits with 3 here, can be
+// told apart. The firmware's log goes to /dev/null unless -v is given; what
+// the scenarios say goes to stderr either way, and how fast clean got frames
+// through goes to stdout, as JSON (see bench.h).
+//
+// Exits with 1 if a scenario goes wrong.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "matrix.c"
+#include "sim_internal.h"
+#include "bench.h"
+#include "nats_stub.h"
+
+#define BENCH_CHUNK 32              // frames in flight at once, under event_queue's 128
+#define BENCH_TIMEOUT_MS 5000
+
+struct bench_scenario_s {
+    const char * name;
+    int (* run)(void);
+    uint32_t ping_ms;               // how often the server PINGs
+    int status;                     // what its process has to exit with
+};
+
+static struct nats_stub_s stub;
+static uint8_t frame[NUM_PIXELS][3];
+
+// What the stand-in for led_task got.
+static uint32_t received;
+static uint32_t wrong;
+
+// The stats the wall published, and the ones that weren't whole.
+static uint32_t stats;
+static uint32_t stats_wrong;
+
+// Where the scenarios say how they went: stderr, from before the firmware's
+// log took it over.
+static FILE * bench_out;
+
+// What clean measured, shared with the parent, which writes it out.
+static struct {
+    uint32_t frames;
+    uint64_t ns;
+} * bench_clean_rate;
+
+
+// Waits for *value to reach want. Returns false if it doesn't in time.
+static bool bench_wait (
+    uint32_t * value,
+    uint32_t want
+)
+{
+    uint64_t until_ns = bench_now_ns() + BENCH_TIMEOUT_MS * 1000000ULL;
+
+    while (__atomic_load_n(value, __ATOMIC_RELAXED) < want) {
+        if (bench_now_ns() > until_ns) {
+            return false;
+        }
+        usleep(100);
+    }
+
+    return true;
+}
+
+
+static uint32_t bench_parse_errors (
+    void
+)
+{
+    uint32_t errors = 0;
+
+    for (int i = 0; i < TELEMETRY_NATS_MACHINES; i++) {
+        errors += __atomic_load_n(&telemetry.parse_errors[i], __ATOMIC_RELAXED);
+    }
+
+    return errors;
+}
+
+
+static void bench_set_faults (
+    struct nats_stub_faults_s faults
+)
+{
+    pthread_mutex_lock(&stub.lock);
+    stub.faults = faults;
+    pthread_mutex_unlock(&stub.lock);
+}
+
+
+// Takes the frames off event_queue, like led_task, and checks them.
+static void bench_drain (
+    void * arg
+)
+{
+    static struct display_event_s event;
+    bool bad;
+
+    while (1) {
+        xQueueReceive(event_queue, &event, portMAX_DELAY);
+        bad = false;
+        for (int i = 0; i < NUM_PIXELS; i++) {
+            if (event.wide) {
+                bad |= event.display_buf16[i].r != frame[i][0] * 257 ||
+                    event.display_buf16[i].g != frame[i][1] * 257 ||
+                    event.display_buf16[i].b != frame[i][2] * 257;
+            } else {
+                bad |= event.display_buf[i].r != frame[i][0] ||
+                    event.display_buf[i].g != frame[i][1] ||
+                    event.display_buf[i].b != frame[i][2];
+            }
+        }
+        __atomic_add_fetch(&wrong, bad, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&received, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+// Called by the stub, for what the wall publishes.
+static void bench_on_pub (
+    void * ctx,
+    const char * subject,
+    const uint8_t * payload,
+    uint32_t len
+)
+{
+    if (0 != strncmp(subject, "matrix1.stats.", 14) || 0 == strcmp(subject, "matrix1.stats.trace")) {
+        return;
+    }
+    __atomic_add_fetch(&stats, 1, __ATOMIC_RELAXED);
+    if (len < 2 || '{' != payload[0] || '}' != payload[len - 1]) {
+        __atomic_add_fetch(&stats_wrong, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+// A frame on matrix1.in, or matrix1.frame16, with the header and CRLF
+// around it. Returns its length.
+static uint32_t bench_frame_msg (
+    uint8_t * msg,
+    bool wide
+)
+{
+    uint8_t * p = msg;
+    int64_t tv_sec = 0x7fffffff;
+
+    p += sprintf((char *)p, "MSG matrix1.%s %u\r\n", wide ? "frame16 3" : "in 1", 16 + (wide ? 6 : 3) * NUM_PIXELS);
+    for (int i = 0; i < 8; i++) {
+        *p++ = tv_sec >> (8 * i);
+    }
+    memset(p, 0, 8);
+    p += 8;
+    for (int i = 0; i < NUM_PIXELS; i++) {
+        for (int c = 0; c < 3; c++) {
+            *p++ = frame[i][c];
+            if (wide) {
+                *p++ = frame[i][c];
+            }
+        }
+    }
+    *p++ = '\r';
+    *p++ = '\n';
+
+    return p - msg;
+}
+
+
+// Publishes n frames, BENCH_CHUNK at a time, and waits for them to be
+// taken off event_queue. Returns false if they aren't.
+static bool bench_frames (
+    uint32_t n,
+    bool wide
+)
+{
+    static uint8_t msg[64 + 16 + 6 * NUM_PIXELS + 2];
+    uint32_t len = bench_frame_msg(msg, wide);
+    const char * payload = strstr((char *)msg, "\r\n") + 2;
+    uint32_t payload_len = len - (payload - (char *)msg) - 2;
+    uint32_t until = received;
+    uint32_t chunk;
+
+    while (0 != n) {
+        chunk = n < BENCH_CHUNK ? n : BENCH_CHUNK;
+        for (uint32_t i = 0; i < chunk; i++) {
+            nats_stub_publish(&stub, wide ? "matrix1.frame16" : "matrix1.in", payload, payload_len);
+        }
+        until += chunk;
+        n -= chunk;
+        if (!bench_wait(&received, until)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Sends a PING and waits for its PONG.
+static bool bench_ping (
+    void
+)
+{
+    uint32_t pongs;
+
+    pthread_mutex_lock(&stub.lock);
+    pongs = stub.pongs;
+    pthread_mutex_unlock(&stub.lock);
+    nats_stub_ping(&stub);
+
+    return bench_wait(&stub.pongs, pongs + 1);
+}
+
+
+// Boots the firmware's nats_task, minus wifi and led_task, against a stub
+// of its own, and waits until it has subscribed and is reading messages.
+static int bench_start (
+    uint32_t ping_ms,
+    bool verbose
+)
+{
+    char port[8];
+
+    bench_out = stderr;
+    if (!verbose) {
+        bench_out = fdopen(dup(STDERR_FILENO), "w");
+        setvbuf(bench_out, NULL, _IONBF, 0);
+        freopen("/dev/null", "w", stderr);
+    }
+
+    for (int i = 0; i < NUM_PIXELS; i++) {
+        for (int c = 0; c < 3; c++) {
+            // Under 'I', 'M' and 'P', so that what's left of a frame the
+            // parser gave up on doesn't look like the start of something.
+            frame[i][c] = (i * 3 + c) * 5 % 64;
+        }
+    }
+
+    esp_timer_get_time();
+    event_queue = xQueueCreate(128, sizeof(struct display_event_s));
+    control_queue = xQueueCreate(4, sizeof(struct control_event_s));
+    latency_hist_init(&latency_hist);
+    telemetry_init(&telemetry);
+    telemetry.period_ms = 0;
+    log_ring_init(&log_ring);
+    task_stats_init(&task_stats);
+    trace_init(&trace);
+    led_driver_init(&led_driver, LED_DRIVER_WS2812, "rgb");
+
+    stub.ping_ms = ping_ms;
+    stub.on_pub = bench_on_pub;
+    if (0 != nats_stub_start(&stub, 0)) {
+        perror("nats_stub_start");
+        return 2;
+    }
+    snprintf(port, sizeof(port), "%u", stub.port);
+    setenv("SIM_NATS_HOST", "127.0.0.1", 1);
+    setenv("SIM_NATS_PORT", port, 1);
+
+    s_wifi_event_group = xEventGroupCreate();
+    xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT | TIME_SYNC_BIT);
+    xTaskCreatePinnedToCore(nats_task, "natstask", 4096, NULL, 0, NULL, 0);
+    xTaskCreatePinnedToCore(bench_drain, "ledtask", 2096, NULL, 1, NULL, 1);
+    sim_start_tasks();
+
+    for (int i = 0; i < BENCH_TIMEOUT_MS && 0 == nats_stub_subscribers(&stub, "matrix1.frame16"); i++) {
+        usleep(1000);
+    }
+    if (0 == nats_stub_subscribers(&stub, "matrix1.frame16") || !bench_ping()) {
+        fprintf(bench_out, "never subscribed: WRONG\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static int bench_clean (
+    void
+)
+{
+    uint64_t start_ns;
+    double seconds;
+    uint32_t errors = bench_parse_errors();
+    bool ok = true;
+
+    start_ns = bench_now_ns();
+    for (int i = 0; i < 8 && ok; i++) {
+        ok = bench_frames(500, 1 == i % 2) && bench_ping();
+    }
+    seconds = (bench_now_ns() - start_ns) / 1e9;
+    bench_clean_rate->frames = received;
+    bench_clean_rate->ns = seconds * 1e9;
+
+    fprintf(bench_out, "  %u frames in %.2f s, %.0f a second, %u PONGs\n",
+            received, seconds, received / seconds, stub.pongs);
+
+    // The test's PINGs, the one of bench_start, and at least one of the
+    // server's.
+    return !ok || 0 != wrong || errors != bench_parse_errors() || stub.pongs <= 8 + 1;
+}
+
+
+static int bench_split (
+    void
+)
+{
+    uint32_t errors = bench_parse_errors();
+    bool ok = true;
+
+    bench_set_faults((struct nats_stub_faults_s){ .split = 7, .split_gap_us = 20 });
+    for (int i = 0; i < 4 && ok; i++) {
+        ok = bench_frames(50, 1 == i % 2) && bench_ping();
+    }
+    bench_set_faults((struct nats_stub_faults_s){ .split = 1, .split_gap_us = 20 });
+    for (int i = 0; i < 2 && ok; i++) {
+        ok = bench_frames(5, 1 == i % 2) && bench_ping();
+    }
+
+    fprintf(bench_out, "  %u frames\n", received);
+
+    return !ok || 0 != wrong || errors != bench_parse_errors();
+}
+
+
+static int bench_slow (
+    void
+)
+{
+    uint64_t start_ns;
+    double seconds;
+    bool ok = true;
+
+    bench_set_faults((struct nats_stub_faults_s){ .slow_bytes = 256, .slow_gap_ms = 10 });
+    nats_stub_publish(&stub, "matrix1.ctl.telemetry", (const uint8_t[]){ 5, 0, 0, 0 }, 4);
+
+    start_ns = bench_now_ns();
+    for (int i = 0; i < 30 && ok; i++) {
+        ok = bench_frames(BENCH_CHUNK, false);
+        usleep(10000);
+    }
+    seconds = (bench_now_ns() - start_ns) / 1e9;
+
+    fprintf(bench_out, "  %u frames and %u stats in %.2f s, %u publish failures\n",
+            received, stats, seconds, telemetry.publish_failures);
+
+    return !ok || 0 != wrong || 0 == stats || 0 != stats_wrong || 0 != telemetry.publish_failures;
+}
+
+
+static int bench_malformed (
+    void
+)
+{
+    static const struct {
+        const char * name;
+        const char * before;        // a printf format for what comes first
+        uint32_t zeros;             // then this many 0s
+        const char * after;         // and then this
+        enum telemetry_machine_e machine;   // TELEMETRY_NATS_MACHINES for dropped
+        uint32_t lost;              // good frames it may take with it
+    } cases[] = {
+        { "unknown operation", "HELLO\r\n", 0, "", TELEMETRY_NATS_LOOP, 0 },
+        { "PING without CRLF", "PINGX\r\n", 0, "", TELEMETRY_NATS_PING, 0 },
+        { "subject outside matrix1.", "MSG matrix2.in 1 3\r\n", 3, "\r\n", TELEMETRY_NATS_MSG, 0 },
+        { "matrix1.in, too short", "MSG matrix1.in 1 160\r\n", 160, "\r\n", TELEMETRY_NATS_MSG, 0 },
+        { "matrix1.in, no CRLF", "MSG matrix1.in 1 163\r\n", 163, "XX", TELEMETRY_NATS_MSG, 0 },
+        { "matrix1.in, cut short", "MSG matrix1.in 1 163\r\n", 100, "", TELEMETRY_NATS_MSG, 1 },
+        { "length not a number", "MSG matrix1.ctl.gamma 2 1x\r\n", 0, "\r\n", TELEMETRY_NATS_MSG_SUBJECT, 0 },
+        { "payload without CRLF", "MSG matrix1.ctl.telemetry 2 4\r\n", 4, "!!", TELEMETRY_NATS_MSG_END, 0 },
+        { "frame16, too short", "MSG matrix1.frame16 3 5\r\n", 5, "\r\n", TELEMETRY_NATS_MACHINES, 0 },
+        { "payload too long", "MSG matrix1.ctl.gamma 2 3000\r\n", 3000, "\r\n", TELEMETRY_NATS_MACHINES, 0 },
+    };
+    static uint8_t bytes[4096];
+    uint32_t len;
+    uint32_t before;
+    uint32_t until;
+    bool ok;
+    int errors = 0;
+
+    for (uint32_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        len = sprintf((char *)bytes, "%s", cases[i].before);
+        memset(bytes + len, 0, cases[i].zeros);
+        len += cases[i].zeros;
+        len += sprintf((char *)bytes + len, "%s", cases[i].after);
+
+        before = TELEMETRY_NATS_MACHINES == cases[i].machine ?
+            telemetry.dropped : telemetry.parse_errors[cases[i].machine];
+        until = received + 2 - cases[i].lost;
+        nats_stub_inject(&stub, bytes, len);
+
+        // A frame may be lost to the message before, but not both.
+        for (int f = 0; f < 2; f++) {
+            len = bench_frame_msg(bytes, false);
+            nats_stub_inject(&stub, bytes, len);
+        }
+        ok = bench_wait(&received, until) && bench_ping();
+        ok &= before != (TELEMETRY_NATS_MACHINES == cases[i].machine ?
+            telemetry.dropped : telemetry.parse_errors[cases[i].machine]);
+
+        fprintf(bench_out, "  %s: %s\n", cases[i].name, ok ? "ok" : "WRONG");
+        errors += !ok;
+    }
+
+    return 0 != errors || 0 != wrong;
+}
+
+
+// Waits for the wall to restart, which ends the process with 3.
+static int bench_restart (
+    void
+)
+{
+    usleep(BENCH_TIMEOUT_MS * 1000);
+    fprintf(bench_out, "  still running\n");
+
+    return 1;
+}
+
+
+static int bench_drop (
+    void
+)
+{
+    if (!bench_frames(20, false)) {
+        return 1;
+    }
+    nats_stub_drop(&stub);
+
+    return bench_restart();
+}
+
+
+static int bench_drop_mid_message (
+    void
+)
+{
+    static uint8_t msg[64 + 16 + 6 * NUM_PIXELS + 2];
+    uint32_t len = bench_frame_msg(msg, false);
+
+    if (!bench_frames(20, false)) {
+        return 1;
+    }
+    pthread_mutex_lock(&stub.lock);
+    stub.faults.drop_after = stub.clients[0].sent + len / 2;
+    pthread_mutex_unlock(&stub.lock);
+    nats_stub_inject(&stub, msg, len);
+
+    return bench_restart();
+}
+
+
+int main (
+    int argc,
+    char ** argv
+)
+{
+    static const struct bench_scenario_s scenarios[] = {
+        { "clean", bench_clean, 10, 0 },
+        { "split", bench_split, 0, 0 },
+        { "slow", bench_slow, 0, 0 },
+        { "malformed", bench_malformed, 0, 0 },
+        { "drop", bench_drop, 0, 3 },
+        { "drop mid-message", bench_drop_mid_message, 0, 3 },
+    };
+    bool verbose = argc > 1 && 0 == strcmp(argv[1], "-v");
+    int errors = 0;
+    int status;
+    pid_t pid;
+
+    bench_clean_rate = mmap(NULL, sizeof(*bench_clean_rate), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == bench_clean_rate) {
+        perror("bench_nats_task");
+        return 2;
+    }
+
+    for (uint32_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        fprintf(stderr, "%s\n", scenarios[i].name);
+        pid = fork();
+        if (0 == pid) {
+            status = bench_start(scenarios[i].ping_ms, verbose);
+            exit(0 != status ? status : scenarios[i].run());
+        }
+        if (-1 == pid || pid != waitpid(pid, &status, 0)) {
+            perror("bench_nats_task");
+            return 2;
+        }
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        if (scenarios[i].status != status) {
+            errors++;
+        }
+        fprintf(stderr, "%s: exited with %d: %s\n", scenarios[i].name, status, scenarios[i].status != status ? "WRONG" : "ok");
+    }
+
+    bench_json_begin("bench_nats_task");
+    if (0 != bench_clean_rate->frames) {
+        bench_json_result("nats_task", NUM_PIXELS, "clean", bench_clean_rate->frames,
+                (double)bench_clean_rate->ns / bench_clean_rate->frames,
+                (double)bench_clean_rate->ns / bench_clean_rate->frames, 1);
+    }
+    bench_json_end();
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,285 @@
+// Checks what every opcode computes, that shader_vm_load turns away
+// malformed programs (and only those), and that the budget and jumps stay in
+// bounds. Then measures how many pixels per second the shader VM evaluates,
+// for a plasma shader of the kind we expect people to upload.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "shader_vm.h"
+
+#define I(op, d, a, b) SHADER_VM_OP_##op, d, a, b
+
+static const uint8_t plasma[] = {
+    I(LDI,  7, 16, 0),      // r7 = 16
+    I(SHR,  8, 2, 2),       // r8 = t / 4
+    I(MUL,  6, 0, 7),       // r6 = x * 16
+    I(ADD,  6, 6, 8),       // r6 += t / 4
+    I(SIN,  3, 6, 0),       // r = sin(r6)
+    I(MUL,  9, 1, 7),       // r9 = y * 16
+    I(SUB,  9, 9, 8),       // r9 -= t / 4
+    I(SIN,  4, 9, 0),       // g = sin(r9)
+    I(ADD, 10, 6, 9),
+    I(SIN,  5, 10, 0),      // b = sin(r6 + r9)
+    I(LT,  11, 5, 7),
+    I(JZ,  11, 1, 0),       // if b >= 16, skip the next one
+    I(LDI,  5, 0, 0),       // b = 0
+    I(HALT, 0, 0, 0),
+};
+
+
+// Each of these runs on one pixel that starts out as { 9, 10, 11 }, at
+// t = 77, and should leave r at want and g and b as they were.
+struct op_case_s {
+    const char * name;
+    uint8_t code[8 * 4];
+    uint32_t len;
+    uint8_t want;
+};
+
+static const struct op_case_s op_cases[] = {
+    { "halt",       { I(HALT, 0, 0, 0) }, 1, 9 },
+    { "empty",      { 0 }, 0, 9 },
+    { "ldi",        { I(LDI, 3, 200, 0) }, 1, 200 },
+    { "ldi high",   { I(LDI, 3, 0x2c, 0x01) }, 1, 255 },      // 300, clamped
+    { "ldi neg",    { I(LDI, 3, 0xfb, 0xff) }, 1, 0 },        // -5, clamped
+    { "mov",        { I(MOV, 3, 2, 0) }, 1, 77 },
+    { "add",        { I(LDI, 6, 100, 0), I(LDI, 7, 55, 0), I(ADD, 3, 6, 7) }, 3, 155 },
+    { "addi",       { I(LDI, 6, 100, 0), I(ADDI, 3, 6, 0xfa) }, 2, 94 },
+    { "sub",        { I(LDI, 6, 100, 0), I(LDI, 7, 55, 0), I(SUB, 3, 6, 7) }, 3, 45 },
+    { "mul",        { I(LDI, 6, 12, 0), I(LDI, 7, 11, 0), I(MUL, 3, 6, 7) }, 3, 132 },
+    { "mulq",       { I(LDI, 6, 0xe8, 0x03), I(LDI, 7, 64, 0), I(MULQ, 3, 6, 7) }, 3, 250 },
+    { "div",        { I(LDI, 6, 100, 0), I(LDI, 7, 7, 0), I(DIV, 3, 6, 7) }, 3, 14 },
+    { "div 0",      { I(LDI, 6, 100, 0), I(DIV, 3, 6, 7) }, 2, 0 },
+    { "div -1",     { I(LDI, 6, 0x9c, 0xff), I(LDI, 7, 0xff, 0xff), I(DIV, 3, 6, 7) }, 3, 100 },
+    { "mod",        { I(LDI, 6, 100, 0), I(LDI, 7, 7, 0), I(MOD, 3, 6, 7) }, 3, 2 },
+    { "mod 0",      { I(LDI, 6, 100, 0), I(MOD, 3, 6, 7) }, 2, 0 },
+    { "and",        { I(LDI, 6, 0xf0, 0), I(LDI, 7, 0x3c, 0), I(AND, 3, 6, 7) }, 3, 0x30 },
+    { "or",         { I(LDI, 6, 0xf0, 0), I(LDI, 7, 0x0c, 0), I(OR, 3, 6, 7) }, 3, 0xfc },
+    { "xor",        { I(LDI, 6, 0xff, 0), I(LDI, 7, 0x0f, 0), I(XOR, 3, 6, 7) }, 3, 0xf0 },
+    { "shl",        { I(LDI, 6, 3, 0), I(SHL, 3, 6, 5) }, 2, 96 },
+    { "shr",        { I(LDI, 6, 0xc0, 0xff), I(SHR, 6, 6, 2), I(ADDI, 3, 6, 100) }, 3, 84 },
+    { "min",        { I(LDI, 6, 100, 0), I(LDI, 7, 55, 0), I(MIN, 3, 6, 7) }, 3, 55 },
+    { "max",        { I(LDI, 6, 100, 0), I(LDI, 7, 55, 0), I(MAX, 3, 6, 7) }, 3, 100 },
+    { "lt",         { I(LDI, 6, 55, 0), I(LDI, 7, 100, 0), I(LT, 3, 6, 7) }, 3, 1 },
+    { "lt not",     { I(LDI, 6, 100, 0), I(LDI, 7, 55, 0), I(LT, 3, 6, 7) }, 3, 0 },
+    { "sin 0",      { I(SIN, 3, 6, 0) }, 1, 128 },
+    { "sin 64",     { I(LDI, 6, 64, 0), I(SIN, 3, 6, 0) }, 2, 255 },
+    { "sin 448",    { I(LDI, 6, 0xc0, 0x01), I(SIN, 3, 6, 0) }, 2, 0 },
+    { "jmp",        { I(LDI, 3, 1, 0), I(JMP, 0, 1, 0), I(LDI, 3, 2, 0) }, 3, 1 },
+    { "jmp end",    { I(JMP, 0, 1, 0), I(LDI, 3, 2, 0) }, 2, 9 },
+    { "jz taken",   { I(LDI, 3, 1, 0), I(JZ, 6, 1, 0), I(LDI, 3, 2, 0) }, 3, 1 },
+    { "jz not",     { I(LDI, 3, 1, 0), I(JZ, 2, 1, 0), I(LDI, 3, 2, 0) }, 3, 2 },
+    { "jnz taken",  { I(LDI, 3, 1, 0), I(JNZ, 2, 1, 0), I(LDI, 3, 2, 0) }, 3, 1 },
+    { "jnz not",    { I(LDI, 3, 1, 0), I(JNZ, 6, 1, 0), I(LDI, 3, 2, 0) }, 3, 2 },
+};
+
+// Programs shader_vm_load has to turn away, and the ones right next to them
+// that it has to take.
+struct load_case_s {
+    const char * name;
+    uint8_t code[4 * 4];
+    uint32_t code_len;
+    int want;
+};
+
+static const struct load_case_s load_cases[] = {
+    { "partial insn",       { I(LDI, 3, 1, 0), 0, 0, 0 }, 7, -1 },
+    { "bad op",             { SHADER_VM_OP_COUNT, 3, 0, 0 }, 4, -1 },
+    { "bad d",              { I(LDI, 16, 0, 0) }, 4, -1 },
+    { "bad a",              { I(MOV, 3, 16, 0) }, 4, -1 },
+    { "bad b",              { I(ADD, 3, 0, 16) }, 4, -1 },
+    { "bad sin a",          { I(SIN, 3, 16, 0) }, 4, -1 },
+    { "shift 31",           { I(SHL, 3, 0, 31) }, 4, 0 },
+    { "shift 32",           { I(SHR, 3, 0, 32) }, 4, -1 },
+    { "jmp to halt",        { I(JMP, 0, 1, 0), I(HALT, 0, 0, 0) }, 8, 0 },
+    { "jmp past halt",      { I(JMP, 0, 2, 0), I(HALT, 0, 0, 0) }, 8, -1 },
+    { "jz past halt",       { I(JZ, 0, 255, 0) }, 4, -1 },
+    { "jnz bad d",          { I(JNZ, 16, 0, 0) }, 4, -1 },
+    { "ldi any a b",        { I(LDI, 3, 255, 255) }, 4, 0 },
+};
+
+
+static int check_ops (
+    void
+)
+{
+    static struct shader_vm_s vm;
+    struct matrix_rgb_s pixel;
+    int errors = 0;
+
+    for (uint32_t i = 0; i < sizeof(op_cases) / sizeof(op_cases[0]); i++) {
+        if (0 != shader_vm_load(&vm, op_cases[i].code, op_cases[i].len * 4)) {
+            fprintf(stderr, "shader_vm op %s: didn't load: WRONG\n", op_cases[i].name);
+            errors++;
+            continue;
+        }
+        pixel = (struct matrix_rgb_s){ .r = 9, .g = 10, .b = 11 };
+        shader_vm_run(&vm, &pixel, 1, 1, 77, UINT32_MAX);
+        if (op_cases[i].want != pixel.r || 10 != pixel.g || 11 != pixel.b) {
+            fprintf(stderr, "shader_vm op %s: %u %u %u, not %u 10 11: WRONG\n",
+                    op_cases[i].name, pixel.r, pixel.g, pixel.b, op_cases[i].want);
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+
+static int check_load (
+    void
+)
+{
+    static struct shader_vm_s vm;
+    static uint8_t longest[(SHADER_VM_MAX_INSNS + 1) * 4];
+    static const uint8_t keep[] = { I(LDI, 3, 42, 0) };
+    struct matrix_rgb_s pixel;
+    int ret, errors = 0;
+
+    for (uint32_t i = 0; i < sizeof(load_cases) / sizeof(load_cases[0]); i++) {
+        if (0 != shader_vm_load(&vm, keep, sizeof(keep))) {
+            fprintf(stderr, "shader_vm load: keep didn't load: WRONG\n");
+            return errors + 1;
+        }
+        ret = shader_vm_load(&vm, load_cases[i].code, load_cases[i].code_len);
+        if (load_cases[i].want != ret) {
+            fprintf(stderr, "shader_vm load %s: %d, not %d: WRONG\n", load_cases[i].name, ret, load_cases[i].want);
+            errors++;
+        }
+        // A program that's turned away leaves the one before it running.
+        pixel = (struct matrix_rgb_s){ 0 };
+        shader_vm_run(&vm, &pixel, 1, 1, 0, UINT32_MAX);
+        if (0 != ret && 42 != pixel.r) {
+            fprintf(stderr, "shader_vm load %s: replaced the loaded program: WRONG\n", load_cases[i].name);
+            errors++;
+        }
+    }
+
+    // All HALTs: as long as a program can be, and one longer.
+    if (0 != shader_vm_load(&vm, longest, SHADER_VM_MAX_INSNS * 4)) {
+        fprintf(stderr, "shader_vm load: %u instructions: WRONG\n", SHADER_VM_MAX_INSNS);
+        errors++;
+    }
+    if (-1 != shader_vm_load(&vm, longest, sizeof(longest))) {
+        fprintf(stderr, "shader_vm load: %u instructions: WRONG\n", SHADER_VM_MAX_INSNS + 1);
+        errors++;
+    }
+
+    return errors;
+}
+
+
+// Registers start out the same for every pixel, whatever the one before
+// left in them; the budget is never overrun and the next frame picks up
+// where it ran out; and the longest chain of forward jumps ends on the HALT.
+static int check_bounds (
+    void
+)
+{
+    static struct shader_vm_s vm;
+    static uint8_t chain[SHADER_VM_MAX_INSNS * 4];
+    static const uint8_t coords[] = {
+        I(MOV, 3, 0, 0),
+        I(MOV, 4, 1, 0),
+        I(MOV, 5, 8, 0),        // never written before this, so 0
+        I(LDI, 8, 99, 0),
+    };
+    struct matrix_rgb_s frame[3 * 2];
+    uint32_t n;
+    int errors = 0;
+
+    shader_vm_load(&vm, coords, sizeof(coords));
+    memset(frame, 0xff, sizeof(frame));
+    n = shader_vm_run(&vm, frame, 3, 2, 0, UINT32_MAX);
+    for (uint32_t i = 0; i < 6; i++) {
+        if (i % 3 != frame[i].r || i / 3 != frame[i].g || 0 != frame[i].b) {
+            fprintf(stderr, "shader_vm registers at pixel %u: %u %u %u: WRONG\n", i, frame[i].r, frame[i].g, frame[i].b);
+            errors++;
+        }
+    }
+    if (6 != n) {
+        fprintf(stderr, "shader_vm ran %u of 6 pixels: WRONG\n", n);
+        errors++;
+    }
+
+    // 5 instructions per pixel, with the HALT: 14 is enough for 2 pixels.
+    shader_vm_load(&vm, coords, sizeof(coords));
+    memset(frame, 0xff, sizeof(frame));
+    if (0 != shader_vm_run(&vm, frame, 3, 2, 0, 4)) {
+        fprintf(stderr, "shader_vm ran a pixel on a budget of 4: WRONG\n");
+        errors++;
+    }
+    n = shader_vm_run(&vm, frame, 3, 2, 0, 14);
+    if (2 != n || 255 != frame[2].r) {
+        fprintf(stderr, "shader_vm ran %u pixels on a budget of 14: WRONG\n", n);
+        errors++;
+    }
+    n = shader_vm_run(&vm, frame, 3, 2, 0, 20);
+    if (4 != n || 2 != frame[2].r || 2 != frame[5].r || 0 != frame[0].r) {
+        fprintf(stderr, "shader_vm didn't pick up at pixel 2: WRONG\n");
+        errors++;
+    }
+
+    // Every instruction jumps over nothing, up to the last one, which jumps
+    // onto the HALT shader_vm_load adds.
+    for (uint32_t i = 0; i < SHADER_VM_MAX_INSNS; i++) {
+        memcpy(&chain[i * 4], (const uint8_t[]){ I(JMP, 0, 0, 0) }, 4);
+    }
+    if (0 != shader_vm_load(&vm, chain, sizeof(chain))) {
+        fprintf(stderr, "shader_vm jump chain didn't load: WRONG\n");
+        errors++;
+    } else if (1 != shader_vm_run(&vm, frame, 1, 1, 0, SHADER_VM_MAX_INSNS + 1)) {
+        fprintf(stderr, "shader_vm jump chain overran its budget: WRONG\n");
+        errors++;
+    }
+
+    return errors;
+}
+
+
+int main (
+    void
+)
+{
+    static struct shader_vm_s vm;
+    static const uint32_t sides[] = { 7, 32, 64, 128 };
+    struct matrix_rgb_s * frame;
+    uint64_t pixels;
+    uint32_t frames;
+    double start, elapsed;
+    int errors = 0;
+
+    bench_json_begin("bench_shader_vm");
+
+    errors += check_ops();
+    errors += check_load();
+    errors += check_bounds();
+
+    if (0 != shader_vm_load(&vm, plasma, sizeof(plasma))) {
+        fprintf(stderr, "plasma shader didn't load\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < sizeof(sides) / sizeof(sides[0]); i++) {
+        frame = calloc(sides[i] * sides[i], sizeof(*frame));
+        pixels = 0;
+        frames = 0;
+        start = bench_now();
+        do {
+            pixels += shader_vm_run(&vm, frame, sides[i], sides[i], frames * 33, UINT32_MAX);
+            frames += 1;
+            elapsed = bench_now() - start;
+        } while (elapsed < 0.5);
+
+        bench_json_result("shader_vm", sides[i] * sides[i], "plasma", frames,
+                elapsed / frames * 1e9, elapsed / frames * 1e9, 1);
+        fprintf(stderr, "shader_vm %ux%u: %.2f Mpixels/s, %.0f frames/s\n",
+                sides[i], sides[i], pixels / elapsed / 1e6, frames / elapsed);
+        free(frame);
+    }
+    bench_json_end();
+
+    return errors ? 1 : 0;
+}
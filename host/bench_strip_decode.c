@@ -0,0 +1,172 @@
+// Reads back what every output draws for every one-wire chipset, through
+// the virtual strip of strip_decode.h: SPI words from led_driver_write, RMT
+// items from led_rmt_translate, and each lane of led_i2s_write. Checks that
+// the strip latches exactly the frame that was written, with every bit and
+// the reset within the datasheet, and prints how close each output comes.
+//
+// Then sends a frame in two SPI transactions with the line resting in
+// between, to check that gaps that may latch early, and ones that do, are
+// caught.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "led_driver.h"
+#include "led_i2s.h"
+#include "led_rmt.h"
+#include "strip_decode.h"
+
+#define NUM_PIXELS 300
+#define RMT_TICK_NS 50          // like matrix.c's
+#define I2S_LANES 8
+
+static uint8_t latched[NUM_PIXELS * 4];
+static uint32_t latched_len;
+
+static void latch (
+    void * ctx,
+    const uint8_t * bytes,
+    uint32_t len
+)
+{
+    (void)ctx;
+    memcpy(latched, bytes, len);
+    latched_len = len;
+}
+
+
+static void start (
+    struct strip_decode_s * dec,
+    enum led_driver_type_e type
+)
+{
+    static uint8_t out[NUM_PIXELS * 4];
+
+    strip_decode_init(dec, strip_timing(type), out, sizeof(out));
+    dec->latch = latch;
+    latched_len = 0;
+}
+
+
+// Whether the strip ended up with frame, only once, and in spec.
+static int check (
+    const char * what,
+    const struct led_driver_s * drv,
+    struct strip_decode_s * dec,
+    const uint8_t * frame,
+    uint32_t len
+)
+{
+    int wrong = 1 != dec->frames || latched_len != len || 0 != memcmp(latched, frame, len) ||
+        !strip_decode_ok(dec);
+
+    fprintf(stderr, "%s over %s: %s\n", drv->name, what, wrong ? "WRONG" : "ok");
+    strip_decode_report(dec, stderr);
+
+    return wrong;
+}
+
+
+int main (
+    void
+)
+{
+    static uint8_t rgb[NUM_PIXELS][3];
+    static uint8_t frame[NUM_PIXELS * 4];
+    static uint8_t packed[NUM_PIXELS * 4 + 1];
+    static uint8_t spi[LED_DRIVER_MAX_FRAME_LEN(NUM_PIXELS)];
+    static uint8_t samples[1 << 20];
+    static uint32_t items[NUM_PIXELS * 32 + 8];
+    static const uint32_t gaps_us[] = { 0, 5, 50, 1000 };
+    struct led_driver_s drv;
+    struct led_rmt_s rmt;
+    struct strip_decode_s dec;
+    uint32_t len, frame_len, segment_len, pixels, item_count, half;
+    size_t translated, n;
+    int errors = 0;
+    bool gap, early;
+
+    // Nothing here is timed, so there are no results.
+    bench_json_begin("bench_strip_decode");
+    bench_json_end();
+
+    srand(1);
+    for (uint32_t i = 0; i < NUM_PIXELS; i++) {
+        rgb[i][0] = rand();
+        rgb[i][1] = rand();
+        rgb[i][2] = rand();
+    }
+
+    for (enum led_driver_type_e type = 0; type < LED_DRIVER_COUNT; type++) {
+        if (NULL == strip_timing(type)) {
+            continue;
+        }
+        led_driver_init(&drv, type, NULL);
+        frame_len = led_driver_pack(&drv, frame, rgb, NUM_PIXELS, 256);
+
+        start(&dec, type);
+        len = led_driver_write(&drv, spi, rgb, NUM_PIXELS, 256);
+        strip_decode_spi(&dec, spi, len, drv.spi_clock_hz);
+        strip_decode_idle(&dec);
+        errors += check("spi", &drv, &dec, frame, frame_len);
+
+        // The translator is called for a few items at a time, like the
+        // driver does.
+        start(&dec, type);
+        led_rmt_init(&rmt, &drv, RMT_TICK_NS);
+        memcpy(packed, frame, frame_len);
+        rmt.frame = packed;
+        rmt.frame_len = frame_len;
+        item_count = 0;
+        for (uint32_t done = 0; done < frame_len + 1; done += translated) {
+            led_rmt_translate(&rmt, packed + done, items + item_count, frame_len + 1 - done, 64, &translated, &n);
+            item_count += n;
+        }
+        for (uint32_t i = 0; i < item_count; i++) {
+            half = items[i] & 0xffff;
+            strip_decode_run(&dec, half >> 15, (half & 0x7fff) * RMT_TICK_NS);
+            half = items[i] >> 16;
+            strip_decode_run(&dec, half >> 15, (half & 0x7fff) * RMT_TICK_NS);
+        }
+        strip_decode_idle(&dec);
+        errors += check("rmt", &drv, &dec, frame, frame_len);
+
+        // Lane 0 only, the others are the same waveform.
+        start(&dec, type);
+        len = led_i2s_write(&drv, samples, frame, NUM_PIXELS, I2S_LANES);
+        for (uint32_t i = 0; i < len; i++) {
+            strip_decode_run(&dec, samples[i] & 1, 1000000000ULL / led_i2s_clock_hz(&drv));
+        }
+        strip_decode_idle(&dec);
+        segment_len = (NUM_PIXELS + I2S_LANES - 1) / I2S_LANES;
+        errors += check("i2s", &drv, &dec, frame, segment_len * drv.channels);
+    }
+
+    // A frame in two transactions, split after a pixel. The first one has
+    // no reset time at the end.
+    led_driver_init(&drv, LED_DRIVER_WS2812, NULL);
+    len = led_driver_write(&drv, spi, rgb, NUM_PIXELS, 256);
+    frame_len = led_driver_pack(&drv, frame, rgb, NUM_PIXELS, 256);
+    pixels = NUM_PIXELS / 2;
+    for (uint32_t i = 0; i < sizeof(gaps_us) / sizeof(gaps_us[0]); i++) {
+        start(&dec, LED_DRIVER_WS2812);
+        strip_decode_spi(&dec, spi, pixels * drv.channels * 32, drv.spi_clock_hz);
+        strip_decode_run(&dec, false, gaps_us[i] * 1000ULL);
+        strip_decode_spi(&dec, spi + pixels * drv.channels * 32, len - pixels * drv.channels * 32, drv.spi_clock_hz);
+        strip_decode_idle(&dec);
+
+        gap = 0 != dec.gaps;
+        early = 1 != dec.frames;
+        fprintf(stderr, "split with a %4u us gap: %s%s", gaps_us[i], gap ? "a gap" : "no gap", early ? ", latched early" : "");
+        if (gap != (gaps_us[i] >= 5 && gaps_us[i] < 280) || early != (gaps_us[i] >= 280) ||
+            (!early && (latched_len != frame_len || 0 != memcmp(latched, frame, frame_len))))
+        {
+            errors++;
+            fprintf(stderr, ": WRONG");
+        }
+        fprintf(stderr, "\n");
+    }
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+// Records from two threads at once, standing in for the cores, the way
+// nats_task, led_task and the ISRs share the trace. Checks that no event is
+// lost or torn while the ring wraps, that nothing is recorded while it's
+// paused, and prints what a record costs.
+
+#include <pthread.h>
+#include <stdio.h>
+#include "bench.h"
+#include "trace.h"
+
+#define RECORDS 2000000
+
+static struct trace_s trace;
+
+// Every event's arg says which core recorded it, so torn ones stand out.
+static void *record (
+    void * arg
+)
+{
+    int core = (int)(intptr_t)arg;
+
+    for (uint32_t n = 0; n < RECORDS; n++) {
+        trace_record(&trace, TRACE_QUEUED + core, core, n, 0x1000 * (core + 1));
+    }
+
+    return NULL;
+}
+
+
+int main (
+    void
+)
+{
+    const struct trace_event_s * e;
+    pthread_t thread;
+    uint32_t head;
+    double start, elapsed;
+    int errors = 0;
+
+    bench_json_begin("bench_trace");
+    trace_init(&trace);
+    start = bench_now();
+    record((void *)0);
+    elapsed = bench_now() - start;
+    bench_json_result("trace_record", 0, "one_core", RECORDS, elapsed / RECORDS * 1e9, elapsed / RECORDS * 1e9, 1);
+    fprintf(stderr, "one core:  %5.1f ns per record\n", elapsed / RECORDS * 1e9);
+
+    trace_init(&trace);
+    start = bench_now();
+    pthread_create(&thread, NULL, record, (void *)1);
+    record((void *)0);
+    pthread_join(thread, NULL);
+    elapsed = bench_now() - start;
+    bench_json_result("trace_record", 0, "two_cores", RECORDS, elapsed / RECORDS * 1e9,
+            elapsed / RECORDS * 1e9, 1);
+    bench_json_end();
+    fprintf(stderr, "two cores: %5.1f ns per record\n", elapsed / RECORDS * 1e9);
+
+    if (2 * RECORDS != trace.head) {
+        errors++;
+        fprintf(stderr, "head is %u, should be %u: WRONG\n", trace.head, 2 * RECORDS);
+    }
+    for (uint32_t i = 0; i < TRACE_LEN; i++) {
+        e = &trace.events[i];
+        if (e->core > 1 || TRACE_QUEUED + e->core != e->type || 0x1000u * (e->core + 1) != e->arg) {
+            errors++;
+            fprintf(stderr, "event %u is torn: WRONG\n", i);
+            break;
+        }
+    }
+    if (!trace_survived(&trace)) {
+        errors++;
+        fprintf(stderr, "trace_survived: WRONG\n");
+    }
+
+    head = trace.head;
+    trace.paused = 1;
+    trace_record(&trace, TRACE_PING, 0, 0, 0);
+    if (head != trace.head) {
+        errors++;
+        fprintf(stderr, "recorded while paused: WRONG\n");
+    }
+
+    fprintf(stderr, "events: %s\n", errors ? "WRONG" : "ok");
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,800 @@
+// Puts load on the wall the way a show would, only more of it: publishes
+// matrix1.in frames, with their timestamp, at a set rate, and reports how
+// many went out and how many the wall dropped or missed.
+//
+// Through a NATS server, which the wall is connected to too:
+//
+//   ./build/nats_load -s 127.0.0.1:4222 -r 200
+//
+// or with nothing else running, as the server the wall connects to, e.g.
+// the simulator:
+//
+//   ./build/nats_load -l 4333 -r 200 -m sim.log &
+//   SIM_NATS_PORT=4333 ./build/matrix_sim 2> sim.log
+//
+// Options:
+//
+//   -s host:port  the NATS server to publish through, 127.0.0.1:4222 by default
+//   -l port       be the server instead, for one wall
+//   -r hz         frames per second, 30 by default
+//   -d s          for how long, 10 s by default
+//   -b n          up to n frames that are due go out in one write, 1 by default
+//   -B n          frames come in bursts of n, back to back, with the time
+//                 between bursts keeping the rate, 1 by default
+//   -n pixels     per frame, NUM_PIXELS by default; the wall takes no other
+//                 size, so anything else is for its error paths
+//   -a ms         how far ahead of now frames are stamped, 50 by default
+//   -L pct        the share of frames stamped -A ms in the past instead
+//   -A ms         100 by default
+//   -R pct        the share of frames that swap places with the next one
+//   -T ms         how often the wall is asked for telemetry, 1000 by default
+//   -m file       the wall's log, to count the "missed event" lines in it
+//   -c            before the frames, send every control message led_task
+//                 takes, once as it should be and once malformed, and leave
+//                 the wall set up as it boots
+//
+// What the wall did comes from its telemetry (matrix1.stats.telemetry, see
+// telemetry.h): the counters are read before the first frame goes out and
+// once the last one has had time to arrive. The log only has up to
+// MATRIX_LOG_ERRORS_PER_S missed events a second, the telemetry all of them.
+//
+// The telemetry also says how much stack every task had left at worst;
+// with -c, that covers led_task handling every control message and drawing
+// with every chipset and output. The simulator's tasks run on the host's
+// stacks, so it always says 0.
+//
+// Exits with 1 if the wall didn't take every frame, or telemetry never came.
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "matrix.h"
+#include "led_driver.h"
+#include "pixel_map.h"
+#include "shader_vm.h"
+
+#define LOAD_MAX_PIXELS 1024
+#define LOAD_MAX_BATCH 256
+#define LOAD_HEADER_LEN 64
+#define LOAD_FRAME_LEN (LOAD_HEADER_LEN + 16 + 3 * LOAD_MAX_PIXELS + 2)
+#define LOAD_READ_LEN 8192
+#define LOAD_CONTROL_GAP_MS 20
+#define LOAD_TASKS 4                // the stack_free of telemetry.h
+
+// The counters of a matrix1.stats.telemetry report that say what happened
+// to the frames.
+struct load_telemetry_s {
+    uint32_t frames;
+    uint32_t queue_full;
+    uint32_t dropped;
+    uint32_t parse_errors;
+    uint32_t missed;
+    uint32_t stack_free[LOAD_TASKS];
+};
+
+struct load_s {
+    // Set up from the options.
+    bool listen;
+    uint32_t rate_hz;
+    uint32_t duration_s;
+    uint32_t batch;
+    uint32_t burst;
+    uint32_t pixels;
+    uint32_t ahead_ms;
+    uint32_t late_pct;
+    uint32_t late_ms;
+    uint32_t reorder_pct;
+    uint32_t telemetry_ms;
+    bool control;
+
+    int fd;
+
+    // Only ever written by one thread at a time.
+    pthread_mutex_t write_lock;
+
+    // What the reader saw.
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool subscribed;        // the wall is there to take frames
+    char in_sid[16];        // what to send them with, as the server
+    char ctl_sid[16];
+    struct load_telemetry_s telemetry;
+    uint32_t reports;
+    bool closed;
+};
+
+static struct load_s load = {
+    .rate_hz = 30,
+    .duration_s = 10,
+    .batch = 1,
+    .burst = 1,
+    .pixels = NUM_PIXELS,
+    .ahead_ms = 50,
+    .late_ms = 100,
+    .telemetry_ms = 1000,
+    .write_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER
+};
+
+static uint64_t load_now_ns (
+    clockid_t clock
+)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void load_write (
+    const void * buf,
+    size_t len
+)
+{
+    const uint8_t * p = buf;
+    ssize_t ret;
+
+    pthread_mutex_lock(&load.write_lock);
+    while (0 != len) {
+        ret = write(load.fd, p, len);
+        if (ret <= 0) {
+            perror("write");
+            exit(2);
+        }
+        p += ret;
+        len -= ret;
+    }
+    pthread_mutex_unlock(&load.write_lock);
+}
+
+
+// The value after "name": in json, or the sum of the values if it's an
+// array.
+static uint32_t load_json_value (
+    const char * json,
+    const char * name
+)
+{
+    char key[32];
+    const char * p;
+    char * end;
+    uint32_t sum = 0;
+
+    snprintf(key, sizeof(key), "\"%s\":", name);
+    p = strstr(json, key);
+    if (NULL == p) {
+        return 0;
+    }
+    p += strlen(key);
+    if ('[' != *p) {
+        return strtoul(p, NULL, 10);
+    }
+    for (p++; ']' != *p && '\0' != *p; p = end + (',' == *end)) {
+        sum += strtoul(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+    }
+
+    return sum;
+}
+
+
+// The values of the array "name": in json.
+static void load_json_array (
+    const char * json,
+    const char * name,
+    uint32_t * values,
+    uint32_t num_values
+)
+{
+    char key[32];
+    const char * p;
+    char * end;
+
+    snprintf(key, sizeof(key), "\"%s\":[", name);
+    p = strstr(json, key);
+    for (uint32_t i = 0; i < num_values; i++) {
+        values[i] = 0;
+        if (NULL != p) {
+            p += i == 0 ? strlen(key) : 1;
+            values[i] = strtoul(p, &end, 10);
+            p = ',' == *end ? end : NULL;
+        }
+    }
+}
+
+
+static void load_message (
+    const char * subject,
+    const char * payload,
+    uint32_t len
+)
+{
+    char json[1024];
+
+    if (0 != strcmp(subject, "matrix1.stats.telemetry")) {
+        return;
+    }
+    if (len >= sizeof(json)) {
+        len = sizeof(json) - 1;
+    }
+    memcpy(json, payload, len);
+    json[len] = '\0';
+
+    pthread_mutex_lock(&load.lock);
+    load.telemetry = (struct load_telemetry_s) {
+        .frames = load_json_value(json, "frames"),
+        .queue_full = load_json_value(json, "queue_full"),
+        .dropped = load_json_value(json, "dropped"),
+        .parse_errors = load_json_value(json, "parse_errors"),
+        .missed = load_json_value(json, "missed")
+    };
+    load_json_array(json, "stack_free", load.telemetry.stack_free, LOAD_TASKS);
+    load.reports++;
+    pthread_cond_broadcast(&load.changed);
+    pthread_mutex_unlock(&load.lock);
+}
+
+
+// Handles one line of the protocol. Returns how much of buf it took, which
+// is 0 if a message's payload hasn't all come in yet.
+static size_t load_line (
+    const char * buf,
+    size_t len
+)
+{
+    char line[256];
+    char * args[5];
+    int n = 0;
+    size_t line_len = 0;
+    uint32_t payload_len;
+
+    while (line_len + 1 < len && ('\r' != buf[line_len] || '\n' != buf[line_len + 1])) {
+        line_len++;
+    }
+    if (line_len + 1 >= len) {
+        return 0;
+    }
+    snprintf(line, sizeof(line), "%.*s", (int)line_len, buf);
+    line_len += 2;
+    for (char * p = strtok(line, " "); NULL != p && n < 5; p = strtok(NULL, " ")) {
+        args[n++] = p;
+    }
+    if (0 == n) {
+        return line_len;
+    }
+
+    // MSG subject sid [reply] len from the server, PUB subject [reply] len
+    // from the wall.
+    if ((0 == strcmp(args[0], "MSG") && n >= 4) || (0 == strcmp(args[0], "PUB") && n >= 3)) {
+        payload_len = strtoul(args[n - 1], NULL, 10);
+        if (line_len + payload_len + 2 > len) {
+            return 0;
+        }
+        load_message(args[1], buf + line_len, payload_len);
+        return line_len + payload_len + 2;
+    }
+
+    if (0 == strcmp(args[0], "PING")) {
+        load_write("PONG\r\n", 6);
+    } else if (0 == strcmp(args[0], "SUB") && n >= 3) {
+        pthread_mutex_lock(&load.lock);
+        if (0 == strcmp(args[1], "matrix1.in")) {
+            snprintf(load.in_sid, sizeof(load.in_sid), "%s", args[n - 1]);
+            load.subscribed = true;
+        } else if (0 == strcmp(args[1], "matrix1.ctl.>")) {
+            snprintf(load.ctl_sid, sizeof(load.ctl_sid), "%s", args[n - 1]);
+        }
+        pthread_cond_broadcast(&load.changed);
+        pthread_mutex_unlock(&load.lock);
+    } else if (0 == strcmp(args[0], "-ERR")) {
+        fprintf(stderr, "server: %.*s\n", (int)line_len - 2, buf);
+    }
+
+    return line_len;
+}
+
+
+static void *load_reader (
+    void * arg
+)
+{
+    static char buf[LOAD_READ_LEN * 4];
+    size_t len = 0;
+    size_t used;
+    ssize_t ret;
+
+    (void)arg;
+    while (1) {
+        if (sizeof(buf) == len) {
+            fprintf(stderr, "a message too big to read, giving up on reading\n");
+            len = 0;
+        }
+        ret = read(load.fd, buf + len, sizeof(buf) - len);
+        if (ret <= 0) {
+            pthread_mutex_lock(&load.lock);
+            load.closed = true;
+            pthread_cond_broadcast(&load.changed);
+            pthread_mutex_unlock(&load.lock);
+            return NULL;
+        }
+        len += ret;
+        while (0 != (used = load_line(buf, len))) {
+            memmove(buf, buf + used, len - used);
+            len -= used;
+        }
+    }
+}
+
+
+static int load_connect (
+    const char * server,
+    uint16_t listen_port
+)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = AI_PASSIVE
+    };
+    struct addrinfo * res;
+    char host[256];
+    char port[8];
+    const char * colon;
+    int fd;
+    int listen_fd;
+
+    if (0 != listen_port) {
+        snprintf(port, sizeof(port), "%u", listen_port);
+        if (0 != getaddrinfo(NULL, port, &hints, &res)) {
+            return -1;
+        }
+        listen_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &(int){ 1 }, sizeof(int));
+        if (-1 == listen_fd || 0 != bind(listen_fd, res->ai_addr, res->ai_addrlen) || 0 != listen(listen_fd, 1)) {
+            perror("listen");
+            freeaddrinfo(res);
+            return -1;
+        }
+        freeaddrinfo(res);
+        fprintf(stderr, "waiting for the wall on port %u\n", listen_port);
+        fd = accept(listen_fd, NULL, NULL);
+        close(listen_fd);
+    } else {
+        colon = strrchr(server, ':');
+        snprintf(host, sizeof(host), "%.*s", NULL == colon ? (int)strlen(server) : (int)(colon - server), server);
+        snprintf(port, sizeof(port), "%s", NULL == colon ? "4222" : colon + 1);
+        if (0 != getaddrinfo(host, port, &hints, &res)) {
+            fprintf(stderr, "%s: can't look that up\n", server);
+            return -1;
+        }
+        fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (-1 != fd && 0 != connect(fd, res->ai_addr, res->ai_addrlen)) {
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+    }
+    if (-1 == fd) {
+        perror(server);
+        return -1;
+    }
+
+    // Frames go out as soon as they're written, like a show would send them.
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){ 1 }, sizeof(int));
+
+    return fd;
+}
+
+
+// Sends a message on matrix1.ctl.subject.
+static void load_control_send (
+    const char * subject,
+    const void * payload,
+    uint32_t len
+)
+{
+    static char msg[128 + 2 * NUM_PIXELS];
+    int n;
+
+    if (load.listen) {
+        n = snprintf(msg, sizeof(msg), "MSG matrix1.ctl.%s %s %u\r\n", subject, load.ctl_sid, len);
+    } else {
+        n = snprintf(msg, sizeof(msg), "PUB matrix1.ctl.%s %u\r\n", subject, len);
+    }
+    memcpy(msg + n, payload, len);
+    memcpy(msg + n + len, "\r\n", 2);
+    load_write(msg, n + len + 2);
+}
+
+
+// Sends every control message led_task takes, LOAD_CONTROL_GAP_MS apart so
+// that it draws with each of them, then each of them malformed, and then
+// what puts the wall back the way it boots.
+static void load_control (
+    void
+)
+{
+    static const struct shader_vm_insn_s shader[] = {
+        { SHADER_VM_OP_ADD, 6, 0, 2 },
+        { SHADER_VM_OP_SIN, 3, 6, 0 },
+        { SHADER_VM_OP_SIN, 4, 1, 0 },
+        { SHADER_VM_OP_MULQ, 5, 3, 4 }
+    };
+    static const uint8_t cal[] = { 1, 0x00, 0x10, 0, 0, 0, 0, 0, 0, 0x00, 0x10, 0, 0, 0, 0, 0, 0, 0x00, 0x10 };
+    static const struct {
+        const char * subject;
+        uint8_t payload[16];
+        uint32_t len;
+    } messages[] = {
+        { "map.layout", { PIXEL_MAP_SERPENTINE }, sizeof(struct pixel_map_layout_s) },
+        { "gamma", { 220, 0, 220, 0, 220, 0 }, 6 },
+        { "brightness", { 128, 100, 0 }, 3 },
+        { "power", { 0xf4, 0x01, 0, 0, 20, 0, 20, 0, 20, 0, 1, 0 }, 12 },
+        { "driver", { LED_DRIVER_WS2811, 'g', 'r', 'b' }, 4 },
+        { "driver", { LED_DRIVER_SK6812_RGBW, 'g', 'r', 'b', 'w' }, 5 },
+        { "driver", { LED_DRIVER_APA102, 'b', 'g', 'r' }, 4 },
+        { "driver", { LED_DRIVER_WS2812, 'r', 'g', 'b' }, 4 },
+        { "output", { 1 }, 1 },
+        { "output", { 2 }, 1 },
+        { "split", { NUM_PIXELS / 3 & 0xff, NUM_PIXELS / 3 >> 8, 2 * NUM_PIXELS / 3 & 0xff, 2 * NUM_PIXELS / 3 >> 8 }, 4 },
+        { "output", { 3 }, 1 },
+        { "output", { 0 }, 1 },
+        { "skip", { 1, 0xe8, 0x03, 0, 0 }, 5 },
+        { "prefix", { 1 }, 1 },
+        { "cache", { 0, 0, 1, 0 }, 4 },
+        { "refresh", { 100, 0 }, 2 }
+    };
+    static const struct {
+        const char * subject;
+        uint8_t payload[6];
+        uint32_t len;
+    } restore[] = {
+        { "shader", { 0 }, 0 },
+        { "map.layout", { 0 }, sizeof(struct pixel_map_layout_s) },
+        { "cal", { 0 }, 0 },
+        { "gamma", { 100, 0, 100, 0, 100, 0 }, 6 },
+        { "brightness", { 255 }, 1 },
+        { "power", { 0 }, 4 },
+        { "prefix", { 0 }, 1 },
+        { "cache", { 0 }, 4 },
+        { "refresh", { 0 }, 2 }
+    };
+    static const uint8_t malformed[7] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    static const char * subjects[] = {
+        "shader", "map.layout", "map.table", "gamma", "brightness", "power", "cal", "driver",
+        "output", "split", "skip", "prefix", "cache", "refresh"
+    };
+    uint8_t table[2 * NUM_PIXELS];
+    struct timespec gap = { .tv_nsec = LOAD_CONTROL_GAP_MS * 1000000L };
+
+    for (uint32_t i = 0; i < NUM_PIXELS; i++) {
+        table[2 * i] = i;
+        table[2 * i + 1] = i >> 8;
+    }
+    load_control_send("shader", shader, sizeof(shader));
+    nanosleep(&gap, NULL);
+    load_control_send("map.table", table, sizeof(table));
+    nanosleep(&gap, NULL);
+    load_control_send("cal", cal, sizeof(cal));
+    nanosleep(&gap, NULL);
+    for (uint32_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+        load_control_send(messages[i].subject, messages[i].payload, messages[i].len);
+        nanosleep(&gap, NULL);
+    }
+    for (uint32_t i = 0; i < sizeof(subjects) / sizeof(subjects[0]); i++) {
+        load_control_send(subjects[i], malformed, sizeof(malformed));
+        nanosleep(&gap, NULL);
+    }
+    for (uint32_t i = 0; i < sizeof(restore) / sizeof(restore[0]); i++) {
+        load_control_send(restore[i].subject, restore[i].payload, restore[i].len);
+        nanosleep(&gap, NULL);
+    }
+}
+
+
+// Asks for telemetry every load.telemetry_ms, and waits for a report that
+// was made after that.
+static bool load_telemetry (
+    struct load_telemetry_s * tel
+)
+{
+    uint8_t period[4];
+    uint32_t reports;
+    uint64_t deadline;
+    struct timespec ts;
+
+    for (int i = 0; i < 4; i++) {
+        period[i] = load.telemetry_ms >> (8 * i);
+    }
+    load_control_send("telemetry", period, 4);
+
+    // The report due first may have been taken before the frames came in,
+    // so it takes the one after.
+    deadline = load_now_ns(CLOCK_REALTIME) + 3ULL * load.telemetry_ms * 1000000 + 1000000000;
+    ts.tv_sec = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+    pthread_mutex_lock(&load.lock);
+    reports = load.reports;
+    while (load.reports < reports + 2 && !load.closed) {
+        if (ETIMEDOUT == pthread_cond_timedwait(&load.changed, &load.lock, &ts)) {
+            break;
+        }
+    }
+    *tel = load.telemetry;
+    reports = load.reports - reports;
+    pthread_mutex_unlock(&load.lock);
+
+    return 0 != reports;
+}
+
+
+// Writes frame number seq, for slot_ns on the wall clock, to out. Returns its length.
+static uint32_t load_frame (
+    uint8_t * out,
+    uint64_t seq,
+    uint64_t slot_ns,
+    bool late
+)
+{
+    uint64_t stamp_ns = late ? slot_ns - load.late_ms * 1000000ULL : slot_ns + load.ahead_ms * 1000000ULL;
+    uint32_t len = 16 + 3 * load.pixels;
+    uint8_t * p = out;
+
+    if (load.listen) {
+        p += sprintf((char *)p, "MSG matrix1.in %s %u\r\n", load.in_sid, len);
+    } else {
+        p += sprintf((char *)p, "PUB matrix1.in %u\r\n", len);
+    }
+
+    // struct timespec, as the wall has it: little-endian 64 bit seconds
+    // and nanoseconds.
+    for (int i = 0; i < 8; i++) {
+        p[i] = (stamp_ns / 1000000000) >> (8 * i);
+        p[8 + i] = (stamp_ns % 1000000000) >> (8 * i);
+    }
+    p += 16;
+
+    // Something that moves, so that nothing can skip it as unchanged.
+    for (uint32_t i = 0; i < load.pixels; i++) {
+        *p++ = seq + i;
+        *p++ = seq >> 8;
+        *p++ = i;
+    }
+    *p++ = '\r';
+    *p++ = '\n';
+
+    return p - out;
+}
+
+
+// The number of "missed event" lines in path after offset.
+static uint32_t load_count_missed (
+    const char * path,
+    long offset
+)
+{
+    char line[512];
+    uint32_t count = 0;
+    FILE * f = fopen(path, "r");
+
+    if (NULL == f) {
+        return 0;
+    }
+    fseek(f, offset, SEEK_SET);
+    while (NULL != fgets(line, sizeof(line), f)) {
+        count += NULL != strstr(line, "missed event");
+    }
+    fclose(f);
+
+    return count;
+}
+
+
+static long load_log_end (
+    const char * path
+)
+{
+    FILE * f = fopen(path, "r");
+    long end;
+
+    if (NULL == f) {
+        perror(path);
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    end = ftell(f);
+    fclose(f);
+
+    return end;
+}
+
+
+static int usage (
+    const char * name
+)
+{
+    fprintf(stderr, "usage: %s [-s host:port | -l port] [-r hz] [-d s] [-b n] [-B n] [-n pixels] "
+            "[-a ms] [-L pct] [-A ms] [-R pct] [-T ms] [-m log] [-c]\n", name);
+
+    return 2;
+}
+
+
+int main (
+    int argc,
+    char ** argv
+)
+{
+    static uint8_t batch[LOAD_MAX_BATCH * LOAD_FRAME_LEN];
+    static uint8_t held[LOAD_FRAME_LEN];
+    struct load_telemetry_s before = { 0 };
+    struct load_telemetry_s after = { 0 };
+    const char * server = "127.0.0.1:4222";
+    const char * log_path = NULL;
+    uint16_t listen_port = 0;
+    long log_offset = 0;
+    pthread_t reader;
+    uint64_t frames, start_ns, due_ns, next_ns, slot_ns, elapsed_ns, bytes = 0, writes = 0, late = 0, reordered = 0;
+    uint64_t behind_ns = 0;
+    uint32_t used = 0, held_len = 0, in_batch = 0, accounted;
+    bool have_before, have_after;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "s:l:r:d:b:B:n:a:L:A:R:T:m:c"))) {
+        switch (opt) {
+            case 's': server = optarg; break;
+            case 'l': listen_port = strtoul(optarg, NULL, 0); load.listen = true; break;
+            case 'r': load.rate_hz = strtoul(optarg, NULL, 0); break;
+            case 'd': load.duration_s = strtoul(optarg, NULL, 0); break;
+            case 'b': load.batch = strtoul(optarg, NULL, 0); break;
+            case 'B': load.burst = strtoul(optarg, NULL, 0); break;
+            case 'n': load.pixels = strtoul(optarg, NULL, 0); break;
+            case 'a': load.ahead_ms = strtoul(optarg, NULL, 0); break;
+            case 'L': load.late_pct = strtoul(optarg, NULL, 0); break;
+            case 'A': load.late_ms = strtoul(optarg, NULL, 0); break;
+            case 'R': load.reorder_pct = strtoul(optarg, NULL, 0); break;
+            case 'T': load.telemetry_ms = strtoul(optarg, NULL, 0); break;
+            case 'm': log_path = optarg; break;
+            case 'c': load.control = true; break;
+            default: return usage(argv[0]);
+        }
+    }
+    if (optind != argc || 0 == load.rate_hz || 0 == load.batch || load.batch > LOAD_MAX_BATCH ||
+        0 == load.burst || 0 == load.pixels || load.pixels > LOAD_MAX_PIXELS || 0 == load.telemetry_ms)
+    {
+        return usage(argv[0]);
+    }
+
+    load.fd = load_connect(server, listen_port);
+    if (-1 == load.fd) {
+        return 2;
+    }
+    pthread_create(&reader, NULL, load_reader, NULL);
+
+    // As the server, wait for the wall to subscribe; as a client, tell the
+    // server who's there.
+    if (load.listen) {
+        load_write("INFO {\"server_id\":\"nats_load\",\"max_payload\":1048576} \r\n+OK\r\n",
+                strlen("INFO {\"server_id\":\"nats_load\",\"max_payload\":1048576} \r\n+OK\r\n"));
+        pthread_mutex_lock(&load.lock);
+        while ((!load.subscribed || '\0' == load.ctl_sid[0]) && !load.closed) {
+            pthread_cond_wait(&load.changed, &load.lock);
+        }
+        pthread_mutex_unlock(&load.lock);
+    } else {
+        load_write("CONNECT {\"verbose\":false,\"name\":\"nats_load\"}\r\nSUB matrix1.stats.telemetry 1\r\n",
+                strlen("CONNECT {\"verbose\":false,\"name\":\"nats_load\"}\r\nSUB matrix1.stats.telemetry 1\r\n"));
+    }
+
+    if (load.control) {
+        load_control();
+    }
+    have_before = load_telemetry(&before);
+    if (!have_before) {
+        fprintf(stderr, "no telemetry from the wall, only counting what's sent\n");
+    }
+    if (NULL != log_path) {
+        log_offset = load_log_end(log_path);
+    }
+
+    srand(1);
+    frames = (uint64_t)load.rate_hz * load.duration_s;
+    start_ns = load_now_ns(CLOCK_MONOTONIC);
+    for (uint64_t seq = 0; seq < frames; seq++) {
+
+        // Bursts start on the grid of the rate, so that it averages out,
+        // but every frame is stamped for its own place on the grid, like a
+        // show that's sent in bursts by the network.
+        due_ns = start_ns + seq / load.burst * load.burst * 1000000000ULL / load.rate_hz;
+        next_ns = start_ns + (seq + 1) / load.burst * load.burst * 1000000000ULL / load.rate_hz;
+        if (0 == used) {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                    &(struct timespec){ .tv_sec = due_ns / 1000000000, .tv_nsec = due_ns % 1000000000 }, NULL);
+        }
+        if (load_now_ns(CLOCK_MONOTONIC) > due_ns + behind_ns) {
+            behind_ns = load_now_ns(CLOCK_MONOTONIC) - due_ns;
+        }
+
+        // The stamp is on the wall clock, which is what the wall compares
+        // it to.
+        slot_ns = start_ns + seq * 1000000000ULL / load.rate_hz +
+            load_now_ns(CLOCK_REALTIME) - load_now_ns(CLOCK_MONOTONIC);
+        if (0 == held_len && seq + 1 < frames && (uint32_t)(rand() % 100) < load.reorder_pct) {
+            held_len = load_frame(held, seq, slot_ns, false);
+            reordered++;
+            continue;
+        }
+        if ((uint32_t)(rand() % 100) < load.late_pct) {
+            late++;
+            used += load_frame(batch + used, seq, slot_ns, true);
+        } else {
+            used += load_frame(batch + used, seq, slot_ns, false);
+        }
+        in_batch++;
+        if (0 != held_len) {
+            memcpy(batch + used, held, held_len);
+            used += held_len;
+            held_len = 0;
+            in_batch++;
+        }
+
+        // Out it goes when the batch is full, or when the next frame isn't
+        // due yet.
+        if (in_batch >= load.batch || next_ns > load_now_ns(CLOCK_MONOTONIC) || seq + 1 == frames) {
+            load_write(batch, used);
+            bytes += used;
+            writes++;
+            used = 0;
+            in_batch = 0;
+        }
+    }
+
+    // Up to the end of the last frame's slot, so that bursts that went
+    // out early don't count as a higher rate.
+    due_ns = start_ns + frames * 1000000000ULL / load.rate_hz;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+            &(struct timespec){ .tv_sec = due_ns / 1000000000, .tv_nsec = due_ns % 1000000000 }, NULL);
+    elapsed_ns = load_now_ns(CLOCK_MONOTONIC) - start_ns;
+
+    printf("sent %llu frames of %u pixels in %.3f s: %.1f frames/s (asked for %u), %.1f kB/s, %llu writes\n",
+            (unsigned long long)frames, load.pixels, elapsed_ns / 1e9, frames * 1e9 / elapsed_ns, load.rate_hz,
+            bytes * 1e6 / elapsed_ns, (unsigned long long)writes);
+    printf("%llu stamped %u ms late, %llu swapped with the next, up to %.1f ms behind schedule\n",
+            (unsigned long long)late, load.late_ms, (unsigned long long)reordered, behind_ns / 1e6);
+
+    have_after = have_before && load_telemetry(&after);
+    if (have_after) {
+        printf("the wall queued %u, dropped %u with the queue full, %u otherwise, %u parse errors, missed %u\n",
+                after.frames - before.frames, after.queue_full - before.queue_full, after.dropped - before.dropped,
+                after.parse_errors - before.parse_errors, after.missed - before.missed);
+        printf("stack left at worst: led_task %u, encode_task %u, nats_task %u, log_task %u bytes\n",
+                after.stack_free[0], after.stack_free[1], after.stack_free[2], after.stack_free[3]);
+        accounted = after.frames - before.frames;
+        if (accounted != frames) {
+            printf("%lld frames unaccounted for\n", (long long)frames - accounted);
+        }
+    }
+    if (NULL != log_path) {
+        printf("%u missed events in %s\n", load_count_missed(log_path, log_offset), log_path);
+    }
+
+    close(load.fd);
+
+    return have_after && after.frames - before.frames == frames && after.queue_full == before.queue_full &&
+        after.parse_errors == before.parse_errors ? 0 : 1;
+}
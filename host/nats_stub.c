@@ -0,0 +1,557 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "nats_stub.h"
+
+#define NATS_STUB_INFO "INFO {\"server_id\":\"nats_stub\",\"version\":\"0.0.0\",\"max_payload\":1048576} \r\n"
+
+static uint64_t nats_stub_now_ns (
+    void
+)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void nats_stub_close (
+    struct nats_stub_s * stub,
+    struct nats_stub_client_s * client
+)
+{
+    close(client->fd);
+    client->fd = -1;
+
+    // The server thread may be polling it.
+    write(stub->wake[1], "", 1);
+}
+
+
+// Sends len bytes to client, the way faults say. Needs lock.
+static void nats_stub_send (
+    struct nats_stub_s * stub,
+    struct nats_stub_client_s * client,
+    const void * bytes,
+    uint32_t len
+)
+{
+    const uint8_t * p = bytes;
+    const struct nats_stub_faults_s * f = &stub->faults;
+    uint32_t n;
+    ssize_t ret;
+
+    while (-1 != client->fd && 0 != len) {
+        n = len;
+        if (0 != f->split) {
+            n = 1 + rand_r(&stub->seed) % f->split;
+            n = n < len ? n : len;
+        }
+        if (0 != f->drop_after && client->sent + n > f->drop_after) {
+            n = f->drop_after - client->sent;
+        }
+
+        for (uint32_t done = 0; done < n; done += ret) {
+            ret = send(client->fd, p + done, n - done, MSG_NOSIGNAL);
+            if (ret <= 0) {
+                nats_stub_close(stub, client);
+                return;
+            }
+        }
+        client->sent += n;
+        p += n;
+        len -= n;
+
+        if (0 != f->drop_after && client->sent >= f->drop_after) {
+            stub->drops++;
+            nats_stub_close(stub, client);
+            return;
+        }
+        if (0 != f->split && 0 != len && 0 != f->split_gap_us) {
+            usleep(f->split_gap_us);
+        }
+    }
+}
+
+
+static void nats_stub_send_str (
+    struct nats_stub_s * stub,
+    struct nats_stub_client_s * client,
+    const char * str
+)
+{
+    nats_stub_send(stub, client, str, strlen(str));
+}
+
+
+// Whether subject is matched by pattern, token by token: * matches any one
+// token, > all the ones that are left, if there's at least one.
+static bool nats_stub_match (
+    const char * pattern,
+    const char * subject
+)
+{
+    while (1) {
+        if ('>' == pattern[0] && '\0' == pattern[1]) {
+            return '\0' != *subject;
+        }
+        if ('*' == pattern[0] && ('.' == pattern[1] || '\0' == pattern[1])) {
+            if ('\0' == *subject || '.' == *subject) {
+                return false;
+            }
+            pattern++;
+            while ('\0' != *subject && '.' != *subject) {
+                subject++;
+            }
+        } else {
+            while ('\0' != *pattern && '.' != *pattern && *pattern == *subject) {
+                pattern++;
+                subject++;
+            }
+            if (*pattern != *subject || ('\0' != *pattern && '.' != *pattern)) {
+                return false;
+            }
+        }
+        if ('\0' == *pattern) {
+            return '\0' == *subject;
+        }
+        if ('.' != *subject) {
+            return false;
+        }
+        pattern++;
+        subject++;
+    }
+}
+
+
+// Needs lock.
+static void nats_stub_route (
+    struct nats_stub_s * stub,
+    const char * subject,
+    const char * reply,
+    const void * payload,
+    uint32_t len
+)
+{
+    struct nats_stub_client_s * client;
+    char header[NATS_STUB_SUBJECT_LEN * 2 + 48];
+    int n;
+
+    for (int c = 0; c < NATS_STUB_MAX_CLIENTS; c++) {
+        client = &stub->clients[c];
+        for (uint32_t s = 0; -1 != client->fd && s < client->num_subs; s++) {
+            if (!nats_stub_match(client->subs[s].subject, subject)) {
+                continue;
+            }
+            n = snprintf(header, sizeof(header), "MSG %s %s %s%s%u\r\n", subject, client->subs[s].sid,
+                    NULL == reply ? "" : reply, NULL == reply ? "" : " ", len);
+            nats_stub_send(stub, client, header, n);
+            nats_stub_send(stub, client, payload, len);
+            nats_stub_send_str(stub, client, "\r\n");
+            stub->msgs++;
+        }
+    }
+}
+
+
+static void nats_stub_ok (
+    struct nats_stub_s * stub,
+    struct nats_stub_client_s * client
+)
+{
+    if (client->verbose) {
+        nats_stub_send_str(stub, client, "+OK\r\n");
+    }
+}
+
+
+static void nats_stub_error (
+    struct nats_stub_s * stub,
+    struct nats_stub_client_s * client,
+    const char * error
+)
+{
+    char line[128];
+
+    snprintf(line, sizeof(line), "-ERR '%s'\r\n", error);
+    nats_stub_send_str(stub, client, line);
+    stub->errors++;
+}
+
+
+// Handles the first line in the client's buffer. Returns how much of it
+// was used, 0 if it needs more. Needs lock.
+static uint32_t nats_stub_line (
+    struct nats_stub_s * stub,
+    struct nats_stub_client_s * client
+)
+{
+    const char * buf = (const char *)client->buf;
+    char line[256];
+    char * args[5];
+    struct nats_stub_sub_s * sub;
+    uint32_t line_len = 0;
+    uint32_t len;
+    int n = 0;
+
+    while (line_len + 1 < client->len && ('\r' != buf[line_len] || '\n' != buf[line_len + 1])) {
+        line_len++;
+    }
+    if (line_len + 1 >= client->len) {
+        if (sizeof(client->buf) == client->len) {
+            nats_stub_error(stub, client, "Maximum Control Line Exceeded");
+            return client->len;
+        }
+        return 0;
+    }
+    snprintf(line, sizeof(line), "%.*s", (int)line_len, buf);
+    line_len += 2;
+
+    // CONNECT takes the rest of the line.
+    if (0 == strncmp(line, "CONNECT ", 8)) {
+        client->verbose = NULL != strstr(line, "\"verbose\":true");
+        nats_stub_ok(stub, client);
+        return line_len;
+    }
+
+    for (char * p = strtok(line, " \t"); NULL != p && n < 5; p = strtok(NULL, " \t")) {
+        args[n++] = p;
+    }
+    if (0 == n) {
+        return line_len;
+    }
+
+    if (0 == strcmp(args[0], "PING")) {
+        nats_stub_send_str(stub, client, "PONG\r\n");
+    } else if (0 == strcmp(args[0], "PONG")) {
+        stub->pongs++;
+    } else if (0 == strcmp(args[0], "PUB") && (3 == n || 4 == n)) {
+        len = strtoul(args[n - 1], NULL, 10);
+        if (len > sizeof(client->buf) - line_len - 2) {
+            nats_stub_error(stub, client, "Maximum Payload Violation");
+            return client->len;
+        }
+        if (line_len + len + 2 > client->len) {
+            return 0;
+        }
+        stub->pubs++;
+        if (NULL != stub->on_pub) {
+            stub->on_pub(stub->ctx, args[1], client->buf + line_len, len);
+        }
+        nats_stub_route(stub, args[1], 4 == n ? args[2] : NULL, client->buf + line_len, len);
+        nats_stub_ok(stub, client);
+        return line_len + len + 2;
+    } else if (0 == strcmp(args[0], "SUB") && (3 == n || 4 == n)) {
+        if (NATS_STUB_MAX_SUBS == client->num_subs) {
+            nats_stub_error(stub, client, "Too Many Subscriptions");
+            return line_len;
+        }
+        sub = &client->subs[client->num_subs++];
+        snprintf(sub->subject, sizeof(sub->subject), "%s", args[1]);
+        snprintf(sub->sid, sizeof(sub->sid), "%s", args[n - 1]);
+        nats_stub_ok(stub, client);
+    } else if (0 == strcmp(args[0], "UNSUB") && n >= 2) {
+        for (uint32_t s = 0; s < client->num_subs; s++) {
+            if (0 == strcmp(client->subs[s].sid, args[1])) {
+                client->subs[s] = client->subs[--client->num_subs];
+                break;
+            }
+        }
+        nats_stub_ok(stub, client);
+    } else if ('+' != args[0][0] && 0 != strcmp(args[0], "INFO")) {
+        nats_stub_error(stub, client, "Unknown Protocol Operation");
+    }
+
+    return line_len;
+}
+
+
+static void nats_stub_accept (
+    struct nats_stub_s * stub
+)
+{
+    struct nats_stub_client_s * client = NULL;
+    int fd = accept(stub->listen_fd, NULL, NULL);
+
+    if (-1 == fd) {
+        return;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){ 1 }, sizeof(int));
+
+    pthread_mutex_lock(&stub->lock);
+    for (int c = 0; c < NATS_STUB_MAX_CLIENTS && NULL == client; c++) {
+        if (-1 == stub->clients[c].fd) {
+            client = &stub->clients[c];
+        }
+    }
+    if (NULL == client) {
+        close(fd);
+        pthread_mutex_unlock(&stub->lock);
+        return;
+    }
+    client->fd = fd;
+    client->verbose = true;
+    client->num_subs = 0;
+    client->sent = 0;
+    client->next_read_ns = 0;
+    client->slow = false;
+    client->len = 0;
+    stub->connects++;
+    nats_stub_send_str(stub, client, NATS_STUB_INFO);
+    pthread_mutex_unlock(&stub->lock);
+}
+
+
+// Reads what the client sent and handles every line of it that's whole.
+// Needs lock.
+static void nats_stub_read (
+    struct nats_stub_s * stub,
+    struct nats_stub_client_s * client
+)
+{
+    uint32_t len = sizeof(client->buf) - client->len;
+    uint32_t used;
+    ssize_t ret;
+
+    if (0 != stub->faults.slow_bytes && len > stub->faults.slow_bytes) {
+        len = stub->faults.slow_bytes;
+        if (!client->slow) {
+            setsockopt(client->fd, SOL_SOCKET, SO_RCVBUF, &(int){ len }, sizeof(int));
+            client->slow = true;
+        }
+    }
+    ret = read(client->fd, client->buf + client->len, len);
+    if (ret <= 0) {
+        nats_stub_close(stub, client);
+        return;
+    }
+    client->len += ret;
+    if (0 != stub->faults.slow_bytes) {
+        client->next_read_ns = nats_stub_now_ns() + stub->faults.slow_gap_ms * 1000000ULL;
+    }
+
+    while (-1 != client->fd && 0 != client->len && 0 != (used = nats_stub_line(stub, client))) {
+        memmove(client->buf, client->buf + used, client->len - used);
+        client->len -= used;
+    }
+}
+
+
+static void *nats_stub_main (
+    void * arg
+)
+{
+    struct nats_stub_s * stub = arg;
+    struct pollfd fds[NATS_STUB_MAX_CLIENTS + 2];
+    int client_fds[NATS_STUB_MAX_CLIENTS + 2];
+    int client_of[NATS_STUB_MAX_CLIENTS + 2];
+    struct nats_stub_client_s * client;
+    uint64_t now_ns;
+    uint64_t wake_ns;
+    char drain[16];
+    int nfds;
+    int timeout_ms;
+
+    while (1) {
+        pthread_mutex_lock(&stub->lock);
+        if (stub->stop) {
+            pthread_mutex_unlock(&stub->lock);
+            return NULL;
+        }
+
+        // PINGs that are due go out first.
+        now_ns = nats_stub_now_ns();
+        if (0 != stub->ping_ms && now_ns >= stub->next_ping_ns) {
+            for (int c = 0; c < NATS_STUB_MAX_CLIENTS; c++) {
+                if (-1 != stub->clients[c].fd) {
+                    nats_stub_send_str(stub, &stub->clients[c], "PING\r\n");
+                }
+            }
+            stub->next_ping_ns = now_ns + stub->ping_ms * 1000000ULL;
+        }
+        wake_ns = 0 == stub->ping_ms ? UINT64_MAX : stub->next_ping_ns;
+
+        fds[0] = (struct pollfd){ .fd = stub->wake[0], .events = POLLIN };
+        fds[1] = (struct pollfd){ .fd = stub->listen_fd, .events = POLLIN };
+        nfds = 2;
+        for (int c = 0; c < NATS_STUB_MAX_CLIENTS; c++) {
+            client = &stub->clients[c];
+            if (-1 == client->fd) {
+                continue;
+            }
+            if (client->next_read_ns > now_ns) {
+                wake_ns = client->next_read_ns < wake_ns ? client->next_read_ns : wake_ns;
+                continue;
+            }
+            client_of[nfds] = c;
+            client_fds[nfds] = client->fd;
+            fds[nfds++] = (struct pollfd){ .fd = client->fd, .events = POLLIN };
+        }
+        pthread_mutex_unlock(&stub->lock);
+
+        timeout_ms = UINT64_MAX == wake_ns ? -1 : (int)((wake_ns - now_ns + 999999) / 1000000);
+        if (poll(fds, nfds, timeout_ms) <= 0) {
+            continue;
+        }
+
+        if (0 != fds[0].revents) {
+            read(stub->wake[0], drain, sizeof(drain));
+        }
+        if (0 != fds[1].revents) {
+            nats_stub_accept(stub);
+        }
+        pthread_mutex_lock(&stub->lock);
+        for (int i = 2; i < nfds; i++) {
+            client = &stub->clients[client_of[i]];
+
+            // It may have been closed, or even replaced, since the poll.
+            if (0 != fds[i].revents && client->fd == client_fds[i]) {
+                nats_stub_read(stub, client);
+            }
+        }
+        pthread_mutex_unlock(&stub->lock);
+    }
+}
+
+
+int nats_stub_start (
+    struct nats_stub_s * stub,
+    uint16_t port
+)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    socklen_t addr_len = sizeof(addr);
+
+    stub->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (-1 == stub->listen_fd) {
+        return -1;
+    }
+    setsockopt(stub->listen_fd, SOL_SOCKET, SO_REUSEADDR, &(int){ 1 }, sizeof(int));
+    if (0 != bind(stub->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        0 != listen(stub->listen_fd, NATS_STUB_MAX_CLIENTS) ||
+        0 != getsockname(stub->listen_fd, (struct sockaddr *)&addr, &addr_len) ||
+        0 != pipe(stub->wake))
+    {
+        close(stub->listen_fd);
+        return -1;
+    }
+    stub->port = ntohs(addr.sin_port);
+
+    for (int c = 0; c < NATS_STUB_MAX_CLIENTS; c++) {
+        stub->clients[c].fd = -1;
+    }
+    stub->seed = 1;
+    stub->stop = false;
+
+    // The first PINGs go out a period from now.
+    stub->next_ping_ns = nats_stub_now_ns() + stub->ping_ms * 1000000ULL;
+    pthread_mutex_init(&stub->lock, NULL);
+    pthread_create(&stub->thread, NULL, nats_stub_main, stub);
+
+    return 0;
+}
+
+
+void nats_stub_stop (
+    struct nats_stub_s * stub
+)
+{
+    pthread_mutex_lock(&stub->lock);
+    stub->stop = true;
+    for (int c = 0; c < NATS_STUB_MAX_CLIENTS; c++) {
+        if (-1 != stub->clients[c].fd) {
+            nats_stub_close(stub, &stub->clients[c]);
+        }
+    }
+    pthread_mutex_unlock(&stub->lock);
+
+    pthread_join(stub->thread, NULL);
+    close(stub->listen_fd);
+    close(stub->wake[0]);
+    close(stub->wake[1]);
+}
+
+
+void nats_stub_publish (
+    struct nats_stub_s * stub,
+    const char * subject,
+    const void * payload,
+    uint32_t len
+)
+{
+    pthread_mutex_lock(&stub->lock);
+    nats_stub_route(stub, subject, NULL, payload, len);
+    pthread_mutex_unlock(&stub->lock);
+}
+
+
+void nats_stub_inject (
+    struct nats_stub_s * stub,
+    const void * bytes,
+    uint32_t len
+)
+{
+    pthread_mutex_lock(&stub->lock);
+    for (int c = 0; c < NATS_STUB_MAX_CLIENTS; c++) {
+        if (-1 != stub->clients[c].fd) {
+            nats_stub_send(stub, &stub->clients[c], bytes, len);
+        }
+    }
+    pthread_mutex_unlock(&stub->lock);
+}
+
+
+void nats_stub_ping (
+    struct nats_stub_s * stub
+)
+{
+    nats_stub_inject(stub, "PING\r\n", 6);
+}
+
+
+void nats_stub_drop (
+    struct nats_stub_s * stub
+)
+{
+    pthread_mutex_lock(&stub->lock);
+    for (int c = 0; c < NATS_STUB_MAX_CLIENTS; c++) {
+        if (-1 != stub->clients[c].fd) {
+            stub->drops++;
+            nats_stub_close(stub, &stub->clients[c]);
+        }
+    }
+    pthread_mutex_unlock(&stub->lock);
+}
+
+
+uint32_t nats_stub_subscribers (
+    struct nats_stub_s * stub,
+    const char * subject
+)
+{
+    uint32_t count = 0;
+
+    pthread_mutex_lock(&stub->lock);
+    for (int c = 0; c < NATS_STUB_MAX_CLIENTS; c++) {
+        for (uint32_t s = 0; -1 != stub->clients[c].fd && s < stub->clients[c].num_subs; s++) {
+            count += nats_stub_match(stub->clients[c].subs[s].subject, subject);
+        }
+    }
+    pthread_mutex_unlock(&stub->lock);
+
+    return count;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+// A NATS server small enough to run inside a test, in a thread of its own:
+// it sends INFO, takes CONNECT, SUB, UNSUB and PUB, routes what's published
+// to whoever subscribed (with * and > wildcards) as MSG, and answers and
+// sends PINGs. Enough for the wall.
+//
+// On top of that, it can misbehave on purpose (nats_stub_faults_s): cut
+// what it sends into small pieces, so that reads on the other end end at
+// every possible byte, read slowly, so that writes to it back up, drop the
+// connection, halfway through a message if need be, and send whatever
+// bytes it's given, so that malformed messages can be tested.
+//
+// Clients that never send CONNECT are verbose, like they are with gnatsd:
+// every SUB, UNSUB and PUB is answered with +OK. The wall, which doesn't
+// send CONNECT, waits for the first of those.
+//
+// Writes to a client block until they're out, with the stub locked; a
+// client that doesn't read holds up the others.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NATS_STUB_MAX_CLIENTS 8
+#define NATS_STUB_MAX_SUBS 16
+#define NATS_STUB_SUBJECT_LEN 64
+#define NATS_STUB_BUF_LEN (64 * 1024)
+
+struct nats_stub_faults_s {
+    // Writes go out in pieces of 1 to split bytes, split_gap_us apart. 0
+    // sends them whole.
+    uint32_t split;
+    uint32_t split_gap_us;
+
+    // Reads take up to slow_bytes, slow_gap_ms apart, and the receive
+    // buffer is cut down to about as much, so that the client's writes
+    // back up after kilobytes rather than megabytes. 0 reads as fast as
+    // the client writes.
+    uint32_t slow_bytes;
+    uint32_t slow_gap_ms;
+
+    // A client is dropped once it has been sent this many bytes, in the
+    // middle of whatever was being sent. 0 never drops it.
+    uint64_t drop_after;
+};
+
+struct nats_stub_sub_s {
+    char subject[NATS_STUB_SUBJECT_LEN];
+    char sid[16];
+};
+
+struct nats_stub_client_s {
+    int fd;                     // -1 if the slot is free
+    bool verbose;
+    struct nats_stub_sub_s subs[NATS_STUB_MAX_SUBS];
+    uint32_t num_subs;
+    uint64_t sent;              // bytes, for drop_after
+    uint64_t next_read_ns;      // for slow_gap_ms
+    bool slow;                  // the receive buffer was cut down
+
+    // What came in and hasn't been handled yet.
+    uint8_t buf[NATS_STUB_BUF_LEN];
+    uint32_t len;
+};
+
+struct nats_stub_s {
+    // The port it listens on, on 127.0.0.1. 0 before nats_stub_start picks
+    // one.
+    uint16_t port;
+
+    // How often to PING every client, 0 for never.
+    uint32_t ping_ms;
+
+    // Can be changed at any time, with lock held.
+    struct nats_stub_faults_s faults;
+
+    // Optional. Called with lock held for everything a client publishes,
+    // before it's routed.
+    void (* on_pub)(void * ctx, const char * subject, const uint8_t * payload, uint32_t len);
+    void * ctx;
+
+    // Counters, with lock held.
+    uint32_t connects;
+    uint32_t drops;             // connections the stub closed
+    uint32_t pubs;
+    uint32_t msgs;              // MSGs routed to subscribers
+    uint32_t pongs;
+    uint32_t errors;            // -ERRs sent
+
+    pthread_mutex_t lock;
+    pthread_t thread;
+    int listen_fd;
+    int wake[2];
+    bool stop;
+    uint64_t next_ping_ns;
+    unsigned int seed;
+    struct nats_stub_client_s clients[NATS_STUB_MAX_CLIENTS];
+};
+
+
+// Starts listening on port (0 for any free one, see stub->port) and
+// serving. stub has to be zeroed, or set up with ping_ms, faults and
+// on_pub. Returns -1 if it can't listen.
+int nats_stub_start (
+    struct nats_stub_s * stub,
+    uint16_t port
+);
+
+
+// Drops every client and stops.
+void nats_stub_stop (
+    struct nats_stub_s * stub
+);
+
+
+// Routes a message to the subscribers of subject, as if a client had
+// published it.
+void nats_stub_publish (
+    struct nats_stub_s * stub,
+    const char * subject,
+    const void * payload,
+    uint32_t len
+);
+
+
+// Sends len bytes, as they are, to every client.
+void nats_stub_inject (
+    struct nats_stub_s * stub,
+    const void * bytes,
+    uint32_t len
+);
+
+
+// Sends PING to every client.
+void nats_stub_ping (
+    struct nats_stub_s * stub
+);
+
+
+// Closes the connection of every client.
+void nats_stub_drop (
+    struct nats_stub_s * stub
+);
+
+
+// How many subscriptions there are that subject would be routed to.
+uint32_t nats_stub_subscribers (
+    struct nats_stub_s * stub,
+    const char * subject
+);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "sim.h"
+
+// As on the ESP32.
+#define GPIO_IS_VALID_OUTPUT_GPIO(n) ((n) >= 0 && (n) < 34 && (n) != 20 && (n) != 24 && ((n) < 28 || (n) > 31))
@@ -0,0 +1,88 @@
+#pragma once
+
+// The legacy RMT driver, with one channel. rmt_write_sample runs the
+// translator over the whole frame, half a memory block at a time like the
+// driver's ISR does, and records the items, see sim_leds.c.
+
+#include "sim.h"
+
+typedef int rmt_channel_t;
+
+typedef enum {
+    RMT_MODE_TX,
+    RMT_MODE_RX
+} rmt_mode_t;
+
+typedef enum {
+    RMT_IDLE_LEVEL_LOW,
+    RMT_IDLE_LEVEL_HIGH
+} rmt_idle_level_t;
+
+typedef struct {
+    union {
+        struct {
+            uint32_t duration0 :15;
+            uint32_t level0 :1;
+            uint32_t duration1 :15;
+            uint32_t level1 :1;
+        };
+        uint32_t val;
+    };
+} rmt_item32_t;
+
+typedef struct {
+    bool loop_en;
+    bool carrier_en;
+    bool idle_output_en;
+    rmt_idle_level_t idle_level;
+} rmt_tx_config_t;
+
+typedef struct {
+    rmt_mode_t rmt_mode;
+    rmt_channel_t channel;
+    int gpio_num;
+    uint8_t clk_div;
+    uint8_t mem_block_num;
+    rmt_tx_config_t tx_config;
+} rmt_config_t;
+
+typedef void (* sample_to_rmt_t)(const void * src, rmt_item32_t * dest, size_t src_size,
+        size_t wanted_num, size_t * translated_size, size_t * item_num);
+
+typedef void (* rmt_tx_end_fn_t)(rmt_channel_t channel, void * arg);
+
+esp_err_t rmt_config (
+    const rmt_config_t * config
+);
+
+esp_err_t rmt_driver_install (
+    rmt_channel_t channel,
+    size_t rx_buf_size,
+    int intr_alloc_flags
+);
+
+esp_err_t rmt_driver_uninstall (
+    rmt_channel_t channel
+);
+
+esp_err_t rmt_translator_init (
+    rmt_channel_t channel,
+    sample_to_rmt_t fn
+);
+
+void rmt_register_tx_end_callback (
+    rmt_tx_end_fn_t fn,
+    void * arg
+);
+
+esp_err_t rmt_write_sample (
+    rmt_channel_t channel,
+    const uint8_t * src,
+    size_t src_size,
+    bool wait_tx_done
+);
+
+esp_err_t rmt_wait_tx_done (
+    rmt_channel_t channel,
+    TickType_t wait
+);
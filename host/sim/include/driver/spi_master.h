@@ -0,0 +1,96 @@
+#pragma once
+
+// SPI devices record what they're sent, see sim_leds.c. A transfer takes as
+// long as it would on the wire, and post_cb is called once it's done.
+
+#include "sim.h"
+
+typedef enum {
+    SPI1_HOST,
+    SPI2_HOST,
+    SPI3_HOST,
+    SIM_SPI_HOSTS
+} spi_host_device_t;
+
+#define SPI_SWAP_DATA_TX(data, len) __builtin_bswap32((uint32_t)(data) << (32 - (len)))
+#define SPI_DEVICE_3WIRE (1 << 2)
+#define SPI_DEVICE_HALFDUPLEX (1 << 4)
+
+typedef struct {
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+    uint32_t flags;
+} spi_bus_config_t;
+
+typedef struct {
+    uint32_t flags;
+    uint16_t cmd;
+    uint64_t addr;
+    size_t length;      // in bits
+    size_t rxlength;
+    void * user;
+    const void * tx_buffer;
+    void * rx_buffer;
+} spi_transaction_t;
+
+typedef void (* transaction_cb_t)(spi_transaction_t * trans);
+
+typedef struct {
+    uint8_t command_bits;
+    uint8_t address_bits;
+    uint8_t dummy_bits;
+    uint8_t mode;
+    uint16_t duty_cycle_pos;
+    uint16_t cs_ena_pretrans;
+    uint8_t cs_ena_posttrans;
+    int clock_speed_hz;
+    int input_delay_ns;
+    int spics_io_num;
+    uint32_t flags;
+    int queue_size;
+    transaction_cb_t pre_cb;
+    transaction_cb_t post_cb;
+} spi_device_interface_config_t;
+
+typedef struct sim_spi_device_s * spi_device_handle_t;
+
+esp_err_t spi_bus_initialize (
+    spi_host_device_t host,
+    const spi_bus_config_t * config,
+    int dma_chan
+);
+
+esp_err_t spi_bus_free (
+    spi_host_device_t host
+);
+
+esp_err_t spi_bus_add_device (
+    spi_host_device_t host,
+    const spi_device_interface_config_t * config,
+    spi_device_handle_t * handle
+);
+
+esp_err_t spi_bus_remove_device (
+    spi_device_handle_t handle
+);
+
+esp_err_t spi_device_queue_trans (
+    spi_device_handle_t handle,
+    spi_transaction_t * trans,
+    TickType_t wait
+);
+
+esp_err_t spi_device_get_trans_result (
+    spi_device_handle_t handle,
+    spi_transaction_t ** trans,
+    TickType_t wait
+);
+
+esp_err_t spi_device_transmit (
+    spi_device_handle_t handle,
+    spi_transaction_t * trans
+);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "sim.h"
+
+typedef const char * esp_event_base_t;
+
+extern esp_event_base_t WIFI_EVENT;
+extern esp_event_base_t IP_EVENT;
+
+#define ESP_EVENT_ANY_ID -1
+
+typedef void (* esp_event_handler_t)(void * arg, esp_event_base_t base, int32_t id, void * data);
+
+esp_err_t esp_event_loop_create_default (
+    void
+);
+
+esp_err_t esp_event_handler_register (
+    esp_event_base_t base,
+    int32_t id,
+    esp_event_handler_t handler,
+    void * arg
+);
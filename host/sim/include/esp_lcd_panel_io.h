@@ -0,0 +1,55 @@
+#pragma once
+
+// The i80 bus, as led_i2s drives it: every transfer is decoded lane by
+// lane, see sim_leds.c.
+
+#include "sim.h"
+
+typedef struct sim_i80_bus_s * esp_lcd_i80_bus_handle_t;
+typedef struct sim_panel_io_s * esp_lcd_panel_io_handle_t;
+
+typedef bool (* esp_lcd_panel_io_color_trans_done_cb_t)(esp_lcd_panel_io_handle_t io, void * user_data, void * event_data);
+
+typedef struct {
+    int dc_gpio_num;
+    int wr_gpio_num;
+    int data_gpio_nums[24];
+    size_t bus_width;
+    size_t max_transfer_bytes;
+} esp_lcd_i80_bus_config_t;
+
+typedef struct {
+    int cs_gpio_num;
+    unsigned pclk_hz;
+    size_t trans_queue_depth;
+    esp_lcd_panel_io_color_trans_done_cb_t on_color_trans_done;
+    void * user_ctx;
+    int lcd_cmd_bits;
+    int lcd_param_bits;
+} esp_lcd_panel_io_i80_config_t;
+
+esp_err_t esp_lcd_new_i80_bus (
+    const esp_lcd_i80_bus_config_t * config,
+    esp_lcd_i80_bus_handle_t * bus
+);
+
+esp_err_t esp_lcd_del_i80_bus (
+    esp_lcd_i80_bus_handle_t bus
+);
+
+esp_err_t esp_lcd_new_panel_io_i80 (
+    esp_lcd_i80_bus_handle_t bus,
+    const esp_lcd_panel_io_i80_config_t * config,
+    esp_lcd_panel_io_handle_t * io
+);
+
+esp_err_t esp_lcd_panel_io_del (
+    esp_lcd_panel_io_handle_t io
+);
+
+esp_err_t esp_lcd_panel_io_tx_color (
+    esp_lcd_panel_io_handle_t io,
+    int cmd,
+    const void * color,
+    size_t size
+);
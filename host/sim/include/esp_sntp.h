@@ -0,0 +1,28 @@
+#pragma once
+
+// The host's clock is taken to be right: sntp_init reports it as synced
+// right away.
+
+#include <sys/time.h>
+#include "sim.h"
+
+#define SNTP_OPMODE_POLL 0
+
+typedef void (* sntp_sync_time_cb_t)(struct timeval * tv);
+
+void sntp_setoperatingmode (
+    int mode
+);
+
+void sntp_setservername (
+    int idx,
+    const char * server
+);
+
+void sntp_set_time_sync_notification_cb (
+    sntp_sync_time_cb_t callback
+);
+
+void sntp_init (
+    void
+);
@@ -0,0 +1,79 @@
+#pragma once
+
+// The host is always connected: starting wifi gets an IP right away, on
+// 127.0.0.1.
+
+#include "sim.h"
+#include "esp_event.h"
+
+enum {
+    WIFI_EVENT_STA_START,
+    WIFI_EVENT_STA_DISCONNECTED
+};
+
+enum {
+    IP_EVENT_STA_GOT_IP
+};
+
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+    struct {
+        esp_ip4_addr_t ip;
+    } ip_info;
+} ip_event_got_ip_t;
+
+#define IPSTR "%u.%u.%u.%u"
+#define IP2STR(a) ((a)->addr & 0xff), (((a)->addr >> 8) & 0xff), (((a)->addr >> 16) & 0xff), (((a)->addr >> 24) & 0xff)
+
+typedef struct {
+    int unused;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() { 0 }
+
+typedef union {
+    struct {
+        char ssid[32];
+        char password[64];
+    } sta;
+} wifi_config_t;
+
+typedef enum {
+    WIFI_MODE_STA = 1
+} wifi_mode_t;
+
+typedef enum {
+    ESP_IF_WIFI_STA
+} wifi_interface_t;
+
+esp_err_t esp_netif_init (
+    void
+);
+
+void * esp_netif_create_default_wifi_sta (
+    void
+);
+
+esp_err_t esp_wifi_init (
+    const wifi_init_config_t * config
+);
+
+esp_err_t esp_wifi_set_mode (
+    wifi_mode_t mode
+);
+
+esp_err_t esp_wifi_set_config (
+    wifi_interface_t interface,
+    wifi_config_t * config
+);
+
+esp_err_t esp_wifi_start (
+    void
+);
+
+esp_err_t esp_wifi_connect (
+    void
+);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "sim.h"
+
+// Binary semaphores are queues of one empty item, as in FreeRTOS.
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#define xSemaphoreCreateBinary() xQueueCreate(1, 1)
+#define xSemaphoreGive(s) xQueueSend((s), "", 0)
+#define xSemaphoreGiveFromISR(s, woken) xQueueSend((s), "", 0)
+#define xSemaphoreTake(s, wait) xQueueReceive((s), (uint8_t[1]){ 0 }, (wait))
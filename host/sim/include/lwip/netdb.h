@@ -0,0 +1,17 @@
+#pragma once
+
+// Sockets are the host's. Whatever matrix.c looks up, it gets
+// $SIM_NATS_HOST (127.0.0.1 by default) and $SIM_NATS_PORT (the port it
+// asked for by default), so that it connects to a local nats-server.
+
+#include <netdb.h>
+#include "sim.h"
+
+int sim_getaddrinfo (
+    const char * node,
+    const char * service,
+    const struct addrinfo * hints,
+    struct addrinfo ** res
+);
+
+#define getaddrinfo sim_getaddrinfo
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "sim.h"
@@ -0,0 +1,52 @@
+#pragma once
+
+// Keys are files in $SIM_NVS_DIR (sim_nvs by default), one per key, so that
+// settings survive restarts like they do on the wall. Namespaces are
+// ignored.
+
+#include "sim.h"
+
+typedef int nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+
+esp_err_t nvs_open (
+    const char * name,
+    nvs_open_mode_t mode,
+    nvs_handle_t * handle
+);
+
+esp_err_t nvs_get_blob (
+    nvs_handle_t handle,
+    const char * key,
+    void * out,
+    size_t * len
+);
+
+esp_err_t nvs_set_blob (
+    nvs_handle_t handle,
+    const char * key,
+    const void * value,
+    size_t len
+);
+
+esp_err_t nvs_erase_key (
+    nvs_handle_t handle,
+    const char * key
+);
+
+static inline esp_err_t nvs_commit (
+    nvs_handle_t handle
+)
+{
+    return ESP_OK;
+}
+
+static inline void nvs_close (
+    nvs_handle_t handle
+)
+{
+}
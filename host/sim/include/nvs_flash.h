@@ -0,0 +1,17 @@
+#pragma once
+
+#include "sim.h"
+
+static inline esp_err_t nvs_flash_init (
+    void
+)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t nvs_flash_erase (
+    void
+)
+{
+    return ESP_OK;
+}
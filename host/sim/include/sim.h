@@ -0,0 +1,202 @@
+#pragma once
+
+// Just enough of ESP-IDF and FreeRTOS for matrix.c to build and run on a
+// POSIX host, see sim_esp.c. Every shim header includes this one;
+// what belongs to a single header (SPI, RMT, wifi, ...) is declared there.
+//
+// Tasks are threads, queues and event groups are a mutex and a condition
+// variable each, and a tick is a millisecond, like CONFIG_FREERTOS_HZ=1000.
+// There's only one core: xPortGetCoreID is always 0.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef int esp_err_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffU
+#define portTICK_PERIOD_MS 1
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7fffffff
+
+#define BIT0 (1U << 0)
+#define BIT1 (1U << 1)
+#define BIT2 (1U << 2)
+#define BIT3 (1U << 3)
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_NVS_NO_FREE_PAGES 0x1100
+#define ESP_ERR_NVS_NEW_VERSION_FOUND 0x1101
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+
+#define ESP_ERROR_CHECK(x) do { \
+    esp_err_t sim_err = (x); \
+    if (ESP_OK != sim_err) { \
+        fprintf(stderr, "ESP_ERROR_CHECK failed: %d at %s:%d\n", sim_err, __FILE__, __LINE__); \
+        abort(); \
+    } \
+} while (0)
+
+// Logs go to stderr, so that stdout is left to what the strip shows.
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E (%lld) %s: " fmt "\n", (long long)(esp_timer_get_time() / 1000), (tag), ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W (%lld) %s: " fmt "\n", (long long)(esp_timer_get_time() / 1000), (tag), ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I (%lld) %s: " fmt "\n", (long long)(esp_timer_get_time() / 1000), (tag), ##__VA_ARGS__)
+
+#define IRAM_ATTR
+#define __NOINIT_ATTR
+
+int64_t esp_timer_get_time (
+    void
+);
+
+
+// FreeRTOS
+
+typedef struct sim_queue_s * QueueHandle_t;
+typedef struct sim_event_group_s * EventGroupHandle_t;
+typedef struct sim_task_s * TaskHandle_t;
+typedef uint32_t EventBits_t;
+
+typedef struct {
+    TaskHandle_t xHandle;
+    const char * pcTaskName;
+    UBaseType_t xTaskNumber;
+    UBaseType_t uxCurrentPriority;
+    uint32_t ulRunTimeCounter;
+    uint32_t usStackHighWaterMark;
+    BaseType_t xCoreID;
+} TaskStatus_t;
+
+BaseType_t xTaskCreatePinnedToCore (
+    void (* fn)(void * arg),
+    const char * name,
+    uint32_t stack_size,
+    void * arg,
+    UBaseType_t priority,
+    TaskHandle_t * handle,
+    BaseType_t core
+);
+
+void vTaskDelay (
+    TickType_t ticks
+);
+
+TickType_t xTaskGetTickCount (
+    void
+);
+
+void xTaskNotifyGive (
+    TaskHandle_t task
+);
+
+uint32_t ulTaskNotifyTake (
+    BaseType_t clear,
+    TickType_t wait
+);
+
+// Stacks are the host's, so there's nothing to measure.
+UBaseType_t uxTaskGetStackHighWaterMark (
+    TaskHandle_t task
+);
+
+// Run times are the threads' CPU time, in us.
+UBaseType_t uxTaskGetSystemState (
+    TaskStatus_t * status,
+    UBaseType_t len,
+    uint32_t * total_runtime
+);
+
+// There are no idle tasks.
+TaskHandle_t xTaskGetIdleTaskHandleForCPU (
+    int core
+);
+
+static inline int xPortGetCoreID (
+    void
+)
+{
+    return 0;
+}
+
+QueueHandle_t xQueueCreate (
+    UBaseType_t len,
+    UBaseType_t item_size
+);
+
+BaseType_t xQueueSend (
+    QueueHandle_t queue,
+    const void * item,
+    TickType_t wait
+);
+
+BaseType_t xQueueReceive (
+    QueueHandle_t queue,
+    void * item,
+    TickType_t wait
+);
+
+UBaseType_t uxQueueMessagesWaiting (
+    QueueHandle_t queue
+);
+
+EventGroupHandle_t xEventGroupCreate (
+    void
+);
+
+EventBits_t xEventGroupWaitBits (
+    EventGroupHandle_t group,
+    EventBits_t bits,
+    BaseType_t clear,
+    BaseType_t all,
+    TickType_t wait
+);
+
+EventBits_t xEventGroupSetBits (
+    EventGroupHandle_t group,
+    EventBits_t bits
+);
+
+EventBits_t xEventGroupClearBits (
+    EventGroupHandle_t group,
+    EventBits_t bits
+);
+
+
+// System
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_SW,
+    ESP_RST_PANIC
+} esp_reset_reason_t;
+
+// ESP_RST_POWERON, unless $SIM_RESET_REASON says "panic" or "sw".
+esp_reset_reason_t esp_reset_reason (
+    void
+);
+
+// Exits with status 3.
+void esp_restart (
+    void
+);
+
+uint32_t esp_get_free_heap_size (
+    void
+);
+
+uint32_t esp_get_minimum_free_heap_size (
+    void
+);
@@ -0,0 +1,416 @@
+// The firmware on a POSIX host: matrix.c and its modules as they are, built
+// against the headers in sim/include instead of ESP-IDF's (make -C host
+// build/matrix_sim). It connects to a real NATS server and shows the wall
+// on stdout, so it can be fed with the same producers as the wall, and run
+// under perf, valgrind or the sanitizers:
+//
+//   nats-server &
+//   host/build/matrix_sim
+//
+// It's set up with environment variables:
+//
+//   SIM_NATS_HOST     where NATS is, 127.0.0.1 by default
+//   SIM_NATS_PORT     and its port, NATS_PORT by default
+//   SIM_NVS_DIR       where NVS keys are kept, one file each, sim_nvs by default
+//   SIM_RESET_REASON  "panic" or "sw" to boot as if after a crash or a restart
+//   SIM_RENDER, SIM_LED_ORDER, SIM_PPM_DIR, SIM_PPM_SCALE, see sim_leds.c
+//
+// esp_restart exits with status 3, so a script can start it again.
+//
+// This file has the rest of ESP-IDF: timers, the system, wifi and its
+// events, SNTP, NVS, heap_caps and name lookups, and main(), which boots
+// the firmware.
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "sim.h"
+#include "sim_internal.h"
+#include "esp_heap_caps.h"
+#include "esp_sntp.h"
+#include "esp_wifi.h"
+#include "lwip/netdb.h"
+#include "nvs.h"
+
+#define SIM_MAX_HANDLERS 8
+
+struct sim_handler_s {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void * arg;
+};
+
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t IP_EVENT = "IP_EVENT";
+
+static struct sim_handler_s sim_handlers[SIM_MAX_HANDLERS];
+static uint32_t sim_num_handlers;
+static sntp_sync_time_cb_t sim_sntp_cb;
+
+void app_main (
+    void
+);
+
+
+long sim_env_long (
+    const char * name,
+    long def
+)
+{
+    const char * value = getenv(name);
+
+    return NULL == value || '\0' == *value ? def : strtol(value, NULL, 0);
+}
+
+
+const char * sim_env (
+    const char * name,
+    const char * def
+)
+{
+    const char * value = getenv(name);
+
+    return NULL == value || '\0' == *value ? def : value;
+}
+
+
+int64_t esp_timer_get_time (
+    void
+)
+{
+    static int64_t boot;
+    struct timespec ts;
+    int64_t now;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+
+    // Time since boot, like on the ESP32. The first call is during boot.
+    if (0 == boot) {
+        boot = now;
+    }
+
+    return now - boot;
+}
+
+
+esp_reset_reason_t esp_reset_reason (
+    void
+)
+{
+    const char * reason = sim_env("SIM_RESET_REASON", "");
+
+    if (0 == strcmp(reason, "panic")) {
+        return ESP_RST_PANIC;
+    }
+    if (0 == strcmp(reason, "sw")) {
+        return ESP_RST_SW;
+    }
+
+    return ESP_RST_POWERON;
+}
+
+
+void esp_restart (
+    void
+)
+{
+    ESP_LOGW("sim", "esp_restart()");
+    fflush(stdout);
+    exit(3);
+}
+
+
+uint32_t esp_get_free_heap_size (
+    void
+)
+{
+    return 200000;
+}
+
+
+uint32_t esp_get_minimum_free_heap_size (
+    void
+)
+{
+    return 200000;
+}
+
+
+void *heap_caps_malloc (
+    size_t size,
+    uint32_t caps
+)
+{
+    return malloc(size);
+}
+
+
+void heap_caps_free (
+    void * ptr
+)
+{
+    free(ptr);
+}
+
+
+esp_err_t esp_event_loop_create_default (
+    void
+)
+{
+    return ESP_OK;
+}
+
+
+esp_err_t esp_event_handler_register (
+    esp_event_base_t base,
+    int32_t id,
+    esp_event_handler_t handler,
+    void * arg
+)
+{
+    if (SIM_MAX_HANDLERS == sim_num_handlers) {
+        return ESP_FAIL;
+    }
+
+    sim_handlers[sim_num_handlers++] = (struct sim_handler_s) {
+        .base = base,
+        .id = id,
+        .handler = handler,
+        .arg = arg
+    };
+
+    return ESP_OK;
+}
+
+
+// Calls the handlers for an event right away; there's no event task.
+static void sim_event_post (
+    esp_event_base_t base,
+    int32_t id,
+    void * data
+)
+{
+    for (uint32_t i = 0; i < sim_num_handlers; i++) {
+        if (sim_handlers[i].base == base && (ESP_EVENT_ANY_ID == sim_handlers[i].id || id == sim_handlers[i].id)) {
+            sim_handlers[i].handler(sim_handlers[i].arg, base, id, data);
+        }
+    }
+}
+
+
+esp_err_t esp_netif_init (
+    void
+)
+{
+    return ESP_OK;
+}
+
+
+void *esp_netif_create_default_wifi_sta (
+    void
+)
+{
+    return NULL;
+}
+
+
+esp_err_t esp_wifi_init (
+    const wifi_init_config_t * config
+)
+{
+    return ESP_OK;
+}
+
+
+esp_err_t esp_wifi_set_mode (
+    wifi_mode_t mode
+)
+{
+    return ESP_OK;
+}
+
+
+esp_err_t esp_wifi_set_config (
+    wifi_interface_t interface,
+    wifi_config_t * config
+)
+{
+    return ESP_OK;
+}
+
+
+esp_err_t esp_wifi_start (
+    void
+)
+{
+    ip_event_got_ip_t got_ip = {
+        .ip_info.ip.addr = 0x0100007f
+    };
+
+    sim_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL);
+    sim_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip);
+
+    return ESP_OK;
+}
+
+
+esp_err_t esp_wifi_connect (
+    void
+)
+{
+    return ESP_OK;
+}
+
+
+void sntp_setoperatingmode (
+    int mode
+)
+{
+}
+
+
+void sntp_setservername (
+    int idx,
+    const char * server
+)
+{
+}
+
+
+void sntp_set_time_sync_notification_cb (
+    sntp_sync_time_cb_t callback
+)
+{
+    sim_sntp_cb = callback;
+}
+
+
+void sntp_init (
+    void
+)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    if (NULL != sim_sntp_cb) {
+        sim_sntp_cb(&tv);
+    }
+}
+
+
+static void sim_nvs_path (
+    const char * key,
+    char * path,
+    size_t len
+)
+{
+    snprintf(path, len, "%s/%s", sim_env("SIM_NVS_DIR", "sim_nvs"), key);
+}
+
+
+esp_err_t nvs_open (
+    const char * name,
+    nvs_open_mode_t mode,
+    nvs_handle_t * handle
+)
+{
+    if (NVS_READWRITE == mode && 0 != mkdir(sim_env("SIM_NVS_DIR", "sim_nvs"), 0777) && EEXIST != errno) {
+        return ESP_FAIL;
+    }
+    *handle = 1;
+
+    return ESP_OK;
+}
+
+
+esp_err_t nvs_get_blob (
+    nvs_handle_t handle,
+    const char * key,
+    void * out,
+    size_t * len
+)
+{
+    char path[256];
+    FILE * f;
+
+    sim_nvs_path(key, path, sizeof(path));
+    f = fopen(path, "rb");
+    if (NULL == f) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *len = fread(out, 1, *len, f);
+    fclose(f);
+
+    return ESP_OK;
+}
+
+
+esp_err_t nvs_set_blob (
+    nvs_handle_t handle,
+    const char * key,
+    const void * value,
+    size_t len
+)
+{
+    char path[256];
+    FILE * f;
+
+    sim_nvs_path(key, path, sizeof(path));
+    f = fopen(path, "wb");
+    if (NULL == f) {
+        return ESP_FAIL;
+    }
+    fwrite(value, 1, len, f);
+    fclose(f);
+
+    return ESP_OK;
+}
+
+
+esp_err_t nvs_erase_key (
+    nvs_handle_t handle,
+    const char * key
+)
+{
+    char path[256];
+
+    sim_nvs_path(key, path, sizeof(path));
+
+    return 0 == unlink(path) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+
+#undef getaddrinfo
+
+int sim_getaddrinfo (
+    const char * node,
+    const char * service,
+    const struct addrinfo * hints,
+    struct addrinfo ** res
+)
+{
+    return getaddrinfo(sim_env("SIM_NATS_HOST", "127.0.0.1"), sim_env("SIM_NATS_PORT", service), hints, res);
+}
+
+
+// bench_matrix brings its own.
+#ifndef SIM_NO_MAIN
+int main (
+    void
+)
+{
+    // Lines go out as they're written, also when stdout is a pipe.
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    esp_timer_get_time();
+    sim_leds_init();
+
+    app_main();
+    sim_start_tasks();
+
+    while (1) {
+        pause();
+    }
+}
+#endif
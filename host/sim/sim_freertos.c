@@ -0,0 +1,395 @@
+// FreeRTOS on pthreads. Tasks don't start until app_main has returned, like
+// on the ESP32, where app_main runs before the scheduler gets to the tasks
+// it created at a lower priority; main() in sim_esp.c starts them.
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "sim.h"
+#include "sim_internal.h"
+
+#define SIM_MAX_TASKS 16
+
+struct sim_task_s {
+    void (* fn)(void * arg);
+    void * arg;
+    const char * name;
+    UBaseType_t priority;
+    BaseType_t core;
+    pthread_t thread;
+    bool started;
+
+    // Task notifications.
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notifications;
+};
+
+struct sim_queue_s {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t * items;
+    UBaseType_t len;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct sim_event_group_s {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+static struct sim_task_s * sim_tasks[SIM_MAX_TASKS];
+static uint32_t sim_num_tasks;
+static __thread struct sim_task_s * sim_self;
+
+// When a wait of ticks from now ends, for pthread_cond_timedwait.
+static void sim_deadline (
+    struct timespec * ts,
+    TickType_t ticks
+)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ticks / 1000;
+    ts->tv_nsec += (ticks % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+
+// Waits on cond for up to ticks. Returns false once the time is up.
+static bool sim_wait (
+    pthread_cond_t * cond,
+    pthread_mutex_t * lock,
+    const struct timespec * deadline,
+    TickType_t ticks
+)
+{
+    if (0 == ticks) {
+        return false;
+    }
+    if (portMAX_DELAY == ticks) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+
+    return ETIMEDOUT != pthread_cond_timedwait(cond, lock, deadline);
+}
+
+
+static void *sim_task_main (
+    void * arg
+)
+{
+    struct sim_task_s * task = arg;
+
+    sim_self = task;
+    task->fn(task->arg);
+
+    return NULL;
+}
+
+
+void sim_start_tasks (
+    void
+)
+{
+    for (uint32_t i = 0; i < sim_num_tasks; i++) {
+        if (!sim_tasks[i]->started) {
+            sim_tasks[i]->started = true;
+            pthread_create(&sim_tasks[i]->thread, NULL, sim_task_main, sim_tasks[i]);
+        }
+    }
+}
+
+
+BaseType_t xTaskCreatePinnedToCore (
+    void (* fn)(void * arg),
+    const char * name,
+    uint32_t stack_size,
+    void * arg,
+    UBaseType_t priority,
+    TaskHandle_t * handle,
+    BaseType_t core
+)
+{
+    struct sim_task_s * task;
+
+    if (SIM_MAX_TASKS == sim_num_tasks) {
+        return pdFALSE;
+    }
+
+    task = calloc(1, sizeof(*task));
+    task->fn = fn;
+    task->arg = arg;
+    task->name = name;
+    task->priority = priority;
+    task->core = core;
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->notified, NULL);
+    sim_tasks[sim_num_tasks++] = task;
+    if (NULL != handle) {
+        *handle = task;
+    }
+
+    return pdPASS;
+}
+
+
+void vTaskDelay (
+    TickType_t ticks
+)
+{
+    usleep(ticks * 1000);
+}
+
+
+TickType_t xTaskGetTickCount (
+    void
+)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+
+void xTaskNotifyGive (
+    TaskHandle_t task
+)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notifications++;
+    pthread_cond_broadcast(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+}
+
+
+uint32_t ulTaskNotifyTake (
+    BaseType_t clear,
+    TickType_t wait
+)
+{
+    struct sim_task_s * task = sim_self;
+    struct timespec deadline;
+    uint32_t n;
+
+    sim_deadline(&deadline, wait);
+    pthread_mutex_lock(&task->lock);
+    while (0 == task->notifications && sim_wait(&task->notified, &task->lock, &deadline, wait));
+    n = task->notifications;
+    if (0 != n) {
+        task->notifications = clear ? 0 : n - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+
+    return n;
+}
+
+
+UBaseType_t uxTaskGetStackHighWaterMark (
+    TaskHandle_t task
+)
+{
+    return 0;
+}
+
+
+UBaseType_t uxTaskGetSystemState (
+    TaskStatus_t * status,
+    UBaseType_t len,
+    uint32_t * total_runtime
+)
+{
+    struct timespec ts;
+    clockid_t clock;
+    UBaseType_t n = 0;
+
+    *total_runtime = esp_timer_get_time();
+    for (uint32_t i = 0; i < sim_num_tasks && n < len; i++) {
+        if (!sim_tasks[i]->started || 0 != pthread_getcpuclockid(sim_tasks[i]->thread, &clock)) {
+            continue;
+        }
+        clock_gettime(clock, &ts);
+        status[n++] = (TaskStatus_t) {
+            .xHandle = sim_tasks[i],
+            .pcTaskName = sim_tasks[i]->name,
+            .xTaskNumber = i + 1,
+            .uxCurrentPriority = sim_tasks[i]->priority,
+            .ulRunTimeCounter = ts.tv_sec * 1000000 + ts.tv_nsec / 1000,
+            .usStackHighWaterMark = 0,
+            .xCoreID = sim_tasks[i]->core
+        };
+    }
+
+    return n;
+}
+
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU (
+    int core
+)
+{
+    return NULL;
+}
+
+
+QueueHandle_t xQueueCreate (
+    UBaseType_t len,
+    UBaseType_t item_size
+)
+{
+    struct sim_queue_s * queue = calloc(1, sizeof(*queue));
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->items = malloc(len * item_size);
+    queue->len = len;
+    queue->item_size = item_size;
+
+    return queue;
+}
+
+
+BaseType_t xQueueSend (
+    QueueHandle_t queue,
+    const void * item,
+    TickType_t wait
+)
+{
+    struct timespec deadline;
+
+    sim_deadline(&deadline, wait);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->len == queue->count) {
+        if (!sim_wait(&queue->changed, &queue->lock, &deadline, wait)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    memcpy(queue->items + (queue->head + queue->count) % queue->len * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdTRUE;
+}
+
+
+BaseType_t xQueueReceive (
+    QueueHandle_t queue,
+    void * item,
+    TickType_t wait
+)
+{
+    struct timespec deadline;
+
+    sim_deadline(&deadline, wait);
+    pthread_mutex_lock(&queue->lock);
+    while (0 == queue->count) {
+        if (!sim_wait(&queue->changed, &queue->lock, &deadline, wait)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->len;
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdTRUE;
+}
+
+
+UBaseType_t uxQueueMessagesWaiting (
+    QueueHandle_t queue
+)
+{
+    UBaseType_t count;
+
+    pthread_mutex_lock(&queue->lock);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+
+    return count;
+}
+
+
+EventGroupHandle_t xEventGroupCreate (
+    void
+)
+{
+    struct sim_event_group_s * group = calloc(1, sizeof(*group));
+
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->changed, NULL);
+
+    return group;
+}
+
+
+EventBits_t xEventGroupWaitBits (
+    EventGroupHandle_t group,
+    EventBits_t bits,
+    BaseType_t clear,
+    BaseType_t all,
+    TickType_t wait
+)
+{
+    struct timespec deadline;
+    EventBits_t set;
+
+    sim_deadline(&deadline, wait);
+    pthread_mutex_lock(&group->lock);
+    while (1) {
+        set = group->bits & bits;
+        if ((all && set == bits) || (!all && 0 != set)) {
+            if (clear) {
+                group->bits &= ~bits;
+            }
+            break;
+        }
+        if (!sim_wait(&group->changed, &group->lock, &deadline, wait)) {
+            break;
+        }
+    }
+    set = group->bits | set;
+    pthread_mutex_unlock(&group->lock);
+
+    return set;
+}
+
+
+EventBits_t xEventGroupSetBits (
+    EventGroupHandle_t group,
+    EventBits_t bits
+)
+{
+    EventBits_t set;
+
+    pthread_mutex_lock(&group->lock);
+    set = group->bits |= bits;
+    pthread_cond_broadcast(&group->changed);
+    pthread_mutex_unlock(&group->lock);
+
+    return set;
+}
+
+
+EventBits_t xEventGroupClearBits (
+    EventGroupHandle_t group,
+    EventBits_t bits
+)
+{
+    EventBits_t set;
+
+    pthread_mutex_lock(&group->lock);
+    set = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+
+    return set;
+}
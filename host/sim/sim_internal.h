@@ -0,0 +1,47 @@
+#pragma once
+
+// What the parts of the simulator share, and matrix.c doesn't see.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The outputs of sim_leds.c, in the order they make up the strip.
+enum sim_line_e {
+    SIM_LINE_SPI2,
+    SIM_LINE_SPI3,
+    SIM_LINE_RMT,
+    SIM_LINE_I80,
+    SIM_LINES
+};
+
+// Starts the tasks created so far, see sim_freertos.c.
+void sim_start_tasks (
+    void
+);
+
+
+// Reads the SIM_LED_* and SIM_RENDER settings, see sim_leds.c.
+void sim_leds_init (
+    void
+);
+
+
+// The environment variable name as an integer, or def if it's unset.
+long sim_env_long (
+    const char * name,
+    long def
+);
+
+
+// The environment variable name, or def if it's unset or empty.
+const char * sim_env (
+    const char * name,
+    const char * def
+);
+
+
+// When the last transfer was started on the line id, in ns of CPU time of
+// the thread that started it, or 0 if the line isn't open. For the benches.
+int64_t sim_line_queued_ns (
+    enum sim_line_e id
+);
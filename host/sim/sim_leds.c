@@ -0,0 +1,855 @@
+// The outputs: SPI, RMT and the i80 bus. Each one is a line that sends in a
+// thread of its own, the way the peripheral would while the CPU goes on:
+// a transfer takes as long as it would on the wire, then the completion
+// callback runs and the driver's wait returns.
+//
+// What goes out is decoded back into pixels. One-wire waveforms go through
+// the virtual strip of strip_decode.h, as $SIM_LED_CHIPSET (ws2812 by
+// default) would read them, and the first transfer of each line that's out
+// of its datasheet's spec gets a warning with the timing. An SPI device in
+// mode 0 is taken to be an APA102, whose bytes are read as they are. The
+// strip is what the lines decoded, one after the other: SPI2, SPI3, RMT and
+// then the lanes of the i80 bus, as led_split and led_i2s put it.
+//
+// The strip is shown as the wall, MATRIX_WIDTH pixels to a row, every time
+// a transfer ends, depending on $SIM_RENDER:
+//
+//   term  truecolor blocks on stdout, redrawn in place
+//   text  a line of rrggbb per pixel on stdout, for scripts
+//   ppm   $SIM_PPM_DIR/frame_NNNNNN.ppm, $SIM_PPM_SCALE pixels per LED
+//   none  nothing
+//
+// The default is term if stdout is a terminal, and text if it isn't.
+// $SIM_LED_ORDER is the order the channels go out in ("rgb", "grb", "rgbw",
+// ...), "rgb" by default like matrix.c's.
+//
+// With $SIM_SPI_DUMP_DIR, every SPI transfer is also written there as it
+// went out, as spi2_NNNNNN.bin and spi3_NNNNNN.bin, for strip_check.
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "sim.h"
+#include "sim_internal.h"
+#include "driver/rmt.h"
+#include "driver/spi_master.h"
+#include "esp_lcd_panel_io.h"
+#include "freertos/queue.h"
+#include "led_driver.h"
+#include "matrix.h"
+#include "strip_decode.h"
+
+#define SIM_LINE_QUEUE_LEN 8
+#define SIM_RMT_MAX_ITEMS 65536
+#define SIM_I80_MAX_LANES 16
+
+enum sim_render_e {
+    SIM_RENDER_NONE,
+    SIM_RENDER_TERM,
+    SIM_RENDER_TEXT,
+    SIM_RENDER_PPM
+};
+
+struct sim_job_s {
+    const uint8_t * data;
+    size_t len;
+    void * trans;
+};
+
+struct sim_line_s {
+    const char * name;
+    QueueHandle_t jobs;
+    QueueHandle_t done;
+    pthread_t thread;
+    int64_t queued_ns;      // when the last job was handed to the line, see sim_line_queue
+
+    // Decodes a job into pixels and count, and returns how long it takes
+    // on the wire, in ns.
+    uint64_t (* decode)(struct sim_line_s * line, const struct sim_job_s * job);
+
+    // Called when the job is done.
+    void (* finish)(struct sim_line_s * line, const struct sim_job_s * job);
+
+    // What a one-wire strip would make of the last transfer: the frame
+    // that latched last, in bytes and then in pixels.
+    struct strip_decode_s strip;
+    uint8_t bytes[NUM_PIXELS * 4];
+    uint32_t len;
+    bool warned;
+
+    struct matrix_rgb_s pixels[NUM_PIXELS];
+    uint32_t count;
+    uint32_t dumps;
+
+    // What's on the strip: what was decoded last, until the line goes away.
+    struct matrix_rgb_s shown[NUM_PIXELS];
+    uint32_t shown_count;
+};
+
+struct sim_spi_device_s {
+    struct sim_line_s line;
+    int clock_hz;
+    uint8_t mode;
+    transaction_cb_t pre_cb;
+    transaction_cb_t post_cb;
+};
+
+static pthread_mutex_t sim_strip_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sim_line_s * sim_lines[SIM_LINES];
+static enum sim_render_e sim_render;
+static const char * sim_ppm_dir;
+static uint32_t sim_ppm_scale;
+static uint32_t sim_frames;
+
+static uint8_t sim_order[4];
+static uint8_t sim_channels;
+static const struct strip_timing_s * sim_timing;
+static const char * sim_dump_dir;
+
+static struct sim_spi_device_s sim_spi[SIM_SPI_HOSTS];
+
+static struct sim_line_s sim_rmt;
+static sample_to_rmt_t sim_rmt_translate;
+static rmt_tx_end_fn_t sim_rmt_end;
+static void * sim_rmt_end_arg;
+static uint32_t sim_rmt_tick_ns;
+static size_t sim_rmt_block_items;
+
+static struct sim_line_s sim_i80;
+static uint32_t sim_i80_lanes;
+static uint32_t sim_i80_pclk_hz;
+static esp_lcd_panel_io_color_trans_done_cb_t sim_i80_done;
+static void * sim_i80_ctx;
+
+void sim_leds_init (
+    void
+)
+{
+    static const char channel_names[] = "rgbw";
+    const char * render = sim_env("SIM_RENDER", isatty(STDOUT_FILENO) ? "term" : "text");
+    const char * order = sim_env("SIM_LED_ORDER", "rgb");
+    const char * chipset = sim_env("SIM_LED_CHIPSET", "ws2812");
+    struct led_driver_s driver;
+    const char * c;
+
+    for (enum led_driver_type_e type = 0; type < LED_DRIVER_COUNT; type++) {
+        if (0 == led_driver_init(&driver, type, NULL) && 0 == strcmp(driver.name, chipset)) {
+            sim_timing = strip_timing(type);
+        }
+    }
+    if (NULL == sim_timing) {
+        fprintf(stderr, "SIM_LED_CHIPSET must be a one-wire chipset: ws2811, ws2812 or sk6812-rgbw\n");
+        exit(1);
+    }
+
+    sim_dump_dir = getenv("SIM_SPI_DUMP_DIR");
+    if (NULL != sim_dump_dir && 0 != mkdir(sim_dump_dir, 0777) && EEXIST != errno) {
+        perror(sim_dump_dir);
+        exit(1);
+    }
+
+    sim_channels = strlen(order);
+    if (sim_channels < 3 || sim_channels > 4) {
+        fprintf(stderr, "SIM_LED_ORDER must be 3 or 4 of r, g, b and w\n");
+        exit(1);
+    }
+    for (int i = 0; i < sim_channels; i++) {
+        c = strchr(channel_names, order[i]);
+        if (NULL == c || '\0' == *c) {
+            fprintf(stderr, "SIM_LED_ORDER must be 3 or 4 of r, g, b and w\n");
+            exit(1);
+        }
+        sim_order[i] = c - channel_names;
+    }
+
+    if (0 == strcmp(render, "term")) {
+        sim_render = SIM_RENDER_TERM;
+        printf("\033[2J");
+    } else if (0 == strcmp(render, "text")) {
+        sim_render = SIM_RENDER_TEXT;
+    } else if (0 == strcmp(render, "ppm")) {
+        sim_render = SIM_RENDER_PPM;
+        sim_ppm_dir = sim_env("SIM_PPM_DIR", "sim_ppm");
+        sim_ppm_scale = sim_env_long("SIM_PPM_SCALE", 16);
+        if (0 != mkdir(sim_ppm_dir, 0777) && EEXIST != errno) {
+            perror(sim_ppm_dir);
+            exit(1);
+        }
+    } else if (0 == strcmp(render, "none")) {
+        sim_render = SIM_RENDER_NONE;
+    } else {
+        fprintf(stderr, "SIM_RENDER must be term, text, ppm or none\n");
+        exit(1);
+    }
+}
+
+
+static void sim_strip_latch (
+    void * ctx,
+    const uint8_t * bytes,
+    uint32_t len
+)
+{
+    struct sim_line_s * line = ctx;
+
+    line->len = len;
+}
+
+
+static void sim_strip_start (
+    struct sim_line_s * line,
+    uint32_t max
+)
+{
+    strip_decode_init(&line->strip, sim_timing, line->bytes, max);
+    line->strip.latch = sim_strip_latch;
+    line->strip.ctx = line;
+    line->len = 0;
+}
+
+
+// Lets the strip latch, and returns how many bytes it took.
+static uint32_t sim_strip_end (
+    struct sim_line_s * line
+)
+{
+    strip_decode_idle(&line->strip);
+    if (!line->warned && !strip_decode_ok(&line->strip)) {
+        ESP_LOGW("sim", "%s: out of spec for %s:", line->name, sim_timing->name);
+        strip_decode_report(&line->strip, stderr);
+        line->warned = true;
+    }
+
+    return line->len;
+}
+
+
+// Turns bytes, in the order they went out, into pixels.
+static uint32_t sim_pixels (
+    struct matrix_rgb_s * pixels,
+    uint32_t max,
+    const uint8_t * bytes,
+    size_t len
+)
+{
+    uint8_t v[4];
+    uint32_t n = 0;
+
+    for (size_t i = 0; i + sim_channels <= len && n < max; i += sim_channels) {
+        v[3] = 0;
+        for (int c = 0; c < sim_channels; c++) {
+            v[sim_order[c]] = bytes[i + c];
+        }
+
+        // White adds to all three.
+        pixels[n++] = (struct matrix_rgb_s) {
+            .r = v[0] + v[3] > 255 ? 255 : v[0] + v[3],
+            .g = v[1] + v[3] > 255 ? 255 : v[1] + v[3],
+            .b = v[2] + v[3] > 255 ? 255 : v[2] + v[3]
+        };
+    }
+
+    return n;
+}
+
+
+static void sim_show (
+    void
+)
+{
+    static struct matrix_rgb_s strip[NUM_PIXELS];
+    struct matrix_rgb_s * p;
+    uint32_t count = 0;
+    uint32_t n;
+    char path[512];
+    FILE * f;
+
+    for (int i = 0; i < SIM_LINES; i++) {
+        if (NULL == sim_lines[i]) {
+            continue;
+        }
+        n = sim_lines[i]->shown_count;
+        if (n > NUM_PIXELS - count) {
+            n = NUM_PIXELS - count;
+        }
+        memcpy(&strip[count], sim_lines[i]->shown, n * sizeof(strip[0]));
+        count += n;
+    }
+    memset(&strip[count], 0, (NUM_PIXELS - count) * sizeof(strip[0]));
+    sim_frames++;
+
+    switch (sim_render) {
+        case SIM_RENDER_TERM:
+            printf("\033[H");
+            for (int y = 0; y < MATRIX_HEIGHT; y++) {
+                for (int x = 0; x < MATRIX_WIDTH; x++) {
+                    p = &strip[y * MATRIX_WIDTH + x];
+                    printf("\033[48;2;%d;%d;%dm  ", p->r, p->g, p->b);
+                }
+                printf("\033[0m\n");
+            }
+            printf("frame %u, %u pixels\033[K\n", sim_frames, count);
+            fflush(stdout);
+            break;
+
+        case SIM_RENDER_TEXT:
+            printf("frame %u:", sim_frames);
+            for (uint32_t i = 0; i < count; i++) {
+                printf(" %02x%02x%02x", strip[i].r, strip[i].g, strip[i].b);
+            }
+            printf("\n");
+            break;
+
+        case SIM_RENDER_PPM:
+            snprintf(path, sizeof(path), "%s/frame_%06u.ppm", sim_ppm_dir, sim_frames);
+            f = fopen(path, "wb");
+            if (NULL == f) {
+                break;
+            }
+            fprintf(f, "P6\n%u %u\n255\n", MATRIX_WIDTH * sim_ppm_scale, MATRIX_HEIGHT * sim_ppm_scale);
+            for (uint32_t y = 0; y < MATRIX_HEIGHT * sim_ppm_scale; y++) {
+                for (uint32_t x = 0; x < MATRIX_WIDTH * sim_ppm_scale; x++) {
+                    fwrite(&strip[y / sim_ppm_scale * MATRIX_WIDTH + x / sim_ppm_scale], 3, 1, f);
+                }
+            }
+            fclose(f);
+            break;
+
+        case SIM_RENDER_NONE:
+            break;
+    }
+}
+
+
+static void *sim_line_main (
+    void * arg
+)
+{
+    struct sim_line_s * line = arg;
+    struct sim_job_s job;
+    int64_t end;
+    int64_t now;
+
+    while (1) {
+        xQueueReceive(line->jobs, &job, portMAX_DELAY);
+        end = esp_timer_get_time() * 1000 + line->decode(line, &job);
+        now = esp_timer_get_time() * 1000;
+        if (end > now) {
+            usleep((end - now) / 1000);
+        }
+
+        pthread_mutex_lock(&sim_strip_lock);
+        memcpy(line->shown, line->pixels, line->count * sizeof(line->pixels[0]));
+        line->shown_count = line->count;
+        sim_show();
+        pthread_mutex_unlock(&sim_strip_lock);
+
+        line->finish(line, &job);
+        if (NULL != line->done) {
+            xQueueSend(line->done, &job, portMAX_DELAY);
+        }
+    }
+
+    return NULL;
+}
+
+
+// done is whether the driver waits for transfers to be done, and so
+// needs a queue of them.
+static void sim_line_open (
+    struct sim_line_s * line,
+    enum sim_line_e id,
+    const char * name,
+    bool done
+)
+{
+    // Lines are set up once and then come and go from the strip.
+    if (NULL == line->jobs) {
+        line->name = name;
+        line->jobs = xQueueCreate(SIM_LINE_QUEUE_LEN, sizeof(struct sim_job_s));
+        line->done = done ? xQueueCreate(SIM_LINE_QUEUE_LEN, sizeof(struct sim_job_s)) : NULL;
+        pthread_create(&line->thread, NULL, sim_line_main, line);
+    }
+
+    pthread_mutex_lock(&sim_strip_lock);
+    line->shown_count = 0;
+    sim_lines[id] = line;
+    pthread_mutex_unlock(&sim_strip_lock);
+}
+
+
+// Takes the line off the strip, once what it was sending is out.
+static void sim_line_close (
+    struct sim_line_s * line,
+    enum sim_line_e id
+)
+{
+    while (0 != uxQueueMessagesWaiting(line->jobs)) {
+        usleep(100);
+    }
+
+    pthread_mutex_lock(&sim_strip_lock);
+    sim_lines[id] = NULL;
+    pthread_mutex_unlock(&sim_strip_lock);
+}
+
+
+// Hands job to the line, the way starting a transfer hands it to the
+// peripheral. When that was is taken in the CPU time of the thread doing
+// it: the lines' threads take the host's CPU away from it, where the
+// peripherals don't on the ESP32.
+static BaseType_t sim_line_queue (
+    struct sim_line_s * line,
+    const struct sim_job_s * job,
+    TickType_t wait
+)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    __atomic_store_n(&line->queued_ns, ts.tv_sec * 1000000000LL + ts.tv_nsec, __ATOMIC_RELAXED);
+
+    return xQueueSend(line->jobs, job, wait);
+}
+
+
+int64_t sim_line_queued_ns (
+    enum sim_line_e id
+)
+{
+    int64_t queued_ns = 0;
+
+    pthread_mutex_lock(&sim_strip_lock);
+    if (NULL != sim_lines[id]) {
+        queued_ns = __atomic_load_n(&sim_lines[id]->queued_ns, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&sim_strip_lock);
+
+    return queued_ns;
+}
+
+
+// SPI
+
+static uint64_t sim_spi_decode (
+    struct sim_line_s * line,
+    const struct sim_job_s * job
+)
+{
+    struct sim_spi_device_s * dev = (struct sim_spi_device_s *)line;
+    spi_transaction_t * trans = job->trans;
+    const uint8_t * p;
+    uint32_t len = 0;
+    char path[512];
+    FILE * f;
+
+    if (NULL != dev->pre_cb) {
+        dev->pre_cb(trans);
+    }
+
+    if (NULL != sim_dump_dir) {
+        snprintf(path, sizeof(path), "%s/%s_%06u.bin", sim_dump_dir, line->name, ++line->dumps);
+        f = fopen(path, "wb");
+        if (NULL != f) {
+            fwrite(job->data, 1, job->len, f);
+            fclose(f);
+        }
+    }
+
+    if (0 == dev->mode) {
+        // APA102: a start frame of zeros, then 0xe0 | brightness and three
+        // channels per pixel.
+        for (p = job->data + 4; p + 4 <= job->data + job->len && 0xe0 == (p[0] & 0xe0); p += 4) {
+            for (int c = 0; c < 3; c++) {
+                line->bytes[len++] = p[1 + c] * (p[0] & 0x1f) / 31;
+            }
+            if (len + 3 > sizeof(line->bytes)) {
+                break;
+            }
+        }
+    } else {
+        sim_strip_start(line, sizeof(line->bytes));
+        strip_decode_spi(&line->strip, job->data, job->len, dev->clock_hz);
+        len = sim_strip_end(line);
+    }
+
+    line->count = sim_pixels(line->pixels, NUM_PIXELS, line->bytes, len);
+
+    return (uint64_t)job->len * 8 * 1000000000 / dev->clock_hz;
+}
+
+
+static void sim_spi_finish (
+    struct sim_line_s * line,
+    const struct sim_job_s * job
+)
+{
+    struct sim_spi_device_s * dev = (struct sim_spi_device_s *)line;
+
+    if (NULL != dev->post_cb) {
+        dev->post_cb(job->trans);
+    }
+}
+
+
+esp_err_t spi_bus_initialize (
+    spi_host_device_t host,
+    const spi_bus_config_t * config,
+    int dma_chan
+)
+{
+    return host < SIM_SPI_HOSTS ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+
+esp_err_t spi_bus_free (
+    spi_host_device_t host
+)
+{
+    return ESP_OK;
+}
+
+
+esp_err_t spi_bus_add_device (
+    spi_host_device_t host,
+    const spi_device_interface_config_t * config,
+    spi_device_handle_t * handle
+)
+{
+    struct sim_spi_device_s * dev;
+
+    if (SPI2_HOST != host && SPI3_HOST != host) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    dev = &sim_spi[host];
+    dev->clock_hz = config->clock_speed_hz;
+    dev->mode = config->mode;
+    dev->pre_cb = config->pre_cb;
+    dev->post_cb = config->post_cb;
+    dev->line.decode = sim_spi_decode;
+    dev->line.finish = sim_spi_finish;
+    sim_line_open(&dev->line, SPI2_HOST == host ? SIM_LINE_SPI2 : SIM_LINE_SPI3,
+            SPI2_HOST == host ? "spi2" : "spi3", true);
+    *handle = dev;
+
+    return ESP_OK;
+}
+
+
+esp_err_t spi_bus_remove_device (
+    spi_device_handle_t handle
+)
+{
+    sim_line_close(&handle->line, handle == &sim_spi[SPI2_HOST] ? SIM_LINE_SPI2 : SIM_LINE_SPI3);
+
+    return ESP_OK;
+}
+
+
+esp_err_t spi_device_queue_trans (
+    spi_device_handle_t handle,
+    spi_transaction_t * trans,
+    TickType_t wait
+)
+{
+    struct sim_job_s job = {
+        .data = trans->tx_buffer,
+        .len = trans->length / 8,
+        .trans = trans
+    };
+
+    return pdTRUE == sim_line_queue(&handle->line, &job, wait) ? ESP_OK : ESP_FAIL;
+}
+
+
+esp_err_t spi_device_get_trans_result (
+    spi_device_handle_t handle,
+    spi_transaction_t ** trans,
+    TickType_t wait
+)
+{
+    struct sim_job_s job;
+
+    if (pdTRUE != xQueueReceive(handle->line.done, &job, wait)) {
+        return ESP_FAIL;
+    }
+    *trans = job.trans;
+
+    return ESP_OK;
+}
+
+
+esp_err_t spi_device_transmit (
+    spi_device_handle_t handle,
+    spi_transaction_t * trans
+)
+{
+    spi_transaction_t * done;
+    esp_err_t ret;
+
+    ret = spi_device_queue_trans(handle, trans, portMAX_DELAY);
+    if (ESP_OK != ret) {
+        return ret;
+    }
+
+    return spi_device_get_trans_result(handle, &done, portMAX_DELAY);
+}
+
+
+// RMT
+
+static uint64_t sim_rmt_decode (
+    struct sim_line_s * line,
+    const struct sim_job_s * job
+)
+{
+    static rmt_item32_t items[SIM_RMT_MAX_ITEMS];
+    size_t translated;
+    size_t done = 0;
+    size_t count = 0;
+    size_t n;
+    uint64_t ticks = 0;
+
+    // Half a memory block at a time, like the driver's ISR asks for them.
+    while (done < job->len && count + sim_rmt_block_items / 2 <= SIM_RMT_MAX_ITEMS) {
+        sim_rmt_translate(job->data + done, items + count, job->len - done, sim_rmt_block_items / 2, &translated, &n);
+        if (0 == translated) {
+            fprintf(stderr, "rmt translator made no progress\n");
+            abort();
+        }
+        done += translated;
+        count += n;
+    }
+
+    sim_strip_start(line, sizeof(line->bytes));
+    for (size_t i = 0; i < count; i++) {
+        strip_decode_run(&line->strip, items[i].level0, items[i].duration0 * sim_rmt_tick_ns);
+        strip_decode_run(&line->strip, items[i].level1, items[i].duration1 * sim_rmt_tick_ns);
+        ticks += items[i].duration0 + items[i].duration1;
+    }
+    line->count = sim_pixels(line->pixels, NUM_PIXELS, line->bytes, sim_strip_end(line));
+
+    return ticks * sim_rmt_tick_ns;
+}
+
+
+static void sim_rmt_finish (
+    struct sim_line_s * line,
+    const struct sim_job_s * job
+)
+{
+    if (NULL != sim_rmt_end) {
+        sim_rmt_end(0, sim_rmt_end_arg);
+    }
+}
+
+
+esp_err_t rmt_config (
+    const rmt_config_t * config
+)
+{
+    if (0 == config->clk_div || 0 == config->mem_block_num) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Ticks of the 80 MHz APB clock, 64 items per memory block.
+    sim_rmt_tick_ns = config->clk_div * 1000 / 80;
+    sim_rmt_block_items = config->mem_block_num * 64;
+
+    return ESP_OK;
+}
+
+
+esp_err_t rmt_driver_install (
+    rmt_channel_t channel,
+    size_t rx_buf_size,
+    int intr_alloc_flags
+)
+{
+    sim_rmt.decode = sim_rmt_decode;
+    sim_rmt.finish = sim_rmt_finish;
+    sim_line_open(&sim_rmt, SIM_LINE_RMT, "rmt", true);
+
+    return ESP_OK;
+}
+
+
+esp_err_t rmt_driver_uninstall (
+    rmt_channel_t channel
+)
+{
+    sim_line_close(&sim_rmt, SIM_LINE_RMT);
+    sim_rmt_translate = NULL;
+
+    return ESP_OK;
+}
+
+
+esp_err_t rmt_translator_init (
+    rmt_channel_t channel,
+    sample_to_rmt_t fn
+)
+{
+    sim_rmt_translate = fn;
+
+    return ESP_OK;
+}
+
+
+void rmt_register_tx_end_callback (
+    rmt_tx_end_fn_t fn,
+    void * arg
+)
+{
+    sim_rmt_end = fn;
+    sim_rmt_end_arg = arg;
+}
+
+
+esp_err_t rmt_write_sample (
+    rmt_channel_t channel,
+    const uint8_t * src,
+    size_t src_size,
+    bool wait_tx_done
+)
+{
+    struct sim_job_s job = {
+        .data = src,
+        .len = src_size
+    };
+
+    if (NULL == sim_rmt_translate) {
+        return ESP_FAIL;
+    }
+    sim_line_queue(&sim_rmt, &job, portMAX_DELAY);
+    if (wait_tx_done) {
+        return rmt_wait_tx_done(channel, portMAX_DELAY);
+    }
+
+    return ESP_OK;
+}
+
+
+esp_err_t rmt_wait_tx_done (
+    rmt_channel_t channel,
+    TickType_t wait
+)
+{
+    struct sim_job_s job;
+
+    return pdTRUE == xQueueReceive(sim_rmt.done, &job, wait) ? ESP_OK : ESP_FAIL;
+}
+
+
+// The i80 bus
+
+static uint64_t sim_i80_decode (
+    struct sim_line_s * line,
+    const struct sim_job_s * job
+)
+{
+    uint32_t width = sim_i80_lanes / 8;
+    uint64_t sample_ns = 1000000000 / sim_i80_pclk_hz;
+    uint32_t segment_len = (NUM_PIXELS + sim_i80_lanes - 1) / sim_i80_lanes;
+    uint32_t n;
+    uint16_t sample;
+
+    line->count = 0;
+    for (uint32_t k = 0; k < sim_i80_lanes && line->count < NUM_PIXELS; k++) {
+        sim_strip_start(line, segment_len * sim_channels);
+        for (size_t i = 0; i + width <= job->len; i += width) {
+            sample = job->data[i] | (2 == width ? job->data[i + 1] << 8 : 0);
+            strip_decode_run(&line->strip, (sample >> k) & 1, sample_ns);
+        }
+
+        // Short segments were padded with black.
+        n = sim_pixels(&line->pixels[line->count], NUM_PIXELS - line->count, line->bytes, sim_strip_end(line));
+        line->count += n < segment_len ? n : segment_len;
+    }
+
+    return (uint64_t)job->len / width * 1000000000 / sim_i80_pclk_hz;
+}
+
+
+static void sim_i80_finish (
+    struct sim_line_s * line,
+    const struct sim_job_s * job
+)
+{
+    if (NULL != sim_i80_done) {
+        sim_i80_done(job->trans, sim_i80_ctx, NULL);
+    }
+}
+
+
+esp_err_t esp_lcd_new_i80_bus (
+    const esp_lcd_i80_bus_config_t * config,
+    esp_lcd_i80_bus_handle_t * bus
+)
+{
+    if (8 != config->bus_width && SIM_I80_MAX_LANES != config->bus_width) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sim_i80_lanes = config->bus_width;
+    *bus = (esp_lcd_i80_bus_handle_t)&sim_i80;
+
+    return ESP_OK;
+}
+
+
+esp_err_t esp_lcd_del_i80_bus (
+    esp_lcd_i80_bus_handle_t bus
+)
+{
+    return ESP_OK;
+}
+
+
+esp_err_t esp_lcd_new_panel_io_i80 (
+    esp_lcd_i80_bus_handle_t bus,
+    const esp_lcd_panel_io_i80_config_t * config,
+    esp_lcd_panel_io_handle_t * io
+)
+{
+    sim_i80_pclk_hz = config->pclk_hz;
+    sim_i80_done = config->on_color_trans_done;
+    sim_i80_ctx = config->user_ctx;
+    sim_i80.decode = sim_i80_decode;
+    sim_i80.finish = sim_i80_finish;
+    sim_line_open(&sim_i80, SIM_LINE_I80, "i80", false);
+    *io = (esp_lcd_panel_io_handle_t)&sim_i80;
+
+    return ESP_OK;
+}
+
+
+esp_err_t esp_lcd_panel_io_del (
+    esp_lcd_panel_io_handle_t io
+)
+{
+    sim_line_close(&sim_i80, SIM_LINE_I80);
+
+    return ESP_OK;
+}
+
+
+esp_err_t esp_lcd_panel_io_tx_color (
+    esp_lcd_panel_io_handle_t io,
+    int cmd,
+    const void * color,
+    size_t size
+)
+{
+    struct sim_job_s job = {
+        .data = color,
+        .len = size,
+        .trans = io
+    };
+
+    // There's no waiting for it: on_color_trans_done is the only way to
+    // find out it's done.
+    return pdTRUE == sim_line_queue(&sim_i80, &job, portMAX_DELAY) ? ESP_OK : ESP_FAIL;
+}
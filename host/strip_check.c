@@ -0,0 +1,142 @@
+// Checks what matrix.c sends a one-wire strip over SPI: decodes the bytes
+// of one or more transactions, as a strip would (see strip_decode.h), prints
+// the frames that latched, and how close the timing came to the datasheet.
+//
+//   SIM_SPI_DUMP_DIR=dumps host/build/matrix_sim
+//   ./build/strip_check -c ws2812 -n 49 dumps/spi2_000001.bin
+//
+// Options:
+//
+//   -c chipset  ws2811, ws2812 (the default) or sk6812-rgbw
+//   -f hz       the SPI clock, what led_driver uses for the chipset by default
+//   -n pixels   how many pixels every frame should have
+//   -g us       how long the line rests between transactions, 0 by default
+//   -q          only the report, not the frames
+//
+// Exits with 1 if anything is out of spec, may have latched early, or a
+// frame doesn't have -n pixels.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "strip_decode.h"
+
+struct check_s {
+    const struct led_driver_s * driver;
+    uint32_t num_pixels;
+    bool quiet;
+    uint32_t wrong_frames;
+};
+
+static void check_latch (
+    void * ctx,
+    const uint8_t * bytes,
+    uint32_t len
+)
+{
+    static uint32_t frame;
+    struct check_s * check = ctx;
+    uint32_t channels = check->driver->channels;
+
+    frame++;
+    if (0 != check->num_pixels && len != check->num_pixels * channels) {
+        check->wrong_frames++;
+        printf("frame %u has %u pixels, not %u: WRONG\n", frame, len / channels, check->num_pixels);
+    }
+    if (check->quiet) {
+        return;
+    }
+
+    printf("frame %u:", frame);
+    for (uint32_t i = 0; i + channels <= len; i += channels) {
+        printf(" ");
+        for (uint32_t c = 0; c < channels; c++) {
+            printf("%02x", bytes[i + c]);
+        }
+    }
+    printf("\n");
+}
+
+
+static int usage (
+    const char * name
+)
+{
+    fprintf(stderr, "usage: %s [-c chipset] [-f hz] [-n pixels] [-g us] [-q] spi.bin...\n", name);
+
+    return 2;
+}
+
+
+int main (
+    int argc,
+    char ** argv
+)
+{
+    static uint8_t frame[65536];
+    static uint8_t bytes[1 << 20];
+    struct led_driver_s driver;
+    struct strip_decode_s dec;
+    struct check_s check = { 0 };
+    const char * chipset = "ws2812";
+    uint32_t clock_hz = 0;
+    uint64_t gap_ns = 0;
+    enum led_driver_type_e type;
+    size_t len;
+    FILE * f;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "c:f:n:g:q"))) {
+        switch (opt) {
+            case 'c': chipset = optarg; break;
+            case 'f': clock_hz = strtoul(optarg, NULL, 0); break;
+            case 'n': check.num_pixels = strtoul(optarg, NULL, 0); break;
+            case 'g': gap_ns = strtoull(optarg, NULL, 0) * 1000; break;
+            case 'q': check.quiet = true; break;
+            default: return usage(argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        return usage(argv[0]);
+    }
+
+    for (type = 0; type < LED_DRIVER_COUNT; type++) {
+        if (0 == led_driver_init(&driver, type, NULL) && 0 == strcmp(driver.name, chipset)) {
+            break;
+        }
+    }
+    if (LED_DRIVER_COUNT == type || NULL == strip_timing(type)) {
+        fprintf(stderr, "%s: not a one-wire chipset\n", chipset);
+        return 2;
+    }
+    if (0 == clock_hz) {
+        clock_hz = driver.spi_clock_hz;
+    }
+
+    check.driver = &driver;
+    strip_decode_init(&dec, strip_timing(type), frame, sizeof(frame));
+    dec.latch = check_latch;
+    dec.ctx = &check;
+
+    for (int i = optind; i < argc; i++) {
+        f = fopen(argv[i], "rb");
+        if (NULL == f) {
+            perror(argv[i]);
+            return 2;
+        }
+        len = fread(bytes, 1, sizeof(bytes), f);
+        fclose(f);
+
+        if (i > optind) {
+            strip_decode_run(&dec, false, gap_ns);
+        }
+        strip_decode_spi(&dec, bytes, len, clock_hz);
+    }
+    strip_decode_idle(&dec);
+
+    printf("%s at %u Hz:\n", chipset, clock_hz);
+    strip_decode_report(&dec, stdout);
+
+    return strip_decode_ok(&dec) && 0 == check.wrong_frames ? 0 : 1;
+}
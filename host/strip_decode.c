@@ -0,0 +1,328 @@
+#include <string.h>
+#include "strip_decode.h"
+
+// From the datasheets: WS2811 in its low speed mode, WS2812B-V5 (which asks
+// for the 280 us reset led_driver uses), and SK6812 RGBW.
+static const struct strip_timing_s strip_timings[LED_DRIVER_COUNT] = {
+    [LED_DRIVER_WS2811] = {
+        .name = "ws2811",
+        .t0h_min = 350, .t0h_max = 650,
+        .t1h_min = 1050, .t1h_max = 1350,
+        .t0l_min = 1850, .t0l_max = 2150,
+        .t1l_min = 1150, .t1l_max = 1450,
+        .reset_ns = 50000
+    },
+    [LED_DRIVER_WS2812] = {
+        .name = "ws2812",
+        .t0h_min = 220, .t0h_max = 380,
+        .t1h_min = 580, .t1h_max = 1000,
+        .t0l_min = 580, .t0l_max = 1000,
+        .t1l_min = 580, .t1l_max = 1000,
+        .reset_ns = 280000
+    },
+    [LED_DRIVER_SK6812_RGBW] = {
+        .name = "sk6812-rgbw",
+        .t0h_min = 150, .t0h_max = 450,
+        .t1h_min = 450, .t1h_max = 750,
+        .t0l_min = 750, .t0l_max = 1050,
+        .t1l_min = 450, .t1l_max = 750,
+        .reset_ns = 80000
+    },
+};
+
+static const char * const strip_margin_names[STRIP_MARGINS] = {
+    [STRIP_T0H] = "T0H",
+    [STRIP_T1H] = "T1H",
+    [STRIP_T0L] = "T0L",
+    [STRIP_T1L] = "T1L"
+};
+
+const struct strip_timing_s *strip_timing (
+    enum led_driver_type_e type
+)
+{
+    if (type >= LED_DRIVER_COUNT || NULL == strip_timings[type].name) {
+        return NULL;
+    }
+
+    return &strip_timings[type];
+}
+
+
+void strip_decode_init (
+    struct strip_decode_s * dec,
+    const struct strip_timing_s * timing,
+    uint8_t * out,
+    uint32_t max
+)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->timing = timing;
+    dec->out = out;
+    dec->max = max;
+    for (int i = 0; i < STRIP_MARGINS; i++) {
+        dec->margins[i].min_ns = UINT32_MAX;
+    }
+}
+
+
+static void strip_decode_window (
+    const struct strip_timing_s * t,
+    enum strip_margin_e i,
+    uint32_t * min,
+    uint32_t * max
+)
+{
+    switch (i) {
+        case STRIP_T0H: *min = t->t0h_min; *max = t->t0h_max; break;
+        case STRIP_T1H: *min = t->t1h_min; *max = t->t1h_max; break;
+        case STRIP_T0L: *min = t->t0l_min; *max = t->t0l_max; break;
+        default: *min = t->t1l_min; *max = t->t1l_max; break;
+    }
+}
+
+
+static void strip_decode_measure (
+    struct strip_decode_s * dec,
+    enum strip_margin_e i,
+    uint64_t ns
+)
+{
+    struct strip_margin_s * m = &dec->margins[i];
+    uint32_t min;
+    uint32_t max;
+
+    strip_decode_window(dec->timing, i, &min, &max);
+    if (ns > UINT32_MAX) {
+        ns = UINT32_MAX;
+    }
+
+    m->count++;
+    if (ns < m->min_ns) {
+        m->min_ns = ns;
+    }
+    if (ns > m->max_ns) {
+        m->max_ns = ns;
+    }
+    if (ns < min || ns > max) {
+        m->out_of_spec++;
+    }
+}
+
+
+static void strip_decode_latch (
+    struct strip_decode_s * dec
+)
+{
+    if (0 != dec->bits) {
+        dec->split_bytes++;
+        dec->bits = 0;
+    }
+    if (NULL != dec->latch) {
+        dec->latch(dec->ctx, dec->out, dec->len < dec->max ? dec->len : dec->max);
+    }
+    dec->frames++;
+    dec->len = 0;
+    dec->in_bit = false;
+}
+
+
+// The line falls: the high time says what the bit is.
+static void strip_decode_high (
+    struct strip_decode_s * dec
+)
+{
+    const struct strip_timing_s * t = dec->timing;
+
+    dec->bit = dec->high_ns * 2 > t->t0h_max + t->t1h_min;
+    strip_decode_measure(dec, dec->bit ? STRIP_T1H : STRIP_T0H, dec->high_ns);
+    dec->high_ns = 0;
+    dec->in_bit = true;
+
+    dec->byte = (dec->byte << 1) | dec->bit;
+    if (8 == ++dec->bits) {
+        if (dec->len < dec->max) {
+            dec->out[dec->len] = dec->byte;
+        }
+        dec->len++;
+        dec->bits = 0;
+    }
+}
+
+
+// The line rises: the low time before was the end of a bit, or a reset.
+static void strip_decode_low (
+    struct strip_decode_s * dec
+)
+{
+    const struct strip_timing_s * t = dec->timing;
+    uint32_t longest = t->t0l_max > t->t1l_max ? t->t0l_max : t->t1l_max;
+
+    if (dec->in_bit) {
+        strip_decode_measure(dec, dec->bit ? STRIP_T1L : STRIP_T0L, dec->low_ns);
+        if (dec->low_ns > 2 * (uint64_t)longest) {
+            dec->gaps++;
+            if (dec->low_ns > dec->longest_gap_ns) {
+                dec->longest_gap_ns = dec->low_ns;
+            }
+        }
+    } else if (0 != dec->frames) {
+        dec->last_reset_ns = dec->low_ns;
+    }
+    dec->low_ns = 0;
+}
+
+
+void strip_decode_run (
+    struct strip_decode_s * dec,
+    bool level,
+    uint64_t ns
+)
+{
+    if (0 == ns) {
+        return;
+    }
+
+    if (level) {
+        if (0 != dec->low_ns) {
+            strip_decode_low(dec);
+        }
+        dec->high_ns += ns;
+        return;
+    }
+
+    if (0 != dec->high_ns) {
+        strip_decode_high(dec);
+    }
+    dec->low_ns += ns;
+    if (dec->in_bit && dec->low_ns >= dec->timing->reset_ns) {
+        strip_decode_latch(dec);
+    }
+}
+
+
+void strip_decode_spi (
+    struct strip_decode_s * dec,
+    const uint8_t * bytes,
+    uint32_t len,
+    uint32_t clock_hz
+)
+{
+    uint64_t clocks = 0;
+    uint64_t start = 0;
+    bool level = false;
+    bool bit;
+
+    // In runs of the same level, timed from the start, so that rounding
+    // doesn't add up.
+    for (uint32_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            bit = (bytes[i] >> b) & 1;
+            if (bit != level) {
+                strip_decode_run(dec, level, (clocks * 1000000000 + clock_hz / 2) / clock_hz -
+                        (start * 1000000000 + clock_hz / 2) / clock_hz);
+                start = clocks;
+                level = bit;
+            }
+            clocks++;
+        }
+    }
+    strip_decode_run(dec, level, (clocks * 1000000000 + clock_hz / 2) / clock_hz -
+            (start * 1000000000 + clock_hz / 2) / clock_hz);
+}
+
+
+void strip_decode_idle (
+    struct strip_decode_s * dec
+)
+{
+    if (0 != dec->high_ns) {
+        strip_decode_high(dec);
+    }
+    if (dec->in_bit) {
+        dec->last_reset_ns = dec->low_ns;
+        strip_decode_latch(dec);
+    } else if (0 != dec->low_ns && 0 != dec->frames) {
+        dec->last_reset_ns = dec->low_ns;
+    }
+    dec->low_ns = 0;
+}
+
+
+int32_t strip_decode_margin (
+    const struct strip_decode_s * dec,
+    enum strip_margin_e i
+)
+{
+    const struct strip_margin_s * m = &dec->margins[i];
+    int64_t below;
+    int64_t above;
+    uint32_t min;
+    uint32_t max;
+
+    if (0 == m->count) {
+        return 0;
+    }
+
+    strip_decode_window(dec->timing, i, &min, &max);
+    below = (int64_t)m->min_ns - min;
+    above = (int64_t)max - m->max_ns;
+
+    return below < above ? below : above;
+}
+
+
+bool strip_decode_ok (
+    const struct strip_decode_s * dec
+)
+{
+    for (int i = 0; i < STRIP_MARGINS; i++) {
+        if (0 != dec->margins[i].out_of_spec) {
+            return false;
+        }
+    }
+
+    return 0 == dec->gaps && 0 == dec->split_bytes &&
+        (0 == dec->last_reset_ns || dec->last_reset_ns >= dec->timing->reset_ns);
+}
+
+
+void strip_decode_report (
+    const struct strip_decode_s * dec,
+    FILE * f
+)
+{
+    const struct strip_margin_s * m;
+    uint32_t min;
+    uint32_t max;
+
+    for (int i = 0; i < STRIP_MARGINS; i++) {
+        m = &dec->margins[i];
+        strip_decode_window(dec->timing, i, &min, &max);
+        if (0 == m->count) {
+            fprintf(f, "%s  none, spec %u..%u ns\n", strip_margin_names[i], min, max);
+            continue;
+        }
+        fprintf(f, "%s  %u..%u ns, spec %u..%u ns, margin %d ns%s (%u bits",
+                strip_margin_names[i], m->min_ns, m->max_ns, min, max, strip_decode_margin(dec, i),
+                0 == m->out_of_spec ? "" : ": OUT OF SPEC", m->count);
+        if (0 != m->out_of_spec) {
+            fprintf(f, ", %u outside", m->out_of_spec);
+        }
+        fprintf(f, ")\n");
+    }
+
+    fprintf(f, "gaps %u", dec->gaps);
+    if (0 != dec->gaps) {
+        fprintf(f, ", longest %llu ns: MAY LATCH EARLY", (unsigned long long)dec->longest_gap_ns);
+    }
+    fprintf(f, "\nframes %u", dec->frames);
+    if (0 != dec->split_bytes) {
+        fprintf(f, ", %u latched mid-byte: LATCHED EARLY", dec->split_bytes);
+    }
+    if (0 != dec->last_reset_ns) {
+        fprintf(f, ", last reset %llu ns, spec %u ns%s", (unsigned long long)dec->last_reset_ns,
+                dec->timing->reset_ns, dec->last_reset_ns < dec->timing->reset_ns ? ": TOO SHORT" : "");
+    }
+    fprintf(f, "\n");
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+// A virtual one-wire LED strip: reads a waveform the way a WS2811, WS2812 or
+// SK6812 would, and checks it against the chipset's datasheet on the way.
+//
+// The waveform goes in as runs of high and low, from SPI bytes at a clock
+// rate (strip_decode_spi, what matrix.c hands spi_device_queue_trans), or
+// anything else that can be turned into runs (strip_decode_run: RMT items,
+// lanes of the I2S output, the idle time between transactions).
+//
+// Like the LED, the decoder tells a 1 from a 0 by whether the line is still
+// high halfway between the longest T0H and the shortest T1H, and latches a
+// frame once the line has been low for the reset time. Every high and low
+// time is measured against the datasheet's window, so the report has how
+// close every kind of bit came to its limits. A low that's more than twice
+// as long as a bit's may be, but shorter than the reset time, is a gap: it's
+// not jitter any more, and some LEDs may take it for a reset and latch half
+// a frame.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "led_driver.h"
+
+// What a chipset's datasheet allows, in ns.
+struct strip_timing_s {
+    const char * name;
+    uint32_t t0h_min, t0h_max;
+    uint32_t t1h_min, t1h_max;
+    uint32_t t0l_min, t0l_max;
+    uint32_t t1l_min, t1l_max;
+    uint32_t reset_ns;
+};
+
+// How the measured times of one kind of bit compare to their window.
+struct strip_margin_s {
+    uint32_t count;
+    uint32_t min_ns;
+    uint32_t max_ns;
+    uint32_t out_of_spec;
+};
+
+enum strip_margin_e {
+    STRIP_T0H,
+    STRIP_T1H,
+    STRIP_T0L,
+    STRIP_T1L,
+    STRIP_MARGINS
+};
+
+struct strip_decode_s {
+    const struct strip_timing_s * timing;
+
+    // The bytes of the frame being decoded. Bytes past max are counted in
+    // len, but not kept.
+    uint8_t * out;
+    uint32_t max;
+    uint32_t len;
+
+    // Called with every frame that latches.
+    void (* latch)(void * ctx, const uint8_t * bytes, uint32_t len);
+    void * ctx;
+
+    struct strip_margin_s margins[STRIP_MARGINS];
+    uint32_t frames;
+
+    // Lows that may have latched, and latches in the middle of a byte,
+    // which lose the bits before them.
+    uint32_t gaps;
+    uint64_t longest_gap_ns;
+    uint32_t split_bytes;
+
+    // The low time before the last latch, which has to be at least the
+    // reset time if something follows right after.
+    uint64_t last_reset_ns;
+
+    // Where the line is: how long it has been high or low, and whether
+    // that low is the end of a bit or a reset.
+    uint64_t high_ns;
+    uint64_t low_ns;
+    bool in_bit;
+    bool bit;
+    uint8_t byte;
+    uint8_t bits;
+};
+
+
+// The datasheet timing of a chipset, or NULL for clocked ones (APA102).
+const struct strip_timing_s *strip_timing (
+    enum led_driver_type_e type
+);
+
+
+void strip_decode_init (
+    struct strip_decode_s * dec,
+    const struct strip_timing_s * timing,
+    uint8_t * out,
+    uint32_t max
+);
+
+
+// Adds ns of the line at level.
+void strip_decode_run (
+    struct strip_decode_s * dec,
+    bool level,
+    uint64_t ns
+);
+
+
+// Adds the bits of len bytes, most significant bit first, clocked out at
+// clock_hz.
+void strip_decode_spi (
+    struct strip_decode_s * dec,
+    const uint8_t * bytes,
+    uint32_t len,
+    uint32_t clock_hz
+);
+
+
+// Lets the line rest until whatever was sent has latched.
+void strip_decode_idle (
+    struct strip_decode_s * dec
+);
+
+
+// How far the i-th margin is inside its window, in ns: negative if it's
+// outside. 0 if there were no bits of that kind.
+int32_t strip_decode_margin (
+    const struct strip_decode_s * dec,
+    enum strip_margin_e i
+);
+
+
+// Whether every time was within the datasheet, and nothing latched where it
+// shouldn't have.
+bool strip_decode_ok (
+    const struct strip_decode_s * dec
+);
+
+
+// Prints the margins, gaps and frames to f, one line each.
+void strip_decode_report (
+    const struct strip_decode_s * dec,
+    FILE * f
+);
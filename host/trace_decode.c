@@ -0,0 +1,122 @@
+// Turns a trace dump (see trace.h) into Chrome trace JSON, for
+// chrome://tracing or https://ui.perfetto.dev:
+//
+//   nats sub --raw matrix1.stats.trace > dump.bin
+//   ./build/trace_decode dump.bin > trace.json
+//
+// Every event shows up as an instant on the core that recorded it, and every
+// frame as an async slice from when nats_task queued it to when it was on
+// the strip, missed or skipped, with the steps in between marked on it.
+//
+// Dumps are little-endian, like the host this runs on.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+static int first = 1;
+
+static void emit (
+    const char * fmt,
+    const char * name,
+    uint8_t core,
+    uint64_t time_us,
+    uint16_t arg
+)
+{
+    printf("%s\n    ", first ? "" : ",");
+    printf(fmt, name, core, (unsigned long long)time_us, arg);
+    first = 0;
+}
+
+
+int main (
+    int argc,
+    char ** argv
+)
+{
+    static struct trace_s trace;
+    const struct trace_event_s * e;
+    const char * name;
+    FILE * f;
+    size_t len;
+    uint32_t count, start, last_us = 0;
+    uint64_t high = 0, time_us;
+
+    if (2 != argc) {
+        fprintf(stderr, "usage: %s dump.bin > trace.json\n", argv[0]);
+        return 2;
+    }
+    f = fopen(argv[1], "rb");
+    if (NULL == f) {
+        perror(argv[1]);
+        return 1;
+    }
+    len = fread(&trace, 1, sizeof(trace), f);
+    fclose(f);
+    if (len != sizeof(trace) || TRACE_MAGIC != trace.magic) {
+        fprintf(stderr, "%s: not a trace dump\n", argv[1]);
+        return 1;
+    }
+
+    // Oldest first. Once the ring has wrapped, the oldest event is the one
+    // that would have been overwritten next.
+    count = trace.head < TRACE_LEN ? trace.head : TRACE_LEN;
+    start = trace.head < TRACE_LEN ? 0 : trace.head % TRACE_LEN;
+
+    printf("{\"traceEvents\":[");
+    for (int core = 0; core < 2; core++) {
+        printf("%s\n    {\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"core %d\"}}",
+                first ? "" : ",", core, core);
+        first = 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        e = &trace.events[(start + i) % TRACE_LEN];
+        name = trace_type_name(e->type);
+        if (NULL == name) {
+            continue;
+        }
+
+        // time_us wraps every 71 minutes.
+        if (e->time_us < last_us && last_us - e->time_us > 0x80000000u) {
+            high += 1ull << 32;
+        }
+        last_us = e->time_us;
+        time_us = high + e->time_us;
+
+        emit("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%u,\"ts\":%llu,\"args\":{\"arg\":%u}}",
+                name, e->core, time_us, e->arg);
+
+        if (TRACE_NO_FRAME == e->arg) {
+            continue;
+        }
+        switch (e->type) {
+            case TRACE_QUEUED:
+                emit("{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"b\",\"pid\":0,\"tid\":%u,\"ts\":%llu,\"id\":%u}",
+                        "frame", e->core, time_us, e->arg);
+                break;
+
+            case TRACE_DEQUEUED:
+            case TRACE_DEADLINE:
+            case TRACE_SENT:
+                emit("{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"n\",\"pid\":0,\"tid\":%u,\"ts\":%llu,\"id\":%u}",
+                        name, e->core, time_us, e->arg);
+                break;
+
+            case TRACE_DONE:
+            case TRACE_MISSED:
+            case TRACE_SKIPPED:
+                emit("{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"e\",\"pid\":0,\"tid\":%u,\"ts\":%llu,\"id\":%u}",
+                        "frame", e->core, time_us, e->arg);
+                break;
+
+            default:
+                break;
+        }
+    }
+    printf("\n]}\n");
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <string.h>
+#include "color_cal.h"
+
+void color_cal_init (
+    struct color_cal_s * cal,
+    uint8_t * segment
+)
+{
+    cal->num_matrices = 0;
+    cal->segment = segment;
+}
+
+
+int color_cal_load (
+    struct color_cal_s * cal,
+    uint32_t len,
+    const uint8_t * data,
+    uint32_t data_len
+)
+{
+    uint32_t num_matrices;
+    uint32_t matrices_len;
+    const uint8_t * segment;
+    int16_t coeff;
+
+    if (0 == data_len) {
+        cal->num_matrices = 0;
+        return 0;
+    }
+
+    num_matrices = data[0];
+    if (0 == num_matrices || num_matrices > COLOR_CAL_MAX_MATRICES) {
+        return -1;
+    }
+
+    matrices_len = 1 + num_matrices * 18;
+    if (data_len == matrices_len) {
+        if (1 != num_matrices) {
+            return -1;
+        }
+        segment = NULL;
+    } else if (data_len == matrices_len + len) {
+        segment = &data[matrices_len];
+    } else {
+        return -1;
+    }
+
+    // Check everything first, so that a bad table leaves the old one be.
+    for (uint32_t i = 0; i < num_matrices * 9; i++) {
+        coeff = data[1 + i*2] | (data[2 + i*2] << 8);
+        if (coeff < -COLOR_CAL_MAX_COEFF || coeff > COLOR_CAL_MAX_COEFF) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; NULL != segment && i < len; i++) {
+        if (segment[i] >= num_matrices) {
+            return -1;
+        }
+    }
+
+    for (uint32_t k = 0; k < num_matrices; k++) {
+        for (uint32_t i = 0; i < 9; i++) {
+            cal->m[k][i / 3][i % 3] = data[1 + (k*9 + i)*2] | (data[2 + (k*9 + i)*2] << 8);
+        }
+    }
+    if (NULL != segment) {
+        memcpy(cal->segment, segment, len);
+    } else {
+        memset(cal->segment, 0, len);
+    }
+    cal->num_matrices = num_matrices;
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+// Per-pixel color calibration. LEDs from different reels have visibly
+// different white points, so every pixel on the strip can be given a 3x3
+// matrix that its (gamma and brightness corrected) r, g, b go through before
+// they go out. Pixels from the same reel share a matrix: there is a small
+// table of matrices, and a segment index per pixel that picks one.
+//
+// A plain per-channel scale is just a matrix with only a diagonal.
+//
+// Coefficients are fixed-point with 12 fractional bits, so 4096 is 1.0, and
+// are limited to -2.0..2.0 so that the products fit in 32 bits even for 16
+// bit values.
+
+#include <stdint.h>
+
+#define COLOR_CAL_MAX_MATRICES 16
+#define COLOR_CAL_ONE 4096
+#define COLOR_CAL_MAX_COEFF (2 * COLOR_CAL_ONE)
+
+struct color_cal_s {
+    // 0 means calibration is off.
+    uint8_t num_matrices;
+
+    // Row-major, so m[k][0] gives r from the r, g, b going in.
+    int16_t m[COLOR_CAL_MAX_MATRICES][3][3];
+
+    // Which matrix each pixel on the strip uses, by wire index. Owned by
+    // the caller, see color_cal_init.
+    uint8_t * segment;
+};
+
+
+// Turns calibration off. segment must have room for one entry per pixel on
+// the strip.
+void color_cal_init (
+    struct color_cal_s * cal,
+    uint8_t * segment
+);
+
+
+// Loads calibration for len pixels from data, which is:
+//
+//   uint8_t num_matrices (1..COLOR_CAL_MAX_MATRICES)
+//   int16_t m[num_matrices][3][3], little-endian
+//   uint8_t segment[len], optional if num_matrices is 1
+//
+// An empty data turns calibration off. Returns -1, leaving cal as it was,
+// if data is malformed, a coefficient is out of range, or a segment points
+// past the matrices.
+int color_cal_load (
+    struct color_cal_s * cal,
+    uint32_t len,
+    const uint8_t * data,
+    uint32_t data_len
+);
+
+
+// Runs v (r, g, b, each 0..max) of pixel i on the strip through its matrix,
+// in place.
+static inline void color_cal_apply (
+    const struct color_cal_s * cal,
+    uint32_t i,
+    uint32_t * v,
+    int32_t max
+)
+{
+    const int16_t (* m)[3] = cal->m[cal->segment[i]];
+    int32_t in[3] = { v[0], v[1], v[2] };
+    int32_t out;
+
+    for (int c = 0; c < 3; c++) {
+        out = (m[c][0] * in[0] + m[c][1] * in[1] + m[c][2] * in[2] + COLOR_CAL_ONE / 2) / COLOR_CAL_ONE;
+        v[c] = out < 0 ? 0 : out > max ? max : out;
+    }
+}
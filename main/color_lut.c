@@ -0,0 +1,108 @@
+#include <math.h>
+#include "color_lut.h"
+
+static void color_lut_rebuild (
+    struct color_lut_s * lut
+)
+{
+    uint32_t v;
+
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < 256; i++) {
+            // Both factors are 0..65535, so this fits in 32 bits.
+            v = ((uint32_t)lut->gamma[c][i] * lut->brightness + 32767) / 65535;
+            lut->lut16[c][i] = v;
+            lut->lut[c][i] = (v * 255 + 32767) / 65535;
+        }
+        lut->lut16[c][256] = lut->lut16[c][255];
+    }
+}
+
+
+void color_lut_init (
+    struct color_lut_s * lut
+)
+{
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < 256; i++) {
+            lut->gamma[c][i] = i * 257;
+        }
+    }
+    lut->brightness = 65535;
+    lut->ramp_len_ms = 0;
+    color_lut_rebuild(lut);
+}
+
+
+int color_lut_set_gamma (
+    struct color_lut_s * lut,
+    const uint16_t gamma_x100[3]
+)
+{
+    for (int c = 0; c < 3; c++) {
+        if (0 == gamma_x100[c] || gamma_x100[c] > 500) {
+            return -1;
+        }
+    }
+
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < 256; i++) {
+            lut->gamma[c][i] = lroundf(65535.0f * powf(i / 255.0f, gamma_x100[c] / 100.0f));
+        }
+    }
+    color_lut_rebuild(lut);
+
+    return 0;
+}
+
+
+void color_lut_set_brightness (
+    struct color_lut_s * lut,
+    uint8_t brightness,
+    uint32_t ramp_ms,
+    uint32_t now_ms
+)
+{
+    if (0 == ramp_ms) {
+        lut->brightness = brightness * 257;
+        lut->ramp_len_ms = 0;
+        color_lut_rebuild(lut);
+        return;
+    }
+
+    lut->ramp_from = lut->brightness;
+    lut->ramp_to = brightness * 257;
+    lut->ramp_start_ms = now_ms;
+    lut->ramp_len_ms = ramp_ms;
+}
+
+
+bool color_lut_update (
+    struct color_lut_s * lut,
+    uint32_t now_ms
+)
+{
+    uint32_t elapsed;
+    uint16_t brightness;
+
+    if (0 == lut->ramp_len_ms) {
+        return false;
+    }
+
+    elapsed = now_ms - lut->ramp_start_ms;
+    if (elapsed >= lut->ramp_len_ms) {
+        brightness = lut->ramp_to;
+        lut->ramp_len_ms = 0;
+    } else {
+        brightness = lut->ramp_from +
+            ((int32_t)lut->ramp_to - lut->ramp_from) * (int64_t)elapsed / lut->ramp_len_ms;
+    }
+
+    if (brightness == lut->brightness) {
+        return false;
+    }
+
+    lut->brightness = brightness;
+    color_lut_rebuild(lut);
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+// Gamma and brightness correction, as one lookup table per channel that the
+// encoder applies to every byte on its way to the strip.
+//
+// The gamma curves are kept at 16 bits so that brightness can be applied on
+// top of them without losing the low end, and brightness itself is 16 bits
+// so that ramps move smoothly. Changing either just rebuilds the tables;
+// frames are never touched.
+//
+// By default gamma is 1.0 and brightness is full, so values go to the strip
+// unchanged.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct color_lut_s {
+    // What the encoder looks up, per channel (r, g, b).
+    uint8_t lut[3][256];
+
+    // The same at 16 bits, for 16 bit frames. Entry i is for the 16 bit
+    // value i * 257, like lut's is for i. The extra entry repeats the last
+    // one, so that color_lut_lookup16 doesn't need a bounds check.
+    uint16_t lut16[3][257];
+
+    // The gamma curves, 0..65535.
+    uint16_t gamma[3][256];
+
+    // Current brightness, 0..65535.
+    uint16_t brightness;
+
+    // Brightness ramp. Done when ramp_len_ms is 0.
+    uint16_t ramp_from;
+    uint16_t ramp_to;
+    uint32_t ramp_start_ms;
+    uint32_t ramp_len_ms;
+};
+
+
+void color_lut_init (
+    struct color_lut_s * lut
+);
+
+
+// Sets the gamma of each channel, in hundredths (220 means 2.2). Returns -1
+// if a gamma is 0 or unreasonably high (over 5.0).
+int color_lut_set_gamma (
+    struct color_lut_s * lut,
+    const uint16_t gamma_x100[3]
+);
+
+
+// Moves brightness (0..255) to the given value over ramp_ms milliseconds,
+// starting at now_ms. A ramp of 0 ms takes effect immediately.
+void color_lut_set_brightness (
+    struct color_lut_s * lut,
+    uint8_t brightness,
+    uint32_t ramp_ms,
+    uint32_t now_ms
+);
+
+
+// Looks up a 16 bit value in the table for channel c, interpolating
+// between entries. The entries are 257 apart, so v sits v % 257 of the way
+// from entry v / 257 to the next; both divisions are by a constant, which
+// compilers turn into a multiplication.
+static inline uint16_t color_lut_lookup16 (
+    const struct color_lut_s * lut,
+    int c,
+    uint16_t v
+)
+{
+    const uint16_t * e = &lut->lut16[c][v / 257];
+    return e[0] + ((int32_t)e[1] - e[0]) * (v % 257) / 257;
+}
+
+
+// Advances a running ramp to now_ms. Returns true if the tables changed, in
+// which case whatever is on the strip should be redrawn.
+bool color_lut_update (
+    struct color_lut_s * lut,
+    uint32_t now_ms
+);
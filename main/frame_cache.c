@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+#include "frame_cache.h"
+
+static uint32_t frame_cache_entry_size (
+    uint32_t key_len,
+    uint32_t len
+)
+{
+    return sizeof(struct frame_cache_entry_s) + key_len + len;
+}
+
+
+static void frame_cache_unlink (
+    struct frame_cache_s * cache,
+    struct frame_cache_entry_s * entry
+)
+{
+    if (NULL != entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (NULL != entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+}
+
+
+static void frame_cache_push_front (
+    struct frame_cache_s * cache,
+    struct frame_cache_entry_s * entry
+)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (NULL != cache->head) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+
+static void frame_cache_remove (
+    struct frame_cache_s * cache,
+    struct frame_cache_entry_s * entry
+)
+{
+    frame_cache_unlink(cache, entry);
+    cache->used -= frame_cache_entry_size(entry->key_len, entry->len);
+    cache->free(entry->data);
+    free(entry);
+}
+
+
+// Throws out stale entries, and then the least recently used ones until
+// size more bytes fit.
+static void frame_cache_evict (
+    struct frame_cache_s * cache,
+    uint32_t size
+)
+{
+    struct frame_cache_entry_s * entry = cache->head;
+    struct frame_cache_entry_s * next;
+
+    while (NULL != entry) {
+        next = entry->next;
+        if (entry->generation != cache->generation) {
+            frame_cache_remove(cache, entry);
+        }
+        entry = next;
+    }
+
+    while (NULL != cache->tail && cache->used + size > cache->budget) {
+        frame_cache_remove(cache, cache->tail);
+    }
+}
+
+
+void frame_cache_init (
+    struct frame_cache_s * cache,
+    void * (* alloc_data)(size_t size),
+    void (* free_data)(void * p)
+)
+{
+    *cache = (struct frame_cache_s) {
+        .budget = 0,
+        .alloc = alloc_data,
+        .free = free_data
+    };
+}
+
+
+uint32_t frame_cache_hash (
+    const void * key,
+    uint32_t key_len
+)
+{
+    const uint8_t * p = key;
+    uint32_t hash = 2166136261U;
+
+    for (uint32_t i = 0; i < key_len; i++) {
+        hash = (hash ^ p[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+
+const struct frame_cache_entry_s * frame_cache_get (
+    struct frame_cache_s * cache,
+    const void * key,
+    uint32_t key_len,
+    uint32_t hash
+)
+{
+    struct frame_cache_entry_s * entry;
+
+    cache->lookups++;
+
+    for (entry = cache->head; NULL != entry; entry = entry->next) {
+        if (hash == entry->hash &&
+            key_len == entry->key_len &&
+            cache->generation == entry->generation &&
+            0 == memcmp(key, entry->key, key_len))
+        {
+            break;
+        }
+    }
+    if (NULL == entry) {
+        return NULL;
+    }
+
+    if (cache->head != entry) {
+        frame_cache_unlink(cache, entry);
+        frame_cache_push_front(cache, entry);
+    }
+    cache->hits++;
+    cache->bytes_saved += entry->len;
+
+    return entry;
+}
+
+
+void frame_cache_put (
+    struct frame_cache_s * cache,
+    const void * key,
+    uint32_t key_len,
+    uint32_t hash,
+    const void * data,
+    uint32_t len,
+    uint16_t scale,
+    uint32_t ma
+)
+{
+    uint32_t size = frame_cache_entry_size(key_len, len);
+    struct frame_cache_entry_s * entry;
+
+    if (size > cache->budget) {
+        return;
+    }
+    frame_cache_evict(cache, size);
+
+    // Only the encoded frame needs to be where the output can send it
+    // from.
+    entry = malloc(sizeof(*entry) + key_len);
+    if (NULL == entry) {
+        return;
+    }
+    entry->data = cache->alloc(len);
+    if (NULL == entry->data) {
+        free(entry);
+        return;
+    }
+
+    entry->hash = hash;
+    entry->generation = cache->generation;
+    entry->key_len = key_len;
+    entry->len = len;
+    entry->scale = scale;
+    entry->ma = ma;
+    entry->key = (uint8_t *)(entry + 1);
+    memcpy(entry->key, key, key_len);
+    memcpy(entry->data, data, len);
+
+    frame_cache_push_front(cache, entry);
+    cache->used += size;
+}
+
+
+void frame_cache_invalidate (
+    struct frame_cache_s * cache
+)
+{
+    cache->generation++;
+}
+
+
+void frame_cache_set_budget (
+    struct frame_cache_s * cache,
+    uint32_t budget
+)
+{
+    cache->budget = budget;
+    frame_cache_evict(cache, 0);
+}
+
+
+void frame_cache_reset_stats (
+    struct frame_cache_s * cache
+)
+{
+    cache->lookups = 0;
+    cache->hits = 0;
+    cache->bytes_saved = 0;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+// Keeps encoded frames around, so that looping shows, which send the same
+// few hundred frames over and over, don't have every one of them encoded
+// again each time. A frame that's in the cache goes straight out of it.
+//
+// Entries are found by a hash of the frame as it came in, and then compared
+// in full, so a collision costs a memcmp and never the wrong picture.
+// Anything that changes how frames are encoded (the color tables, the pixel
+// map, the driver, ...) makes every entry stale; stale entries are thrown
+// out the next time one is added. When the cache is over its budget, the
+// least recently used entries go first.
+//
+// Lookups walk the entries in LRU order, which is fine for the number that
+// fit into memory here.
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct frame_cache_entry_s {
+    struct frame_cache_entry_s * prev;
+    struct frame_cache_entry_s * next;
+
+    uint32_t hash;
+    uint32_t generation;
+
+    // The frame as it came in, and as it goes out.
+    uint32_t key_len;
+    uint32_t len;
+    uint8_t * key;
+    uint8_t * data;
+
+    // What the power limit made of the frame, so that it can be counted
+    // again when the frame goes out again, see power_limit_count.
+    uint16_t scale;
+    uint32_t ma;
+};
+
+struct frame_cache_s {
+    // How many bytes the entries may take up, all told. 0 turns the cache
+    // off.
+    uint32_t budget;
+    uint32_t used;
+
+    // Most recently used first.
+    struct frame_cache_entry_s * head;
+    struct frame_cache_entry_s * tail;
+
+    // Entries from an earlier generation are stale.
+    uint32_t generation;
+
+    // Where encoded frames are kept. They have to be somewhere the output
+    // can send them from, e.g. DMA capable memory.
+    void * (* alloc)(size_t size);
+    void (* free)(void * p);
+
+    // Telemetry, since the last frame_cache_reset_stats.
+    uint32_t lookups;
+    uint32_t hits;
+    uint64_t bytes_saved;   // encoded bytes that didn't have to be written
+};
+
+
+void frame_cache_init (
+    struct frame_cache_s * cache,
+    void * (* alloc_data)(size_t size),
+    void (* free_data)(void * p)
+);
+
+
+// FNV-1a, which is quick and good enough to tell frames apart.
+uint32_t frame_cache_hash (
+    const void * key,
+    uint32_t key_len
+);
+
+
+// Returns the entry for the frame key, or NULL if there is none.
+const struct frame_cache_entry_s * frame_cache_get (
+    struct frame_cache_s * cache,
+    const void * key,
+    uint32_t key_len,
+    uint32_t hash
+);
+
+
+// Adds the frame key, encoded as data with the power limit's scale and
+// estimate of ma, making room for it as needed.
+// Entries may be freed, so no entry may be in use (being sent) while this
+// runs. Does nothing if the entry doesn't fit the budget or can't be
+// allocated.
+void frame_cache_put (
+    struct frame_cache_s * cache,
+    const void * key,
+    uint32_t key_len,
+    uint32_t hash,
+    const void * data,
+    uint32_t len,
+    uint16_t scale,
+    uint32_t ma
+);
+
+
+// Makes every entry stale.
+void frame_cache_invalidate (
+    struct frame_cache_s * cache
+);
+
+
+// Sets the budget, throwing out entries to fit. The same goes as for
+// frame_cache_put.
+void frame_cache_set_budget (
+    struct frame_cache_s * cache,
+    uint32_t budget
+);
+
+
+void frame_cache_reset_stats (
+    struct frame_cache_s * cache
+);
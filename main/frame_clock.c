@@ -0,0 +1,77 @@
+#include "frame_clock.h"
+
+void frame_clock_init (
+    struct frame_clock_s * clock
+)
+{
+    *clock = (struct frame_clock_s) {
+        .rate_hz = 0,
+        .period_us = 0
+    };
+}
+
+
+uint16_t frame_clock_set_rate (
+    struct frame_clock_s * clock,
+    uint16_t rate_hz,
+    uint32_t min_period_us,
+    int64_t now_us
+)
+{
+    clock->rate_hz = rate_hz;
+    if (0 == rate_hz) {
+        clock->period_us = 0;
+        return 0;
+    }
+
+    clock->period_us = 1000000 / rate_hz;
+    if (clock->period_us < min_period_us) {
+        clock->period_us = min_period_us;
+    }
+    clock->next_us = now_us;
+
+    return 1000000 / clock->period_us;
+}
+
+
+int64_t frame_clock_wait_us (
+    const struct frame_clock_s * clock,
+    int64_t now_us
+)
+{
+    return now_us >= clock->next_us ? 0 : clock->next_us - now_us;
+}
+
+
+void frame_clock_tick (
+    struct frame_clock_s * clock,
+    int64_t start_us,
+    uint32_t took_us
+)
+{
+    uint32_t late;
+
+    clock->ticks++;
+    if (took_us > clock->period_us) {
+        clock->overruns++;
+    }
+    if (took_us > clock->max_us) {
+        clock->max_us = took_us;
+    }
+
+    // Every whole period we're late by is a tick that never happened.
+    late = start_us > clock->next_us ? (start_us - clock->next_us) / clock->period_us : 0;
+    clock->missed += late;
+    clock->next_us += (int64_t)(late + 1) * clock->period_us;
+}
+
+
+void frame_clock_reset_stats (
+    struct frame_clock_s * clock
+)
+{
+    clock->ticks = 0;
+    clock->missed = 0;
+    clock->overruns = 0;
+    clock->max_us = 0;
+}
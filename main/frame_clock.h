@@ -0,0 +1,74 @@
+#pragma once
+
+// A fixed rate to present frames at, whether or not new ones come in, for
+// things that have to keep moving on their own: dithering, fades, shaders,
+// and getting the strip back after a glitch on the line.
+//
+// Ticks stay on a fixed grid. If one is handled late, the ones that were
+// missed are counted and skipped, rather than bunched up to catch up. A tick
+// that takes longer than the period to handle is an overrun.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct frame_clock_s {
+    // What was asked for, and the period that came out of it, in us. A
+    // period of 0 means the clock is stopped.
+    uint16_t rate_hz;
+    uint32_t period_us;
+
+    // When the next tick is due.
+    int64_t next_us;
+
+    // Telemetry, since the last frame_clock_reset_stats.
+    uint32_t ticks;
+    uint32_t missed;
+    uint32_t overruns;
+    uint32_t max_us;        // longest a tick took to handle
+};
+
+
+void frame_clock_init (
+    struct frame_clock_s * clock
+);
+
+
+// Runs the clock at rate_hz, starting at now_us, or stops it if rate_hz is
+// 0. The period is never shorter than min_period_us, which is how long a
+// frame takes to go out and latch. Returns the rate it actually runs at.
+uint16_t frame_clock_set_rate (
+    struct frame_clock_s * clock,
+    uint16_t rate_hz,
+    uint32_t min_period_us,
+    int64_t now_us
+);
+
+
+// Returns how long it is until the next tick, in us, or 0 if it's due.
+int64_t frame_clock_wait_us (
+    const struct frame_clock_s * clock,
+    int64_t now_us
+);
+
+
+static inline bool frame_clock_due (
+    const struct frame_clock_s * clock,
+    int64_t now_us
+)
+{
+    return 0 != clock->period_us && now_us >= clock->next_us;
+}
+
+
+// Records that the tick due at or before start_us was handled, starting at
+// start_us and taking took_us, and schedules the next one.
+void frame_clock_tick (
+    struct frame_clock_s * clock,
+    int64_t start_us,
+    uint32_t took_us
+);
+
+
+void frame_clock_reset_stats (
+    struct frame_clock_s * clock
+);
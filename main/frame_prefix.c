@@ -0,0 +1,68 @@
+#include <string.h>
+#include "frame_prefix.h"
+
+void frame_prefix_init (
+    struct frame_prefix_s * prefix,
+    uint8_t (* last)[3]
+)
+{
+    *prefix = (struct frame_prefix_s) {
+        .enabled = false,
+        .valid = false,
+        .last = last
+    };
+}
+
+
+uint32_t frame_prefix_len (
+    struct frame_prefix_s * prefix,
+    const uint8_t (* wire)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    uint32_t len = num_pixels;
+
+    if (!prefix->enabled) {
+        prefix->valid = false;
+    } else {
+        if (prefix->valid && scale == prefix->scale) {
+            while (len > 0 && 0 == memcmp(wire[len - 1], prefix->last[len - 1], 3)) {
+                len--;
+            }
+        }
+
+        // Past len, last is already the same.
+        memcpy(prefix->last, wire, len * 3);
+        prefix->scale = scale;
+        prefix->valid = true;
+    }
+
+    prefix->frames++;
+    if (len < num_pixels) {
+        prefix->truncated++;
+    }
+    prefix->pixels_sent += len;
+    prefix->pixels += num_pixels;
+
+    return len;
+}
+
+
+void frame_prefix_invalidate (
+    struct frame_prefix_s * prefix
+)
+{
+    prefix->valid = false;
+}
+
+
+void frame_prefix_reset_stats (
+    struct frame_prefix_s * prefix
+)
+{
+    prefix->frames = 0;
+    prefix->truncated = 0;
+    prefix->pixels_sent = 0;
+    prefix->pixels = 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+// Sends only as much of the strip as changed. Chipsets keep whatever they
+// were last sent until new data reaches them, so when only the first k
+// pixels of a frame are different from what's on the strip, sending those k
+// pixels (and the reset time) is enough. Progress bars, wipes and anything
+// else that only changes near the start of the strip go out that much
+// faster.
+//
+// Only works for outputs that drive the strip as one chain, and is off by
+// default.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct frame_prefix_s {
+    bool enabled;
+
+    // Whether last is what's on the strip. Anything that changes what goes
+    // out for the same pixels (driver, output) or that wants the whole strip
+    // sent (a refresh) clears this.
+    bool valid;
+
+    // What went out for every pixel on the strip, before scaling, and the
+    // scale it went out with.
+    uint8_t (* last)[3];
+    uint16_t scale;
+
+    // Telemetry, since the last frame_prefix_reset_stats.
+    uint32_t frames;
+    uint32_t truncated;
+    uint64_t pixels_sent;
+    uint64_t pixels;
+};
+
+
+// last is where to keep the frame on the strip, num_pixels entries.
+void frame_prefix_init (
+    struct frame_prefix_s * prefix,
+    uint8_t (* last)[3]
+);
+
+
+// Returns how many pixels from the start of the strip have to be sent for
+// it to show wire at scale: up to and including the last one that changed,
+// or all of them if truncating is off or last isn't valid. 0 means nothing
+// changed. Then takes wire as what's on the strip.
+uint32_t frame_prefix_len (
+    struct frame_prefix_s * prefix,
+    const uint8_t (* wire)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+);
+
+
+// Makes the next frame go out whole.
+void frame_prefix_invalidate (
+    struct frame_prefix_s * prefix
+);
+
+
+void frame_prefix_reset_stats (
+    struct frame_prefix_s * prefix
+);
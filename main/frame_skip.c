@@ -0,0 +1,97 @@
+#include <string.h>
+#include "frame_skip.h"
+
+// Often enough to catch a glitch before anyone notices, rarely enough to
+// cost nothing.
+#define FRAME_SKIP_REFRESH_MS 1000
+
+void frame_skip_init (
+    struct frame_skip_s * skip
+)
+{
+    *skip = (struct frame_skip_s) {
+        .enabled = false,
+        .refresh_ms = FRAME_SKIP_REFRESH_MS
+    };
+}
+
+
+int frame_skip_load (
+    struct frame_skip_s * skip,
+    const uint8_t * data,
+    uint32_t data_len
+)
+{
+    if ((1 != data_len && 5 != data_len) || data[0] > 1) {
+        return -1;
+    }
+
+    skip->enabled = data[0];
+    if (5 == data_len) {
+        skip->refresh_ms = data[1] | (data[2] << 8) | (data[3] << 16) | ((uint32_t)data[4] << 24);
+    }
+
+    return 0;
+}
+
+
+bool frame_skip_check (
+    struct frame_skip_s * skip,
+    const void * frame,
+    const void * shown,
+    uint32_t len,
+    bool dirty,
+    uint32_t now_ms
+)
+{
+    skip->frames++;
+
+    if (!skip->enabled || dirty || frame_skip_refresh_due(skip, now_ms)) {
+        return false;
+    }
+
+    if (0 != memcmp(frame, shown, len)) {
+        return false;
+    }
+
+    skip->skipped++;
+    skip->saved_us += skip->draw_us;
+
+    return true;
+}
+
+
+bool frame_skip_refresh_due (
+    const struct frame_skip_s * skip,
+    uint32_t now_ms
+)
+{
+    return 0 != skip->refresh_ms && now_ms - skip->drawn_ms >= skip->refresh_ms;
+}
+
+
+void frame_skip_drawn (
+    struct frame_skip_s * skip,
+    uint32_t now_ms,
+    uint32_t draw_us
+)
+{
+    skip->drawn_ms = now_ms;
+
+    // A moving average over the last 8 or so frames.
+    if (0 == skip->draw_us) {
+        skip->draw_us = draw_us;
+    } else {
+        skip->draw_us = (skip->draw_us * 7 + draw_us) / 8;
+    }
+}
+
+
+void frame_skip_reset_stats (
+    struct frame_skip_s * skip
+)
+{
+    skip->frames = 0;
+    skip->skipped = 0;
+    skip->saved_us = 0;
+}
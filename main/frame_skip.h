@@ -0,0 +1,81 @@
+#pragma once
+
+// Skips frames that are the same as the one already on the strip. Producers
+// often send the same frame over and over (holds, still scenes), and every
+// one of them would otherwise cost an encode pass and a whole frame on the
+// wire.
+//
+// Every refresh_ms, the frame goes out anyway, in case the strip picked up
+// a glitch in the meantime.
+//
+// Off by default, until matrix1.ctl.skip turns it on.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct frame_skip_s {
+    bool enabled;
+
+    // How long the strip may go without being drawn, in ms. 0 means
+    // forever.
+    uint32_t refresh_ms;
+
+    // When the strip was last drawn, and how long drawing takes on average,
+    // in us, to tell how much skipping saves.
+    uint32_t drawn_ms;
+    uint32_t draw_us;
+
+    // Telemetry, since the last frame_skip_reset_stats.
+    uint32_t frames;
+    uint32_t skipped;
+    uint64_t saved_us;
+};
+
+
+void frame_skip_init (
+    struct frame_skip_s * skip
+);
+
+
+// Loads the settings from a payload of one byte, 0 to turn skipping off or
+// 1 to turn it on, optionally followed by refresh_ms as a little-endian
+// uint32_t. Returns -1 if the payload is malformed.
+int frame_skip_load (
+    struct frame_skip_s * skip,
+    const uint8_t * data,
+    uint32_t data_len
+);
+
+
+// Returns true if frame, of len bytes, doesn't need to be drawn: it's the
+// same as shown, nothing else changed since (dirty is false), and the strip
+// isn't due for a refresh.
+bool frame_skip_check (
+    struct frame_skip_s * skip,
+    const void * frame,
+    const void * shown,
+    uint32_t len,
+    bool dirty,
+    uint32_t now_ms
+);
+
+
+// Returns true if the strip hasn't been drawn for refresh_ms, so that what's
+// on it should be drawn again even though no frames came in.
+bool frame_skip_refresh_due (
+    const struct frame_skip_s * skip,
+    uint32_t now_ms
+);
+
+
+// Records that the strip was drawn at now_ms, and that it took draw_us.
+void frame_skip_drawn (
+    struct frame_skip_s * skip,
+    uint32_t now_ms,
+    uint32_t draw_us
+);
+
+
+void frame_skip_reset_stats (
+    struct frame_skip_s * skip
+);
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+#include "latency_hist.h"
+
+static const char * const latency_stage_names[LATENCY_STAGES] = {
+    [LATENCY_PARSE] = "parse",
+    [LATENCY_QUEUE] = "queue",
+    [LATENCY_DRAW] = "draw",
+    [LATENCY_WIRE] = "wire",
+    [LATENCY_TOTAL] = "total"
+};
+
+
+void latency_hist_init (
+    struct latency_hist_s * hist
+)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+
+uint32_t latency_hist_json (
+    const struct latency_hist_s * hist,
+    char * buf,
+    uint32_t len
+)
+{
+    uint32_t used = 0;
+    uint32_t count;
+    int n;
+
+    for (int s = 0; s < LATENCY_STAGES; s++) {
+        n = snprintf(buf + used, len - used, "%s\"%s\":[", 0 == s ? "{" : ",", latency_stage_names[s]);
+        if (n < 0 || (uint32_t)n >= len - used) {
+            return 0;
+        }
+        used += n;
+
+        for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+            count = 0;
+            for (int c = 0; c < LATENCY_HIST_CORES; c++) {
+                count += hist->count[c][s][b];
+            }
+            n = snprintf(buf + used, len - used, "%s%u", 0 == b ? "" : ",", count);
+            if (n < 0 || (uint32_t)n >= len - used) {
+                return 0;
+            }
+            used += n;
+        }
+
+        n = snprintf(buf + used, len - used, "]");
+        if (n < 0 || (uint32_t)n >= len - used) {
+            return 0;
+        }
+        used += n;
+    }
+
+    n = snprintf(buf + used, len - used, "}");
+    if (n < 0 || (uint32_t)n >= len - used) {
+        return 0;
+    }
+
+    return used + n;
+}
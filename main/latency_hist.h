@@ -0,0 +1,77 @@
+#pragma once
+
+// Where the time goes between a frame arriving and it being on the strip,
+// as a histogram per stage:
+//
+//   parse  read() returning the start of the MSG to the frame being queued
+//   queue  queued to led_task taking it off event_queue
+//   draw   taken off the queue to the transfer starting, not counting the
+//          wait until the frame's time
+//   wire   the transfer starting to DMA being done with it
+//   total  read() to DMA being done, again without the wait
+//
+// Buckets are powers of two: bucket 0 counts anything under 2 us, bucket i
+// anything from 2^i to 2^(i+1) us, and the last one everything longer.
+//
+// Every core has its own counters, and every stage is recorded from one
+// place only (a task or an ISR), so each counter only ever has one writer
+// and needs no lock. Counters run from boot and are never reset; whoever
+// reads them takes the difference between two reads.
+
+#include <stdint.h>
+
+#define LATENCY_HIST_CORES 2
+#define LATENCY_HIST_BUCKETS 20
+
+enum latency_stage_e {
+    LATENCY_PARSE,
+    LATENCY_QUEUE,
+    LATENCY_DRAW,
+    LATENCY_WIRE,
+    LATENCY_TOTAL,
+    LATENCY_STAGES
+};
+
+struct latency_hist_s {
+    uint32_t count[LATENCY_HIST_CORES][LATENCY_STAGES][LATENCY_HIST_BUCKETS];
+};
+
+
+void latency_hist_init (
+    struct latency_hist_s * hist
+);
+
+
+// Counts a latency of us in stage. Cheap enough for an ISR.
+static inline void latency_hist_record (
+    struct latency_hist_s * hist,
+    int core,
+    enum latency_stage_e stage,
+    int64_t us
+)
+{
+    uint32_t bucket = 0;
+
+    if (us >= 2) {
+        bucket = 31 - __builtin_clz(us < UINT32_MAX ? (uint32_t)us : UINT32_MAX);
+        if (bucket >= LATENCY_HIST_BUCKETS) {
+            bucket = LATENCY_HIST_BUCKETS - 1;
+        }
+    }
+    hist->count[core][stage][bucket]++;
+}
+
+
+// Writes the histograms, summed over the cores, to buf as JSON:
+//
+//   {"parse":[12,40,...],"queue":[...],"draw":[...],"wire":[...],"total":[...]}
+//
+// with LATENCY_HIST_BUCKETS counts per stage. Returns the length, or 0 if it
+// doesn't fit in len bytes. LATENCY_HIST_JSON_LEN is always enough.
+#define LATENCY_HIST_JSON_LEN (LATENCY_STAGES * (12 + LATENCY_HIST_BUCKETS * 11) + 2)
+
+uint32_t latency_hist_json (
+    const struct latency_hist_s * hist,
+    char * buf,
+    uint32_t len
+);
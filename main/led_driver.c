@@ -0,0 +1,272 @@
+#include <string.h>
+#include "led_driver.h"
+
+// What the datasheets say. The SPI clocks are chosen so that a bit is 32 SPI
+// clocks long.
+static const struct led_driver_s led_driver_chipsets[LED_DRIVER_COUNT] = {
+    [LED_DRIVER_WS2811] = {
+        .type = LED_DRIVER_WS2811,
+        .name = "ws2811",
+        .channels = 3,
+        .order = { 0, 1, 2 },
+        .expand = true,
+        .t0h_ns = 500,
+        .t1h_ns = 1200,
+        .bit_ns = 2500,
+        .reset_us = 50,
+        .spi_clock_hz = 12800000,
+        .spi_mode = 1
+    },
+    [LED_DRIVER_WS2812] = {
+        .type = LED_DRIVER_WS2812,
+        .name = "ws2812",
+        .channels = 3,
+        .order = { 1, 0, 2 },
+        .expand = true,
+        .t0h_ns = 250,
+        .t1h_ns = 600,
+        .bit_ns = 1200,
+        .reset_us = 280,
+        .spi_clock_hz = 26666666,       // 80 MHz / 3, so that T0L stays under 1000 ns
+        .spi_mode = 1
+    },
+    [LED_DRIVER_SK6812_RGBW] = {
+        .type = LED_DRIVER_SK6812_RGBW,
+        .name = "sk6812-rgbw",
+        .channels = 4,
+        .order = { 1, 0, 2, 3 },
+        .expand = true,
+        .t0h_ns = 300,
+        .t1h_ns = 600,
+        .bit_ns = 1248,
+        .reset_us = 80,
+        .spi_clock_hz = 25641025,
+        .spi_mode = 1
+    },
+    [LED_DRIVER_APA102] = {
+        .type = LED_DRIVER_APA102,
+        .name = "apa102",
+        .channels = 3,
+        .order = { 2, 1, 0 },
+        .expand = false,
+        .spi_clock_hz = 8000000,
+        .spi_mode = 0
+    },
+};
+
+
+// A word that is high for the first high_ns of a bit.
+static void led_driver_word (
+    const struct led_driver_s * drv,
+    uint32_t high_ns,
+    uint8_t * word
+)
+{
+    uint32_t high = (high_ns * (uint64_t)drv->spi_clock_hz + 500000000) / 1000000000;
+    uint32_t bits = high >= 32 ? 0xffffffff : ~(0xffffffff >> high);
+
+    word[0] = bits >> 24;
+    word[1] = bits >> 16;
+    word[2] = bits >> 8;
+    word[3] = bits;
+}
+
+
+int led_driver_init (
+    struct led_driver_s * drv,
+    enum led_driver_type_e type,
+    const char * order
+)
+{
+    static const char channel_names[] = "rgbw";
+    const char * c;
+    uint8_t seen = 0;
+
+    if (type >= LED_DRIVER_COUNT) {
+        return -1;
+    }
+
+    *drv = led_driver_chipsets[type];
+
+    if (NULL != order) {
+        if (strlen(order) != drv->channels) {
+            return -1;
+        }
+        for (int i = 0; i < drv->channels; i++) {
+            c = memchr(channel_names, order[i], drv->channels);
+            if (NULL == c || (seen & (1 << (c - channel_names)))) {
+                return -1;
+            }
+            seen |= 1 << (c - channel_names);
+            drv->order[i] = c - channel_names;
+        }
+    }
+
+    led_driver_word(drv, drv->t0h_ns, drv->zero);
+    led_driver_word(drv, drv->t1h_ns, drv->one);
+
+    return 0;
+}
+
+
+static uint32_t led_driver_reset_len (
+    const struct led_driver_s * drv
+)
+{
+    return ((uint64_t)drv->reset_us * drv->spi_clock_hz + 7999999) / 8000000;
+}
+
+
+uint32_t led_driver_frame_len (
+    const struct led_driver_s * drv,
+    uint32_t num_pixels
+)
+{
+    if (drv->expand) {
+        return num_pixels * drv->channels * 8 * 4 + led_driver_reset_len(drv);
+    }
+
+    // APA102: a start frame, 4 bytes per pixel, and an end frame. The end
+    // frame has to be at least half a clock per pixel long, to push the data
+    // all the way down the strip, and is made of zeros so that SK9822 clones
+    // don't take it for another pixel.
+    return 4 + num_pixels * 4 + 4 + (num_pixels + 15) / 16;
+}
+
+
+uint32_t led_driver_frame_us (
+    const struct led_driver_s * drv,
+    uint32_t num_pixels
+)
+{
+    if (drv->expand) {
+        return ((uint64_t)num_pixels * drv->channels * 8 * drv->bit_ns + 999) / 1000 + drv->reset_us;
+    }
+
+    return ((uint64_t)led_driver_frame_len(drv, num_pixels) * 8000000 + drv->spi_clock_hz - 1) / drv->spi_clock_hz;
+}
+
+
+// Works out the channels of one pixel, in the order they go out.
+static inline void led_driver_pixel (
+    const struct led_driver_s * drv,
+    const uint8_t * rgb,
+    uint16_t scale,
+    uint8_t * out
+)
+{
+    uint8_t v[4];
+
+    v[0] = rgb[0];
+    v[1] = rgb[1];
+    v[2] = rgb[2];
+    v[3] = 0;
+
+    // What all three channels have in common goes to the white LED.
+    if (4 == drv->channels) {
+        v[3] = v[0] < v[1] ? v[0] : v[1];
+        v[3] = v[3] < v[2] ? v[3] : v[2];
+        v[0] -= v[3];
+        v[1] -= v[3];
+        v[2] -= v[3];
+    }
+
+    if (scale < 256) {
+        for (int c = 0; c < drv->channels; c++) {
+            v[c] = (v[c] * scale) >> 8;
+        }
+    }
+
+    for (int c = 0; c < drv->channels; c++) {
+        out[c] = v[drv->order[c]];
+    }
+}
+
+
+void led_driver_write_pixels (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    const uint8_t (* rgb)[3],
+    uint32_t first,
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    uint8_t * p;
+    uint8_t v[4];
+
+    if (!drv->expand) {
+        // After the start frame, 4 bytes per pixel.
+        p = out + 4 + first * 4;
+        for (uint32_t i = first; i < first + num_pixels; i++) {
+            led_driver_pixel(drv, rgb[i], scale, v);
+            *p++ = 0xff;    // full global brightness
+            for (int c = 0; c < drv->channels; c++) {
+                *p++ = v[c];
+            }
+        }
+        return;
+    }
+
+    p = out + first * drv->channels * 8 * 4;
+    for (uint32_t i = first; i < first + num_pixels; i++) {
+        led_driver_pixel(drv, rgb[i], scale, v);
+        for (int c = 0; c < drv->channels; c++) {
+            for (int bit = 7; bit >= 0; bit--) {
+                memcpy(p, (v[c] >> bit) & 1 ? drv->one : drv->zero, 4);
+                p += 4;
+            }
+        }
+    }
+}
+
+
+uint32_t led_driver_write_ends (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    uint32_t num_pixels
+)
+{
+    uint32_t len = led_driver_frame_len(drv, num_pixels);
+    uint32_t pixels_end;
+
+    if (drv->expand) {
+        pixels_end = num_pixels * drv->channels * 8 * 4;
+    } else {
+        memset(out, 0, 4);
+        pixels_end = 4 + num_pixels * 4;
+    }
+    memset(out + pixels_end, 0, len - pixels_end);
+
+    return len;
+}
+
+
+uint32_t led_driver_write (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    led_driver_write_pixels(drv, out, rgb, 0, num_pixels, scale);
+
+    return led_driver_write_ends(drv, out, num_pixels);
+}
+
+
+uint32_t led_driver_pack (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    for (uint32_t i = 0; i < num_pixels; i++) {
+        led_driver_pixel(drv, rgb[i], scale, &out[i * drv->channels]);
+    }
+
+    return num_pixels * drv->channels;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+// LED chipsets. A driver knows how a chipset wants its pixels: in which order
+// the channels go out, whether there is a white channel, what a bit looks
+// like on the wire, and how long the line has to rest before the LEDs latch.
+//
+// Chipsets with just a data line (WS2811, WS2812, SK6812) need their waveform
+// drawn out: every bit becomes one 32 bit SPI word, which is high for as long
+// as the bit should be high. Clocked chipsets (APA102) take the bytes as they
+// are, so their frames are 32 times smaller and go out much faster.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Enough for any chipset: 4 channels of 8 bits of 4 bytes per pixel, plus the
+// reset time at the end.
+#define LED_DRIVER_MAX_FRAME_LEN(num_pixels) (128 * (num_pixels) + 1024)
+
+enum led_driver_type_e {
+    LED_DRIVER_WS2811,          // in its 400 kHz mode; at 800 kHz, it's a WS2812
+    LED_DRIVER_WS2812,
+    LED_DRIVER_SK6812_RGBW,
+    LED_DRIVER_APA102,
+    LED_DRIVER_COUNT
+};
+
+struct led_driver_s {
+    enum led_driver_type_e type;
+    const char * name;
+
+    // Channels per pixel, 3 or 4 with white, and which of r, g, b, w (0..3)
+    // goes out first, second, and so on.
+    uint8_t channels;
+    uint8_t order[4];
+
+    // Whether every bit has to be drawn out as a waveform.
+    bool expand;
+
+    // How long a 0 bit and a 1 bit are high, and how long a bit is, in ns.
+    // Only for chipsets that are expanded.
+    uint16_t t0h_ns;
+    uint16_t t1h_ns;
+    uint16_t bit_ns;
+
+    // How long the data line has to stay low for the LEDs to latch a frame.
+    uint16_t reset_us;
+
+    uint32_t spi_clock_hz;
+    uint8_t spi_mode;
+
+    // The SPI words for a 0 and a 1 bit, in the order they go out. Filled in
+    // by led_driver_init.
+    uint8_t zero[4];
+    uint8_t one[4];
+};
+
+
+// Sets up drv for a chipset. order is the order the channels go out in, as
+// letters ("grb", "rgbw", ...), or NULL for what the datasheet says. Returns
+// -1 for an unknown chipset or an order that doesn't fit it.
+int led_driver_init (
+    struct led_driver_s * drv,
+    enum led_driver_type_e type,
+    const char * order
+);
+
+
+// How many bytes a frame of num_pixels takes on the wire.
+uint32_t led_driver_frame_len (
+    const struct led_driver_s * drv,
+    uint32_t num_pixels
+);
+
+
+// How long a frame of num_pixels takes to go out and latch, in us.
+uint32_t led_driver_frame_us (
+    const struct led_driver_s * drv,
+    uint32_t num_pixels
+);
+
+
+// Writes a frame of num_pixels r, g, b values to out, scaled by scale
+// (0..256, where 256 is full; see power_limit.h), and returns its length.
+// out must have room for led_driver_frame_len bytes.
+uint32_t led_driver_write (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+);
+
+
+// Writes pixels first .. first + num_pixels - 1 of rgb to where they go in
+// a frame that starts at out, leaving the rest of it alone. Together with
+// led_driver_write_ends, this lets a frame be written in pieces, by more
+// than one core at once.
+void led_driver_write_pixels (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    const uint8_t (* rgb)[3],
+    uint32_t first,
+    uint32_t num_pixels,
+    uint16_t scale
+);
+
+
+// Writes what goes around the pixels of a frame of num_pixels (start and
+// end frames, reset time) to out, and returns its length.
+uint32_t led_driver_write_ends (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    uint32_t num_pixels
+);
+
+
+// Like led_driver_write, but only puts the channels of each pixel in order,
+// without drawing out the bits, for outputs that do that themselves (see
+// led_rmt.h). Returns the length, num_pixels * channels.
+uint32_t led_driver_pack (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+);
@@ -0,0 +1,143 @@
+#include <string.h>
+#include "led_i2s.h"
+
+// How close high samples of bit_ns / samples each come to high_ns. Returns
+// how many, or 0 if none are close enough.
+static uint32_t led_i2s_high (
+    const struct led_driver_s * drv,
+    uint32_t samples,
+    uint32_t high_ns
+)
+{
+    uint32_t high = (high_ns * samples + drv->bit_ns / 2) / drv->bit_ns;
+    uint32_t error = high * drv->bit_ns > high_ns * samples ?
+        high * drv->bit_ns - high_ns * samples : high_ns * samples - high * drv->bit_ns;
+
+    return error > LED_I2S_TOLERANCE_NS * samples ? 0 : high;
+}
+
+
+int led_i2s_shape (
+    const struct led_driver_s * drv,
+    struct led_i2s_shape_s * shape
+)
+{
+    uint32_t high0, high1;
+
+    if (!drv->expand) {
+        return -1;
+    }
+
+    for (uint32_t samples = 3; samples <= LED_I2S_MAX_SAMPLES_PER_BIT; samples++) {
+        high0 = led_i2s_high(drv, samples, drv->t0h_ns);
+        high1 = led_i2s_high(drv, samples, drv->t1h_ns);
+        if (0 != high0 && high0 < high1 && high1 < samples) {
+            shape->samples = samples;
+            shape->high0 = high0;
+            shape->high1 = high1;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
+uint32_t led_i2s_clock_hz (
+    const struct led_driver_s * drv
+)
+{
+    struct led_i2s_shape_s shape;
+
+    if (0 != led_i2s_shape(drv, &shape)) {
+        return 0;
+    }
+
+    return (uint64_t)shape.samples * 1000000000 / drv->bit_ns;
+}
+
+
+static uint32_t led_i2s_reset_samples (
+    const struct led_driver_s * drv,
+    const struct led_i2s_shape_s * shape
+)
+{
+    return ((uint64_t)drv->reset_us * 1000 * shape->samples + drv->bit_ns - 1) / drv->bit_ns;
+}
+
+
+uint32_t led_i2s_frame_len (
+    const struct led_driver_s * drv,
+    uint32_t num_pixels,
+    uint32_t lanes
+)
+{
+    struct led_i2s_shape_s shape;
+    uint32_t segment_len = (num_pixels + lanes - 1) / lanes;
+    uint32_t samples;
+
+    if (0 != led_i2s_shape(drv, &shape)) {
+        return 0;
+    }
+    samples = segment_len * drv->channels * 8 * shape.samples + led_i2s_reset_samples(drv, &shape);
+
+    return samples * (lanes / 8);
+}
+
+
+uint32_t led_i2s_write (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    const uint8_t * frame,
+    uint32_t num_pixels,
+    uint32_t lanes
+)
+{
+    struct led_i2s_shape_s shape;
+    uint32_t segment_len = (num_pixels + lanes - 1) / lanes;
+    uint32_t width = lanes / 8;
+    uint32_t pixel;
+    uint8_t lane[16];
+    uint64_t bits[2] = {0};
+    uint8_t * p = out;
+    uint32_t len;
+
+    if (0 != led_i2s_shape(drv, &shape)) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < segment_len; i++) {
+        for (int c = 0; c < drv->channels; c++) {
+
+            // The byte of this channel of pixel i of every segment. Short
+            // segments are padded with black.
+            for (uint32_t k = 0; k < lanes; k++) {
+                pixel = k * segment_len + i;
+                lane[k] = pixel < num_pixels ? frame[pixel * drv->channels + c] : 0;
+            }
+
+            bits[0] = led_i2s_transpose8(&lane[0]);
+            if (2 == width) {
+                bits[1] = led_i2s_transpose8(&lane[8]);
+            }
+
+            for (int b = 7; b >= 0; b--) {
+                memset(p, 0xff, shape.high0 * width);
+                p += shape.high0 * width;
+                for (uint32_t n = shape.high0; n < shape.high1; n++) {
+                    *p++ = bits[0] >> (8 * b);
+                    if (2 == width) {
+                        *p++ = bits[1] >> (8 * b);
+                    }
+                }
+                memset(p, 0, (shape.samples - shape.high1) * width);
+                p += (shape.samples - shape.high1) * width;
+            }
+        }
+    }
+
+    len = led_i2s_frame_len(drv, num_pixels, lanes);
+    memset(p, 0, len - (p - out));
+
+    return len;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+// Frames for the I2S peripheral in parallel (LCD) mode, which drives 8 or 16
+// data pins at once, one strip on each. The frame is split into as many
+// segments as there are lanes: lane k gets pixels k * len .. (k + 1) * len
+// - 1, where len is the number of pixels divided by the lanes, rounded up.
+//
+// Every sample of the bus carries one bit for each lane, so the bits of the
+// lanes have to be transposed: the 8 bytes going out at the same time, one
+// per lane, become 8 samples with one bit of each. Like the SPI output, a bit
+// is drawn out as a waveform (see led_i2s_shape_s): a few samples that are
+// high, then ones that carry the data bit, then low ones.
+//
+// How many samples a bit takes depends on the chipset: the fewest that get
+// both high times within LED_I2S_TOLERANCE_NS of the driver's t0h_ns and
+// t1h_ns. That's 4 for WS2812 and SK6812, and 10 for WS2811. A chipset
+// that can't be met in LED_I2S_MAX_SAMPLES_PER_BIT has no shape, and can't
+// be driven over I2S.
+
+#include <stdint.h>
+#include "led_driver.h"
+
+#define LED_I2S_MAX_SAMPLES_PER_BIT 16
+
+// Half the +-150 ns most datasheets allow, so that the sample clock itself
+// can be off by a little.
+#define LED_I2S_TOLERANCE_NS 75
+
+// A bit is samples long: the first high0 are high, the ones up to high1 are
+// the data bit, and the rest are low. 1 <= high0 < high1 < samples.
+struct led_i2s_shape_s {
+    uint8_t samples;
+    uint8_t high0;
+    uint8_t high1;
+};
+
+
+// Works out the shape of a bit for a chipset. Returns -1 if there is none.
+int led_i2s_shape (
+    const struct led_driver_s * drv,
+    struct led_i2s_shape_s * shape
+);
+
+
+// The sample rate for a chipset, 0 if it has no shape.
+uint32_t led_i2s_clock_hz (
+    const struct led_driver_s * drv
+);
+
+
+// How many bytes a frame of num_pixels takes, over lanes (8 or 16) lanes,
+// including the reset time at the end. The chipset needs a shape.
+uint32_t led_i2s_frame_len (
+    const struct led_driver_s * drv,
+    uint32_t num_pixels,
+    uint32_t lanes
+);
+
+
+// Writes out the samples for a frame of num_pixels, as it comes out of
+// led_driver_pack, and returns the length. Samples of 16 lanes are written
+// as little-endian uint16_t.
+uint32_t led_i2s_write (
+    const struct led_driver_s * drv,
+    uint8_t * out,
+    const uint8_t * frame,
+    uint32_t num_pixels,
+    uint32_t lanes
+);
+
+
+// Transposes 8 bytes, one per lane, into 8 samples, most significant bit
+// first: bit k of sample j is bit 7 - j of lane k. This is the inner loop
+// of led_i2s_write.
+static inline uint64_t led_i2s_transpose8 (
+    const uint8_t * lane
+)
+{
+    uint64_t x = 0;
+    uint64_t t;
+
+    // Byte k is lane k, so bit 8k + b is bit b of lane k...
+    for (int k = 0; k < 8; k++) {
+        x |= (uint64_t)lane[k] << (8 * k);
+    }
+
+    // ...and after this, bit 8b + k is. Swaps 1x1, 2x2 and then 4x4 blocks.
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    x ^= t ^ (t << 28);
+
+    // Byte b holds bit b of every lane. Samples start with bit 7.
+    return x;
+}
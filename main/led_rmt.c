@@ -0,0 +1,80 @@
+#include "led_rmt.h"
+
+// The largest duration an item can hold.
+#define LED_RMT_MAX_TICKS 32767
+
+static uint32_t led_rmt_item (
+    uint32_t level0,
+    uint32_t duration0,
+    uint32_t level1,
+    uint32_t duration1
+)
+{
+    return duration0 | (level0 << 15) | (duration1 << 16) | (level1 << 31);
+}
+
+
+int led_rmt_init (
+    struct led_rmt_s * rmt,
+    const struct led_driver_s * drv,
+    uint32_t tick_ns
+)
+{
+    uint32_t t0h = (drv->t0h_ns + tick_ns / 2) / tick_ns;
+    uint32_t t1h = (drv->t1h_ns + tick_ns / 2) / tick_ns;
+    uint32_t bit = (drv->bit_ns + tick_ns / 2) / tick_ns;
+    uint32_t reset = ((uint32_t)drv->reset_us * 1000 + tick_ns - 1) / tick_ns;
+
+    if (!drv->expand || 0 == t0h || t0h >= bit || t1h >= bit || bit > LED_RMT_MAX_TICKS) {
+        return -1;
+    }
+    if (reset < 2 || reset > 2 * LED_RMT_MAX_TICKS) {
+        return -1;
+    }
+
+    rmt->zero = led_rmt_item(1, t0h, 0, bit - t0h);
+    rmt->one = led_rmt_item(1, t1h, 0, bit - t1h);
+
+    // A duration of 0 would end the transmission, so the reset is split in
+    // two halves that are both low.
+    rmt->reset = led_rmt_item(0, reset - reset / 2, 0, reset / 2);
+
+    rmt->frame = NULL;
+    rmt->frame_len = 0;
+
+    return 0;
+}
+
+
+void led_rmt_translate (
+    const struct led_rmt_s * rmt,
+    const uint8_t * src,
+    uint32_t * dest,
+    size_t src_size,
+    size_t wanted_num,
+    size_t * translated_size,
+    size_t * item_num
+)
+{
+    const uint8_t * end = rmt->frame + rmt->frame_len;
+    size_t size = 0;
+    size_t num = 0;
+    uint8_t b;
+
+    while (size < src_size && num + 8 <= wanted_num) {
+        if (src + size >= end) {
+            dest[num++] = rmt->reset;
+            size++;
+            continue;
+        }
+
+        b = src[size];
+        for (int bit = 7; bit >= 0; bit--) {
+            dest[num++] = (b >> bit) & 1 ? rmt->one : rmt->zero;
+        }
+        size++;
+    }
+
+    *translated_size = size;
+    *item_num = num;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// Drawing out the bits of a frame for the RMT peripheral, as an alternative
+// to the SPI words of led_driver_write. The RMT driver calls a translator
+// while it sends, a few bytes at a time, to turn bytes into RMT items (a
+// high and a low time each), so the frame never has to be expanded in
+// memory: it's led_driver_pack bytes in, one item per bit out.
+//
+// The frame is followed by one byte more than its length, which the
+// translator turns into the reset time, holding the line low.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "led_driver.h"
+
+struct led_rmt_s {
+    // The items for a 0 bit, a 1 bit, and for the reset time, laid out
+    // like rmt_item32_t.
+    uint32_t zero;
+    uint32_t one;
+    uint32_t reset;
+
+    // The frame being sent. Set these before handing it to the RMT driver.
+    const uint8_t * frame;
+    uint32_t frame_len;
+};
+
+
+// Sets up rmt for a chipset, with an RMT tick of tick_ns. Returns -1 if the
+// chipset isn't a single wire one, or its timing doesn't fit in an item.
+int led_rmt_init (
+    struct led_rmt_s * rmt,
+    const struct led_driver_s * drv,
+    uint32_t tick_ns
+);
+
+
+// Turns bytes from src into at most wanted_num items in dest, as the RMT
+// driver's translator (sample_to_rmt_t) does.
+void led_rmt_translate (
+    const struct led_rmt_s * rmt,
+    const uint8_t * src,
+    uint32_t * dest,
+    size_t src_size,
+    size_t wanted_num,
+    size_t * translated_size,
+    size_t * item_num
+);
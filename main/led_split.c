@@ -0,0 +1,77 @@
+#include "led_split.h"
+
+int led_split_load (
+    struct led_split_s * split,
+    uint32_t num_pixels,
+    const uint8_t * data,
+    uint32_t data_len
+)
+{
+    uint16_t end[LED_SPLIT_SEGMENTS];
+
+    if (data_len != (LED_SPLIT_SEGMENTS - 1) * 2 && data_len != (LED_SPLIT_SEGMENTS - 1) * 2 + LED_SPLIT_SEGMENTS) {
+        return -1;
+    }
+
+    for (int i = 0; i < LED_SPLIT_SEGMENTS - 1; i++) {
+        end[i] = data[i*2] | (data[i*2 + 1] << 8);
+        if (end[i] > num_pixels || (i > 0 && end[i] < end[i - 1])) {
+            return -1;
+        }
+    }
+    end[LED_SPLIT_SEGMENTS - 1] = num_pixels;
+
+    for (int i = 0; i < LED_SPLIT_SEGMENTS; i++) {
+        split->end[i] = end[i];
+    }
+    if (data_len > (LED_SPLIT_SEGMENTS - 1) * 2) {
+        for (int i = 0; i < LED_SPLIT_SEGMENTS; i++) {
+            split->pin[i] = data[(LED_SPLIT_SEGMENTS - 1) * 2 + i];
+        }
+    }
+
+    return 0;
+}
+
+
+uint32_t led_split_count (
+    const struct led_split_s * split
+)
+{
+    uint32_t first = 0;
+    uint32_t count = 0;
+
+    for (int i = 0; i < LED_SPLIT_SEGMENTS; i++) {
+        if (split->end[i] > first) {
+            count++;
+        }
+        first = split->end[i];
+    }
+
+    return count;
+}
+
+
+void led_split_send (
+    const struct led_split_s * split,
+    const struct led_split_ops_s * ops,
+    void * ctx
+)
+{
+    uint32_t first = 0;
+
+    for (int i = 0; i < LED_SPLIT_SEGMENTS; i++) {
+        if (split->end[i] > first) {
+            ops->prepare(ctx, i, first, split->end[i] - first);
+        }
+        first = split->end[i];
+    }
+
+    first = 0;
+    for (int i = 0; i < LED_SPLIT_SEGMENTS; i++) {
+        if (split->end[i] > first) {
+            ops->start(ctx, i);
+        }
+        first = split->end[i];
+    }
+}
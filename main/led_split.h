@@ -0,0 +1,61 @@
+#pragma once
+
+// Splitting the strip into segments that go out on separate peripherals at
+// the same time (SPI2, SPI3 and RMT, see matrix.c), so that a frame takes as
+// long as its longest segment instead of all of them together.
+//
+// Each segment is a range of wire indexes, so the pixel map decides which
+// pixels of the frame end up where. For the segments to start together, all
+// of them are prepared before any of them is started: starting is then just
+// a few register writes per peripheral. They all end with the chipset's
+// reset time, so the frame latches once the longest segment is done.
+
+#include <stdint.h>
+
+#define LED_SPLIT_SEGMENTS 3
+
+struct led_split_s {
+    // Segment i is wire indexes end[i - 1] .. end[i] - 1, where end[-1] is
+    // 0, and may be empty. The last one always ends at the end of the strip.
+    uint16_t end[LED_SPLIT_SEGMENTS];
+
+    // The data pin of each segment.
+    uint8_t pin[LED_SPLIT_SEGMENTS];
+};
+
+// How the segments are sent, see led_split_send.
+struct led_split_ops_s {
+    // Gets len pixels starting at wire index first ready to go out as
+    // segment i.
+    void (* prepare)(void * ctx, int i, uint32_t first, uint32_t len);
+
+    // Starts sending segment i.
+    void (* start)(void * ctx, int i);
+};
+
+
+// Loads a split of num_pixels pixels from data, which is the end of the
+// first LED_SPLIT_SEGMENTS - 1 segments as little-endian uint16_t,
+// optionally followed by a data pin for every segment. Returns -1, leaving
+// split as it was, if the segments are out of order or past the end.
+int led_split_load (
+    struct led_split_s * split,
+    uint32_t num_pixels,
+    const uint8_t * data,
+    uint32_t data_len
+);
+
+
+// Returns how many segments aren't empty, which is how many led_split_send
+// starts.
+uint32_t led_split_count (
+    const struct led_split_s * split
+);
+
+
+// Prepares every non-empty segment, and then starts them all.
+void led_split_send (
+    const struct led_split_s * split,
+    const struct led_split_ops_s * ops,
+    void * ctx
+);
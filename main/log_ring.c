@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+#include "log_ring.h"
+
+// A bounded multi-producer queue: entries[i].seq is the head a writer has
+// to see to claim slot i, and head + 1 once the slot is filled, which is
+// what the reader waits for. The reader then hands the slot to the next
+// round with tail + LOG_RING_LEN. Writers only ever race on the
+// compare-and-swap of head.
+
+void log_ring_init (
+    struct log_ring_s * ring
+)
+{
+    memset(ring, 0, sizeof(*ring));
+    for (uint32_t i = 0; i < LOG_RING_LEN; i++) {
+        ring->entries[i].seq = i;
+    }
+}
+
+
+bool log_ring_write (
+    struct log_ring_s * ring,
+    struct log_site_s * site,
+    uint32_t now_ms,
+    char level,
+    const char * tag,
+    const char * fmt,
+    const int args[LOG_RING_ARGS]
+)
+{
+    struct log_entry_s * e;
+    uint32_t pos, seq;
+
+    if (now_ms - site->window_ms >= 1000) {
+        site->window_ms = now_ms;
+        site->count = 0;
+    }
+    if (site->count >= site->per_s) {
+        site->dropped++;
+        __atomic_fetch_add(&ring->limited, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    while (1) {
+        e = &ring->entries[pos & (LOG_RING_LEN - 1)];
+        seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        } else if ((int32_t)(seq - pos) < 0) {
+            // Still holds a line from the last round.
+            site->dropped++;
+            __atomic_fetch_add(&ring->full, 1, __ATOMIC_RELAXED);
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    site->count++;
+    e->level = level;
+    e->tag = tag;
+    e->fmt = fmt;
+    memcpy(e->args, args, sizeof(e->args));
+    e->dropped = site->dropped;
+    site->dropped = 0;
+    __atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+
+bool log_ring_read (
+    struct log_ring_s * ring,
+    struct log_entry_s * entry
+)
+{
+    struct log_entry_s * e = &ring->entries[ring->tail & (LOG_RING_LEN - 1)];
+
+    if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != ring->tail + 1) {
+        return false;
+    }
+    *entry = *e;
+    __atomic_store_n(&e->seq, ring->tail + LOG_RING_LEN, __ATOMIC_RELEASE);
+    ring->tail++;
+
+    return true;
+}
+
+
+uint32_t log_ring_format (
+    const struct log_entry_s * entry,
+    char * buf,
+    uint32_t len
+)
+{
+    int n;
+
+    if (0 == len) {
+        return 0;
+    }
+
+    n = snprintf(buf, len, entry->fmt, entry->args[0], entry->args[1], entry->args[2], entry->args[3]);
+    if (n >= 0 && (uint32_t)n < len && 0 != entry->dropped) {
+        n += snprintf(buf + n, len - n, " (%u more dropped)", entry->dropped);
+    }
+    if (n < 0) {
+        buf[0] = '\0';
+        return 0;
+    }
+
+    return (uint32_t)n < len ? (uint32_t)n : len - 1;
+}
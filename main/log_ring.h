@@ -0,0 +1,97 @@
+#pragma once
+
+// Deferred logging for the hot paths. A log call only stores its format
+// string and arguments in a lock-free ring; a low-priority task formats
+// them and writes them out later, so led_task never waits on the UART.
+//
+// Every call site has a rate limit, and lines over it are counted instead
+// of stored. The next line from the same site says how many were dropped,
+// and so does the ring, see log_ring_s.
+//
+// Formats and tags have to be string constants, and every conversion has
+// to take an int (%d, %u, %x, %c): strings and wider types can't be
+// deferred.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A power of two.
+#define LOG_RING_LEN 64
+
+#define LOG_RING_ARGS 4
+
+// What log_ring_format needs at most, without the dropped count.
+#define LOG_RING_LINE_LEN 160
+
+struct log_entry_s {
+    // Which round of the ring this slot is ready for, see log_ring.c.
+    uint32_t seq;
+
+    char level;         // 'E', 'W' or 'I'
+    const char * tag;
+    const char * fmt;
+    int args[LOG_RING_ARGS];
+
+    // Lines from the same site that were dropped before this one.
+    uint32_t dropped;
+};
+
+// A call site. Belongs to one task, see LOG_SITE.
+struct log_site_s {
+    uint32_t per_s;     // most lines per second
+    uint32_t window_ms;
+    uint32_t count;
+    uint32_t dropped;   // since the last line that went through
+};
+
+#define LOG_SITE(lines_per_s) { .per_s = (lines_per_s) }
+
+struct log_ring_s {
+    struct log_entry_s entries[LOG_RING_LEN];
+    uint32_t head;      // any writer
+    uint32_t tail;      // the reader
+
+    // Lines that were over their site's limit, and lines that didn't fit.
+    // Run from boot.
+    uint32_t limited;
+    uint32_t full;
+};
+
+
+void log_ring_init (
+    struct log_ring_s * ring
+);
+
+
+// Stores a line, unless site is over its limit at now_ms or the ring is
+// full. Safe from any task or ISR on either core, as long as each site is
+// only used by one of them. Returns whether the line was stored.
+bool log_ring_write (
+    struct log_ring_s * ring,
+    struct log_site_s * site,
+    uint32_t now_ms,
+    char level,
+    const char * tag,
+    const char * fmt,
+    const int args[LOG_RING_ARGS]
+);
+
+#define log_ring_printf(ring, site, now_ms, level, tag, fmt, ...) \
+    log_ring_write((ring), (site), (now_ms), (level), (tag), (fmt), (const int[LOG_RING_ARGS]){ __VA_ARGS__ })
+
+
+// Takes the oldest line out of the ring. Only one task may read. Returns
+// false if there's none.
+bool log_ring_read (
+    struct log_ring_s * ring,
+    struct log_entry_s * entry
+);
+
+
+// Formats entry into buf, with the dropped count at the end. Returns the
+// length, cut to fit in len bytes.
+uint32_t log_ring_format (
+    const struct log_entry_s * entry,
+    char * buf,
+    uint32_t len
+);
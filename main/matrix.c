@@ -8,11 +8,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/event_groups.h"
 #include "driver/gpio.h"
 #include "driver/rmt.h"
@@ -22,8 +24,11 @@
 #include "esp_attr.h"
 #include "esp_sleep.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "esp_sntp.h"
 #include "nvs_flash.h"
+#include "nvs.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
 #include "lwip/sockets.h"
@@ -33,6 +38,28 @@
 // spi
 #include <hal/spi_types.h>
 #include <driver/spi_master.h>
+#include "esp_lcd_panel_io.h"
+
+#include "matrix.h"
+#include "shader_vm.h"
+#include "pixel_map.h"
+#include "color_lut.h"
+#include "matrix_encode.h"
+#include "power_limit.h"
+#include "color_cal.h"
+#include "led_driver.h"
+#include "led_rmt.h"
+#include "led_i2s.h"
+#include "led_split.h"
+#include "frame_skip.h"
+#include "frame_prefix.h"
+#include "frame_cache.h"
+#include "frame_clock.h"
+#include "latency_hist.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "log_ring.h"
+#include "task_stats.h"
 
 spi_device_handle_t spi;
 
@@ -40,53 +67,208 @@ spi_device_handle_t spi;
 #define GPIO_PIN_SEL (1ULL << GPIO_PIN)
 #define RMT_CHANNEL 2
 #define RMT_CLOCK_DIV 4
+#define RMT_TICK_NS (RMT_CLOCK_DIV * 1000 / 80) // of the 80 MHz APB clock
+#define RMT_MEM_BLOCKS 4 // channels 2 to 5 are free, so use their memory too
 #define SPI_CHANNEL 1
 #define SPI_CHANNEL_1_MOSI 12
 #define SPI_CHANNEL_1_SCLK 14
 
-// For these, one tick is 50ns.
-#define RMT_TICKS_BIT_1_HIGH_WS2812 12 // 12*50ns = 600 ns
-#define RMT_TICKS_BIT_1_LOW_WS2812  13 // 12*50ns = 650 ns
-#define RMT_TICKS_BIT_0_HIGH_WS2812 5 // 12*50ns = 250 ns
-#define RMT_TICKS_BIT_0_LOW_WS2812  20 // 20*50ns = 1000 ns
-#define RMT_TICKS_RESET 510 // This isn't used now... i'm not sure what this value should be.
+// The I2S output drives one strip per data pin, lane 0 on the same pin as
+// SPI and RMT. The peripheral also wants a clock (WR) and a DC pin, which
+// the strips don't use.
+#define I2S_LANES 8
+#define I2S_DATA_PINS { SPI_CHANNEL_1_MOSI, 13, 15, 18, 19, 21, 22, 23 }
+#define I2S_WR_PIN SPI_CHANNEL_1_SCLK
+#define I2S_DC_PIN 4
+
+// Until told otherwise (matrix1.ctl.split), the split output sends the
+// first third of the strip on SPI2, the second on SPI3 and the rest on RMT.
+#define SPLIT_PINS { SPI_CHANNEL_1_MOSI, 23, 27 }
+
+// Frames of at least this many pixels are encoded by both cores, with
+// encode_task, on core 0, taking ENCODE_SHARD_CORE0_SHARE 256ths of the
+// strip. Core 0 also has wifi and nats_task to take care of, so that's a
+// bit less than half.
+#define ENCODE_SHARD_MIN_PIXELS 256
+#define ENCODE_SHARD_CORE0_SHARE 112
 
 // This can be set pretty low, I don't remember what the exact number should
-// be, check ws2811 datasheet.
+// be, check ws2811 datasheet. With the refresh clock running
+// (matrix1.ctl.refresh), its rate is used instead.
 #define LED_STRIP_REFRESH_PERIOD_MS (30U) 
 
+// 16 bit frames are dithered, which only works if they're refreshed much
+// faster than that. 49 pixels take about 1.5 ms to send.
+#define DITHER_REFRESH_PERIOD_MS (1U)
+
+// How often to log how much the power limit had to step in, and add it to
+// the telemetry, and how many frames were skipped (see frame_skip.h).
+#define POWER_LIMIT_REPORT_PERIOD_MS (10000U)
+
+// Where color calibration is kept across reboots, in the format
+// color_cal_load takes.
+#define COLOR_CAL_NVS_NAMESPACE "matrix"
+#define COLOR_CAL_NVS_KEY "cal"
+
 #define WIFI_CONNECTED_BIT BIT0
 #define NATS_CONNECTED_BIT BIT1
 #define TIME_SYNC_BIT BIT2
 
-#define NUM_PIXELS 49
-
 #define NATS_HOST "192.168.4.1"
 #define NATS_PORT "4222"
 #define NATS_BUF_LEN 512
 
+// Messages on any subject other than matrix1.in are collected into a buffer
+// of this size before they're handled. Longer payloads are dropped.
+#define NATS_SUBJECT_LEN 32
+#define NATS_PAYLOAD_LEN 1024
+
+// How many instructions the shader VM may run per frame, at most. This keeps
+// a heavy shader from starving led_task.
+#define SHADER_VM_FRAME_BUDGET (32 * 1024)
+
+// Reads time out after NATS_READ_TIMEOUT_MS, so that stats still go out
+// when nothing comes in (see nats_publish_stats).
+#define NATS_READ_TIMEOUT_MS (1000U)
+#define NATS_PUB_LEN (LATENCY_HIST_JSON_LEN + TELEMETRY_JSON_LEN + TASK_STATS_JSON_LEN + 3 * (NATS_SUBJECT_LEN + 32))
+#define NATS_STATS_JSON_LEN (TASK_STATS_JSON_LEN > TELEMETRY_JSON_LEN ? \
+        (TASK_STATS_JSON_LEN > LATENCY_HIST_JSON_LEN ? TASK_STATS_JSON_LEN : LATENCY_HIST_JSON_LEN) : \
+        (TELEMETRY_JSON_LEN > LATENCY_HIST_JSON_LEN ? TELEMETRY_JSON_LEN : LATENCY_HIST_JSON_LEN))
+#define NATS_PUB_TRACE_LEN "8204"   // sizeof(struct trace_s)
+
 static EventGroupHandle_t s_wifi_event_group;
 static QueueHandle_t event_queue;
+static QueueHandle_t control_queue;
+
+struct display_event_s {
+    struct timespec tv;
+
+    // When read() returned the start of the message, and when it was
+    // queued, in esp_timer_get_time() us. See latency_hist.h.
+    int64_t read_us;
+    int64_t queued_us;
 
-uint32_t one  = SPI_SWAP_DATA_TX(0b11111111111111100000000000000000, 32);
-uint32_t zero = SPI_SWAP_DATA_TX(0b11111100000000000000000000000000, 32);
-//uint32_t one  = SPI_SWAP_DATA_TX(0b11101010101010101010101010101010, 32);
-//uint32_t zero = SPI_SWAP_DATA_TX(0b11110000111100001111000011110000, 32);
+    // Numbers frames for trace.h.
+    uint16_t seq;
+
+    // Set for frames from matrix1.frame16, which have 16 bits per channel.
+    bool wide;
+    union {
+        struct matrix_rgb_s display_buf[NUM_PIXELS];
+        struct matrix_rgb16_s display_buf16[NUM_PIXELS];
+    };
+};
 
-struct matrix_rgb_s {
-    uint8_t r;
-    uint8_t g;
-    uint8_t b;
+enum control_type_e {
+    CONTROL_SHADER_LOAD,
+    CONTROL_SHADER_CLEAR,
+    CONTROL_MAP_LAYOUT,
+    CONTROL_MAP_TABLE,
+    CONTROL_GAMMA,
+    CONTROL_BRIGHTNESS,
+    CONTROL_POWER,
+    CONTROL_CAL,
+    CONTROL_DRIVER,
+    CONTROL_OUTPUT,
+    CONTROL_SPLIT,
+    CONTROL_SKIP,
+    CONTROL_PREFIX,
+    CONTROL_CACHE,
+    CONTROL_REFRESH
+};
 
+// Control messages go from nats_task to led_task through control_queue, so
+// that everything the led task uses is only ever touched by the led task.
+struct control_event_s {
+    enum control_type_e type;
+    uint16_t len;
+    uint8_t data[NATS_PAYLOAD_LEN];
 };
 
+// Words rather than bytes, since SPI DMA wants the buffer 32 bit aligned.
+uint32_t rmt_items[LED_DRIVER_MAX_FRAME_LEN(NUM_PIXELS) / 4] = {0};
+static spi_transaction_t spi_trans;
+static bool spi_trans_pending = false;
+static bool rmt_trans_pending = false;
+static struct led_driver_s led_driver;
+static struct led_rmt_s led_rmt;
+static esp_lcd_i80_bus_handle_t i2s_bus;
+static esp_lcd_panel_io_handle_t i2s_io;
+static SemaphoreHandle_t i2s_done;
+static bool i2s_trans_pending = false;
+static struct led_split_s led_split = {
+    .end = { NUM_PIXELS / 3, NUM_PIXELS * 2 / 3, NUM_PIXELS },
+    .pin = SPLIT_PINS
+};
+static spi_device_handle_t spi3;
+static spi_transaction_t spi3_trans;
+static uint32_t split_items[LED_DRIVER_MAX_FRAME_LEN(NUM_PIXELS) / 4];
+static uint8_t split_rmt_frame[NUM_PIXELS * 4 + 1];
+static uint8_t split_pending = 0;
 
-struct display_event_s {
-    struct timespec tv;
-    struct matrix_rgb_s display_buf[NUM_PIXELS];
+// A piece of work for encode_task, see matrix_shard_run.
+struct matrix_shard_s {
+    void (* fn)(void * arg, uint32_t first, uint32_t len);
+    void * arg;
+    uint32_t first;
+    uint32_t len;
 };
+static struct matrix_shard_s encode_shard;
+static TaskHandle_t led_task_handle = NULL;
+static TaskHandle_t encode_task_handle = NULL;
+static TaskHandle_t log_task_handle = NULL;
+
+static uint8_t nats_payload[NATS_PAYLOAD_LEN];
+static struct control_event_s nats_control_event;
+static int64_t nats_msg_read_us;
+static bool nats_trace_requested = false;
+
+// Shared by nats_task, led_task and the transfer done ISRs, see
+// latency_hist.h and telemetry.h for how that works without a lock.
+static struct latency_hist_s latency_hist;
+static struct telemetry_s telemetry;
 
-uint32_t rmt_items[24*NUM_PIXELS] = {0};
+// Only nats_task touches this.
+static struct task_stats_s task_stats;
+
+// Isn't cleared by a reset, so that what led up to a crash can be
+// published once the wall is back, see app_main.
+static __NOINIT_ATTR struct trace_s trace;
+_Static_assert(8204 == sizeof(struct trace_s), "NATS_PUB_TRACE_LEN is out of date");
+static bool trace_crashed = false;
+
+// What the hot paths log, for log_task to write out. MATRIX_LOG stores a
+// line unless the place it's called from logged more than per_s lines in
+// the last second, see log_ring.h for what formats can take.
+static struct log_ring_s log_ring;
+
+#define MATRIX_LOG(level, per_s, tag, fmt, ...) do { \
+    static struct log_site_s log_site = LOG_SITE(per_s); \
+    log_ring_printf(&log_ring, &log_site, esp_timer_get_time() / 1000, (level), (tag), (fmt), __VA_ARGS__); \
+} while (0)
+
+// For errors that can come in bursts, like one per frame or per byte.
+#define MATRIX_LOG_ERRORS_PER_S 5
+
+#define LOG_DRAIN_PERIOD_MS 50
+
+// Times the frames from event_queue on their way to the strip, for the
+// stages of latency_hist and the trace that led_task and the ISRs record.
+struct matrix_latency_s {
+    // The frame led_task is about to send. dequeued_us is 0 for redraws.
+    // Only led_task touches these.
+    int64_t read_us;
+    int64_t dequeued_us;
+    uint16_t seq;
+
+    // The frame going out. Only matrix_latency_sent sets these, when
+    // nothing is going out.
+    int64_t sent_read_us;
+    int64_t sent_us;        // 0 once the transfer is done
+    uint16_t sent_seq;      // TRACE_NO_FRAME for redraws
+    uint32_t pending;       // transfers still going out
+};
+static volatile struct matrix_latency_s matrix_latency;
 
 
 void time_sync_notification_cb(struct timeval *tv)
@@ -108,6 +290,7 @@ static void event_handler (
         esp_wifi_connect();
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
         esp_wifi_connect();
+        telemetry.wifi_reconnects++;
         xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
         ESP_LOGI("H", "retry to connect to the AP");
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
@@ -156,69 +339,1227 @@ static void wifi_init_sta (
     ESP_LOGI("H", "wifi_init_sta finished.");
 }
 
-// This function takes an rgb display buffer and draws it on the display
-// using an rmt channel.
-static void matrix_display_draw_rgb (
+// Called right before anything starts going out.
+static void matrix_latency_sent (
+    void
+)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    if (0 != matrix_latency.dequeued_us) {
+        latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_DRAW, now_us - matrix_latency.dequeued_us);
+        matrix_latency.dequeued_us = 0;
+        matrix_latency.sent_read_us = matrix_latency.read_us;
+        matrix_latency.sent_seq = matrix_latency.seq;
+    } else {
+        matrix_latency.sent_seq = TRACE_NO_FRAME;
+    }
+    trace_record(&trace, TRACE_SENT, xPortGetCoreID(), now_us, matrix_latency.sent_seq);
+    matrix_latency.pending = 1;
+    matrix_latency.sent_us = now_us;
+}
+
+
+// Called from the ISR of every transfer that finishes, and for every one
+// that couldn't be started. The frame is on the strip once the last of its
+// transfers is.
+static void IRAM_ATTR matrix_latency_done (
+    void
+)
+{
+    int64_t now_us;
+
+    // Atomic, since the ISRs of the segments of a split frame can run on
+    // either core.
+    if (0 == matrix_latency.sent_us || 0 != __atomic_sub_fetch(&matrix_latency.pending, 1, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    now_us = esp_timer_get_time();
+    trace_record(&trace, TRACE_DONE, xPortGetCoreID(), now_us, matrix_latency.sent_seq);
+    if (TRACE_NO_FRAME != matrix_latency.sent_seq) {
+        latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_WIRE, now_us - matrix_latency.sent_us);
+        latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_TOTAL, now_us - matrix_latency.sent_read_us);
+    }
+    matrix_latency.sent_us = 0;
+}
+
+
+// The strip can be driven by SPI or by the RMT peripheral, on the same pin,
+// or split over several strips by I2S. They all do the same thing behind
+// this interface, so they can be swapped at runtime (matrix1.ctl.output)
+// and compared.
+struct matrix_output_s {
+    const char * name;
+
+    // Whether the strip goes out as one chain, front to back, so that the
+    // end of it can be left out when it didn't change (see frame_prefix.h).
+    bool chain;
+
+    // Returns -1 if the output can't drive the chipset.
+    int (* check)(const struct led_driver_s * driver);
+
+    // Takes over the pin and sets up the peripheral for led_driver.
+    esp_err_t (* open)(void);
+
+    // Lets go of the pin again.
+    void (* close)(void);
+
+    // Waits until the frame being sent, if any, is out, so that items can
+    // be written to again.
+    void (* wait)(void);
+
+    // Sends the r, g, b of num_pixels pixels from items, where it may also
+    // put what it needs for that. rgb is NULL if write has already put every
+    // pixel in items.
+    esp_err_t (* send)(uint32_t * items, const uint8_t (* rgb)[3], uint32_t num_pixels, uint16_t scale);
+
+    // Optional. Writes pixels first .. first + len - 1 into items the way
+    // send would, so that both cores can share the work (see
+    // matrix_shard_run).
+    void (* write)(uint32_t * items, const uint8_t (* rgb)[3], uint32_t first, uint32_t len, uint16_t scale);
+
+    // Optional. Sends len bytes of a frame that send put in items earlier,
+    // from wherever it has been kept since (see frame_cache.h).
+    esp_err_t (* send_frame)(const uint8_t * frame, uint32_t len);
+};
+
+
+static void IRAM_ATTR matrix_spi_done (
+    spi_transaction_t * trans
+)
+{
+    matrix_latency_done();
+}
+
+
+static int matrix_spi_check (
+    const struct led_driver_s * driver
+)
+{
+    if (led_driver_frame_len(driver, NUM_PIXELS) > sizeof(rmt_items)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+// Sets up an SPI host with the strip as its only device, clocked the way
+// led_driver wants it.
+static esp_err_t matrix_spi_add (
+    spi_host_device_t host,
+    int mosi_io_num,
+    int sclk_io_num,
+    int dma_chan,
+    spi_device_handle_t * handle
+)
+{
+    esp_err_t ret;
+
+    ret = spi_bus_initialize(
+        /* spi_host_device_t host = */ host,
+        /* spi_bus_config_t * config = */ &(spi_bus_config_t) {
+            .miso_io_num = -1,
+            .mosi_io_num = mosi_io_num,
+            .sclk_io_num = sclk_io_num,
+            .quadwp_io_num = -1,
+            .quadhd_io_num = -1,
+            .max_transfer_sz = 8192
+        },
+        /* dma_chan = */ dma_chan
+    );
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "Could not initialize SPI bus.");
+        return ret;
+    }
+
+    // The clock is set per device, so it's added again for every driver.
+    ret = spi_bus_add_device(
+        /* spi_host_device_t host = */ host,
+        /* spi_device_interface_config_t * config = */ &(spi_device_interface_config_t) {
+            .command_bits = 0,
+            .address_bits = 0,
+            .dummy_bits = 0,
+            .clock_speed_hz = led_driver.spi_clock_hz,
+            .mode = led_driver.spi_mode,
+            .spics_io_num = -1,
+            .queue_size = NUM_PIXELS,
+            .cs_ena_posttrans = 0,
+            .cs_ena_pretrans = 0,
+            .flags = SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_3WIRE,
+            .input_delay_ns = 0,
+            .post_cb = matrix_spi_done
+        },
+        /* spi_device_handle_t * handle = */ handle
+    );
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "spi_bus_add_device() returned %d", ret);
+        spi_bus_free(host);
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+
+static void matrix_spi_remove (
+    spi_host_device_t host,
+    spi_device_handle_t handle
+)
+{
+    spi_bus_remove_device(handle);
+    spi_bus_free(host);
+}
+
+
+static esp_err_t matrix_spi_open (
+    void
+)
+{
+    return matrix_spi_add(SPI2_HOST, SPI_CHANNEL_1_MOSI, SPI_CHANNEL_1_SCLK, 1, &spi);
+}
+
+
+static void matrix_spi_close (
+    void
+)
+{
+    matrix_spi_remove(SPI2_HOST, spi);
+}
+
+
+static void matrix_spi_wait (
+    void
+)
+{
+    spi_transaction_t * done;
+
+    if (spi_trans_pending) {
+        spi_device_get_trans_result(spi, &done, portMAX_DELAY);
+        spi_trans_pending = false;
+    }
+}
+
+
+// frame has to be in DMA capable memory.
+static esp_err_t matrix_spi_send_frame (
+    const uint8_t * frame,
+    uint32_t len
+)
+{
+    esp_err_t ret;
+
+    spi_trans = (spi_transaction_t) {
+        .tx_buffer = frame,
+        .length = 8*len,
+        .rxlength = 0
+    };
+    ret = spi_device_queue_trans(spi, &spi_trans, portMAX_DELAY);
+    if (ESP_OK != ret) {
+        telemetry.send_errors++;
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, __func__, "spi_device_queue_trans() returned %d", ret);
+        return ret;
+    }
+    spi_trans_pending = true;
+
+    return ESP_OK;
+}
+
+
+static esp_err_t matrix_spi_send (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    uint32_t len;
+
+    if (NULL != rgb) {
+        led_driver_write_pixels(&led_driver, (uint8_t *)items, rgb, 0, num_pixels, scale);
+    }
+    len = led_driver_write_ends(&led_driver, (uint8_t *)items, num_pixels);
+
+    return matrix_spi_send_frame((const uint8_t *)items, len);
+}
+
+
+static void matrix_spi_write (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t first,
+    uint32_t len,
+    uint16_t scale
+)
+{
+    led_driver_write_pixels(&led_driver, (uint8_t *)items, rgb, first, len, scale);
+}
+
+
+static const struct matrix_output_s matrix_output_spi = {
+    .name = "spi",
+    .chain = true,
+    .check = matrix_spi_check,
+    .open = matrix_spi_open,
+    .close = matrix_spi_close,
+    .wait = matrix_spi_wait,
+    .send = matrix_spi_send,
+    .write = matrix_spi_write,
+    .send_frame = matrix_spi_send_frame
+};
+
+
+// The RMT driver has no way to pass anything to its translator, hence
+// led_rmt lives out here.
+static void matrix_rmt_translate (
+    const void * src,
+    rmt_item32_t * dest,
+    size_t src_size,
+    size_t wanted_num,
+    size_t * translated_size,
+    size_t * item_num
+)
+{
+    led_rmt_translate(&led_rmt, src, (uint32_t *)dest, src_size, wanted_num, translated_size, item_num);
+}
+
+
+static void IRAM_ATTR matrix_rmt_done (
+    rmt_channel_t channel,
+    void * arg
+)
+{
+    matrix_latency_done();
+}
+
+
+static int matrix_rmt_check (
+    const struct led_driver_s * driver
+)
+{
+    struct led_rmt_s rmt;
+
+    return led_rmt_init(&rmt, driver, RMT_TICK_NS);
+}
+
+
+// Sets up the RMT channel to send led_rmt frames on gpio_num.
+static esp_err_t matrix_rmt_install (
+    int gpio_num
+)
+{
+    esp_err_t ret;
+
+    ret = rmt_config(&(rmt_config_t) {
+        .rmt_mode = RMT_MODE_TX,
+        .channel = RMT_CHANNEL,
+        .gpio_num = gpio_num,
+        .clk_div = RMT_CLOCK_DIV,
+        .mem_block_num = RMT_MEM_BLOCKS,
+        .tx_config = {
+            .loop_en = false,
+            .carrier_en = false,
+            .idle_output_en = true,
+            .idle_level = RMT_IDLE_LEVEL_LOW
+        }
+    });
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "rmt_config() returned %d", ret);
+        return ret;
+    }
+
+    ret = rmt_driver_install(RMT_CHANNEL, 0, 0);
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "rmt_driver_install() returned %d", ret);
+        return ret;
+    }
+
+    ret = rmt_translator_init(RMT_CHANNEL, matrix_rmt_translate);
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "rmt_translator_init() returned %d", ret);
+        rmt_driver_uninstall(RMT_CHANNEL);
+        return ret;
+    }
+    rmt_register_tx_end_callback(matrix_rmt_done, NULL);
+
+    return ESP_OK;
+}
+
+
+static esp_err_t matrix_rmt_open (
+    void
+)
+{
+    if (0 != led_rmt_init(&led_rmt, &led_driver, RMT_TICK_NS)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return matrix_rmt_install(SPI_CHANNEL_1_MOSI);
+}
+
+
+static void matrix_rmt_close (
+    void
+)
+{
+    rmt_driver_uninstall(RMT_CHANNEL);
+}
+
+
+static void matrix_rmt_wait (
+    void
+)
+{
+    if (rmt_trans_pending) {
+        rmt_wait_tx_done(RMT_CHANNEL, portMAX_DELAY);
+        rmt_trans_pending = false;
+    }
+}
+
+
+static esp_err_t matrix_rmt_send (
     uint32_t * items,
-    struct matrix_rgb_s * buf,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    esp_err_t ret;
+
+    led_rmt.frame = (const uint8_t *)items;
+    led_rmt.frame_len = led_driver_pack(&led_driver, (uint8_t *)items, rgb, num_pixels, scale);
+
+    // The byte past the frame becomes the reset time, see led_rmt.h.
+    ret = rmt_write_sample(RMT_CHANNEL, (const uint8_t *)items, led_rmt.frame_len + 1, false);
+    if (ESP_OK != ret) {
+        telemetry.send_errors++;
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, __func__, "rmt_write_sample() returned %d", ret);
+        return ret;
+    }
+    rmt_trans_pending = true;
+
+    return ESP_OK;
+}
+
+
+static const struct matrix_output_s matrix_output_rmt = {
+    .name = "rmt",
+    .chain = true,
+    .check = matrix_rmt_check,
+    .open = matrix_rmt_open,
+    .close = matrix_rmt_close,
+    .wait = matrix_rmt_wait,
+    .send = matrix_rmt_send
+};
+
+
+// Drives the strip in up to three segments at once: on SPI2, SPI3 and RMT,
+// see led_split.h.
+static int matrix_split_check (
+    const struct led_driver_s * driver
+)
+{
+    if (0 != matrix_spi_check(driver) || 0 != matrix_rmt_check(driver)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static esp_err_t matrix_split_open (
+    void
+)
+{
+    esp_err_t ret;
+
+    if (0 != led_rmt_init(&led_rmt, &led_driver, RMT_TICK_NS)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // SPI3 doesn't need a clock pin, nobody listens to it.
+    ret = matrix_spi_add(SPI2_HOST, led_split.pin[0], SPI_CHANNEL_1_SCLK, 1, &spi);
+    if (ESP_OK != ret) {
+        return ret;
+    }
+    ret = matrix_spi_add(SPI3_HOST, led_split.pin[1], -1, 2, &spi3);
+    if (ESP_OK != ret) {
+        matrix_spi_remove(SPI2_HOST, spi);
+        return ret;
+    }
+    ret = matrix_rmt_install(led_split.pin[2]);
+    if (ESP_OK != ret) {
+        matrix_spi_remove(SPI2_HOST, spi);
+        matrix_spi_remove(SPI3_HOST, spi3);
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+
+static void matrix_split_close (
+    void
+)
+{
+    matrix_spi_remove(SPI2_HOST, spi);
+    matrix_spi_remove(SPI3_HOST, spi3);
+    rmt_driver_uninstall(RMT_CHANNEL);
+}
+
+
+static void matrix_split_wait (
+    void
+)
+{
+    spi_transaction_t * done;
+
+    if (split_pending & (1 << 0)) {
+        spi_device_get_trans_result(spi, &done, portMAX_DELAY);
+    }
+    if (split_pending & (1 << 1)) {
+        spi_device_get_trans_result(spi3, &done, portMAX_DELAY);
+    }
+    if (split_pending & (1 << 2)) {
+        rmt_wait_tx_done(RMT_CHANNEL, portMAX_DELAY);
+    }
+    split_pending = 0;
+}
+
+
+struct matrix_split_ctx_s {
+    uint32_t * items;
+    const uint8_t (* rgb)[3];
+    uint16_t scale;
+};
+
+
+static void matrix_split_prepare (
+    void * arg,
+    int i,
+    uint32_t first,
+    uint32_t len
+)
+{
+    struct matrix_split_ctx_s * ctx = arg;
+
+    switch (i) {
+        case 0:
+            len = led_driver_write(&led_driver, (uint8_t *)ctx->items, &ctx->rgb[first], len, ctx->scale);
+            spi_trans = (spi_transaction_t) {
+                .tx_buffer = ctx->items,
+                .length = 8*len,
+                .rxlength = 0
+            };
+            break;
+
+        case 1:
+            len = led_driver_write(&led_driver, (uint8_t *)split_items, &ctx->rgb[first], len, ctx->scale);
+            spi3_trans = (spi_transaction_t) {
+                .tx_buffer = split_items,
+                .length = 8*len,
+                .rxlength = 0
+            };
+            break;
+
+        case 2:
+            led_rmt.frame = split_rmt_frame;
+            led_rmt.frame_len = led_driver_pack(&led_driver, split_rmt_frame, &ctx->rgb[first], len, ctx->scale);
+            break;
+    }
+}
+
+
+static void matrix_split_start (
+    void * arg,
+    int i
+)
+{
+    esp_err_t ret;
+
+    switch (i) {
+        case 0:
+            ret = spi_device_queue_trans(spi, &spi_trans, portMAX_DELAY);
+            break;
+        case 1:
+            ret = spi_device_queue_trans(spi3, &spi3_trans, portMAX_DELAY);
+            break;
+        default:
+            ret = rmt_write_sample(RMT_CHANNEL, split_rmt_frame, led_rmt.frame_len + 1, false);
+            break;
+    }
+    if (ESP_OK != ret) {
+        // It won't finish either, so it's done as far as the frame goes.
+        telemetry.send_errors++;
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, __func__, "could not start segment %d: %d", i, ret);
+        matrix_latency_done();
+        return;
+    }
+    split_pending |= 1 << i;
+}
+
+
+static esp_err_t matrix_split_send (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    static const struct led_split_ops_s ops = {
+        .prepare = matrix_split_prepare,
+        .start = matrix_split_start
+    };
+    struct matrix_split_ctx_s ctx = {
+        .items = items,
+        .rgb = rgb,
+        .scale = scale
+    };
+
+    // One transfer per segment, rather than the one matrix_latency_sent
+    // expects. Segments that don't start count themselves off.
+    matrix_latency.pending = led_split_count(&led_split);
+    led_split_send(&led_split, &ops, &ctx);
+
+    return ESP_OK;
+}
+
+
+static const struct matrix_output_s matrix_output_split = {
+    .name = "split",
+    .check = matrix_split_check,
+    .open = matrix_split_open,
+    .close = matrix_split_close,
+    .wait = matrix_split_wait,
+    .send = matrix_split_send
+};
+
+
+static int matrix_i2s_check (
+    const struct led_driver_s * driver
+)
+{
+    if (0 != led_i2s_shape(driver, &(struct led_i2s_shape_s){0}) || led_i2s_frame_len(driver, NUM_PIXELS, I2S_LANES) > sizeof(rmt_items)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static bool matrix_i2s_trans_done (
+    esp_lcd_panel_io_handle_t io,
+    void * user_data,
+    void * event_data
+)
+{
+    BaseType_t woken = pdFALSE;
+
+    matrix_latency_done();
+    xSemaphoreGiveFromISR(i2s_done, &woken);
+
+    return pdTRUE == woken;
+}
+
+
+static esp_err_t matrix_i2s_open (
+    void
+)
+{
+    esp_err_t ret;
+
+    if (NULL == i2s_done) {
+        i2s_done = xSemaphoreCreateBinary();
+    }
+
+    ret = esp_lcd_new_i80_bus(&(esp_lcd_i80_bus_config_t) {
+        .dc_gpio_num = I2S_DC_PIN,
+        .wr_gpio_num = I2S_WR_PIN,
+        .data_gpio_nums = I2S_DATA_PINS,
+        .bus_width = I2S_LANES,
+        .max_transfer_bytes = sizeof(rmt_items)
+    }, &i2s_bus);
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "esp_lcd_new_i80_bus() returned %d", ret);
+        return ret;
+    }
+
+    // There's no way to send data without a command first, but a command
+    // of 0 is just one more sample with the lines low.
+    ret = esp_lcd_new_panel_io_i80(i2s_bus, &(esp_lcd_panel_io_i80_config_t) {
+        .cs_gpio_num = -1,
+        .pclk_hz = led_i2s_clock_hz(&led_driver),
+        .trans_queue_depth = 1,
+        .on_color_trans_done = matrix_i2s_trans_done,
+        .lcd_cmd_bits = I2S_LANES,
+        .lcd_param_bits = I2S_LANES
+    }, &i2s_io);
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "esp_lcd_new_panel_io_i80() returned %d", ret);
+        esp_lcd_del_i80_bus(i2s_bus);
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+
+static void matrix_i2s_close (
+    void
+)
+{
+    esp_lcd_panel_io_del(i2s_io);
+    esp_lcd_del_i80_bus(i2s_bus);
+}
+
+
+static void matrix_i2s_wait (
+    void
+)
+{
+    if (i2s_trans_pending) {
+        xSemaphoreTake(i2s_done, portMAX_DELAY);
+        i2s_trans_pending = false;
+    }
+}
+
+
+static esp_err_t matrix_i2s_send (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    static uint8_t frame[NUM_PIXELS * 4];
+    uint32_t len;
+    esp_err_t ret;
+
+    led_driver_pack(&led_driver, frame, rgb, num_pixels, scale);
+    len = led_i2s_write(&led_driver, (uint8_t *)items, frame, num_pixels, I2S_LANES);
+
+    ret = esp_lcd_panel_io_tx_color(i2s_io, 0, items, len);
+    if (ESP_OK != ret) {
+        telemetry.send_errors++;
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, __func__, "esp_lcd_panel_io_tx_color() returned %d", ret);
+        return ret;
+    }
+    i2s_trans_pending = true;
+
+    return ESP_OK;
+}
+
+
+static const struct matrix_output_s matrix_output_i2s = {
+    .name = "i2s",
+    .check = matrix_i2s_check,
+    .open = matrix_i2s_open,
+    .close = matrix_i2s_close,
+    .wait = matrix_i2s_wait,
+    .send = matrix_i2s_send
+};
+
+
+static const struct matrix_output_s * matrix_output = &matrix_output_spi;
+
+
+// Switches to another chipset and/or output. Returns -1, leaving things as
+// they were, if they don't go together.
+static int matrix_display_reconfigure (
+    const struct led_driver_s * driver,
+    const struct matrix_output_s * output
+)
+{
+    esp_err_t ret;
+
+    if (0 != output->check(driver)) {
+        return -1;
+    }
+
+    matrix_output->wait();
+    matrix_output->close();
+
+    led_driver = *driver;
+    matrix_output = output;
+    ret = matrix_output->open();
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "could not open %s output: %d", matrix_output->name, ret);
+        esp_restart();
+    }
+
+    return 0;
+}
+
+
+// Big frames are encoded by both cores: led_task takes the start of the
+// strip, and encode_task, on core 0, the rest. They hand work to each other
+// with task notifications, which are a lot cheaper than queues. Below
+// ENCODE_SHARD_MIN_PIXELS, handing over costs more than it saves.
+static void encode_task (
+    void * arg
+)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        encode_shard.fn(encode_shard.arg, encode_shard.first, encode_shard.len);
+        xTaskNotifyGive(led_task_handle);
+    }
+}
+
+
+// Writes out what went through MATRIX_LOG. Runs at the lowest priority, so
+// that the UART only gets time nobody else wants.
+static void log_task (
+    void * arg
+)
+{
+    struct log_entry_s entry;
+    char line[LOG_RING_LINE_LEN];
+    uint32_t full = 0;
+
+    while (1) {
+        while (log_ring_read(&log_ring, &entry)) {
+            log_ring_format(&entry, line, sizeof(line));
+            if ('E' == entry.level) {
+                ESP_LOGE(entry.tag, "%s", line);
+            } else if ('W' == entry.level) {
+                ESP_LOGW(entry.tag, "%s", line);
+            } else {
+                ESP_LOGI(entry.tag, "%s", line);
+            }
+        }
+
+        // Lines that didn't fit have no next line to report them.
+        if (full != log_ring.full) {
+            ESP_LOGW("log_task", "%u lines didn't fit in the log ring", log_ring.full - full);
+            full = log_ring.full;
+        }
+
+        vTaskDelay(LOG_DRAIN_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+}
+
+
+// Runs fn over pixels 0 .. num_pixels - 1 on the strip, on both cores if
+// it's worth it, and returns when all of it is done. Only led_task may call
+// this.
+static void matrix_shard_run (
+    void (* fn)(void * arg, uint32_t first, uint32_t len),
+    void * arg,
+    uint32_t num_pixels
+)
+{
+    uint32_t split;
+
+    if (NULL == encode_task_handle || num_pixels < ENCODE_SHARD_MIN_PIXELS) {
+        fn(arg, 0, num_pixels);
+        return;
+    }
+
+    split = num_pixels - num_pixels * ENCODE_SHARD_CORE0_SHARE / 256;
+    encode_shard = (struct matrix_shard_s) {
+        .fn = fn,
+        .arg = arg,
+        .first = split,
+        .len = num_pixels - split
+    };
+    xTaskNotifyGive(encode_task_handle);
+    fn(arg, 0, split);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+
+// What the shards of matrix_display_draw_rgb share.
+struct matrix_draw_s {
+    const struct matrix_encode_s * enc;
+    const struct matrix_rgb_s * buf;
+    const struct matrix_rgb16_s * buf16;
+    uint8_t (* wire)[3];
+    uint32_t * items;
+    uint16_t scale;
+
+    // Per shard, so that they don't have to add to the same sum.
+    uint32_t sum[2][3];
+};
+
+
+static void matrix_draw_encode (
+    void * arg,
+    uint32_t first,
+    uint32_t len
+)
+{
+    struct matrix_draw_s * draw = arg;
+
+    matrix_encode_range(draw->enc, draw->buf, draw->buf16, draw->wire, first, len, draw->sum[0 != first]);
+}
+
+
+static void matrix_draw_write (
+    void * arg,
+    uint32_t first,
+    uint32_t len
+)
+{
+    struct matrix_draw_s * draw = arg;
+
+    matrix_output->write(draw->items, (const uint8_t (*)[3])draw->wire, first, len, draw->scale);
+}
+
+
+// This function takes an rgb display buffer, either 8 bit (buf) or 16 bit
+// (buf16), and draws it on the display using matrix_output. Each pixel goes
+// through enc on its way out (see matrix_encode.h), and then through
+// led_driver, which turns it into what the chipset wants on the wire.
+// Returns how long that took in us, not counting the wait for the previous
+// frame to go out.
+static uint32_t matrix_display_draw_rgb (
+    uint32_t * items,
+    const struct matrix_encode_s * enc,
+    const struct matrix_rgb_s * buf,
+    const struct matrix_rgb16_s * buf16,
     uint32_t buf_len
 )
 {
 
-    uint32_t rmt_i = 0;
-    uint8_t bit;
+    struct matrix_draw_s draw = {
+        .enc = enc,
+        .buf = buf,
+        .buf16 = buf16,
+        .wire = enc->wire,
+        .items = items
+    };
+    uint32_t sum[3];
+    uint32_t len = buf_len;
+    int64_t start_us = esp_timer_get_time();
+    int64_t wait_us;
+    const struct frame_cache_entry_s * cached;
+    uint32_t hash = 0;
+    bool cacheable = NULL == buf16 && NULL != matrix_output->send_frame && 0 != enc->cache->budget;
+
+    // A frame that was encoded before goes out as it was then. 16 bit
+    // frames are dithered, so they never come out the same twice.
+    if (cacheable) {
+        hash = frame_cache_hash(buf, buf_len * sizeof(*buf));
+        cached = frame_cache_get(enc->cache, buf, buf_len * sizeof(*buf), hash);
+        if (NULL != cached) {
+            power_limit_count(enc->power, cached->scale, cached->ma);
+            frame_prefix_invalidate(enc->prefix);
+            wait_us = esp_timer_get_time();
+            matrix_output->wait();
+            wait_us = esp_timer_get_time() - wait_us;
+            matrix_latency_sent();
+            matrix_output->send_frame(cached->data, cached->len);
+            return esp_timer_get_time() - start_us - wait_us;
+        }
+    }
+
+    // For each pixel, in the order they sit on the strip, work out what to
+    // send. The power estimate is summed up on the way.
+    matrix_shard_run(matrix_draw_encode, &draw, buf_len);
+    for (int c = 0; c < 3; c++) {
+        sum[c] = draw.sum[0][c] + draw.sum[1][c];
+    }
+    draw.scale = power_limit_scale(enc->power, buf_len, sum);
+
+    // Pixels past the last one that changed can stay as they are.
+    if (matrix_output->chain) {
+        len = frame_prefix_len(enc->prefix, (const uint8_t (*)[3])enc->wire, buf_len, draw.scale);
+    } else {
+        frame_prefix_invalidate(enc->prefix);
+    }
+    if (0 == len) {
+        return esp_timer_get_time() - start_us;
+    }
+
+    // The previous frame may still be going out of items.
+    wait_us = esp_timer_get_time();
+    matrix_output->wait();
+    wait_us = esp_timer_get_time() - wait_us;
+
+    // Finally, write out the buffer, with both cores if the output can take
+    // it in pieces.
+    if (NULL != matrix_output->write) {
+        matrix_shard_run(matrix_draw_write, &draw, len);
+        matrix_latency_sent();
+        matrix_output->send(items, NULL, len, draw.scale);
+    } else {
+        matrix_latency_sent();
+        matrix_output->send(items, enc->wire, len, draw.scale);
+    }
+
+    // Only whole frames are worth keeping. Nothing in the cache is being
+    // sent any more, so it's safe to make room in it.
+    if (cacheable && len == buf_len) {
+        frame_cache_put(enc->cache, buf, buf_len * sizeof(*buf), hash,
+                items, led_driver_frame_len(&led_driver, buf_len), draw.scale, enc->power->last_ma);
+    }
+
+    return esp_timer_get_time() - start_us - wait_us;
+}
+
+
+// Hands a frame to led_task. display_event->read_us has to be set.
+static void nats_queue_display_event (
+    struct display_event_s * display_event
+)
+{
+    static uint16_t seq = 0;
+    UBaseType_t depth;
+
+    // TRACE_NO_FRAME isn't a frame.
+    display_event->seq = seq;
+    seq = (seq + 1) % TRACE_NO_FRAME;
+
+    display_event->queued_us = esp_timer_get_time();
+    latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_PARSE,
+            display_event->queued_us - display_event->read_us);
+    if (pdTRUE != xQueueSend(event_queue, display_event, 0)) {
+        trace_record(&trace, TRACE_QUEUE_FULL, xPortGetCoreID(), display_event->queued_us, display_event->seq);
+        telemetry.queue_full++;
+        return;
+    }
+    trace_record(&trace, TRACE_QUEUED, xPortGetCoreID(), display_event->queued_us, display_event->seq);
+
+    telemetry.frames++;
+    depth = uxQueueMessagesWaiting(event_queue);
+    if (depth > telemetry.queue_high) {
+        telemetry.queue_high = depth;
+    }
+}
+
+
+// matrix1.frame16 is like matrix1.in, but with 16 bits per channel: 8 byte
+// tv_sec, 8 byte tv_nsec, then r, g and b of every pixel as little-endian
+// uint16_t.
+static void nats_dispatch_frame16 (
+    const uint8_t * payload,
+    uint32_t len
+)
+{
+    static struct display_event_s display_event;
+    const uint8_t * px;
+    int64_t tv_sec = 0;
+    int64_t tv_nsec = 0;
+
+    if (16 + 6*NUM_PIXELS != len) {
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "dropping %u byte matrix1.frame16", len);
+        telemetry.dropped++;
+        return;
+    }
+
+    for (int i = 7; i >= 0; i--) {
+        tv_sec = (tv_sec << 8) | payload[i];
+        tv_nsec = (tv_nsec << 8) | payload[8 + i];
+    }
+    display_event.tv.tv_sec = tv_sec;
+    display_event.tv.tv_nsec = tv_nsec;
+    display_event.wide = true;
+    display_event.read_us = nats_msg_read_us;
+
+    for (int i = 0; i < NUM_PIXELS; i++) {
+        px = &payload[16 + i*6];
+        display_event.display_buf16[i].r = px[0] | (px[1] << 8);
+        display_event.display_buf16[i].g = px[2] | (px[3] << 8);
+        display_event.display_buf16[i].b = px[4] | (px[5] << 8);
+    }
+
+    nats_queue_display_event(&display_event);
+}
+
+
+// Handles a message on any subject except matrix1.in. subject is what came
+// after "matrix1.".
+static void nats_dispatch (
+    const char * subject,
+    const uint8_t * payload,
+    uint32_t len
+)
+{
+    if (0 == strcmp(subject, "frame16")) {
+        nats_dispatch_frame16(payload, len);
+        return;
+    }
+
+    // nats_task sends the dump once it's done with this message. No
+    // payload.
+    if (0 == strcmp(subject, "ctl.trace")) {
+        nats_trace_requested = true;
+        return;
+    }
+
+    // Telemetry belongs to nats_task, so this one stays here. Payload is
+    // how often to publish, in ms, as a little-endian uint32_t. 0 stops it.
+    if (0 == strcmp(subject, "ctl.telemetry")) {
+        if (4 != len) {
+            ESP_LOGE("nats_task", "rejecting bad telemetry period");
+            telemetry.dropped++;
+            return;
+        }
+        telemetry.period_ms = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+        ESP_LOGI("nats_task", "publishing stats every %u ms", telemetry.period_ms);
+        return;
+    }
+
+    if (0 == strcmp(subject, "ctl.shader")) {
+        nats_control_event.type = 0 == len ? CONTROL_SHADER_CLEAR : CONTROL_SHADER_LOAD;
+    } else if (0 == strcmp(subject, "ctl.map.layout")) {
+        nats_control_event.type = CONTROL_MAP_LAYOUT;
+    } else if (0 == strcmp(subject, "ctl.map.table")) {
+        nats_control_event.type = CONTROL_MAP_TABLE;
+    } else if (0 == strcmp(subject, "ctl.gamma")) {
+        nats_control_event.type = CONTROL_GAMMA;
+    } else if (0 == strcmp(subject, "ctl.brightness")) {
+        nats_control_event.type = CONTROL_BRIGHTNESS;
+    } else if (0 == strcmp(subject, "ctl.power")) {
+        nats_control_event.type = CONTROL_POWER;
+    } else if (0 == strcmp(subject, "ctl.cal")) {
+        nats_control_event.type = CONTROL_CAL;
+    } else if (0 == strcmp(subject, "ctl.driver")) {
+        nats_control_event.type = CONTROL_DRIVER;
+    } else if (0 == strcmp(subject, "ctl.output")) {
+        nats_control_event.type = CONTROL_OUTPUT;
+    } else if (0 == strcmp(subject, "ctl.split")) {
+        nats_control_event.type = CONTROL_SPLIT;
+    } else if (0 == strcmp(subject, "ctl.skip")) {
+        nats_control_event.type = CONTROL_SKIP;
+    } else if (0 == strcmp(subject, "ctl.prefix")) {
+        nats_control_event.type = CONTROL_PREFIX;
+    } else if (0 == strcmp(subject, "ctl.cache")) {
+        nats_control_event.type = CONTROL_CACHE;
+    } else if (0 == strcmp(subject, "ctl.refresh")) {
+        nats_control_event.type = CONTROL_REFRESH;
+    } else {
+        ESP_LOGW("nats_task", "no handler for matrix1.%s", subject);
+        return;
+    }
+
+    nats_control_event.len = len;
+    memcpy(nats_control_event.data, payload, len);
+    if (pdTRUE != xQueueSend(control_queue, &nats_control_event, 0)) {
+        ESP_LOGE("nats_task", "control queue full, dropping matrix1.%s", subject);
+        telemetry.dropped++;
+    }
+}
+
+
+// Adds a PUB of payload on subject to msg, which holds *used bytes.
+static int nats_pub_add (
+    char * msg,
+    uint32_t * used,
+    const char * subject,
+    const char * payload,
+    uint32_t len
+)
+{
+    int n;
+
+    if (0 == len) {
+        return -1;
+    }
+    n = snprintf(&msg[*used], NATS_PUB_LEN - *used, "PUB %s %u\r\n", subject, len);
+    if (n < 0 || *used + n + len + 2 > NATS_PUB_LEN) {
+        return -1;
+    }
+    memcpy(&msg[*used + n], payload, len);
+    memcpy(&msg[*used + n + len], "\r\n", 2);
+    *used += n + len + 2;
+
+    return 0;
+}
+
+
+// Publishes the trace on subject, see trace.h for the format. Tracing
+// stops while it goes out, so that the dump is consistent.
+static void nats_publish_trace (
+    int sockfd,
+    const char * subject
+)
+{
+    char header[NATS_SUBJECT_LEN + 32];
+    int n;
+
+    n = snprintf(header, sizeof(header), "PUB %s " NATS_PUB_TRACE_LEN "\r\n", subject);
+    trace.paused = 1;
+    if (n != write(sockfd, header, n) ||
+        sizeof(trace) != write(sockfd, &trace, sizeof(trace)) ||
+        2 != write(sockfd, "\r\n", 2))
+    {
+        ESP_LOGE("nats_task", "could not publish %s", subject);
+        telemetry.publish_failures++;
+    }
+    trace.paused = 0;
+}
+
+
+// Samples every task there is into task_stats, including the ones ESP-IDF
+// starts. Needs FreeRTOS's trace facility and run time stats, see
+// sdkconfig.
+static void nats_sample_tasks (
+    void
+)
+{
+    static TaskStatus_t status[TASK_STATS_MAX];
+    struct task_stats_task_s * task;
+    uint32_t time;
+    UBaseType_t n;
 
-    // For each pixel...
-    for (int i = 0; i < buf_len; i++) {
+    n = uxTaskGetSystemState(status, TASK_STATS_MAX, &time);
+    if (0 == n) {
+        ESP_LOGE("nats_task", "more than %d tasks, not sampling them", TASK_STATS_MAX);
+    }
 
-        // Convert this pixels display buffer red to rmt_items.
-        // For each bit in the buf[i].r, set the corresponding 
-        for (bit = 8; bit > 0; bit--) {
-            if ((buf[i].r >> (bit - 1)) & 1) {
-                items[rmt_i] = one;
-            } else {
-                items[rmt_i] = zero;
-            }
-            rmt_i += 1;
-        }
+    for (UBaseType_t i = 0; i < n; i++) {
+        task = &task_stats.tasks[i];
+        task->id = status[i].xTaskNumber;
+        strncpy(task->name, status[i].pcTaskName, TASK_STATS_NAME_LEN);
+        task->core = tskNO_AFFINITY == status[i].xCoreID ? -1 : status[i].xCoreID;
+        task->priority = status[i].uxCurrentPriority;
+        task->idle = task->core >= 0 && status[i].xHandle == xTaskGetIdleTaskHandleForCPU(task->core);
+        task->runtime = status[i].ulRunTimeCounter;
+        task->stack_free = status[i].usStackHighWaterMark;
+    }
+    task_stats.count = n;
+    task_stats.time = time;
+}
 
-        // Same thing with green
-        for (bit = 8; bit > 0; bit--) {
-            if ((buf[i].g >> (bit - 1)) & 1) {
-                items[rmt_i] = one;
-            } else {
-                items[rmt_i] = zero;
-            }
-            rmt_i += 1;
-        }
 
-        // And blue
-        for (bit = 8; bit > 0; bit--) {
-            if ((buf[i].b >> (bit - 1)) & 1) {
-                items[rmt_i] = one;
-            } else {
-                items[rmt_i] = zero;
-            }
-            rmt_i += 1;
-        }
+// Publishes telemetry on matrix1.stats.telemetry, latency_hist on
+// matrix1.stats.latency and task_stats on matrix1.stats.tasks. All of it
+// goes out in a single write, so that the read loop is held up once, and
+// only briefly: in practice it's well under what the TCP send buffer holds.
+static void nats_publish_stats (
+    int sockfd
+)
+{
+    static char msg[NATS_PUB_LEN];
+    static char json[NATS_STATS_JSON_LEN];
+    uint32_t used = 0;
 
-        spi_device_queue_trans(spi, &(spi_transaction_t) {
-            .tx_buffer = &rmt_items[rmt_i-24],
-            .length = 32*24,
-            .rxlength = 0
-        }, 0);
+    trace_record(&trace, TRACE_PUBLISH, xPortGetCoreID(), esp_timer_get_time(), 0);
+    telemetry.uptime_s = esp_timer_get_time() / 1000000;
+    telemetry.heap_free = esp_get_free_heap_size();
+    telemetry.heap_min = esp_get_minimum_free_heap_size();
+    telemetry.stack_free[TELEMETRY_TASK_LED] = uxTaskGetStackHighWaterMark(led_task_handle);
+    telemetry.stack_free[TELEMETRY_TASK_ENCODE] = uxTaskGetStackHighWaterMark(encode_task_handle);
+    telemetry.stack_free[TELEMETRY_TASK_NATS] = uxTaskGetStackHighWaterMark(NULL);
+    telemetry.stack_free[TELEMETRY_TASK_LOG] = uxTaskGetStackHighWaterMark(log_task_handle);
+    telemetry.log_dropped = log_ring.limited + log_ring.full;
+    nats_sample_tasks();
 
+    if (0 != nats_pub_add(msg, &used, "matrix1.stats.telemetry",
+                json, telemetry_json(&telemetry, json, sizeof(json))) ||
+        0 != nats_pub_add(msg, &used, "matrix1.stats.latency",
+                json, latency_hist_json(&latency_hist, json, sizeof(json))) ||
+        0 != nats_pub_add(msg, &used, "matrix1.stats.tasks",
+                json, task_stats_json(&task_stats, json, sizeof(json))) ||
+        used != write(sockfd, msg, used))
+    {
+        ESP_LOGE("nats_task", "could not publish stats");
+        telemetry.publish_failures++;
     }
-
-    // Finally, write out the buffer.
-//    printf("%u:%u ", rmt_items[8], rmt_items[9]);
-//    spi_device_transmit(spi, &(spi_transaction_t) {
-//        .tx_buffer = rmt_items,
-//        //.length = 32*24*NUM_PIXELS,
-//        .length = 32*24,
-//        .rxlength = 0
-//    });
-//    printf("(%u:%u)\n", rmt_items[8], rmt_items[9]);
+    task_stats_next(&task_stats);
 }
 
 
@@ -240,6 +1581,13 @@ static void nats_task (
     uint8_t color_i = 0;
     uint8_t tv_sec_i = 0;
     uint8_t tv_nsec_i = 0;
+    char subject[NATS_SUBJECT_LEN];
+    uint8_t subject_i = 0;
+    uint32_t payload_len = 0;
+    uint32_t payload_i = 0;
+    int64_t read_us = 0;
+    int64_t published_us = 0;
+    bool subscribed = false;
 
     union {
         long tv_sec;
@@ -254,7 +1602,7 @@ static void nats_task (
     struct display_event_s display_event = {0};
 
     
-#line 258 "main/matrix.c"
+#line 1606 "main/matrix.c"
 static const int nats_start = 1;
 static const int nats_first_final = 217;
 static const int nats_error = 0;
@@ -264,14 +1612,17 @@ static const int nats_en_ping = 200;
 static const int nats_en_info = 202;
 static const int nats_en_loop = 208;
 static const int nats_en_main = 1;
+static const int nats_en_msg_subject = 223;
+static const int nats_en_msg_payload = 231;
+static const int nats_en_msg_end = 232;
 
 
-#line 270 "main/matrix.c"
+#line 1621 "main/matrix.c"
 	{
 	cs = nats_start;
 	}
 
-#line 356 "main/matrix.c.rl"
+#line 1787 "main/matrix.c.rl"
 
 
 
@@ -330,11 +1681,23 @@ static const int nats_en_main = 1;
         }
 
         ESP_LOGI("nats_task", "Connected to NATS!");
+        telemetry.connects++;
+
+        if (0 != setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &(struct timeval) {
+                    .tv_sec = NATS_READ_TIMEOUT_MS / 1000,
+                    .tv_usec = NATS_READ_TIMEOUT_MS % 1000 * 1000
+                }, sizeof(struct timeval)))
+        {
+            ESP_LOGE("nats_task", "could not set a read timeout, stats only go out when something comes in");
+        }
 
         // Read loop on nats
         do {
             bytes_read = read(sockfd, buf, NATS_BUF_LEN);
-            if (-1 == bytes_read) {
+            read_us = esp_timer_get_time();
+            if (-1 == bytes_read && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+                // Nothing came in, just check whether stats are due.
+            } else if (-1 == bytes_read) {
                 ESP_LOGE("nats_task", "read returned -1");
                 // todo: reset, or retry.
                 esp_restart();
@@ -345,10 +1708,36 @@ static const int nats_en_main = 1;
                 esp_restart();
             }
 
+            // Stats wait for the end of the message being read, so that
+            // they don't hold up a frame halfway through, unless that keeps
+            // them waiting for another whole period.
+            if (subscribed && 0 != telemetry.period_ms &&
+                read_us - published_us >= (int64_t)telemetry.period_ms * 1000 &&
+                (nats_en_loop == cs || read_us - published_us >= (int64_t)telemetry.period_ms * 2000))
+            {
+                nats_publish_stats(sockfd);
+                published_us = read_us;
+            }
+
+            // A trace that survived a crash goes out as soon as possible,
+            // and then tracing starts over.
+            if (subscribed && trace_crashed) {
+                nats_publish_trace(sockfd, "matrix1.stats.trace.crash");
+                trace_init(&trace);
+                trace_crashed = false;
+            }
+            if (nats_trace_requested && nats_en_loop == cs) {
+                nats_publish_trace(sockfd, "matrix1.stats.trace");
+                nats_trace_requested = false;
+            }
+            if (-1 == bytes_read) {
+                continue;
+            }
+
             p = buf;
             pe = buf + bytes_read;
             
-#line 352 "main/matrix.c"
+#line 1741 "main/matrix.c"
 	{
 	if ( p == pe )
 		goto _test_eof;
@@ -359,26 +1748,26 @@ case 1:
 		goto st2;
 	goto st0;
 tr8:
-#line 350 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task", "err: %c (0x%02x)", *p, *p); }
+#line 1781 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_MAIN]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "err: %c (0x%02x)", *p, *p); }
 	goto st0;
 tr199:
-#line 329 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task_msg", "err: %c (0x%02x)", *p, *p); {goto st208;} }
+#line 1748 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_MSG]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_msg", "err: %c (0x%02x)", *p, *p); {goto st208;} }
 	goto st0;
 tr202:
-#line 331 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task_ping", "err: %c (0x%02x)", *p, *p); {goto st208;} }
+#line 1762 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_PING]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_ping", "err: %c (0x%02x)", *p, *p); {goto st208;} }
 	goto st0;
 tr208:
-#line 337 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task_info", "err: %c (0x%02x)", *p, *p); {goto st208;} }
+#line 1768 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_INFO]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_info", "err: %c (0x%02x)", *p, *p); {goto st208;} }
 	goto st0;
 tr212:
-#line 344 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task", "err in loop: %c (0x%02x) in state %d", *p, *p, cs); {goto st208;} }
+#line 1775 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_LOOP]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "err in loop: %c (0x%02x) in state %d", *p, *p, cs); {goto st208;} }
 	goto st0;
-#line 382 "main/matrix.c"
+#line 1771 "main/matrix.c"
 st0:
 cs = 0;
 	goto _out;
@@ -441,7 +1830,7 @@ case 9:
 		goto tr11;
 	goto tr8;
 tr11:
-#line 261 "main/matrix.c.rl"
+#line 1609 "main/matrix.c.rl"
 	{
             ESP_LOGI("nats_task", "Subscribing to NATS topics...");
             bytes_written = write(sockfd, "SUB matrix1.in 1\r\n", strlen("SUB matrix1.in 1\r\n"));
@@ -449,13 +1838,25 @@ tr11:
                 ESP_LOGE("nats_task", "Failed to subscribe to matrix1.in!");
                 esp_restart();
             }
+            bytes_written = write(sockfd, "SUB matrix1.ctl.> 2\r\n", strlen("SUB matrix1.ctl.> 2\r\n"));
+            if (-1 == bytes_written || 0 == bytes_written) {
+                ESP_LOGE("nats_task", "Failed to subscribe to matrix1.ctl.>!");
+                esp_restart();
+            }
+            bytes_written = write(sockfd, "SUB matrix1.frame16 3\r\n", strlen("SUB matrix1.frame16 3\r\n"));
+            if (-1 == bytes_written || 0 == bytes_written) {
+                ESP_LOGE("nats_task", "Failed to subscribe to matrix1.frame16!");
+                esp_restart();
+            }
+            subscribed = true;
+            published_us = esp_timer_get_time();
         }
 	goto st10;
 st10:
 	if ( ++p == pe )
 		goto _test_eof10;
 case 10:
-#line 459 "main/matrix.c"
+#line 1860 "main/matrix.c"
 	if ( (*p) == 43 )
 		goto st11;
 	goto tr8;
@@ -488,14 +1889,14 @@ case 14:
 		goto tr16;
 	goto st0;
 tr16:
-#line 351 "main/matrix.c.rl"
+#line 1782 "main/matrix.c.rl"
 	{ {goto st208;} }
 	goto st217;
 st217:
 	if ( ++p == pe )
 		goto _test_eof217;
 case 217:
-#line 499 "main/matrix.c"
+#line 1900 "main/matrix.c"
 	goto st0;
 st15:
 	if ( ++p == pe )
@@ -510,149 +1911,167 @@ st16:
 case 16:
 	if ( (*p) == 32 )
 		goto st17;
-	goto st0;
+	goto tr199;
 st17:
 	if ( ++p == pe )
 		goto _test_eof17;
 case 17:
 	if ( (*p) == 109 )
 		goto st18;
-	goto st0;
+	goto tr199;
 st18:
 	if ( ++p == pe )
 		goto _test_eof18;
 case 18:
 	if ( (*p) == 97 )
 		goto st19;
-	goto st0;
+	goto tr199;
 st19:
 	if ( ++p == pe )
 		goto _test_eof19;
 case 19:
 	if ( (*p) == 116 )
 		goto st20;
-	goto st0;
+	goto tr199;
 st20:
 	if ( ++p == pe )
 		goto _test_eof20;
 case 20:
 	if ( (*p) == 114 )
 		goto st21;
-	goto st0;
+	goto tr199;
 st21:
 	if ( ++p == pe )
 		goto _test_eof21;
 case 21:
 	if ( (*p) == 105 )
 		goto st22;
-	goto st0;
+	goto tr199;
 st22:
 	if ( ++p == pe )
 		goto _test_eof22;
 case 22:
 	if ( (*p) == 120 )
 		goto st23;
-	goto st0;
+	goto tr199;
 st23:
 	if ( ++p == pe )
 		goto _test_eof23;
 case 23:
 	if ( (*p) == 49 )
 		goto st24;
-	goto st0;
+	goto tr199;
 st24:
 	if ( ++p == pe )
 		goto _test_eof24;
 case 24:
 	if ( (*p) == 46 )
 		goto st25;
-	goto st0;
+	goto tr199;
 st25:
 	if ( ++p == pe )
 		goto _test_eof25;
 case 25:
-	if ( (*p) == 105 )
-		goto st26;
-	goto st0;
+	switch( (*p) ) {
+		case 46: goto tr224;
+		case 95: goto tr224;
+		case 105: goto st26;
+	}
+	if ( (*p) < 97 ) {
+		if ( 48 <= (*p) && (*p) <= 57 )
+			goto tr224;
+	} else if ( (*p) <= 122 )
+		goto tr224;
+	goto tr199;
+tr224:
+#line 1746 "main/matrix.c.rl"
+	{ p--; {goto st223;} }
+	goto st222;
+st222:
+	if ( ++p == pe )
+		goto _test_eof222;
+case 222:
+#line 1995 "main/matrix.c"
+	goto tr199;
 st26:
 	if ( ++p == pe )
 		goto _test_eof26;
 case 26:
 	if ( (*p) == 110 )
 		goto st27;
-	goto st0;
+	goto tr199;
 st27:
 	if ( ++p == pe )
 		goto _test_eof27;
 case 27:
 	if ( (*p) == 32 )
 		goto st28;
-	goto st0;
+	goto tr199;
 st28:
 	if ( ++p == pe )
 		goto _test_eof28;
 case 28:
 	if ( (*p) == 49 )
 		goto st29;
-	goto st0;
+	goto tr199;
 st29:
 	if ( ++p == pe )
 		goto _test_eof29;
 case 29:
 	if ( (*p) == 32 )
 		goto st30;
-	goto st0;
+	goto tr199;
 st30:
 	if ( ++p == pe )
 		goto _test_eof30;
 case 30:
 	if ( (*p) == 49 )
 		goto st31;
-	goto st0;
+	goto tr199;
 st31:
 	if ( ++p == pe )
 		goto _test_eof31;
 case 31:
 	if ( (*p) == 54 )
 		goto st32;
-	goto st0;
+	goto tr199;
 st32:
 	if ( ++p == pe )
 		goto _test_eof32;
 case 32:
 	if ( (*p) == 51 )
 		goto st33;
-	goto st0;
+	goto tr199;
 st33:
 	if ( ++p == pe )
 		goto _test_eof33;
 case 33:
 	if ( (*p) == 13 )
 		goto st34;
-	goto st0;
+	goto tr199;
 st34:
 	if ( ++p == pe )
 		goto _test_eof34;
 case 34:
 	if ( (*p) == 10 )
 		goto tr35;
-	goto st0;
+	goto tr199;
 tr35:
-#line 320 "main/matrix.c.rl"
+#line 1735 "main/matrix.c.rl"
 	{ color_i = 0; }
 	goto st35;
 st35:
-#line 295 "main/matrix.c.rl"
+#line 1703 "main/matrix.c.rl"
 	{
             tv_sec_i = 0;
         }
 	if ( ++p == pe )
 		goto _test_eof35;
 case 35:
-#line 653 "main/matrix.c"
+#line 2072 "main/matrix.c"
 	goto tr36;
 tr36:
-#line 299 "main/matrix.c.rl"
+#line 1707 "main/matrix.c.rl"
 	{
             my_tv_sec.raw[tv_sec_i++] = *p;
         }
@@ -661,10 +2080,10 @@ st36:
 	if ( ++p == pe )
 		goto _test_eof36;
 case 36:
-#line 665 "main/matrix.c"
+#line 2084 "main/matrix.c"
 	goto tr37;
 tr37:
-#line 299 "main/matrix.c.rl"
+#line 1707 "main/matrix.c.rl"
 	{
             my_tv_sec.raw[tv_sec_i++] = *p;
         }
@@ -673,10 +2092,10 @@ st37:
 	if ( ++p == pe )
 		goto _test_eof37;
 case 37:
-#line 677 "main/matrix.c"
+#line 2096 "main/matrix.c"
 	goto tr38;
 tr38:
-#line 299 "main/matrix.c.rl"
+#line 1707 "main/matrix.c.rl"
 	{
             my_tv_sec.raw[tv_sec_i++] = *p;
         }
@@ -685,10 +2104,10 @@ st38:
 	if ( ++p == pe )
 		goto _test_eof38;
 case 38:
-#line 689 "main/matrix.c"
+#line 2108 "main/matrix.c"
 	goto tr39;
 tr39:
-#line 299 "main/matrix.c.rl"
+#line 1707 "main/matrix.c.rl"
 	{
             my_tv_sec.raw[tv_sec_i++] = *p;
         }
@@ -697,10 +2116,10 @@ st39:
 	if ( ++p == pe )
 		goto _test_eof39;
 case 39:
-#line 701 "main/matrix.c"
+#line 2120 "main/matrix.c"
 	goto tr40;
 tr40:
-#line 299 "main/matrix.c.rl"
+#line 1707 "main/matrix.c.rl"
 	{
             my_tv_sec.raw[tv_sec_i++] = *p;
         }
@@ -709,10 +2128,10 @@ st40:
 	if ( ++p == pe )
 		goto _test_eof40;
 case 40:
-#line 713 "main/matrix.c"
+#line 2132 "main/matrix.c"
 	goto tr41;
 tr41:
-#line 299 "main/matrix.c.rl"
+#line 1707 "main/matrix.c.rl"
 	{
             my_tv_sec.raw[tv_sec_i++] = *p;
         }
@@ -721,10 +2140,10 @@ st41:
 	if ( ++p == pe )
 		goto _test_eof41;
 case 41:
-#line 725 "main/matrix.c"
+#line 2144 "main/matrix.c"
 	goto tr42;
 tr42:
-#line 299 "main/matrix.c.rl"
+#line 1707 "main/matrix.c.rl"
 	{
             my_tv_sec.raw[tv_sec_i++] = *p;
         }
@@ -733,30 +2152,30 @@ st42:
 	if ( ++p == pe )
 		goto _test_eof42;
 case 42:
-#line 737 "main/matrix.c"
+#line 2156 "main/matrix.c"
 	goto tr43;
 tr43:
-#line 299 "main/matrix.c.rl"
+#line 1707 "main/matrix.c.rl"
 	{
             my_tv_sec.raw[tv_sec_i++] = *p;
         }
-#line 303 "main/matrix.c.rl"
+#line 1711 "main/matrix.c.rl"
 	{
             display_event.tv.tv_sec = my_tv_sec.tv_sec;
         }
 	goto st43;
 st43:
-#line 307 "main/matrix.c.rl"
+#line 1715 "main/matrix.c.rl"
 	{
             tv_nsec_i = 0;
         }
 	if ( ++p == pe )
 		goto _test_eof43;
 case 43:
-#line 757 "main/matrix.c"
+#line 2176 "main/matrix.c"
 	goto tr44;
 tr44:
-#line 311 "main/matrix.c.rl"
+#line 1719 "main/matrix.c.rl"
 	{
             my_tv_nsec.raw[tv_nsec_i++] = *p;
         }
@@ -765,10 +2184,10 @@ st44:
 	if ( ++p == pe )
 		goto _test_eof44;
 case 44:
-#line 769 "main/matrix.c"
+#line 2188 "main/matrix.c"
 	goto tr45;
 tr45:
-#line 311 "main/matrix.c.rl"
+#line 1719 "main/matrix.c.rl"
 	{
             my_tv_nsec.raw[tv_nsec_i++] = *p;
         }
@@ -777,10 +2196,10 @@ st45:
 	if ( ++p == pe )
 		goto _test_eof45;
 case 45:
-#line 781 "main/matrix.c"
+#line 2200 "main/matrix.c"
 	goto tr46;
 tr46:
-#line 311 "main/matrix.c.rl"
+#line 1719 "main/matrix.c.rl"
 	{
             my_tv_nsec.raw[tv_nsec_i++] = *p;
         }
@@ -789,10 +2208,10 @@ st46:
 	if ( ++p == pe )
 		goto _test_eof46;
 case 46:
-#line 793 "main/matrix.c"
+#line 2212 "main/matrix.c"
 	goto tr47;
 tr47:
-#line 311 "main/matrix.c.rl"
+#line 1719 "main/matrix.c.rl"
 	{
             my_tv_nsec.raw[tv_nsec_i++] = *p;
         }
@@ -801,10 +2220,10 @@ st47:
 	if ( ++p == pe )
 		goto _test_eof47;
 case 47:
-#line 805 "main/matrix.c"
+#line 2224 "main/matrix.c"
 	goto tr48;
 tr48:
-#line 311 "main/matrix.c.rl"
+#line 1719 "main/matrix.c.rl"
 	{
             my_tv_nsec.raw[tv_nsec_i++] = *p;
         }
@@ -813,10 +2232,10 @@ st48:
 	if ( ++p == pe )
 		goto _test_eof48;
 case 48:
-#line 817 "main/matrix.c"
+#line 2236 "main/matrix.c"
 	goto tr49;
 tr49:
-#line 311 "main/matrix.c.rl"
+#line 1719 "main/matrix.c.rl"
 	{
             my_tv_nsec.raw[tv_nsec_i++] = *p;
         }
@@ -825,10 +2244,10 @@ st49:
 	if ( ++p == pe )
 		goto _test_eof49;
 case 49:
-#line 829 "main/matrix.c"
+#line 2248 "main/matrix.c"
 	goto tr50;
 tr50:
-#line 311 "main/matrix.c.rl"
+#line 1719 "main/matrix.c.rl"
 	{
             my_tv_nsec.raw[tv_nsec_i++] = *p;
         }
@@ -837,14 +2256,14 @@ st50:
 	if ( ++p == pe )
 		goto _test_eof50;
 case 50:
-#line 841 "main/matrix.c"
+#line 2260 "main/matrix.c"
 	goto tr51;
 tr51:
-#line 311 "main/matrix.c.rl"
+#line 1719 "main/matrix.c.rl"
 	{
             my_tv_nsec.raw[tv_nsec_i++] = *p;
         }
-#line 315 "main/matrix.c.rl"
+#line 1723 "main/matrix.c.rl"
 	{
             display_event.tv.tv_nsec = my_tv_nsec.tv_nsec;
         }
@@ -853,10 +2272,10 @@ st51:
 	if ( ++p == pe )
 		goto _test_eof51;
 case 51:
-#line 857 "main/matrix.c"
+#line 2276 "main/matrix.c"
 	goto tr52;
 tr52:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -865,10 +2284,10 @@ st52:
 	if ( ++p == pe )
 		goto _test_eof52;
 case 52:
-#line 869 "main/matrix.c"
+#line 2288 "main/matrix.c"
 	goto tr53;
 tr53:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -877,24 +2296,24 @@ st53:
 	if ( ++p == pe )
 		goto _test_eof53;
 case 53:
-#line 881 "main/matrix.c"
+#line 2300 "main/matrix.c"
 	goto tr54;
 tr54:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st54;
 st54:
 	if ( ++p == pe )
 		goto _test_eof54;
 case 54:
-#line 895 "main/matrix.c"
+#line 2314 "main/matrix.c"
 	goto tr55;
 tr55:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -903,10 +2322,10 @@ st55:
 	if ( ++p == pe )
 		goto _test_eof55;
 case 55:
-#line 907 "main/matrix.c"
+#line 2326 "main/matrix.c"
 	goto tr56;
 tr56:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -915,24 +2334,24 @@ st56:
 	if ( ++p == pe )
 		goto _test_eof56;
 case 56:
-#line 919 "main/matrix.c"
+#line 2338 "main/matrix.c"
 	goto tr57;
 tr57:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st57;
 st57:
 	if ( ++p == pe )
 		goto _test_eof57;
 case 57:
-#line 933 "main/matrix.c"
+#line 2352 "main/matrix.c"
 	goto tr58;
 tr58:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -941,10 +2360,10 @@ st58:
 	if ( ++p == pe )
 		goto _test_eof58;
 case 58:
-#line 945 "main/matrix.c"
+#line 2364 "main/matrix.c"
 	goto tr59;
 tr59:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -953,24 +2372,24 @@ st59:
 	if ( ++p == pe )
 		goto _test_eof59;
 case 59:
-#line 957 "main/matrix.c"
+#line 2376 "main/matrix.c"
 	goto tr60;
 tr60:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st60;
 st60:
 	if ( ++p == pe )
 		goto _test_eof60;
 case 60:
-#line 971 "main/matrix.c"
+#line 2390 "main/matrix.c"
 	goto tr61;
 tr61:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -979,10 +2398,10 @@ st61:
 	if ( ++p == pe )
 		goto _test_eof61;
 case 61:
-#line 983 "main/matrix.c"
+#line 2402 "main/matrix.c"
 	goto tr62;
 tr62:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -991,24 +2410,24 @@ st62:
 	if ( ++p == pe )
 		goto _test_eof62;
 case 62:
-#line 995 "main/matrix.c"
+#line 2414 "main/matrix.c"
 	goto tr63;
 tr63:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st63;
 st63:
 	if ( ++p == pe )
 		goto _test_eof63;
 case 63:
-#line 1009 "main/matrix.c"
+#line 2428 "main/matrix.c"
 	goto tr64;
 tr64:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1017,10 +2436,10 @@ st64:
 	if ( ++p == pe )
 		goto _test_eof64;
 case 64:
-#line 1021 "main/matrix.c"
+#line 2440 "main/matrix.c"
 	goto tr65;
 tr65:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1029,24 +2448,24 @@ st65:
 	if ( ++p == pe )
 		goto _test_eof65;
 case 65:
-#line 1033 "main/matrix.c"
+#line 2452 "main/matrix.c"
 	goto tr66;
 tr66:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st66;
 st66:
 	if ( ++p == pe )
 		goto _test_eof66;
 case 66:
-#line 1047 "main/matrix.c"
+#line 2466 "main/matrix.c"
 	goto tr67;
 tr67:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1055,10 +2474,10 @@ st67:
 	if ( ++p == pe )
 		goto _test_eof67;
 case 67:
-#line 1059 "main/matrix.c"
+#line 2478 "main/matrix.c"
 	goto tr68;
 tr68:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1067,24 +2486,24 @@ st68:
 	if ( ++p == pe )
 		goto _test_eof68;
 case 68:
-#line 1071 "main/matrix.c"
+#line 2490 "main/matrix.c"
 	goto tr69;
 tr69:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st69;
 st69:
 	if ( ++p == pe )
 		goto _test_eof69;
 case 69:
-#line 1085 "main/matrix.c"
+#line 2504 "main/matrix.c"
 	goto tr70;
 tr70:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1093,10 +2512,10 @@ st70:
 	if ( ++p == pe )
 		goto _test_eof70;
 case 70:
-#line 1097 "main/matrix.c"
+#line 2516 "main/matrix.c"
 	goto tr71;
 tr71:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1105,24 +2524,24 @@ st71:
 	if ( ++p == pe )
 		goto _test_eof71;
 case 71:
-#line 1109 "main/matrix.c"
+#line 2528 "main/matrix.c"
 	goto tr72;
 tr72:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st72;
 st72:
 	if ( ++p == pe )
 		goto _test_eof72;
 case 72:
-#line 1123 "main/matrix.c"
+#line 2542 "main/matrix.c"
 	goto tr73;
 tr73:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1131,10 +2550,10 @@ st73:
 	if ( ++p == pe )
 		goto _test_eof73;
 case 73:
-#line 1135 "main/matrix.c"
+#line 2554 "main/matrix.c"
 	goto tr74;
 tr74:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1143,24 +2562,24 @@ st74:
 	if ( ++p == pe )
 		goto _test_eof74;
 case 74:
-#line 1147 "main/matrix.c"
+#line 2566 "main/matrix.c"
 	goto tr75;
 tr75:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st75;
 st75:
 	if ( ++p == pe )
 		goto _test_eof75;
 case 75:
-#line 1161 "main/matrix.c"
+#line 2580 "main/matrix.c"
 	goto tr76;
 tr76:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1169,10 +2588,10 @@ st76:
 	if ( ++p == pe )
 		goto _test_eof76;
 case 76:
-#line 1173 "main/matrix.c"
+#line 2592 "main/matrix.c"
 	goto tr77;
 tr77:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1181,24 +2600,24 @@ st77:
 	if ( ++p == pe )
 		goto _test_eof77;
 case 77:
-#line 1185 "main/matrix.c"
+#line 2604 "main/matrix.c"
 	goto tr78;
 tr78:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st78;
 st78:
 	if ( ++p == pe )
 		goto _test_eof78;
 case 78:
-#line 1199 "main/matrix.c"
+#line 2618 "main/matrix.c"
 	goto tr79;
 tr79:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1207,10 +2626,10 @@ st79:
 	if ( ++p == pe )
 		goto _test_eof79;
 case 79:
-#line 1211 "main/matrix.c"
+#line 2630 "main/matrix.c"
 	goto tr80;
 tr80:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1219,24 +2638,24 @@ st80:
 	if ( ++p == pe )
 		goto _test_eof80;
 case 80:
-#line 1223 "main/matrix.c"
+#line 2642 "main/matrix.c"
 	goto tr81;
 tr81:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st81;
 st81:
 	if ( ++p == pe )
 		goto _test_eof81;
 case 81:
-#line 1237 "main/matrix.c"
+#line 2656 "main/matrix.c"
 	goto tr82;
 tr82:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1245,10 +2664,10 @@ st82:
 	if ( ++p == pe )
 		goto _test_eof82;
 case 82:
-#line 1249 "main/matrix.c"
+#line 2668 "main/matrix.c"
 	goto tr83;
 tr83:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1257,24 +2676,24 @@ st83:
 	if ( ++p == pe )
 		goto _test_eof83;
 case 83:
-#line 1261 "main/matrix.c"
+#line 2680 "main/matrix.c"
 	goto tr84;
 tr84:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st84;
 st84:
 	if ( ++p == pe )
 		goto _test_eof84;
 case 84:
-#line 1275 "main/matrix.c"
+#line 2694 "main/matrix.c"
 	goto tr85;
 tr85:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1283,10 +2702,10 @@ st85:
 	if ( ++p == pe )
 		goto _test_eof85;
 case 85:
-#line 1287 "main/matrix.c"
+#line 2706 "main/matrix.c"
 	goto tr86;
 tr86:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1295,24 +2714,24 @@ st86:
 	if ( ++p == pe )
 		goto _test_eof86;
 case 86:
-#line 1299 "main/matrix.c"
+#line 2718 "main/matrix.c"
 	goto tr87;
 tr87:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st87;
 st87:
 	if ( ++p == pe )
 		goto _test_eof87;
 case 87:
-#line 1313 "main/matrix.c"
+#line 2732 "main/matrix.c"
 	goto tr88;
 tr88:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1321,10 +2740,10 @@ st88:
 	if ( ++p == pe )
 		goto _test_eof88;
 case 88:
-#line 1325 "main/matrix.c"
+#line 2744 "main/matrix.c"
 	goto tr89;
 tr89:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1333,24 +2752,24 @@ st89:
 	if ( ++p == pe )
 		goto _test_eof89;
 case 89:
-#line 1337 "main/matrix.c"
+#line 2756 "main/matrix.c"
 	goto tr90;
 tr90:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st90;
 st90:
 	if ( ++p == pe )
 		goto _test_eof90;
 case 90:
-#line 1351 "main/matrix.c"
+#line 2770 "main/matrix.c"
 	goto tr91;
 tr91:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1359,10 +2778,10 @@ st91:
 	if ( ++p == pe )
 		goto _test_eof91;
 case 91:
-#line 1363 "main/matrix.c"
+#line 2782 "main/matrix.c"
 	goto tr92;
 tr92:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1371,24 +2790,24 @@ st92:
 	if ( ++p == pe )
 		goto _test_eof92;
 case 92:
-#line 1375 "main/matrix.c"
+#line 2794 "main/matrix.c"
 	goto tr93;
 tr93:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st93;
 st93:
 	if ( ++p == pe )
 		goto _test_eof93;
 case 93:
-#line 1389 "main/matrix.c"
+#line 2808 "main/matrix.c"
 	goto tr94;
 tr94:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1397,10 +2816,10 @@ st94:
 	if ( ++p == pe )
 		goto _test_eof94;
 case 94:
-#line 1401 "main/matrix.c"
+#line 2820 "main/matrix.c"
 	goto tr95;
 tr95:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1409,24 +2828,24 @@ st95:
 	if ( ++p == pe )
 		goto _test_eof95;
 case 95:
-#line 1413 "main/matrix.c"
+#line 2832 "main/matrix.c"
 	goto tr96;
 tr96:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st96;
 st96:
 	if ( ++p == pe )
 		goto _test_eof96;
 case 96:
-#line 1427 "main/matrix.c"
+#line 2846 "main/matrix.c"
 	goto tr97;
 tr97:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1435,10 +2854,10 @@ st97:
 	if ( ++p == pe )
 		goto _test_eof97;
 case 97:
-#line 1439 "main/matrix.c"
+#line 2858 "main/matrix.c"
 	goto tr98;
 tr98:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1447,24 +2866,24 @@ st98:
 	if ( ++p == pe )
 		goto _test_eof98;
 case 98:
-#line 1451 "main/matrix.c"
+#line 2870 "main/matrix.c"
 	goto tr99;
 tr99:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st99;
 st99:
 	if ( ++p == pe )
 		goto _test_eof99;
 case 99:
-#line 1465 "main/matrix.c"
+#line 2884 "main/matrix.c"
 	goto tr100;
 tr100:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1473,10 +2892,10 @@ st100:
 	if ( ++p == pe )
 		goto _test_eof100;
 case 100:
-#line 1477 "main/matrix.c"
+#line 2896 "main/matrix.c"
 	goto tr101;
 tr101:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1485,24 +2904,24 @@ st101:
 	if ( ++p == pe )
 		goto _test_eof101;
 case 101:
-#line 1489 "main/matrix.c"
+#line 2908 "main/matrix.c"
 	goto tr102;
 tr102:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st102;
 st102:
 	if ( ++p == pe )
 		goto _test_eof102;
 case 102:
-#line 1503 "main/matrix.c"
+#line 2922 "main/matrix.c"
 	goto tr103;
 tr103:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1511,10 +2930,10 @@ st103:
 	if ( ++p == pe )
 		goto _test_eof103;
 case 103:
-#line 1515 "main/matrix.c"
+#line 2934 "main/matrix.c"
 	goto tr104;
 tr104:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1523,24 +2942,24 @@ st104:
 	if ( ++p == pe )
 		goto _test_eof104;
 case 104:
-#line 1527 "main/matrix.c"
+#line 2946 "main/matrix.c"
 	goto tr105;
 tr105:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st105;
 st105:
 	if ( ++p == pe )
 		goto _test_eof105;
 case 105:
-#line 1541 "main/matrix.c"
+#line 2960 "main/matrix.c"
 	goto tr106;
 tr106:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1549,10 +2968,10 @@ st106:
 	if ( ++p == pe )
 		goto _test_eof106;
 case 106:
-#line 1553 "main/matrix.c"
+#line 2972 "main/matrix.c"
 	goto tr107;
 tr107:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1561,24 +2980,24 @@ st107:
 	if ( ++p == pe )
 		goto _test_eof107;
 case 107:
-#line 1565 "main/matrix.c"
+#line 2984 "main/matrix.c"
 	goto tr108;
 tr108:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st108;
 st108:
 	if ( ++p == pe )
 		goto _test_eof108;
 case 108:
-#line 1579 "main/matrix.c"
+#line 2998 "main/matrix.c"
 	goto tr109;
 tr109:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1587,10 +3006,10 @@ st109:
 	if ( ++p == pe )
 		goto _test_eof109;
 case 109:
-#line 1591 "main/matrix.c"
+#line 3010 "main/matrix.c"
 	goto tr110;
 tr110:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1599,24 +3018,24 @@ st110:
 	if ( ++p == pe )
 		goto _test_eof110;
 case 110:
-#line 1603 "main/matrix.c"
+#line 3022 "main/matrix.c"
 	goto tr111;
 tr111:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st111;
 st111:
 	if ( ++p == pe )
 		goto _test_eof111;
 case 111:
-#line 1617 "main/matrix.c"
+#line 3036 "main/matrix.c"
 	goto tr112;
 tr112:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1625,10 +3044,10 @@ st112:
 	if ( ++p == pe )
 		goto _test_eof112;
 case 112:
-#line 1629 "main/matrix.c"
+#line 3048 "main/matrix.c"
 	goto tr113;
 tr113:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1637,24 +3056,24 @@ st113:
 	if ( ++p == pe )
 		goto _test_eof113;
 case 113:
-#line 1641 "main/matrix.c"
+#line 3060 "main/matrix.c"
 	goto tr114;
 tr114:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st114;
 st114:
 	if ( ++p == pe )
 		goto _test_eof114;
 case 114:
-#line 1655 "main/matrix.c"
+#line 3074 "main/matrix.c"
 	goto tr115;
 tr115:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1663,10 +3082,10 @@ st115:
 	if ( ++p == pe )
 		goto _test_eof115;
 case 115:
-#line 1667 "main/matrix.c"
+#line 3086 "main/matrix.c"
 	goto tr116;
 tr116:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1675,24 +3094,24 @@ st116:
 	if ( ++p == pe )
 		goto _test_eof116;
 case 116:
-#line 1679 "main/matrix.c"
+#line 3098 "main/matrix.c"
 	goto tr117;
 tr117:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st117;
 st117:
 	if ( ++p == pe )
 		goto _test_eof117;
 case 117:
-#line 1693 "main/matrix.c"
+#line 3112 "main/matrix.c"
 	goto tr118;
 tr118:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1701,10 +3120,10 @@ st118:
 	if ( ++p == pe )
 		goto _test_eof118;
 case 118:
-#line 1705 "main/matrix.c"
+#line 3124 "main/matrix.c"
 	goto tr119;
 tr119:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1713,24 +3132,24 @@ st119:
 	if ( ++p == pe )
 		goto _test_eof119;
 case 119:
-#line 1717 "main/matrix.c"
+#line 3136 "main/matrix.c"
 	goto tr120;
 tr120:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st120;
 st120:
 	if ( ++p == pe )
 		goto _test_eof120;
 case 120:
-#line 1731 "main/matrix.c"
+#line 3150 "main/matrix.c"
 	goto tr121;
 tr121:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1739,10 +3158,10 @@ st121:
 	if ( ++p == pe )
 		goto _test_eof121;
 case 121:
-#line 1743 "main/matrix.c"
+#line 3162 "main/matrix.c"
 	goto tr122;
 tr122:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1751,24 +3170,24 @@ st122:
 	if ( ++p == pe )
 		goto _test_eof122;
 case 122:
-#line 1755 "main/matrix.c"
+#line 3174 "main/matrix.c"
 	goto tr123;
 tr123:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st123;
 st123:
 	if ( ++p == pe )
 		goto _test_eof123;
 case 123:
-#line 1769 "main/matrix.c"
+#line 3188 "main/matrix.c"
 	goto tr124;
 tr124:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1777,10 +3196,10 @@ st124:
 	if ( ++p == pe )
 		goto _test_eof124;
 case 124:
-#line 1781 "main/matrix.c"
+#line 3200 "main/matrix.c"
 	goto tr125;
 tr125:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1789,24 +3208,24 @@ st125:
 	if ( ++p == pe )
 		goto _test_eof125;
 case 125:
-#line 1793 "main/matrix.c"
+#line 3212 "main/matrix.c"
 	goto tr126;
 tr126:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st126;
 st126:
 	if ( ++p == pe )
 		goto _test_eof126;
 case 126:
-#line 1807 "main/matrix.c"
+#line 3226 "main/matrix.c"
 	goto tr127;
 tr127:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1815,10 +3234,10 @@ st127:
 	if ( ++p == pe )
 		goto _test_eof127;
 case 127:
-#line 1819 "main/matrix.c"
+#line 3238 "main/matrix.c"
 	goto tr128;
 tr128:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1827,24 +3246,24 @@ st128:
 	if ( ++p == pe )
 		goto _test_eof128;
 case 128:
-#line 1831 "main/matrix.c"
+#line 3250 "main/matrix.c"
 	goto tr129;
 tr129:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st129;
 st129:
 	if ( ++p == pe )
 		goto _test_eof129;
 case 129:
-#line 1845 "main/matrix.c"
+#line 3264 "main/matrix.c"
 	goto tr130;
 tr130:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1853,10 +3272,10 @@ st130:
 	if ( ++p == pe )
 		goto _test_eof130;
 case 130:
-#line 1857 "main/matrix.c"
+#line 3276 "main/matrix.c"
 	goto tr131;
 tr131:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1865,24 +3284,24 @@ st131:
 	if ( ++p == pe )
 		goto _test_eof131;
 case 131:
-#line 1869 "main/matrix.c"
+#line 3288 "main/matrix.c"
 	goto tr132;
 tr132:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st132;
 st132:
 	if ( ++p == pe )
 		goto _test_eof132;
 case 132:
-#line 1883 "main/matrix.c"
+#line 3302 "main/matrix.c"
 	goto tr133;
 tr133:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1891,10 +3310,10 @@ st133:
 	if ( ++p == pe )
 		goto _test_eof133;
 case 133:
-#line 1895 "main/matrix.c"
+#line 3314 "main/matrix.c"
 	goto tr134;
 tr134:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1903,24 +3322,24 @@ st134:
 	if ( ++p == pe )
 		goto _test_eof134;
 case 134:
-#line 1907 "main/matrix.c"
+#line 3326 "main/matrix.c"
 	goto tr135;
 tr135:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st135;
 st135:
 	if ( ++p == pe )
 		goto _test_eof135;
 case 135:
-#line 1921 "main/matrix.c"
+#line 3340 "main/matrix.c"
 	goto tr136;
 tr136:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1929,10 +3348,10 @@ st136:
 	if ( ++p == pe )
 		goto _test_eof136;
 case 136:
-#line 1933 "main/matrix.c"
+#line 3352 "main/matrix.c"
 	goto tr137;
 tr137:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1941,24 +3360,24 @@ st137:
 	if ( ++p == pe )
 		goto _test_eof137;
 case 137:
-#line 1945 "main/matrix.c"
+#line 3364 "main/matrix.c"
 	goto tr138;
 tr138:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st138;
 st138:
 	if ( ++p == pe )
 		goto _test_eof138;
 case 138:
-#line 1959 "main/matrix.c"
+#line 3378 "main/matrix.c"
 	goto tr139;
 tr139:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -1967,10 +3386,10 @@ st139:
 	if ( ++p == pe )
 		goto _test_eof139;
 case 139:
-#line 1971 "main/matrix.c"
+#line 3390 "main/matrix.c"
 	goto tr140;
 tr140:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -1979,24 +3398,24 @@ st140:
 	if ( ++p == pe )
 		goto _test_eof140;
 case 140:
-#line 1983 "main/matrix.c"
+#line 3402 "main/matrix.c"
 	goto tr141;
 tr141:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st141;
 st141:
 	if ( ++p == pe )
 		goto _test_eof141;
 case 141:
-#line 1997 "main/matrix.c"
+#line 3416 "main/matrix.c"
 	goto tr142;
 tr142:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2005,10 +3424,10 @@ st142:
 	if ( ++p == pe )
 		goto _test_eof142;
 case 142:
-#line 2009 "main/matrix.c"
+#line 3428 "main/matrix.c"
 	goto tr143;
 tr143:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2017,24 +3436,24 @@ st143:
 	if ( ++p == pe )
 		goto _test_eof143;
 case 143:
-#line 2021 "main/matrix.c"
+#line 3440 "main/matrix.c"
 	goto tr144;
 tr144:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st144;
 st144:
 	if ( ++p == pe )
 		goto _test_eof144;
 case 144:
-#line 2035 "main/matrix.c"
+#line 3454 "main/matrix.c"
 	goto tr145;
 tr145:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2043,10 +3462,10 @@ st145:
 	if ( ++p == pe )
 		goto _test_eof145;
 case 145:
-#line 2047 "main/matrix.c"
+#line 3466 "main/matrix.c"
 	goto tr146;
 tr146:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2055,24 +3474,24 @@ st146:
 	if ( ++p == pe )
 		goto _test_eof146;
 case 146:
-#line 2059 "main/matrix.c"
+#line 3478 "main/matrix.c"
 	goto tr147;
 tr147:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st147;
 st147:
 	if ( ++p == pe )
 		goto _test_eof147;
 case 147:
-#line 2073 "main/matrix.c"
+#line 3492 "main/matrix.c"
 	goto tr148;
 tr148:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2081,10 +3500,10 @@ st148:
 	if ( ++p == pe )
 		goto _test_eof148;
 case 148:
-#line 2085 "main/matrix.c"
+#line 3504 "main/matrix.c"
 	goto tr149;
 tr149:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2093,24 +3512,24 @@ st149:
 	if ( ++p == pe )
 		goto _test_eof149;
 case 149:
-#line 2097 "main/matrix.c"
+#line 3516 "main/matrix.c"
 	goto tr150;
 tr150:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st150;
 st150:
 	if ( ++p == pe )
 		goto _test_eof150;
 case 150:
-#line 2111 "main/matrix.c"
+#line 3530 "main/matrix.c"
 	goto tr151;
 tr151:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2119,10 +3538,10 @@ st151:
 	if ( ++p == pe )
 		goto _test_eof151;
 case 151:
-#line 2123 "main/matrix.c"
+#line 3542 "main/matrix.c"
 	goto tr152;
 tr152:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2131,24 +3550,24 @@ st152:
 	if ( ++p == pe )
 		goto _test_eof152;
 case 152:
-#line 2135 "main/matrix.c"
+#line 3554 "main/matrix.c"
 	goto tr153;
 tr153:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st153;
 st153:
 	if ( ++p == pe )
 		goto _test_eof153;
 case 153:
-#line 2149 "main/matrix.c"
+#line 3568 "main/matrix.c"
 	goto tr154;
 tr154:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2157,10 +3576,10 @@ st154:
 	if ( ++p == pe )
 		goto _test_eof154;
 case 154:
-#line 2161 "main/matrix.c"
+#line 3580 "main/matrix.c"
 	goto tr155;
 tr155:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2169,24 +3588,24 @@ st155:
 	if ( ++p == pe )
 		goto _test_eof155;
 case 155:
-#line 2173 "main/matrix.c"
+#line 3592 "main/matrix.c"
 	goto tr156;
 tr156:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st156;
 st156:
 	if ( ++p == pe )
 		goto _test_eof156;
 case 156:
-#line 2187 "main/matrix.c"
+#line 3606 "main/matrix.c"
 	goto tr157;
 tr157:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2195,10 +3614,10 @@ st157:
 	if ( ++p == pe )
 		goto _test_eof157;
 case 157:
-#line 2199 "main/matrix.c"
+#line 3618 "main/matrix.c"
 	goto tr158;
 tr158:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2207,24 +3626,24 @@ st158:
 	if ( ++p == pe )
 		goto _test_eof158;
 case 158:
-#line 2211 "main/matrix.c"
+#line 3630 "main/matrix.c"
 	goto tr159;
 tr159:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st159;
 st159:
 	if ( ++p == pe )
 		goto _test_eof159;
 case 159:
-#line 2225 "main/matrix.c"
+#line 3644 "main/matrix.c"
 	goto tr160;
 tr160:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2233,10 +3652,10 @@ st160:
 	if ( ++p == pe )
 		goto _test_eof160;
 case 160:
-#line 2237 "main/matrix.c"
+#line 3656 "main/matrix.c"
 	goto tr161;
 tr161:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2245,24 +3664,24 @@ st161:
 	if ( ++p == pe )
 		goto _test_eof161;
 case 161:
-#line 2249 "main/matrix.c"
+#line 3668 "main/matrix.c"
 	goto tr162;
 tr162:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st162;
 st162:
 	if ( ++p == pe )
 		goto _test_eof162;
 case 162:
-#line 2263 "main/matrix.c"
+#line 3682 "main/matrix.c"
 	goto tr163;
 tr163:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2271,10 +3690,10 @@ st163:
 	if ( ++p == pe )
 		goto _test_eof163;
 case 163:
-#line 2275 "main/matrix.c"
+#line 3694 "main/matrix.c"
 	goto tr164;
 tr164:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2283,24 +3702,24 @@ st164:
 	if ( ++p == pe )
 		goto _test_eof164;
 case 164:
-#line 2287 "main/matrix.c"
+#line 3706 "main/matrix.c"
 	goto tr165;
 tr165:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st165;
 st165:
 	if ( ++p == pe )
 		goto _test_eof165;
 case 165:
-#line 2301 "main/matrix.c"
+#line 3720 "main/matrix.c"
 	goto tr166;
 tr166:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2309,10 +3728,10 @@ st166:
 	if ( ++p == pe )
 		goto _test_eof166;
 case 166:
-#line 2313 "main/matrix.c"
+#line 3732 "main/matrix.c"
 	goto tr167;
 tr167:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2321,24 +3740,24 @@ st167:
 	if ( ++p == pe )
 		goto _test_eof167;
 case 167:
-#line 2325 "main/matrix.c"
+#line 3744 "main/matrix.c"
 	goto tr168;
 tr168:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st168;
 st168:
 	if ( ++p == pe )
 		goto _test_eof168;
 case 168:
-#line 2339 "main/matrix.c"
+#line 3758 "main/matrix.c"
 	goto tr169;
 tr169:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2347,10 +3766,10 @@ st169:
 	if ( ++p == pe )
 		goto _test_eof169;
 case 169:
-#line 2351 "main/matrix.c"
+#line 3770 "main/matrix.c"
 	goto tr170;
 tr170:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2359,24 +3778,24 @@ st170:
 	if ( ++p == pe )
 		goto _test_eof170;
 case 170:
-#line 2363 "main/matrix.c"
+#line 3782 "main/matrix.c"
 	goto tr171;
 tr171:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st171;
 st171:
 	if ( ++p == pe )
 		goto _test_eof171;
 case 171:
-#line 2377 "main/matrix.c"
+#line 3796 "main/matrix.c"
 	goto tr172;
 tr172:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2385,10 +3804,10 @@ st172:
 	if ( ++p == pe )
 		goto _test_eof172;
 case 172:
-#line 2389 "main/matrix.c"
+#line 3808 "main/matrix.c"
 	goto tr173;
 tr173:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2397,24 +3816,24 @@ st173:
 	if ( ++p == pe )
 		goto _test_eof173;
 case 173:
-#line 2401 "main/matrix.c"
+#line 3820 "main/matrix.c"
 	goto tr174;
 tr174:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st174;
 st174:
 	if ( ++p == pe )
 		goto _test_eof174;
 case 174:
-#line 2415 "main/matrix.c"
+#line 3834 "main/matrix.c"
 	goto tr175;
 tr175:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2423,10 +3842,10 @@ st175:
 	if ( ++p == pe )
 		goto _test_eof175;
 case 175:
-#line 2427 "main/matrix.c"
+#line 3846 "main/matrix.c"
 	goto tr176;
 tr176:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2435,24 +3854,24 @@ st176:
 	if ( ++p == pe )
 		goto _test_eof176;
 case 176:
-#line 2439 "main/matrix.c"
+#line 3858 "main/matrix.c"
 	goto tr177;
 tr177:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st177;
 st177:
 	if ( ++p == pe )
 		goto _test_eof177;
 case 177:
-#line 2453 "main/matrix.c"
+#line 3872 "main/matrix.c"
 	goto tr178;
 tr178:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2461,10 +3880,10 @@ st178:
 	if ( ++p == pe )
 		goto _test_eof178;
 case 178:
-#line 2465 "main/matrix.c"
+#line 3884 "main/matrix.c"
 	goto tr179;
 tr179:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2473,24 +3892,24 @@ st179:
 	if ( ++p == pe )
 		goto _test_eof179;
 case 179:
-#line 2477 "main/matrix.c"
+#line 3896 "main/matrix.c"
 	goto tr180;
 tr180:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st180;
 st180:
 	if ( ++p == pe )
 		goto _test_eof180;
 case 180:
-#line 2491 "main/matrix.c"
+#line 3910 "main/matrix.c"
 	goto tr181;
 tr181:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2499,10 +3918,10 @@ st181:
 	if ( ++p == pe )
 		goto _test_eof181;
 case 181:
-#line 2503 "main/matrix.c"
+#line 3922 "main/matrix.c"
 	goto tr182;
 tr182:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2511,24 +3930,24 @@ st182:
 	if ( ++p == pe )
 		goto _test_eof182;
 case 182:
-#line 2515 "main/matrix.c"
+#line 3934 "main/matrix.c"
 	goto tr183;
 tr183:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st183;
 st183:
 	if ( ++p == pe )
 		goto _test_eof183;
 case 183:
-#line 2529 "main/matrix.c"
+#line 3948 "main/matrix.c"
 	goto tr184;
 tr184:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2537,10 +3956,10 @@ st184:
 	if ( ++p == pe )
 		goto _test_eof184;
 case 184:
-#line 2541 "main/matrix.c"
+#line 3960 "main/matrix.c"
 	goto tr185;
 tr185:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2549,24 +3968,24 @@ st185:
 	if ( ++p == pe )
 		goto _test_eof185;
 case 185:
-#line 2553 "main/matrix.c"
+#line 3972 "main/matrix.c"
 	goto tr186;
 tr186:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st186;
 st186:
 	if ( ++p == pe )
 		goto _test_eof186;
 case 186:
-#line 2567 "main/matrix.c"
+#line 3986 "main/matrix.c"
 	goto tr187;
 tr187:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2575,10 +3994,10 @@ st187:
 	if ( ++p == pe )
 		goto _test_eof187;
 case 187:
-#line 2579 "main/matrix.c"
+#line 3998 "main/matrix.c"
 	goto tr188;
 tr188:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2587,24 +4006,24 @@ st188:
 	if ( ++p == pe )
 		goto _test_eof188;
 case 188:
-#line 2591 "main/matrix.c"
+#line 4010 "main/matrix.c"
 	goto tr189;
 tr189:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st189;
 st189:
 	if ( ++p == pe )
 		goto _test_eof189;
 case 189:
-#line 2605 "main/matrix.c"
+#line 4024 "main/matrix.c"
 	goto tr190;
 tr190:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2613,10 +4032,10 @@ st190:
 	if ( ++p == pe )
 		goto _test_eof190;
 case 190:
-#line 2617 "main/matrix.c"
+#line 4036 "main/matrix.c"
 	goto tr191;
 tr191:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2625,24 +4044,24 @@ st191:
 	if ( ++p == pe )
 		goto _test_eof191;
 case 191:
-#line 2629 "main/matrix.c"
+#line 4048 "main/matrix.c"
 	goto tr192;
 tr192:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st192;
 st192:
 	if ( ++p == pe )
 		goto _test_eof192;
 case 192:
-#line 2643 "main/matrix.c"
+#line 4062 "main/matrix.c"
 	goto tr193;
 tr193:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2651,10 +4070,10 @@ st193:
 	if ( ++p == pe )
 		goto _test_eof193;
 case 193:
-#line 2655 "main/matrix.c"
+#line 4074 "main/matrix.c"
 	goto tr194;
 tr194:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2663,24 +4082,24 @@ st194:
 	if ( ++p == pe )
 		goto _test_eof194;
 case 194:
-#line 2667 "main/matrix.c"
+#line 4086 "main/matrix.c"
 	goto tr195;
 tr195:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st195;
 st195:
 	if ( ++p == pe )
 		goto _test_eof195;
 case 195:
-#line 2681 "main/matrix.c"
+#line 4100 "main/matrix.c"
 	goto tr196;
 tr196:
-#line 279 "main/matrix.c.rl"
+#line 1640 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].r = *p;
         }
@@ -2689,10 +4108,10 @@ st196:
 	if ( ++p == pe )
 		goto _test_eof196;
 case 196:
-#line 2693 "main/matrix.c"
+#line 4112 "main/matrix.c"
 	goto tr197;
 tr197:
-#line 283 "main/matrix.c.rl"
+#line 1644 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].g = *p;
         }
@@ -2701,21 +4120,21 @@ st197:
 	if ( ++p == pe )
 		goto _test_eof197;
 case 197:
-#line 2705 "main/matrix.c"
+#line 4124 "main/matrix.c"
 	goto tr198;
 tr198:
-#line 287 "main/matrix.c.rl"
+#line 1648 "main/matrix.c.rl"
 	{
             display_event.display_buf[color_i].b = *p;
         }
-#line 326 "main/matrix.c.rl"
+#line 1741 "main/matrix.c.rl"
 	{ color_i += 1; }
 	goto st198;
 st198:
 	if ( ++p == pe )
 		goto _test_eof198;
 case 198:
-#line 2719 "main/matrix.c"
+#line 4138 "main/matrix.c"
 	if ( (*p) == 13 )
 		goto st199;
 	goto tr199;
@@ -2727,18 +4146,19 @@ case 199:
 		goto tr201;
 	goto tr199;
 tr201:
-#line 291 "main/matrix.c.rl"
+#line 1652 "main/matrix.c.rl"
 	{
-            xQueueSend(event_queue, &display_event, 0);
+            display_event.read_us = nats_msg_read_us;
+            nats_queue_display_event(&display_event);
         }
-#line 328 "main/matrix.c.rl"
+#line 1743 "main/matrix.c.rl"
 	{ {goto st208;} }
 	goto st218;
 st218:
 	if ( ++p == pe )
 		goto _test_eof218;
 case 218:
-#line 2742 "main/matrix.c"
+#line 4162 "main/matrix.c"
 	goto tr199;
 st200:
 	if ( ++p == pe )
@@ -2755,23 +4175,24 @@ case 201:
 		goto tr204;
 	goto tr202;
 tr204:
-#line 270 "main/matrix.c.rl"
+#line 1630 "main/matrix.c.rl"
 	{
-            ESP_LOGI("nats_task", "PONG");
+            MATRIX_LOG('I', 1, "nats_task", "PONG");
+            trace_record(&trace, TRACE_PING, xPortGetCoreID(), esp_timer_get_time(), 0);
             bytes_written = write(sockfd, "PONG\r\n", strlen("PONG\r\n"));
             if (-1 == bytes_written || 0 == bytes_written) {
                 ESP_LOGE("nats_task", "Failed to PONG!");
                 esp_restart();
             }
         }
-#line 331 "main/matrix.c.rl"
+#line 1762 "main/matrix.c.rl"
 	{ {goto st208;} }
 	goto st219;
 st219:
 	if ( ++p == pe )
 		goto _test_eof219;
 case 219:
-#line 2775 "main/matrix.c"
+#line 4196 "main/matrix.c"
 	goto tr202;
 st202:
 	if ( ++p == pe )
@@ -2811,14 +4232,14 @@ case 206:
 		goto tr211;
 	goto tr208;
 tr211:
-#line 338 "main/matrix.c.rl"
+#line 1769 "main/matrix.c.rl"
 	{ {goto st208;} }
 	goto st220;
 st220:
 	if ( ++p == pe )
 		goto _test_eof220;
 case 220:
-#line 2822 "main/matrix.c"
+#line 4243 "main/matrix.c"
 	goto tr208;
 st207:
 	if ( ++p == pe )
@@ -2859,22 +4280,22 @@ case 211:
 		goto tr218;
 	goto tr212;
 tr218:
-#line 341 "main/matrix.c.rl"
+#line 1772 "main/matrix.c.rl"
 	{ {goto st202;} }
 	goto st221;
 tr220:
-#line 343 "main/matrix.c.rl"
-	{ {goto st16;} }
+#line 1774 "main/matrix.c.rl"
+	{ nats_msg_read_us = read_us; trace_record(&trace, TRACE_MSG, xPortGetCoreID(), read_us, 0); {goto st16;} }
 	goto st221;
 tr223:
-#line 342 "main/matrix.c.rl"
+#line 1773 "main/matrix.c.rl"
 	{ {goto st200;} }
 	goto st221;
 st221:
 	if ( ++p == pe )
 		goto _test_eof221;
 case 221:
-#line 2878 "main/matrix.c"
+#line 4299 "main/matrix.c"
 	goto tr212;
 st212:
 	if ( ++p == pe )
@@ -2911,6 +4332,188 @@ case 216:
 	if ( (*p) == 71 )
 		goto tr223;
 	goto tr212;
+st223:
+	if ( ++p == pe )
+		goto _test_eof223;
+case 223:
+	switch( (*p) ) {
+		case 46: goto tr226;
+		case 95: goto tr226;
+	}
+	if ( (*p) < 97 ) {
+		if ( 48 <= (*p) && (*p) <= 57 )
+			goto tr226;
+	} else if ( (*p) <= 122 )
+		goto tr226;
+	goto tr225;
+tr225:
+#line 1756 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_MSG_SUBJECT]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_msg_subject", "err: %c (0x%02x)", *p, *p); {goto st208;} }
+	goto st0;
+tr226:
+#line 1657 "main/matrix.c.rl"
+	{
+            subject_i = 0;
+        }
+#line 1661 "main/matrix.c.rl"
+	{
+            if (subject_i < NATS_SUBJECT_LEN - 1) {
+                subject[subject_i++] = *p;
+            }
+        }
+	goto st224;
+tr227:
+#line 1661 "main/matrix.c.rl"
+	{
+            if (subject_i < NATS_SUBJECT_LEN - 1) {
+                subject[subject_i++] = *p;
+            }
+        }
+	goto st224;
+st224:
+	if ( ++p == pe )
+		goto _test_eof224;
+case 224:
+#line 4378 "main/matrix.c"
+	switch( (*p) ) {
+		case 32: goto st225;
+		case 46: goto tr227;
+		case 95: goto tr227;
+	}
+	if ( (*p) < 97 ) {
+		if ( 48 <= (*p) && (*p) <= 57 )
+			goto tr227;
+	} else if ( (*p) <= 122 )
+		goto tr227;
+	goto tr225;
+st225:
+	if ( ++p == pe )
+		goto _test_eof225;
+case 225:
+	if ( 48 <= (*p) && (*p) <= 57 )
+		goto st226;
+	goto tr225;
+st226:
+	if ( ++p == pe )
+		goto _test_eof226;
+case 226:
+	if ( (*p) == 32 )
+		goto st227;
+	if ( 48 <= (*p) && (*p) <= 57 )
+		goto st226;
+	goto tr225;
+st227:
+	if ( ++p == pe )
+		goto _test_eof227;
+case 227:
+	if ( 48 <= (*p) && (*p) <= 57 )
+		goto tr230;
+	goto tr225;
+tr230:
+#line 1667 "main/matrix.c.rl"
+	{
+            payload_len = 0;
+        }
+#line 1671 "main/matrix.c.rl"
+	{
+            payload_len = payload_len * 10 + (*p - '0');
+        }
+	goto st228;
+tr232:
+#line 1671 "main/matrix.c.rl"
+	{
+            payload_len = payload_len * 10 + (*p - '0');
+        }
+	goto st228;
+st228:
+	if ( ++p == pe )
+		goto _test_eof228;
+case 228:
+#line 4433 "main/matrix.c"
+	if ( (*p) == 13 )
+		goto st229;
+	if ( 48 <= (*p) && (*p) <= 57 )
+		goto tr232;
+	goto tr225;
+st229:
+	if ( ++p == pe )
+		goto _test_eof229;
+case 229:
+	if ( (*p) == 10 )
+		goto tr234;
+	goto tr225;
+tr234:
+#line 1675 "main/matrix.c.rl"
+	{
+            subject[subject_i] = '\0';
+            payload_i = 0;
+            if (0 == payload_len) {
+                {goto st232;}
+            }
+            {goto st231;}
+        }
+	goto st230;
+st230:
+	if ( ++p == pe )
+		goto _test_eof230;
+case 230:
+#line 4461 "main/matrix.c"
+	goto tr225;
+tr235:
+#line 1684 "main/matrix.c.rl"
+	{
+            if (payload_i < NATS_PAYLOAD_LEN) {
+                nats_payload[payload_i] = *p;
+            }
+            payload_i += 1;
+            if (payload_i == payload_len) {
+                {goto st232;}
+            }
+        }
+	goto st231;
+st231:
+	if ( ++p == pe )
+		goto _test_eof231;
+case 231:
+#line 4479 "main/matrix.c"
+	goto tr235;
+st232:
+	if ( ++p == pe )
+		goto _test_eof232;
+case 232:
+	if ( (*p) == 13 )
+		goto st233;
+	goto tr236;
+tr236:
+#line 1760 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_MSG_END]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_msg_end", "err: %c (0x%02x)", *p, *p); {goto st208;} }
+	goto st0;
+st233:
+	if ( ++p == pe )
+		goto _test_eof233;
+case 233:
+	if ( (*p) == 10 )
+		goto tr238;
+	goto tr236;
+tr238:
+#line 1694 "main/matrix.c.rl"
+	{
+            if (payload_len > NATS_PAYLOAD_LEN) {
+                MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "dropping %u byte message", payload_len);
+                telemetry.dropped++;
+            } else {
+                nats_dispatch(subject, nats_payload, payload_len);
+            }
+        }
+#line 1760 "main/matrix.c.rl"
+	{ {goto st208;} }
+	goto st234;
+st234:
+	if ( ++p == pe )
+		goto _test_eof234;
+case 234:
+#line 4516 "main/matrix.c"
+	goto tr236;
 	}
 	_test_eof2: cs = 2; goto _test_eof; 
 	_test_eof3: cs = 3; goto _test_eof; 
@@ -3132,30 +4735,225 @@ case 216:
 	_test_eof214: cs = 214; goto _test_eof; 
 	_test_eof215: cs = 215; goto _test_eof; 
 	_test_eof216: cs = 216; goto _test_eof; 
+	_test_eof222: cs = 222; goto _test_eof; 
+	_test_eof223: cs = 223; goto _test_eof; 
+	_test_eof224: cs = 224; goto _test_eof; 
+	_test_eof225: cs = 225; goto _test_eof; 
+	_test_eof226: cs = 226; goto _test_eof; 
+	_test_eof227: cs = 227; goto _test_eof; 
+	_test_eof228: cs = 228; goto _test_eof; 
+	_test_eof229: cs = 229; goto _test_eof; 
+	_test_eof230: cs = 230; goto _test_eof; 
+	_test_eof231: cs = 231; goto _test_eof; 
+	_test_eof232: cs = 232; goto _test_eof; 
+	_test_eof233: cs = 233; goto _test_eof; 
+	_test_eof234: cs = 234; goto _test_eof; 
 
 	_test_eof: {}
 	if ( p == eof )
 	{
 	switch ( cs ) {
+	case 16: 
+	case 17: 
+	case 18: 
+	case 19: 
+	case 20: 
+	case 21: 
+	case 22: 
+	case 23: 
+	case 24: 
+	case 25: 
+	case 26: 
+	case 27: 
+	case 28: 
+	case 29: 
+	case 30: 
+	case 31: 
+	case 32: 
+	case 33: 
+	case 34: 
+	case 35: 
+	case 36: 
+	case 37: 
+	case 38: 
+	case 39: 
+	case 40: 
+	case 41: 
+	case 42: 
+	case 43: 
+	case 44: 
+	case 45: 
+	case 46: 
+	case 47: 
+	case 48: 
+	case 49: 
+	case 50: 
+	case 51: 
+	case 52: 
+	case 53: 
+	case 54: 
+	case 55: 
+	case 56: 
+	case 57: 
+	case 58: 
+	case 59: 
+	case 60: 
+	case 61: 
+	case 62: 
+	case 63: 
+	case 64: 
+	case 65: 
+	case 66: 
+	case 67: 
+	case 68: 
+	case 69: 
+	case 70: 
+	case 71: 
+	case 72: 
+	case 73: 
+	case 74: 
+	case 75: 
+	case 76: 
+	case 77: 
+	case 78: 
+	case 79: 
+	case 80: 
+	case 81: 
+	case 82: 
+	case 83: 
+	case 84: 
+	case 85: 
+	case 86: 
+	case 87: 
+	case 88: 
+	case 89: 
+	case 90: 
+	case 91: 
+	case 92: 
+	case 93: 
+	case 94: 
+	case 95: 
+	case 96: 
+	case 97: 
+	case 98: 
+	case 99: 
+	case 100: 
+	case 101: 
+	case 102: 
+	case 103: 
+	case 104: 
+	case 105: 
+	case 106: 
+	case 107: 
+	case 108: 
+	case 109: 
+	case 110: 
+	case 111: 
+	case 112: 
+	case 113: 
+	case 114: 
+	case 115: 
+	case 116: 
+	case 117: 
+	case 118: 
+	case 119: 
+	case 120: 
+	case 121: 
+	case 122: 
+	case 123: 
+	case 124: 
+	case 125: 
+	case 126: 
+	case 127: 
+	case 128: 
+	case 129: 
+	case 130: 
+	case 131: 
+	case 132: 
+	case 133: 
+	case 134: 
+	case 135: 
+	case 136: 
+	case 137: 
+	case 138: 
+	case 139: 
+	case 140: 
+	case 141: 
+	case 142: 
+	case 143: 
+	case 144: 
+	case 145: 
+	case 146: 
+	case 147: 
+	case 148: 
+	case 149: 
+	case 150: 
+	case 151: 
+	case 152: 
+	case 153: 
+	case 154: 
+	case 155: 
+	case 156: 
+	case 157: 
+	case 158: 
+	case 159: 
+	case 160: 
+	case 161: 
+	case 162: 
+	case 163: 
+	case 164: 
+	case 165: 
+	case 166: 
+	case 167: 
+	case 168: 
+	case 169: 
+	case 170: 
+	case 171: 
+	case 172: 
+	case 173: 
+	case 174: 
+	case 175: 
+	case 176: 
+	case 177: 
+	case 178: 
+	case 179: 
+	case 180: 
+	case 181: 
+	case 182: 
+	case 183: 
+	case 184: 
+	case 185: 
+	case 186: 
+	case 187: 
+	case 188: 
+	case 189: 
+	case 190: 
+	case 191: 
+	case 192: 
+	case 193: 
+	case 194: 
+	case 195: 
+	case 196: 
+	case 197: 
 	case 198: 
 	case 199: 
-#line 329 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task_msg", "err: %c (0x%02x)", *p, *p); {       if ( p == pe )
+#line 1748 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_MSG]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_msg", "err: %c (0x%02x)", *p, *p); {       if ( p == pe )
                goto _test_eof208;
 goto st208;} }
 	break;
 	case 200: 
 	case 201: 
-#line 331 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task_ping", "err: %c (0x%02x)", *p, *p); {       if ( p == pe )
+#line 1762 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_PING]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_ping", "err: %c (0x%02x)", *p, *p); {       if ( p == pe )
                goto _test_eof208;
 goto st208;} }
 	break;
 	case 205: 
 	case 206: 
 	case 207: 
-#line 337 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task_info", "err: %c (0x%02x)", *p, *p); {       if ( p == pe )
+#line 1768 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_INFO]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_info", "err: %c (0x%02x)", *p, *p); {       if ( p == pe )
                goto _test_eof208;
 goto st208;} }
 	break;
@@ -3168,8 +4966,8 @@ goto st208;} }
 	case 214: 
 	case 215: 
 	case 216: 
-#line 344 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task", "err in loop: %c (0x%02x) in state %d", *p, *p, cs); {       if ( p == pe )
+#line 1775 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_LOOP]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "err in loop: %c (0x%02x) in state %d", *p, *p, cs); {       if ( p == pe )
                goto _test_eof208;
 goto st208;} }
 	break;
@@ -3177,17 +4975,36 @@ goto st208;} }
 	case 9: 
 	case 10: 
 	case 15: 
-#line 350 "main/matrix.c.rl"
-	{ ESP_LOGE("nats_task", "err: %c (0x%02x)", *p, *p); }
+#line 1781 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_MAIN]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "err: %c (0x%02x)", *p, *p); }
+	break;
+	case 223: 
+	case 224: 
+	case 225: 
+	case 226: 
+	case 227: 
+	case 228: 
+	case 229: 
+#line 1756 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_MSG_SUBJECT]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_msg_subject", "err: %c (0x%02x)", *p, *p); {       if ( p == pe )
+               goto _test_eof208;
+goto st208;} }
+	break;
+	case 232: 
+	case 233: 
+#line 1760 "main/matrix.c.rl"
+	{ telemetry.parse_errors[TELEMETRY_NATS_MSG_END]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_msg_end", "err: %c (0x%02x)", *p, *p); {       if ( p == pe )
+               goto _test_eof208;
+goto st208;} }
 	break;
-#line 3184 "main/matrix.c"
+#line 5001 "main/matrix.c"
 	}
 	}
 
 	_out: {}
 	}
 
-#line 432 "main/matrix.c.rl"
+#line 1901 "main/matrix.c.rl"
 
         } while(1);
 
@@ -3196,6 +5013,77 @@ goto st208;} }
 }
 
 
+// Loads the color calibration saved in nvs, if there is any.
+static void color_cal_restore (
+    struct color_cal_s * cal,
+    uint8_t * data
+)
+{
+    nvs_handle_t nvs;
+    size_t len = NATS_PAYLOAD_LEN;
+    esp_err_t ret;
+
+    ret = nvs_open(COLOR_CAL_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (ESP_OK != ret) {
+        return;
+    }
+    ret = nvs_get_blob(nvs, COLOR_CAL_NVS_KEY, data, &len);
+    nvs_close(nvs);
+    if (ESP_OK != ret) {
+        return;
+    }
+
+    if (0 != color_cal_load(cal, NUM_PIXELS, data, len)) {
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "color calibration in nvs is bad, ignoring its %u bytes", len);
+        return;
+    }
+    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "loaded %u bytes of color calibration from nvs", len);
+}
+
+
+// Saves the color calibration to nvs, or removes it if len is 0.
+static void color_cal_save (
+    const uint8_t * data,
+    uint32_t len
+)
+{
+    nvs_handle_t nvs;
+    esp_err_t ret;
+
+    ret = nvs_open(COLOR_CAL_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ESP_OK != ret) {
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "nvs_open() returned %d", ret);
+        return;
+    }
+
+    if (0 == len) {
+        ret = nvs_erase_key(nvs, COLOR_CAL_NVS_KEY);
+        if (ESP_ERR_NVS_NOT_FOUND == ret) {
+            ret = ESP_OK;
+        }
+    } else {
+        ret = nvs_set_blob(nvs, COLOR_CAL_NVS_KEY, data, len);
+    }
+    if (ESP_OK == ret) {
+        ret = nvs_commit(nvs);
+    }
+    if (ESP_OK != ret) {
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "could not save color calibration: %d", ret);
+    }
+    nvs_close(nvs);
+}
+
+
+// Encoded frames are sent from where frame_cache keeps them, so they have
+// to be in memory the SPI DMA can get at.
+static void * matrix_cache_alloc (
+    size_t size
+)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_DMA);
+}
+
+
 static void led_task (
     void * arg
 )
@@ -3207,11 +5095,411 @@ static void led_task (
     int64_t tv_sec_diff;
     int64_t tv_nsec_diff;
     uint32_t sleep_ms;
+    uint32_t wait_ms;
+    int64_t tick_us = 0;
+    int64_t dequeued_us = 0;
+    int64_t delay_us;
+
+    // These are too big for the stack of this task.
+    static struct control_event_s control_event;
+    static struct shader_vm_s shader_vm;
+    static struct matrix_rgb_s shown[NUM_PIXELS];
+    static uint16_t pixel_map[NUM_PIXELS];
+    static struct color_lut_s color_lut;
+    static uint8_t dither[NUM_PIXELS][3];
+    static uint8_t wire[NUM_PIXELS][3];
+    static struct matrix_rgb16_s shown16[NUM_PIXELS];
+    static struct power_limit_s power_limit;
+    static struct color_cal_s color_cal;
+    static uint8_t color_cal_segment[NUM_PIXELS];
+    static struct frame_skip_s frame_skip;
+    static struct frame_prefix_s frame_prefix;
+    static uint8_t frame_prefix_last[NUM_PIXELS][3];
+    static struct frame_cache_s frame_cache;
+    static struct frame_clock_s frame_clock;
+    struct matrix_encode_s encoder = {
+        .map = pixel_map,
+        .lut = &color_lut,
+        .cal = &color_cal,
+        .dither = dither,
+        .wire = wire,
+        .power = &power_limit,
+        .prefix = &frame_prefix,
+        .cache = &frame_cache
+    };
+    uint32_t power_report_ms = 0;
+    bool shown_wide = false;
+    bool shader_loaded = false;
+    bool redraw = false;
+    bool dirty;
+    uint32_t now_ms;
+    uint16_t gamma[3];
+    uint16_t rate_hz;
+    char driver_order[5];
+    struct led_driver_s driver;
+    static const struct matrix_output_s * outputs[] = {
+        &matrix_output_spi,
+        &matrix_output_rmt,
+        &matrix_output_i2s,
+        &matrix_output_split
+    };
+    struct led_split_s split;
+
+    // Until told otherwise, frames are in the same order as the strip.
+    pixel_map_build(pixel_map, MATRIX_WIDTH, MATRIX_HEIGHT, &(struct pixel_map_layout_s){0});
+    color_lut_init(&color_lut);
+    power_limit_init(&power_limit);
+    color_cal_init(&color_cal, color_cal_segment);
+    color_cal_restore(&color_cal, control_event.data);
+    frame_skip_init(&frame_skip);
+    frame_prefix_init(&frame_prefix, frame_prefix_last);
+    frame_cache_init(&frame_cache, matrix_cache_alloc, heap_caps_free);
+    frame_clock_init(&frame_clock);
 
 
     while(1) {
-        qres = xQueueReceive(event_queue, &display_event, portMAX_DELAY);
+        while (pdTRUE == xQueueReceive(control_queue, &control_event, 0)) {
+
+            // Most control messages change how frames are encoded, so to be
+            // safe, none of the encoded frames kept so far are used again.
+            frame_cache_invalidate(&frame_cache);
+
+            trace_record(&trace, TRACE_CONTROL, xPortGetCoreID(), esp_timer_get_time(), control_event.type);
+            switch (control_event.type) {
+                case CONTROL_SHADER_LOAD:
+                    if (0 != shader_vm_load(&shader_vm, control_event.data, control_event.len)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting malformed shader of %u bytes", control_event.len);
+                        break;
+                    }
+                    shader_loaded = true;
+                    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "loaded shader with %u instructions", shader_vm.len);
+                    break;
+
+                case CONTROL_SHADER_CLEAR:
+                    shader_loaded = false;
+                    break;
+
+                // Payload is struct pixel_map_layout_s.
+                case CONTROL_MAP_LAYOUT:
+                    if (sizeof(struct pixel_map_layout_s) != control_event.len ||
+                        0 != pixel_map_build(pixel_map, MATRIX_WIDTH, MATRIX_HEIGHT,
+                                (struct pixel_map_layout_s *)control_event.data))
+                    {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad pixel map layout of %u bytes", control_event.len);
+                        break;
+                    }
+                    redraw = true;
+                    break;
+
+                case CONTROL_MAP_TABLE:
+                    if (0 != pixel_map_load(pixel_map, NUM_PIXELS, control_event.data, control_event.len)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad pixel map table of %u bytes", control_event.len);
+                        break;
+                    }
+                    redraw = true;
+                    break;
+
+                // Payload is the gamma of r, g and b in hundredths, as
+                // little-endian uint16_t.
+                case CONTROL_GAMMA:
+                    if (6 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad gamma of %u bytes", control_event.len);
+                        break;
+                    }
+                    for (int c = 0; c < 3; c++) {
+                        gamma[c] = control_event.data[c*2] | (control_event.data[c*2 + 1] << 8);
+                    }
+                    if (0 != color_lut_set_gamma(&color_lut, gamma)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad gamma %u %u %u", gamma[0], gamma[1], gamma[2]);
+                        break;
+                    }
+                    redraw = true;
+                    break;
+
+                // Payload is the brightness, optionally followed by how many
+                // milliseconds to ramp to it over, as a little-endian
+                // uint16_t.
+                case CONTROL_BRIGHTNESS:
+                    if (1 != control_event.len && 3 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad brightness of %u bytes", control_event.len);
+                        break;
+                    }
+                    color_lut_set_brightness(&color_lut, control_event.data[0],
+                            3 == control_event.len ? control_event.data[1] | (control_event.data[2] << 8) : 0,
+                            xTaskGetTickCount() * portTICK_PERIOD_MS);
+                    redraw = true;
+                    break;
+
+                // Payload is the budget in mA as a little-endian uint32_t,
+                // optionally followed by the mA of the r, g and b channels at
+                // full brightness and the idle mA of one LED, as
+                // little-endian uint16_t.
+                case CONTROL_POWER:
+                    if (4 != control_event.len && 12 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad power budget of %u bytes", control_event.len);
+                        break;
+                    }
+                    power_limit.budget_ma = control_event.data[0] | (control_event.data[1] << 8) |
+                        (control_event.data[2] << 16) | ((uint32_t)control_event.data[3] << 24);
+                    if (12 == control_event.len) {
+                        for (int c = 0; c < 3; c++) {
+                            power_limit.channel_ma[c] = control_event.data[4 + c*2] | (control_event.data[5 + c*2] << 8);
+                        }
+                        power_limit.idle_ma = control_event.data[10] | (control_event.data[11] << 8);
+                    }
+                    redraw = true;
+                    break;
+
+                // See color_cal_load for the payload. It is kept in nvs, so
+                // that the wall stays calibrated across reboots.
+                case CONTROL_CAL:
+                    if (0 != color_cal_load(&color_cal, NUM_PIXELS, control_event.data, control_event.len)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad color calibration of %u bytes", control_event.len);
+                        break;
+                    }
+                    color_cal_save(control_event.data, control_event.len);
+                    redraw = true;
+                    break;
+
+                // Payload is the chipset (enum led_driver_type_e), optionally
+                // followed by the order of its channels, as in "grb".
+                case CONTROL_DRIVER:
+                    if (0 == control_event.len || control_event.len > 5) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad driver of %u bytes", control_event.len);
+                        break;
+                    }
+                    memcpy(driver_order, &control_event.data[1], control_event.len - 1);
+                    driver_order[control_event.len - 1] = '\0';
+                    if (0 != led_driver_init(&driver, control_event.data[0], 1 == control_event.len ? NULL : driver_order) ||
+                        0 != matrix_display_reconfigure(&driver, matrix_output))
+                    {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad driver %u", control_event.data[0]);
+                        break;
+                    }
+                    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "now driving chipset %u", led_driver.type);
+                    frame_prefix_invalidate(&frame_prefix);
+
+                    // Frames may take longer to go out now.
+                    frame_clock_set_rate(&frame_clock, frame_clock.rate_hz,
+                            led_driver_frame_us(&led_driver, NUM_PIXELS), esp_timer_get_time());
+                    redraw = true;
+                    break;
+
+                // Payload is 0 for SPI, 1 for RMT, 2 for I2S, 3 for SPI2,
+                // SPI3 and RMT together.
+                case CONTROL_OUTPUT:
+                    if (1 != control_event.len || control_event.data[0] >= sizeof(outputs) / sizeof(outputs[0]) ||
+                        0 != matrix_display_reconfigure(&led_driver, outputs[control_event.data[0]]))
+                    {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad output %u", control_event.data[0]);
+                        break;
+                    }
+                    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "now driving the strip over output %u", control_event.data[0]);
+                    frame_prefix_invalidate(&frame_prefix);
+                    redraw = true;
+                    break;
+
+                // See led_split_load for the payload.
+                case CONTROL_SPLIT:
+                    split = led_split;
+                    if (0 != led_split_load(&split, NUM_PIXELS, control_event.data, control_event.len) ||
+                        !GPIO_IS_VALID_OUTPUT_GPIO(split.pin[0]) ||
+                        !GPIO_IS_VALID_OUTPUT_GPIO(split.pin[1]) ||
+                        !GPIO_IS_VALID_OUTPUT_GPIO(split.pin[2]))
+                    {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad split of %u bytes", control_event.len);
+                        break;
+                    }
+                    if (&matrix_output_split != matrix_output) {
+                        led_split = split;
+                        break;
+                    }
+                    matrix_output->wait();
+                    matrix_output->close();
+                    led_split = split;
+                    if (ESP_OK != matrix_output->open()) {
+                        esp_restart();
+                    }
+                    redraw = true;
+                    break;
+
+                // See frame_skip_load for the payload.
+                case CONTROL_SKIP:
+                    if (0 != frame_skip_load(&frame_skip, control_event.data, control_event.len)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad frame skip settings of %u bytes", control_event.len);
+                    }
+                    break;
+
+                // Payload is 1 to send only as much of the strip as changed,
+                // 0 to send all of it.
+                case CONTROL_PREFIX:
+                    if (1 != control_event.len || control_event.data[0] > 1) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad prefix setting of %u bytes", control_event.len);
+                        break;
+                    }
+                    frame_prefix.enabled = control_event.data[0];
+                    break;
+
+                // Payload is how much memory encoded frames may take up, as
+                // a little-endian uint32_t, in bytes. 0 turns the cache off.
+                case CONTROL_CACHE:
+                    if (4 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad cache budget of %u bytes", control_event.len);
+                        break;
+                    }
+                    // The frame going out may be one that's thrown out.
+                    matrix_output->wait();
+                    frame_cache_set_budget(&frame_cache, control_event.data[0] | (control_event.data[1] << 8) |
+                            (control_event.data[2] << 16) | ((uint32_t)control_event.data[3] << 24));
+                    break;
+
+                // Payload is the rate to present frames at, in Hz, as a
+                // little-endian uint16_t. 0 stops the clock, so that the strip
+                // is only drawn when something changes.
+                case CONTROL_REFRESH:
+                    if (2 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad refresh rate of %u bytes", control_event.len);
+                        break;
+                    }
+                    rate_hz = frame_clock_set_rate(&frame_clock, control_event.data[0] | (control_event.data[1] << 8),
+                            led_driver_frame_us(&led_driver, NUM_PIXELS), esp_timer_get_time());
+                    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "refreshing at %u Hz", rate_hz);
+                    break;
+            }
+        }
+
+        // Don't block forever, so that control messages get handled, and a
+        // loaded shader or brightness ramp keeps going while no frames come
+        // in. A 16 bit frame is redrawn over and over, for the dithering.
+        // With the refresh clock running, wait for its next tick instead.
+        // A tick that's due goes first, so that frames coming in can't hold
+        // it up.
+        if (0 != frame_clock.period_us) {
+            wait_ms = (frame_clock_wait_us(&frame_clock, esp_timer_get_time()) + 999) / 1000;
+            qres = 0 == wait_ms ? pdFALSE : xQueueReceive(event_queue, &display_event, wait_ms / portTICK_PERIOD_MS);
+        } else {
+            qres = xQueueReceive(event_queue, &display_event,
+                    (shown_wide ? DITHER_REFRESH_PERIOD_MS : LED_STRIP_REFRESH_PERIOD_MS) / portTICK_PERIOD_MS);
+        }
+
+        // Only frames that just came in are timed, see matrix_latency_s.
+        matrix_latency.dequeued_us = 0;
+        if (pdTRUE == qres) {
+            dequeued_us = esp_timer_get_time();
+            latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_QUEUE,
+                    dequeued_us - display_event.queued_us);
+            trace_record(&trace, TRACE_DEQUEUED, xPortGetCoreID(), dequeued_us, display_event.seq);
+        }
+
+        now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        if (now_ms - power_report_ms >= POWER_LIMIT_REPORT_PERIOD_MS) {
+            if (0 != power_limit.limited_frames) {
+                MATRIX_LOG('W', 1, "led_task", "power limit: %u of %u frames limited, to %u%% on average and %u%% at worst",
+                        power_limit.limited_frames,
+                        power_limit.frames,
+                        power_limit.scale_sum * 100 / 256 / power_limit.limited_frames,
+                        power_limit.min_scale * 100 / 256);
+                MATRIX_LOG('W', 1, "led_task", "power limit: peak %u mA, budget %u mA",
+                        power_limit.max_ma,
+                        power_limit.budget_ma);
+            }
+            telemetry.power_frames += power_limit.frames;
+            telemetry.power_limited += power_limit.limited_frames;
+            telemetry.power_scale_sum += power_limit.scale_sum;
+            if (power_limit.min_scale < telemetry.power_min_scale) {
+                telemetry.power_min_scale = power_limit.min_scale;
+            }
+            if (power_limit.max_ma > telemetry.power_max_ma) {
+                telemetry.power_max_ma = power_limit.max_ma;
+            }
+            power_limit_reset_stats(&power_limit);
+            if (0 != frame_skip.skipped) {
+                MATRIX_LOG('I', 1, "led_task", "skipped %u of %u frames as unchanged, saving %u ms of encoding",
+                        frame_skip.skipped,
+                        frame_skip.frames,
+                        (uint32_t)(frame_skip.saved_us / 1000));
+            }
+            telemetry.skipped += frame_skip.skipped;
+            frame_skip_reset_stats(&frame_skip);
+            if (0 != frame_prefix.truncated) {
+                MATRIX_LOG('I', 1, "led_task", "truncated %u of %u frames, sending %u%% of the pixels",
+                        frame_prefix.truncated,
+                        frame_prefix.frames,
+                        (uint32_t)(frame_prefix.pixels_sent * 100 / frame_prefix.pixels));
+            }
+            telemetry.prefix_bytes_saved += led_driver_frame_len(&led_driver, frame_prefix.pixels - frame_prefix.pixels_sent) -
+                    led_driver_frame_len(&led_driver, 0);
+            frame_prefix_reset_stats(&frame_prefix);
+            if (0 != frame_cache.lookups) {
+                MATRIX_LOG('I', 1, "led_task", "frame cache: %u of %u frames hit, saving %u kB of encoding, %u bytes used",
+                        frame_cache.hits,
+                        frame_cache.lookups,
+                        (uint32_t)(frame_cache.bytes_saved / 1024),
+                        frame_cache.used);
+            }
+            telemetry.cache_lookups += frame_cache.lookups;
+            telemetry.cache_hits += frame_cache.hits;
+            telemetry.cache_bytes_saved += (uint32_t)frame_cache.bytes_saved;
+            telemetry.cache_used = frame_cache.used;
+            frame_cache_reset_stats(&frame_cache);
+            if (0 != frame_clock.missed || 0 != frame_clock.overruns) {
+                MATRIX_LOG('W', 1, "led_task", "refresh clock: %u ticks, %u missed, %u took longer than a tick, up to %u us",
+                        frame_clock.ticks,
+                        frame_clock.missed,
+                        frame_clock.overruns,
+                        frame_clock.max_us);
+            }
+            telemetry.clock_ticks += frame_clock.ticks;
+            telemetry.clock_missed += frame_clock.missed;
+            telemetry.clock_overruns += frame_clock.overruns;
+            if (frame_clock.max_us > telemetry.clock_max_us) {
+                telemetry.clock_max_us = frame_clock.max_us;
+            }
+            frame_clock_reset_stats(&frame_clock);
+            power_report_ms = now_ms;
+        }
+
         if (pdFALSE == qres) {
+
+            // With the refresh clock running, this is where its ticks are
+            // handled, and every one of them presents the whole frame again.
+            if (0 != frame_clock.period_us) {
+                tick_us = esp_timer_get_time();
+                if (!frame_clock_due(&frame_clock, tick_us)) {
+                    continue;
+                }
+                trace_record(&trace, TRACE_TICK, xPortGetCoreID(), tick_us, 0);
+                frame_prefix_invalidate(&frame_prefix);
+                redraw = true;
+            }
+
+            if (frame_skip_refresh_due(&frame_skip, now_ms)) {
+                frame_prefix_invalidate(&frame_prefix);
+                redraw = true;
+            }
+            if (color_lut_update(&color_lut, now_ms)) {
+                frame_cache_invalidate(&frame_cache);
+                redraw = true;
+            }
+            if (shown_wide) {
+                frame_skip_drawn(&frame_skip, now_ms,
+                        matrix_display_draw_rgb(rmt_items, &encoder, NULL, shown16, NUM_PIXELS));
+                redraw = false;
+            } else {
+                if (shader_loaded) {
+                    shader_vm_run(&shader_vm, shown, MATRIX_WIDTH, MATRIX_HEIGHT, now_ms, SHADER_VM_FRAME_BUDGET);
+                    redraw = true;
+                }
+                if (redraw) {
+                    frame_skip_drawn(&frame_skip, now_ms,
+                            matrix_display_draw_rgb(rmt_items, &encoder, shown, NULL, NUM_PIXELS));
+                    redraw = false;
+                }
+            }
+
+            if (0 != frame_clock.period_us) {
+                frame_clock_tick(&frame_clock, tick_us, esp_timer_get_time() - tick_us);
+            }
             continue;
         }
 
@@ -3222,18 +5510,72 @@ static void led_task (
 
         if (tv_sec_diff < 0 || (0 == tv_sec_diff && tv_nsec_diff < 0)) {
             // We already missed this event - just skip it.
-            printf("missed event - supposed to be at %ld, but we're at %ld\n", display_event.tv.tv_sec, tv.tv_sec);
+            telemetry_missed(&telemetry, -(tv_sec_diff * 1000 + tv_nsec_diff / 1000000));
+            trace_record(&trace, TRACE_MISSED, xPortGetCoreID(), esp_timer_get_time(), display_event.seq);
+            MATRIX_LOG('W', MATRIX_LOG_ERRORS_PER_S, "led_task", "missed event - supposed to be at %d, but we're at %d",
+                    (int)display_event.tv.tv_sec, (int)tv.tv_sec);
             continue;
         }
 
         sleep_ms = tv_sec_diff*1000 + tv_nsec_diff/1000000;
         if (sleep_ms > 3000) sleep_ms = 3000;
 
+        delay_us = esp_timer_get_time();
         vTaskDelay(sleep_ms / portTICK_PERIOD_MS);
 
+        // The frame asked for the wait, so it doesn't count as latency.
+        delay_us = esp_timer_get_time() - delay_us;
+        matrix_latency.read_us = display_event.read_us + delay_us;
+        matrix_latency.dequeued_us = dequeued_us + delay_us;
+        matrix_latency.seq = display_event.seq;
+        trace_record(&trace, TRACE_DEADLINE, xPortGetCoreID(), esp_timer_get_time(), display_event.seq);
+
+        now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        dirty = redraw;
+        redraw = false;
+        if (color_lut_update(&color_lut, now_ms)) {
+            frame_cache_invalidate(&frame_cache);
+            dirty = true;
+        }
+        if (frame_skip_refresh_due(&frame_skip, now_ms)) {
+            frame_prefix_invalidate(&frame_prefix);
+        }
+
+        // The shader only works on 8 bit frames.
+        if (display_event.wide) {
+            if (shown_wide && frame_skip_check(&frame_skip, display_event.display_buf16, shown16,
+                        sizeof(shown16), dirty, now_ms))
+            {
+                trace_record(&trace, TRACE_SKIPPED, xPortGetCoreID(), esp_timer_get_time(), display_event.seq);
+                continue;
+            }
+            frame_skip_drawn(&frame_skip, now_ms,
+                    matrix_display_draw_rgb(rmt_items, &encoder, NULL, display_event.display_buf16, NUM_PIXELS));
+            memcpy(shown16, display_event.display_buf16, sizeof(shown16));
+            shown_wide = true;
+            continue;
+        }
+
+        if (shader_loaded) {
+            shader_vm_run(&shader_vm, display_event.display_buf, MATRIX_WIDTH, MATRIX_HEIGHT,
+                    now_ms, SHADER_VM_FRAME_BUDGET);
+        }
+
+        // A shader that moves makes every frame different, so this only
+        // skips frames it left alone.
+        if (!shown_wide && frame_skip_check(&frame_skip, display_event.display_buf, shown,
+                    sizeof(shown), dirty, now_ms))
+        {
+            trace_record(&trace, TRACE_SKIPPED, xPortGetCoreID(), esp_timer_get_time(), display_event.seq);
+            continue;
+        }
+
         //vTaskSuspendAll();
-        matrix_display_draw_rgb(rmt_items, display_event.display_buf, NUM_PIXELS);
+        frame_skip_drawn(&frame_skip, now_ms,
+                matrix_display_draw_rgb(rmt_items, &encoder, display_event.display_buf, NULL, NUM_PIXELS));
         //xTaskResumeAll();
+        memcpy(shown, display_event.display_buf, sizeof(shown));
+        shown_wide = false;
     }
 }
 
@@ -3256,44 +5598,27 @@ void app_main (
     // Initialize queue
     event_queue = xQueueCreate(128, sizeof(struct display_event_s));
     // TODO: error check
+    control_queue = xQueueCreate(4, sizeof(struct control_event_s));
 
+    latency_hist_init(&latency_hist);
+    telemetry_init(&telemetry);
+    log_ring_init(&log_ring);
+    task_stats_init(&task_stats);
 
-    ret = spi_bus_initialize(
-        /* spi_host_device_t host = */ SPI2_HOST,
-        /* spi_bus_config_t * config = */ &(spi_bus_config_t) {
-            .miso_io_num = -1,
-            .mosi_io_num = SPI_CHANNEL_1_MOSI,
-            .sclk_io_num = SPI_CHANNEL_1_SCLK,
-            .quadwp_io_num = -1,
-            .quadhd_io_num = -1,
-            .max_transfer_sz = 8192
-        },
-        /* dma_chan = */ 1
-    );
-    if (ESP_OK != ret) {
-        ESP_LOGE(__func__, "Could not initialize SPI bus.");
-        return -1;
+    // A trace from before anything but a power cycle is kept until it's
+    // been published, see nats_task.
+    if (ESP_RST_POWERON != esp_reset_reason() && trace_survived(&trace)) {
+        trace.paused = 1;
+        trace_crashed = true;
+    } else {
+        trace_init(&trace);
     }
 
-    ret = spi_bus_add_device(
-        /* spi_host_device_t host = */ SPI2_HOST,
-        /* spi_device_interface_config_t * config = */ &(spi_device_interface_config_t) {
-            .command_bits = 0,
-            .address_bits = 0,
-            .dummy_bits = 0,
-            .clock_speed_hz = 25641025,
-            .mode = 1,
-            .spics_io_num = -1,
-            .queue_size = NUM_PIXELS,
-            .cs_ena_posttrans = 0,
-            .cs_ena_pretrans = 0,
-            .flags = SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_3WIRE,
-            .input_delay_ns = 0
-        },
-        /* spi_device_handle_t * handle = */ &spi
-    );
+
+    // The wall has always been sent r, g, b in that order.
+    led_driver_init(&led_driver, LED_DRIVER_WS2812, "rgb");
+    ret = matrix_output->open();
     if (ESP_OK != ret) {
-        ESP_LOGE(__func__, "spi_bus_add_device() returned %d", ret);
         return -1;
     }
 
@@ -3308,25 +5633,47 @@ void app_main (
 
 
     // Core 0 gets wifi interrupts
+    // led_task itself takes up to 1.6 kB (-fstack-usage), see stack_free.
     xTaskCreatePinnedToCore(
         led_task,
         "ledtask",
-        2096,
+        4096,
         NULL,
         1,
-        NULL,
+        &led_task_handle,
         1
     );
 
+    // Above nats_task, so that led_task doesn't wait for it.
+    xTaskCreatePinnedToCore(
+        encode_task,
+        "encodetask",
+        2048,
+        NULL,
+        1,
+        &encode_task_handle,
+        0
+    );
+
     xTaskCreatePinnedToCore(
         nats_task,
-        "ledtask",
+        "natstask",
         4096,
         NULL,
         0,
         NULL,
         0
     );
+
+    xTaskCreatePinnedToCore(
+        log_task,
+        "logtask",
+        2560,
+        NULL,
+        0,
+        &log_task_handle,
+        0
+    );
    wifi_init_sta();
 
 }
@@ -6,11 +6,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/event_groups.h"
 #include "driver/gpio.h"
 #include "driver/rmt.h"
@@ -20,8 +22,11 @@
 #include "esp_attr.h"
 #include "esp_sleep.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "esp_sntp.h"
 #include "nvs_flash.h"
+#include "nvs.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
 #include "lwip/sockets.h"
@@ -31,6 +36,28 @@
 // spi
 #include <hal/spi_types.h>
 #include <driver/spi_master.h>
+#include "esp_lcd_panel_io.h"
+
+#include "matrix.h"
+#include "shader_vm.h"
+#include "pixel_map.h"
+#include "color_lut.h"
+#include "matrix_encode.h"
+#include "power_limit.h"
+#include "color_cal.h"
+#include "led_driver.h"
+#include "led_rmt.h"
+#include "led_i2s.h"
+#include "led_split.h"
+#include "frame_skip.h"
+#include "frame_prefix.h"
+#include "frame_cache.h"
+#include "frame_clock.h"
+#include "latency_hist.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "log_ring.h"
+#include "task_stats.h"
 
 spi_device_handle_t spi;
 
@@ -38,185 +65,1499 @@ spi_device_handle_t spi;
 #define GPIO_PIN_SEL (1ULL << GPIO_PIN)
 #define RMT_CHANNEL 2
 #define RMT_CLOCK_DIV 4
+#define RMT_TICK_NS (RMT_CLOCK_DIV * 1000 / 80) // of the 80 MHz APB clock
+#define RMT_MEM_BLOCKS 4 // channels 2 to 5 are free, so use their memory too
 #define SPI_CHANNEL 1
 #define SPI_CHANNEL_1_MOSI 12
 #define SPI_CHANNEL_1_SCLK 14
 
-// For these, one tick is 50ns.
-#define RMT_TICKS_BIT_1_HIGH_WS2812 12 // 12*50ns = 600 ns
-#define RMT_TICKS_BIT_1_LOW_WS2812  13 // 12*50ns = 650 ns
-#define RMT_TICKS_BIT_0_HIGH_WS2812 5 // 12*50ns = 250 ns
-#define RMT_TICKS_BIT_0_LOW_WS2812  20 // 20*50ns = 1000 ns
-#define RMT_TICKS_RESET 510 // This isn't used now... i'm not sure what this value should be.
+// The I2S output drives one strip per data pin, lane 0 on the same pin as
+// SPI and RMT. The peripheral also wants a clock (WR) and a DC pin, which
+// the strips don't use.
+#define I2S_LANES 8
+#define I2S_DATA_PINS { SPI_CHANNEL_1_MOSI, 13, 15, 18, 19, 21, 22, 23 }
+#define I2S_WR_PIN SPI_CHANNEL_1_SCLK
+#define I2S_DC_PIN 4
+
+// Until told otherwise (matrix1.ctl.split), the split output sends the
+// first third of the strip on SPI2, the second on SPI3 and the rest on RMT.
+#define SPLIT_PINS { SPI_CHANNEL_1_MOSI, 23, 27 }
+
+// Frames of at least this many pixels are encoded by both cores, with
+// encode_task, on core 0, taking ENCODE_SHARD_CORE0_SHARE 256ths of the
+// strip. Core 0 also has wifi and nats_task to take care of, so that's a
+// bit less than half.
+#define ENCODE_SHARD_MIN_PIXELS 256
+#define ENCODE_SHARD_CORE0_SHARE 112
 
 // This can be set pretty low, I don't remember what the exact number should
-// be, check ws2811 datasheet.
+// be, check ws2811 datasheet. With the refresh clock running
+// (matrix1.ctl.refresh), its rate is used instead.
 #define LED_STRIP_REFRESH_PERIOD_MS (30U) 
 
+// 16 bit frames are dithered, which only works if they're refreshed much
+// faster than that. 49 pixels take about 1.5 ms to send.
+#define DITHER_REFRESH_PERIOD_MS (1U)
+
+// How often to log how much the power limit had to step in, and add it to
+// the telemetry, and how many frames were skipped (see frame_skip.h).
+#define POWER_LIMIT_REPORT_PERIOD_MS (10000U)
+
+// Where color calibration is kept across reboots, in the format
+// color_cal_load takes.
+#define COLOR_CAL_NVS_NAMESPACE "matrix"
+#define COLOR_CAL_NVS_KEY "cal"
+
 #define WIFI_CONNECTED_BIT BIT0
 #define NATS_CONNECTED_BIT BIT1
 #define TIME_SYNC_BIT BIT2
 
-#define NUM_PIXELS 49
-
 #define NATS_HOST "192.168.4.1"
 #define NATS_PORT "4222"
 #define NATS_BUF_LEN 512
 
+// Messages on any subject other than matrix1.in are collected into a buffer
+// of this size before they're handled. Longer payloads are dropped.
+#define NATS_SUBJECT_LEN 32
+#define NATS_PAYLOAD_LEN 1024
+
+// How many instructions the shader VM may run per frame, at most. This keeps
+// a heavy shader from starving led_task.
+#define SHADER_VM_FRAME_BUDGET (32 * 1024)
+
+// Reads time out after NATS_READ_TIMEOUT_MS, so that stats still go out
+// when nothing comes in (see nats_publish_stats).
+#define NATS_READ_TIMEOUT_MS (1000U)
+#define NATS_PUB_LEN (LATENCY_HIST_JSON_LEN + TELEMETRY_JSON_LEN + TASK_STATS_JSON_LEN + 3 * (NATS_SUBJECT_LEN + 32))
+#define NATS_STATS_JSON_LEN (TASK_STATS_JSON_LEN > TELEMETRY_JSON_LEN ? \
+        (TASK_STATS_JSON_LEN > LATENCY_HIST_JSON_LEN ? TASK_STATS_JSON_LEN : LATENCY_HIST_JSON_LEN) : \
+        (TELEMETRY_JSON_LEN > LATENCY_HIST_JSON_LEN ? TELEMETRY_JSON_LEN : LATENCY_HIST_JSON_LEN))
+#define NATS_PUB_TRACE_LEN "8204"   // sizeof(struct trace_s)
+
 static EventGroupHandle_t s_wifi_event_group;
 static QueueHandle_t event_queue;
+static QueueHandle_t control_queue;
+
+struct display_event_s {
+    struct timespec tv;
+
+    // When read() returned the start of the message, and when it was
+    // queued, in esp_timer_get_time() us. See latency_hist.h.
+    int64_t read_us;
+    int64_t queued_us;
+
+    // Numbers frames for trace.h.
+    uint16_t seq;
+
+    // Set for frames from matrix1.frame16, which have 16 bits per channel.
+    bool wide;
+    union {
+        struct matrix_rgb_s display_buf[NUM_PIXELS];
+        struct matrix_rgb16_s display_buf16[NUM_PIXELS];
+    };
+};
+
+enum control_type_e {
+    CONTROL_SHADER_LOAD,
+    CONTROL_SHADER_CLEAR,
+    CONTROL_MAP_LAYOUT,
+    CONTROL_MAP_TABLE,
+    CONTROL_GAMMA,
+    CONTROL_BRIGHTNESS,
+    CONTROL_POWER,
+    CONTROL_CAL,
+    CONTROL_DRIVER,
+    CONTROL_OUTPUT,
+    CONTROL_SPLIT,
+    CONTROL_SKIP,
+    CONTROL_PREFIX,
+    CONTROL_CACHE,
+    CONTROL_REFRESH
+};
+
+// Control messages go from nats_task to led_task through control_queue, so
+// that everything the led task uses is only ever touched by the led task.
+struct control_event_s {
+    enum control_type_e type;
+    uint16_t len;
+    uint8_t data[NATS_PAYLOAD_LEN];
+};
+
+// Words rather than bytes, since SPI DMA wants the buffer 32 bit aligned.
+uint32_t rmt_items[LED_DRIVER_MAX_FRAME_LEN(NUM_PIXELS) / 4] = {0};
+static spi_transaction_t spi_trans;
+static bool spi_trans_pending = false;
+static bool rmt_trans_pending = false;
+static struct led_driver_s led_driver;
+static struct led_rmt_s led_rmt;
+static esp_lcd_i80_bus_handle_t i2s_bus;
+static esp_lcd_panel_io_handle_t i2s_io;
+static SemaphoreHandle_t i2s_done;
+static bool i2s_trans_pending = false;
+static struct led_split_s led_split = {
+    .end = { NUM_PIXELS / 3, NUM_PIXELS * 2 / 3, NUM_PIXELS },
+    .pin = SPLIT_PINS
+};
+static spi_device_handle_t spi3;
+static spi_transaction_t spi3_trans;
+static uint32_t split_items[LED_DRIVER_MAX_FRAME_LEN(NUM_PIXELS) / 4];
+static uint8_t split_rmt_frame[NUM_PIXELS * 4 + 1];
+static uint8_t split_pending = 0;
+
+// A piece of work for encode_task, see matrix_shard_run.
+struct matrix_shard_s {
+    void (* fn)(void * arg, uint32_t first, uint32_t len);
+    void * arg;
+    uint32_t first;
+    uint32_t len;
+};
+static struct matrix_shard_s encode_shard;
+static TaskHandle_t led_task_handle = NULL;
+static TaskHandle_t encode_task_handle = NULL;
+static TaskHandle_t log_task_handle = NULL;
+
+static uint8_t nats_payload[NATS_PAYLOAD_LEN];
+static struct control_event_s nats_control_event;
+static int64_t nats_msg_read_us;
+static bool nats_trace_requested = false;
+
+// Shared by nats_task, led_task and the transfer done ISRs, see
+// latency_hist.h and telemetry.h for how that works without a lock.
+static struct latency_hist_s latency_hist;
+static struct telemetry_s telemetry;
+
+// Only nats_task touches this.
+static struct task_stats_s task_stats;
+
+// Isn't cleared by a reset, so that what led up to a crash can be
+// published once the wall is back, see app_main.
+static __NOINIT_ATTR struct trace_s trace;
+_Static_assert(8204 == sizeof(struct trace_s), "NATS_PUB_TRACE_LEN is out of date");
+static bool trace_crashed = false;
+
+// What the hot paths log, for log_task to write out. MATRIX_LOG stores a
+// line unless the place it's called from logged more than per_s lines in
+// the last second, see log_ring.h for what formats can take.
+static struct log_ring_s log_ring;
+
+#define MATRIX_LOG(level, per_s, tag, fmt, ...) do { \
+    static struct log_site_s log_site = LOG_SITE(per_s); \
+    log_ring_printf(&log_ring, &log_site, esp_timer_get_time() / 1000, (level), (tag), (fmt), __VA_ARGS__); \
+} while (0)
+
+// For errors that can come in bursts, like one per frame or per byte.
+#define MATRIX_LOG_ERRORS_PER_S 5
+
+#define LOG_DRAIN_PERIOD_MS 50
+
+// Times the frames from event_queue on their way to the strip, for the
+// stages of latency_hist and the trace that led_task and the ISRs record.
+struct matrix_latency_s {
+    // The frame led_task is about to send. dequeued_us is 0 for redraws.
+    // Only led_task touches these.
+    int64_t read_us;
+    int64_t dequeued_us;
+    uint16_t seq;
+
+    // The frame going out. Only matrix_latency_sent sets these, when
+    // nothing is going out.
+    int64_t sent_read_us;
+    int64_t sent_us;        // 0 once the transfer is done
+    uint16_t sent_seq;      // TRACE_NO_FRAME for redraws
+    uint32_t pending;       // transfers still going out
+};
+static volatile struct matrix_latency_s matrix_latency;
+
+
+void time_sync_notification_cb(struct timeval *tv)
+{
+    ESP_LOGI("time_sync", "time is synced");
+    xEventGroupSetBits(s_wifi_event_group, TIME_SYNC_BIT);
+}
+
+
+static void event_handler (
+    void* arg,
+    esp_event_base_t event_base, 
+    int32_t event_id,
+    void* event_data)
+{
+
+    // Connect to wifi
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        esp_wifi_connect();
+        telemetry.wifi_reconnects++;
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        ESP_LOGI("H", "retry to connect to the AP");
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+        ESP_LOGI("H", "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        // Initialize NTP
+        sntp_setoperatingmode(SNTP_OPMODE_POLL);
+        sntp_setservername(0, "192.168.4.1");
+        sntp_set_time_sync_notification_cb(time_sync_notification_cb);
+        sntp_init();
+    }
+}
+
+
+static void wifi_init_sta (
+    void
+)
+{
+    s_wifi_event_group = xEventGroupCreate();
+
+    esp_netif_init();
+
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL));
+
+    // I don't care that this password is in plaintext; it's not a secure
+    // wifi - it's only for the led wall.
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = "led-wall",
+            .password = "nallenalle"
+        },
+    };
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
+    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
+    ESP_ERROR_CHECK(esp_wifi_start() );
+
+    ESP_LOGI("H", "wifi_init_sta finished.");
+}
+
+// Called right before anything starts going out.
+static void matrix_latency_sent (
+    void
+)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    if (0 != matrix_latency.dequeued_us) {
+        latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_DRAW, now_us - matrix_latency.dequeued_us);
+        matrix_latency.dequeued_us = 0;
+        matrix_latency.sent_read_us = matrix_latency.read_us;
+        matrix_latency.sent_seq = matrix_latency.seq;
+    } else {
+        matrix_latency.sent_seq = TRACE_NO_FRAME;
+    }
+    trace_record(&trace, TRACE_SENT, xPortGetCoreID(), now_us, matrix_latency.sent_seq);
+    matrix_latency.pending = 1;
+    matrix_latency.sent_us = now_us;
+}
+
+
+// Called from the ISR of every transfer that finishes, and for every one
+// that couldn't be started. The frame is on the strip once the last of its
+// transfers is.
+static void IRAM_ATTR matrix_latency_done (
+    void
+)
+{
+    int64_t now_us;
+
+    // Atomic, since the ISRs of the segments of a split frame can run on
+    // either core.
+    if (0 == matrix_latency.sent_us || 0 != __atomic_sub_fetch(&matrix_latency.pending, 1, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    now_us = esp_timer_get_time();
+    trace_record(&trace, TRACE_DONE, xPortGetCoreID(), now_us, matrix_latency.sent_seq);
+    if (TRACE_NO_FRAME != matrix_latency.sent_seq) {
+        latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_WIRE, now_us - matrix_latency.sent_us);
+        latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_TOTAL, now_us - matrix_latency.sent_read_us);
+    }
+    matrix_latency.sent_us = 0;
+}
+
+
+// The strip can be driven by SPI or by the RMT peripheral, on the same pin,
+// or split over several strips by I2S. They all do the same thing behind
+// this interface, so they can be swapped at runtime (matrix1.ctl.output)
+// and compared.
+struct matrix_output_s {
+    const char * name;
+
+    // Whether the strip goes out as one chain, front to back, so that the
+    // end of it can be left out when it didn't change (see frame_prefix.h).
+    bool chain;
+
+    // Returns -1 if the output can't drive the chipset.
+    int (* check)(const struct led_driver_s * driver);
+
+    // Takes over the pin and sets up the peripheral for led_driver.
+    esp_err_t (* open)(void);
+
+    // Lets go of the pin again.
+    void (* close)(void);
+
+    // Waits until the frame being sent, if any, is out, so that items can
+    // be written to again.
+    void (* wait)(void);
+
+    // Sends the r, g, b of num_pixels pixels from items, where it may also
+    // put what it needs for that. rgb is NULL if write has already put every
+    // pixel in items.
+    esp_err_t (* send)(uint32_t * items, const uint8_t (* rgb)[3], uint32_t num_pixels, uint16_t scale);
+
+    // Optional. Writes pixels first .. first + len - 1 into items the way
+    // send would, so that both cores can share the work (see
+    // matrix_shard_run).
+    void (* write)(uint32_t * items, const uint8_t (* rgb)[3], uint32_t first, uint32_t len, uint16_t scale);
+
+    // Optional. Sends len bytes of a frame that send put in items earlier,
+    // from wherever it has been kept since (see frame_cache.h).
+    esp_err_t (* send_frame)(const uint8_t * frame, uint32_t len);
+};
+
+
+static void IRAM_ATTR matrix_spi_done (
+    spi_transaction_t * trans
+)
+{
+    matrix_latency_done();
+}
+
+
+static int matrix_spi_check (
+    const struct led_driver_s * driver
+)
+{
+    if (led_driver_frame_len(driver, NUM_PIXELS) > sizeof(rmt_items)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+// Sets up an SPI host with the strip as its only device, clocked the way
+// led_driver wants it.
+static esp_err_t matrix_spi_add (
+    spi_host_device_t host,
+    int mosi_io_num,
+    int sclk_io_num,
+    int dma_chan,
+    spi_device_handle_t * handle
+)
+{
+    esp_err_t ret;
+
+    ret = spi_bus_initialize(
+        /* spi_host_device_t host = */ host,
+        /* spi_bus_config_t * config = */ &(spi_bus_config_t) {
+            .miso_io_num = -1,
+            .mosi_io_num = mosi_io_num,
+            .sclk_io_num = sclk_io_num,
+            .quadwp_io_num = -1,
+            .quadhd_io_num = -1,
+            .max_transfer_sz = 8192
+        },
+        /* dma_chan = */ dma_chan
+    );
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "Could not initialize SPI bus.");
+        return ret;
+    }
+
+    // The clock is set per device, so it's added again for every driver.
+    ret = spi_bus_add_device(
+        /* spi_host_device_t host = */ host,
+        /* spi_device_interface_config_t * config = */ &(spi_device_interface_config_t) {
+            .command_bits = 0,
+            .address_bits = 0,
+            .dummy_bits = 0,
+            .clock_speed_hz = led_driver.spi_clock_hz,
+            .mode = led_driver.spi_mode,
+            .spics_io_num = -1,
+            .queue_size = NUM_PIXELS,
+            .cs_ena_posttrans = 0,
+            .cs_ena_pretrans = 0,
+            .flags = SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_3WIRE,
+            .input_delay_ns = 0,
+            .post_cb = matrix_spi_done
+        },
+        /* spi_device_handle_t * handle = */ handle
+    );
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "spi_bus_add_device() returned %d", ret);
+        spi_bus_free(host);
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+
+static void matrix_spi_remove (
+    spi_host_device_t host,
+    spi_device_handle_t handle
+)
+{
+    spi_bus_remove_device(handle);
+    spi_bus_free(host);
+}
+
+
+static esp_err_t matrix_spi_open (
+    void
+)
+{
+    return matrix_spi_add(SPI2_HOST, SPI_CHANNEL_1_MOSI, SPI_CHANNEL_1_SCLK, 1, &spi);
+}
+
+
+static void matrix_spi_close (
+    void
+)
+{
+    matrix_spi_remove(SPI2_HOST, spi);
+}
+
+
+static void matrix_spi_wait (
+    void
+)
+{
+    spi_transaction_t * done;
+
+    if (spi_trans_pending) {
+        spi_device_get_trans_result(spi, &done, portMAX_DELAY);
+        spi_trans_pending = false;
+    }
+}
+
+
+// frame has to be in DMA capable memory.
+static esp_err_t matrix_spi_send_frame (
+    const uint8_t * frame,
+    uint32_t len
+)
+{
+    esp_err_t ret;
+
+    spi_trans = (spi_transaction_t) {
+        .tx_buffer = frame,
+        .length = 8*len,
+        .rxlength = 0
+    };
+    ret = spi_device_queue_trans(spi, &spi_trans, portMAX_DELAY);
+    if (ESP_OK != ret) {
+        telemetry.send_errors++;
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, __func__, "spi_device_queue_trans() returned %d", ret);
+        return ret;
+    }
+    spi_trans_pending = true;
+
+    return ESP_OK;
+}
+
+
+static esp_err_t matrix_spi_send (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    uint32_t len;
+
+    if (NULL != rgb) {
+        led_driver_write_pixels(&led_driver, (uint8_t *)items, rgb, 0, num_pixels, scale);
+    }
+    len = led_driver_write_ends(&led_driver, (uint8_t *)items, num_pixels);
+
+    return matrix_spi_send_frame((const uint8_t *)items, len);
+}
+
+
+static void matrix_spi_write (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t first,
+    uint32_t len,
+    uint16_t scale
+)
+{
+    led_driver_write_pixels(&led_driver, (uint8_t *)items, rgb, first, len, scale);
+}
+
+
+static const struct matrix_output_s matrix_output_spi = {
+    .name = "spi",
+    .chain = true,
+    .check = matrix_spi_check,
+    .open = matrix_spi_open,
+    .close = matrix_spi_close,
+    .wait = matrix_spi_wait,
+    .send = matrix_spi_send,
+    .write = matrix_spi_write,
+    .send_frame = matrix_spi_send_frame
+};
+
+
+// The RMT driver has no way to pass anything to its translator, hence
+// led_rmt lives out here.
+static void matrix_rmt_translate (
+    const void * src,
+    rmt_item32_t * dest,
+    size_t src_size,
+    size_t wanted_num,
+    size_t * translated_size,
+    size_t * item_num
+)
+{
+    led_rmt_translate(&led_rmt, src, (uint32_t *)dest, src_size, wanted_num, translated_size, item_num);
+}
+
+
+static void IRAM_ATTR matrix_rmt_done (
+    rmt_channel_t channel,
+    void * arg
+)
+{
+    matrix_latency_done();
+}
+
+
+static int matrix_rmt_check (
+    const struct led_driver_s * driver
+)
+{
+    struct led_rmt_s rmt;
+
+    return led_rmt_init(&rmt, driver, RMT_TICK_NS);
+}
+
+
+// Sets up the RMT channel to send led_rmt frames on gpio_num.
+static esp_err_t matrix_rmt_install (
+    int gpio_num
+)
+{
+    esp_err_t ret;
+
+    ret = rmt_config(&(rmt_config_t) {
+        .rmt_mode = RMT_MODE_TX,
+        .channel = RMT_CHANNEL,
+        .gpio_num = gpio_num,
+        .clk_div = RMT_CLOCK_DIV,
+        .mem_block_num = RMT_MEM_BLOCKS,
+        .tx_config = {
+            .loop_en = false,
+            .carrier_en = false,
+            .idle_output_en = true,
+            .idle_level = RMT_IDLE_LEVEL_LOW
+        }
+    });
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "rmt_config() returned %d", ret);
+        return ret;
+    }
+
+    ret = rmt_driver_install(RMT_CHANNEL, 0, 0);
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "rmt_driver_install() returned %d", ret);
+        return ret;
+    }
+
+    ret = rmt_translator_init(RMT_CHANNEL, matrix_rmt_translate);
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "rmt_translator_init() returned %d", ret);
+        rmt_driver_uninstall(RMT_CHANNEL);
+        return ret;
+    }
+    rmt_register_tx_end_callback(matrix_rmt_done, NULL);
+
+    return ESP_OK;
+}
+
+
+static esp_err_t matrix_rmt_open (
+    void
+)
+{
+    if (0 != led_rmt_init(&led_rmt, &led_driver, RMT_TICK_NS)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return matrix_rmt_install(SPI_CHANNEL_1_MOSI);
+}
+
+
+static void matrix_rmt_close (
+    void
+)
+{
+    rmt_driver_uninstall(RMT_CHANNEL);
+}
+
+
+static void matrix_rmt_wait (
+    void
+)
+{
+    if (rmt_trans_pending) {
+        rmt_wait_tx_done(RMT_CHANNEL, portMAX_DELAY);
+        rmt_trans_pending = false;
+    }
+}
+
+
+static esp_err_t matrix_rmt_send (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    esp_err_t ret;
+
+    led_rmt.frame = (const uint8_t *)items;
+    led_rmt.frame_len = led_driver_pack(&led_driver, (uint8_t *)items, rgb, num_pixels, scale);
+
+    // The byte past the frame becomes the reset time, see led_rmt.h.
+    ret = rmt_write_sample(RMT_CHANNEL, (const uint8_t *)items, led_rmt.frame_len + 1, false);
+    if (ESP_OK != ret) {
+        telemetry.send_errors++;
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, __func__, "rmt_write_sample() returned %d", ret);
+        return ret;
+    }
+    rmt_trans_pending = true;
+
+    return ESP_OK;
+}
+
+
+static const struct matrix_output_s matrix_output_rmt = {
+    .name = "rmt",
+    .chain = true,
+    .check = matrix_rmt_check,
+    .open = matrix_rmt_open,
+    .close = matrix_rmt_close,
+    .wait = matrix_rmt_wait,
+    .send = matrix_rmt_send
+};
+
+
+// Drives the strip in up to three segments at once: on SPI2, SPI3 and RMT,
+// see led_split.h.
+static int matrix_split_check (
+    const struct led_driver_s * driver
+)
+{
+    if (0 != matrix_spi_check(driver) || 0 != matrix_rmt_check(driver)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static esp_err_t matrix_split_open (
+    void
+)
+{
+    esp_err_t ret;
+
+    if (0 != led_rmt_init(&led_rmt, &led_driver, RMT_TICK_NS)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // SPI3 doesn't need a clock pin, nobody listens to it.
+    ret = matrix_spi_add(SPI2_HOST, led_split.pin[0], SPI_CHANNEL_1_SCLK, 1, &spi);
+    if (ESP_OK != ret) {
+        return ret;
+    }
+    ret = matrix_spi_add(SPI3_HOST, led_split.pin[1], -1, 2, &spi3);
+    if (ESP_OK != ret) {
+        matrix_spi_remove(SPI2_HOST, spi);
+        return ret;
+    }
+    ret = matrix_rmt_install(led_split.pin[2]);
+    if (ESP_OK != ret) {
+        matrix_spi_remove(SPI2_HOST, spi);
+        matrix_spi_remove(SPI3_HOST, spi3);
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+
+static void matrix_split_close (
+    void
+)
+{
+    matrix_spi_remove(SPI2_HOST, spi);
+    matrix_spi_remove(SPI3_HOST, spi3);
+    rmt_driver_uninstall(RMT_CHANNEL);
+}
+
+
+static void matrix_split_wait (
+    void
+)
+{
+    spi_transaction_t * done;
+
+    if (split_pending & (1 << 0)) {
+        spi_device_get_trans_result(spi, &done, portMAX_DELAY);
+    }
+    if (split_pending & (1 << 1)) {
+        spi_device_get_trans_result(spi3, &done, portMAX_DELAY);
+    }
+    if (split_pending & (1 << 2)) {
+        rmt_wait_tx_done(RMT_CHANNEL, portMAX_DELAY);
+    }
+    split_pending = 0;
+}
+
+
+struct matrix_split_ctx_s {
+    uint32_t * items;
+    const uint8_t (* rgb)[3];
+    uint16_t scale;
+};
+
+
+static void matrix_split_prepare (
+    void * arg,
+    int i,
+    uint32_t first,
+    uint32_t len
+)
+{
+    struct matrix_split_ctx_s * ctx = arg;
+
+    switch (i) {
+        case 0:
+            len = led_driver_write(&led_driver, (uint8_t *)ctx->items, &ctx->rgb[first], len, ctx->scale);
+            spi_trans = (spi_transaction_t) {
+                .tx_buffer = ctx->items,
+                .length = 8*len,
+                .rxlength = 0
+            };
+            break;
+
+        case 1:
+            len = led_driver_write(&led_driver, (uint8_t *)split_items, &ctx->rgb[first], len, ctx->scale);
+            spi3_trans = (spi_transaction_t) {
+                .tx_buffer = split_items,
+                .length = 8*len,
+                .rxlength = 0
+            };
+            break;
+
+        case 2:
+            led_rmt.frame = split_rmt_frame;
+            led_rmt.frame_len = led_driver_pack(&led_driver, split_rmt_frame, &ctx->rgb[first], len, ctx->scale);
+            break;
+    }
+}
+
+
+static void matrix_split_start (
+    void * arg,
+    int i
+)
+{
+    esp_err_t ret;
+
+    switch (i) {
+        case 0:
+            ret = spi_device_queue_trans(spi, &spi_trans, portMAX_DELAY);
+            break;
+        case 1:
+            ret = spi_device_queue_trans(spi3, &spi3_trans, portMAX_DELAY);
+            break;
+        default:
+            ret = rmt_write_sample(RMT_CHANNEL, split_rmt_frame, led_rmt.frame_len + 1, false);
+            break;
+    }
+    if (ESP_OK != ret) {
+        // It won't finish either, so it's done as far as the frame goes.
+        telemetry.send_errors++;
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, __func__, "could not start segment %d: %d", i, ret);
+        matrix_latency_done();
+        return;
+    }
+    split_pending |= 1 << i;
+}
+
+
+static esp_err_t matrix_split_send (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    static const struct led_split_ops_s ops = {
+        .prepare = matrix_split_prepare,
+        .start = matrix_split_start
+    };
+    struct matrix_split_ctx_s ctx = {
+        .items = items,
+        .rgb = rgb,
+        .scale = scale
+    };
+
+    // One transfer per segment, rather than the one matrix_latency_sent
+    // expects. Segments that don't start count themselves off.
+    matrix_latency.pending = led_split_count(&led_split);
+    led_split_send(&led_split, &ops, &ctx);
+
+    return ESP_OK;
+}
+
+
+static const struct matrix_output_s matrix_output_split = {
+    .name = "split",
+    .check = matrix_split_check,
+    .open = matrix_split_open,
+    .close = matrix_split_close,
+    .wait = matrix_split_wait,
+    .send = matrix_split_send
+};
+
 
-uint32_t one  = SPI_SWAP_DATA_TX(0b11111111111111100000000000000000, 32);
-uint32_t zero = SPI_SWAP_DATA_TX(0b11111100000000000000000000000000, 32);
-//uint32_t one  = SPI_SWAP_DATA_TX(0b11101010101010101010101010101010, 32);
-//uint32_t zero = SPI_SWAP_DATA_TX(0b11110000111100001111000011110000, 32);
+static int matrix_i2s_check (
+    const struct led_driver_s * driver
+)
+{
+    if (0 != led_i2s_shape(driver, &(struct led_i2s_shape_s){0}) || led_i2s_frame_len(driver, NUM_PIXELS, I2S_LANES) > sizeof(rmt_items)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static bool matrix_i2s_trans_done (
+    esp_lcd_panel_io_handle_t io,
+    void * user_data,
+    void * event_data
+)
+{
+    BaseType_t woken = pdFALSE;
+
+    matrix_latency_done();
+    xSemaphoreGiveFromISR(i2s_done, &woken);
+
+    return pdTRUE == woken;
+}
+
+
+static esp_err_t matrix_i2s_open (
+    void
+)
+{
+    esp_err_t ret;
+
+    if (NULL == i2s_done) {
+        i2s_done = xSemaphoreCreateBinary();
+    }
+
+    ret = esp_lcd_new_i80_bus(&(esp_lcd_i80_bus_config_t) {
+        .dc_gpio_num = I2S_DC_PIN,
+        .wr_gpio_num = I2S_WR_PIN,
+        .data_gpio_nums = I2S_DATA_PINS,
+        .bus_width = I2S_LANES,
+        .max_transfer_bytes = sizeof(rmt_items)
+    }, &i2s_bus);
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "esp_lcd_new_i80_bus() returned %d", ret);
+        return ret;
+    }
+
+    // There's no way to send data without a command first, but a command
+    // of 0 is just one more sample with the lines low.
+    ret = esp_lcd_new_panel_io_i80(i2s_bus, &(esp_lcd_panel_io_i80_config_t) {
+        .cs_gpio_num = -1,
+        .pclk_hz = led_i2s_clock_hz(&led_driver),
+        .trans_queue_depth = 1,
+        .on_color_trans_done = matrix_i2s_trans_done,
+        .lcd_cmd_bits = I2S_LANES,
+        .lcd_param_bits = I2S_LANES
+    }, &i2s_io);
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "esp_lcd_new_panel_io_i80() returned %d", ret);
+        esp_lcd_del_i80_bus(i2s_bus);
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+
+static void matrix_i2s_close (
+    void
+)
+{
+    esp_lcd_panel_io_del(i2s_io);
+    esp_lcd_del_i80_bus(i2s_bus);
+}
+
+
+static void matrix_i2s_wait (
+    void
+)
+{
+    if (i2s_trans_pending) {
+        xSemaphoreTake(i2s_done, portMAX_DELAY);
+        i2s_trans_pending = false;
+    }
+}
+
+
+static esp_err_t matrix_i2s_send (
+    uint32_t * items,
+    const uint8_t (* rgb)[3],
+    uint32_t num_pixels,
+    uint16_t scale
+)
+{
+    static uint8_t frame[NUM_PIXELS * 4];
+    uint32_t len;
+    esp_err_t ret;
+
+    led_driver_pack(&led_driver, frame, rgb, num_pixels, scale);
+    len = led_i2s_write(&led_driver, (uint8_t *)items, frame, num_pixels, I2S_LANES);
+
+    ret = esp_lcd_panel_io_tx_color(i2s_io, 0, items, len);
+    if (ESP_OK != ret) {
+        telemetry.send_errors++;
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, __func__, "esp_lcd_panel_io_tx_color() returned %d", ret);
+        return ret;
+    }
+    i2s_trans_pending = true;
+
+    return ESP_OK;
+}
+
+
+static const struct matrix_output_s matrix_output_i2s = {
+    .name = "i2s",
+    .check = matrix_i2s_check,
+    .open = matrix_i2s_open,
+    .close = matrix_i2s_close,
+    .wait = matrix_i2s_wait,
+    .send = matrix_i2s_send
+};
+
+
+static const struct matrix_output_s * matrix_output = &matrix_output_spi;
+
+
+// Switches to another chipset and/or output. Returns -1, leaving things as
+// they were, if they don't go together.
+static int matrix_display_reconfigure (
+    const struct led_driver_s * driver,
+    const struct matrix_output_s * output
+)
+{
+    esp_err_t ret;
 
-struct matrix_rgb_s {
-    uint8_t r;
-    uint8_t g;
-    uint8_t b;
+    if (0 != output->check(driver)) {
+        return -1;
+    }
+
+    matrix_output->wait();
+    matrix_output->close();
+
+    led_driver = *driver;
+    matrix_output = output;
+    ret = matrix_output->open();
+    if (ESP_OK != ret) {
+        ESP_LOGE(__func__, "could not open %s output: %d", matrix_output->name, ret);
+        esp_restart();
+    }
+
+    return 0;
+}
+
+
+// Big frames are encoded by both cores: led_task takes the start of the
+// strip, and encode_task, on core 0, the rest. They hand work to each other
+// with task notifications, which are a lot cheaper than queues. Below
+// ENCODE_SHARD_MIN_PIXELS, handing over costs more than it saves.
+static void encode_task (
+    void * arg
+)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        encode_shard.fn(encode_shard.arg, encode_shard.first, encode_shard.len);
+        xTaskNotifyGive(led_task_handle);
+    }
+}
+
+
+// Writes out what went through MATRIX_LOG. Runs at the lowest priority, so
+// that the UART only gets time nobody else wants.
+static void log_task (
+    void * arg
+)
+{
+    struct log_entry_s entry;
+    char line[LOG_RING_LINE_LEN];
+    uint32_t full = 0;
+
+    while (1) {
+        while (log_ring_read(&log_ring, &entry)) {
+            log_ring_format(&entry, line, sizeof(line));
+            if ('E' == entry.level) {
+                ESP_LOGE(entry.tag, "%s", line);
+            } else if ('W' == entry.level) {
+                ESP_LOGW(entry.tag, "%s", line);
+            } else {
+                ESP_LOGI(entry.tag, "%s", line);
+            }
+        }
+
+        // Lines that didn't fit have no next line to report them.
+        if (full != log_ring.full) {
+            ESP_LOGW("log_task", "%u lines didn't fit in the log ring", log_ring.full - full);
+            full = log_ring.full;
+        }
+
+        vTaskDelay(LOG_DRAIN_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+}
+
+
+// Runs fn over pixels 0 .. num_pixels - 1 on the strip, on both cores if
+// it's worth it, and returns when all of it is done. Only led_task may call
+// this.
+static void matrix_shard_run (
+    void (* fn)(void * arg, uint32_t first, uint32_t len),
+    void * arg,
+    uint32_t num_pixels
+)
+{
+    uint32_t split;
+
+    if (NULL == encode_task_handle || num_pixels < ENCODE_SHARD_MIN_PIXELS) {
+        fn(arg, 0, num_pixels);
+        return;
+    }
+
+    split = num_pixels - num_pixels * ENCODE_SHARD_CORE0_SHARE / 256;
+    encode_shard = (struct matrix_shard_s) {
+        .fn = fn,
+        .arg = arg,
+        .first = split,
+        .len = num_pixels - split
+    };
+    xTaskNotifyGive(encode_task_handle);
+    fn(arg, 0, split);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+
+// What the shards of matrix_display_draw_rgb share.
+struct matrix_draw_s {
+    const struct matrix_encode_s * enc;
+    const struct matrix_rgb_s * buf;
+    const struct matrix_rgb16_s * buf16;
+    uint8_t (* wire)[3];
+    uint32_t * items;
+    uint16_t scale;
+
+    // Per shard, so that they don't have to add to the same sum.
+    uint32_t sum[2][3];
+};
+
+
+static void matrix_draw_encode (
+    void * arg,
+    uint32_t first,
+    uint32_t len
+)
+{
+    struct matrix_draw_s * draw = arg;
+
+    matrix_encode_range(draw->enc, draw->buf, draw->buf16, draw->wire, first, len, draw->sum[0 != first]);
+}
+
+
+static void matrix_draw_write (
+    void * arg,
+    uint32_t first,
+    uint32_t len
+)
+{
+    struct matrix_draw_s * draw = arg;
+
+    matrix_output->write(draw->items, (const uint8_t (*)[3])draw->wire, first, len, draw->scale);
+}
+
+
+// This function takes an rgb display buffer, either 8 bit (buf) or 16 bit
+// (buf16), and draws it on the display using matrix_output. Each pixel goes
+// through enc on its way out (see matrix_encode.h), and then through
+// led_driver, which turns it into what the chipset wants on the wire.
+// Returns how long that took in us, not counting the wait for the previous
+// frame to go out.
+static uint32_t matrix_display_draw_rgb (
+    uint32_t * items,
+    const struct matrix_encode_s * enc,
+    const struct matrix_rgb_s * buf,
+    const struct matrix_rgb16_s * buf16,
+    uint32_t buf_len
+)
+{
 
-};
+    struct matrix_draw_s draw = {
+        .enc = enc,
+        .buf = buf,
+        .buf16 = buf16,
+        .wire = enc->wire,
+        .items = items
+    };
+    uint32_t sum[3];
+    uint32_t len = buf_len;
+    int64_t start_us = esp_timer_get_time();
+    int64_t wait_us;
+    const struct frame_cache_entry_s * cached;
+    uint32_t hash = 0;
+    bool cacheable = NULL == buf16 && NULL != matrix_output->send_frame && 0 != enc->cache->budget;
+
+    // A frame that was encoded before goes out as it was then. 16 bit
+    // frames are dithered, so they never come out the same twice.
+    if (cacheable) {
+        hash = frame_cache_hash(buf, buf_len * sizeof(*buf));
+        cached = frame_cache_get(enc->cache, buf, buf_len * sizeof(*buf), hash);
+        if (NULL != cached) {
+            power_limit_count(enc->power, cached->scale, cached->ma);
+            frame_prefix_invalidate(enc->prefix);
+            wait_us = esp_timer_get_time();
+            matrix_output->wait();
+            wait_us = esp_timer_get_time() - wait_us;
+            matrix_latency_sent();
+            matrix_output->send_frame(cached->data, cached->len);
+            return esp_timer_get_time() - start_us - wait_us;
+        }
+    }
 
+    // For each pixel, in the order they sit on the strip, work out what to
+    // send. The power estimate is summed up on the way.
+    matrix_shard_run(matrix_draw_encode, &draw, buf_len);
+    for (int c = 0; c < 3; c++) {
+        sum[c] = draw.sum[0][c] + draw.sum[1][c];
+    }
+    draw.scale = power_limit_scale(enc->power, buf_len, sum);
 
-struct display_event_s {
-    struct timespec tv;
-    struct matrix_rgb_s display_buf[NUM_PIXELS];
-};
+    // Pixels past the last one that changed can stay as they are.
+    if (matrix_output->chain) {
+        len = frame_prefix_len(enc->prefix, (const uint8_t (*)[3])enc->wire, buf_len, draw.scale);
+    } else {
+        frame_prefix_invalidate(enc->prefix);
+    }
+    if (0 == len) {
+        return esp_timer_get_time() - start_us;
+    }
 
-uint32_t rmt_items[24*NUM_PIXELS] = {0};
+    // The previous frame may still be going out of items.
+    wait_us = esp_timer_get_time();
+    matrix_output->wait();
+    wait_us = esp_timer_get_time() - wait_us;
+
+    // Finally, write out the buffer, with both cores if the output can take
+    // it in pieces.
+    if (NULL != matrix_output->write) {
+        matrix_shard_run(matrix_draw_write, &draw, len);
+        matrix_latency_sent();
+        matrix_output->send(items, NULL, len, draw.scale);
+    } else {
+        matrix_latency_sent();
+        matrix_output->send(items, enc->wire, len, draw.scale);
+    }
 
+    // Only whole frames are worth keeping. Nothing in the cache is being
+    // sent any more, so it's safe to make room in it.
+    if (cacheable && len == buf_len) {
+        frame_cache_put(enc->cache, buf, buf_len * sizeof(*buf), hash,
+                items, led_driver_frame_len(&led_driver, buf_len), draw.scale, enc->power->last_ma);
+    }
 
-void time_sync_notification_cb(struct timeval *tv)
-{
-    ESP_LOGI("time_sync", "time is synced");
-    xEventGroupSetBits(s_wifi_event_group, TIME_SYNC_BIT);
+    return esp_timer_get_time() - start_us - wait_us;
 }
 
 
-static void event_handler (
-    void* arg,
-    esp_event_base_t event_base, 
-    int32_t event_id,
-    void* event_data)
+// Hands a frame to led_task. display_event->read_us has to be set.
+static void nats_queue_display_event (
+    struct display_event_s * display_event
+)
 {
+    static uint16_t seq = 0;
+    UBaseType_t depth;
+
+    // TRACE_NO_FRAME isn't a frame.
+    display_event->seq = seq;
+    seq = (seq + 1) % TRACE_NO_FRAME;
+
+    display_event->queued_us = esp_timer_get_time();
+    latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_PARSE,
+            display_event->queued_us - display_event->read_us);
+    if (pdTRUE != xQueueSend(event_queue, display_event, 0)) {
+        trace_record(&trace, TRACE_QUEUE_FULL, xPortGetCoreID(), display_event->queued_us, display_event->seq);
+        telemetry.queue_full++;
+        return;
+    }
+    trace_record(&trace, TRACE_QUEUED, xPortGetCoreID(), display_event->queued_us, display_event->seq);
 
-    // Connect to wifi
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        esp_wifi_connect();
-        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
-        ESP_LOGI("H", "retry to connect to the AP");
-    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI("H", "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-        xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
-        // Initialize NTP
-        sntp_setoperatingmode(SNTP_OPMODE_POLL);
-        sntp_setservername(0, "192.168.4.1");
-        sntp_set_time_sync_notification_cb(time_sync_notification_cb);
-        sntp_init();
+    telemetry.frames++;
+    depth = uxQueueMessagesWaiting(event_queue);
+    if (depth > telemetry.queue_high) {
+        telemetry.queue_high = depth;
     }
 }
 
 
-static void wifi_init_sta (
-    void
+// matrix1.frame16 is like matrix1.in, but with 16 bits per channel: 8 byte
+// tv_sec, 8 byte tv_nsec, then r, g and b of every pixel as little-endian
+// uint16_t.
+static void nats_dispatch_frame16 (
+    const uint8_t * payload,
+    uint32_t len
 )
 {
-    s_wifi_event_group = xEventGroupCreate();
+    static struct display_event_s display_event;
+    const uint8_t * px;
+    int64_t tv_sec = 0;
+    int64_t tv_nsec = 0;
+
+    if (16 + 6*NUM_PIXELS != len) {
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "dropping %u byte matrix1.frame16", len);
+        telemetry.dropped++;
+        return;
+    }
 
-    esp_netif_init();
+    for (int i = 7; i >= 0; i--) {
+        tv_sec = (tv_sec << 8) | payload[i];
+        tv_nsec = (tv_nsec << 8) | payload[8 + i];
+    }
+    display_event.tv.tv_sec = tv_sec;
+    display_event.tv.tv_nsec = tv_nsec;
+    display_event.wide = true;
+    display_event.read_us = nats_msg_read_us;
+
+    for (int i = 0; i < NUM_PIXELS; i++) {
+        px = &payload[16 + i*6];
+        display_event.display_buf16[i].r = px[0] | (px[1] << 8);
+        display_event.display_buf16[i].g = px[2] | (px[3] << 8);
+        display_event.display_buf16[i].b = px[4] | (px[5] << 8);
+    }
 
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+    nats_queue_display_event(&display_event);
+}
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
+// Handles a message on any subject except matrix1.in. subject is what came
+// after "matrix1.".
+static void nats_dispatch (
+    const char * subject,
+    const uint8_t * payload,
+    uint32_t len
+)
+{
+    if (0 == strcmp(subject, "frame16")) {
+        nats_dispatch_frame16(payload, len);
+        return;
+    }
 
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL));
+    // nats_task sends the dump once it's done with this message. No
+    // payload.
+    if (0 == strcmp(subject, "ctl.trace")) {
+        nats_trace_requested = true;
+        return;
+    }
 
-    // I don't care that this password is in plaintext; it's not a secure
-    // wifi - it's only for the led wall.
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = "led-wall",
-            .password = "nallenalle"
-        },
-    };
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
-    ESP_ERROR_CHECK(esp_wifi_start() );
+    // Telemetry belongs to nats_task, so this one stays here. Payload is
+    // how often to publish, in ms, as a little-endian uint32_t. 0 stops it.
+    if (0 == strcmp(subject, "ctl.telemetry")) {
+        if (4 != len) {
+            ESP_LOGE("nats_task", "rejecting bad telemetry period");
+            telemetry.dropped++;
+            return;
+        }
+        telemetry.period_ms = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+        ESP_LOGI("nats_task", "publishing stats every %u ms", telemetry.period_ms);
+        return;
+    }
 
-    ESP_LOGI("H", "wifi_init_sta finished.");
+    if (0 == strcmp(subject, "ctl.shader")) {
+        nats_control_event.type = 0 == len ? CONTROL_SHADER_CLEAR : CONTROL_SHADER_LOAD;
+    } else if (0 == strcmp(subject, "ctl.map.layout")) {
+        nats_control_event.type = CONTROL_MAP_LAYOUT;
+    } else if (0 == strcmp(subject, "ctl.map.table")) {
+        nats_control_event.type = CONTROL_MAP_TABLE;
+    } else if (0 == strcmp(subject, "ctl.gamma")) {
+        nats_control_event.type = CONTROL_GAMMA;
+    } else if (0 == strcmp(subject, "ctl.brightness")) {
+        nats_control_event.type = CONTROL_BRIGHTNESS;
+    } else if (0 == strcmp(subject, "ctl.power")) {
+        nats_control_event.type = CONTROL_POWER;
+    } else if (0 == strcmp(subject, "ctl.cal")) {
+        nats_control_event.type = CONTROL_CAL;
+    } else if (0 == strcmp(subject, "ctl.driver")) {
+        nats_control_event.type = CONTROL_DRIVER;
+    } else if (0 == strcmp(subject, "ctl.output")) {
+        nats_control_event.type = CONTROL_OUTPUT;
+    } else if (0 == strcmp(subject, "ctl.split")) {
+        nats_control_event.type = CONTROL_SPLIT;
+    } else if (0 == strcmp(subject, "ctl.skip")) {
+        nats_control_event.type = CONTROL_SKIP;
+    } else if (0 == strcmp(subject, "ctl.prefix")) {
+        nats_control_event.type = CONTROL_PREFIX;
+    } else if (0 == strcmp(subject, "ctl.cache")) {
+        nats_control_event.type = CONTROL_CACHE;
+    } else if (0 == strcmp(subject, "ctl.refresh")) {
+        nats_control_event.type = CONTROL_REFRESH;
+    } else {
+        ESP_LOGW("nats_task", "no handler for matrix1.%s", subject);
+        return;
+    }
+
+    nats_control_event.len = len;
+    memcpy(nats_control_event.data, payload, len);
+    if (pdTRUE != xQueueSend(control_queue, &nats_control_event, 0)) {
+        ESP_LOGE("nats_task", "control queue full, dropping matrix1.%s", subject);
+        telemetry.dropped++;
+    }
 }
 
-// This function takes an rgb display buffer and draws it on the display
-// using an rmt channel.
-static void matrix_display_draw_rgb (
-    uint32_t * items,
-    struct matrix_rgb_s * buf,
-    uint32_t buf_len
+
+// Adds a PUB of payload on subject to msg, which holds *used bytes.
+static int nats_pub_add (
+    char * msg,
+    uint32_t * used,
+    const char * subject,
+    const char * payload,
+    uint32_t len
 )
 {
+    int n;
 
-    uint32_t rmt_i = 0;
-    uint8_t bit;
+    if (0 == len) {
+        return -1;
+    }
+    n = snprintf(&msg[*used], NATS_PUB_LEN - *used, "PUB %s %u\r\n", subject, len);
+    if (n < 0 || *used + n + len + 2 > NATS_PUB_LEN) {
+        return -1;
+    }
+    memcpy(&msg[*used + n], payload, len);
+    memcpy(&msg[*used + n + len], "\r\n", 2);
+    *used += n + len + 2;
 
-    // For each pixel...
-    for (int i = 0; i < buf_len; i++) {
+    return 0;
+}
 
-        // Convert this pixels display buffer red to rmt_items.
-        // For each bit in the buf[i].r, set the corresponding 
-        for (bit = 8; bit > 0; bit--) {
-            if ((buf[i].r >> (bit - 1)) & 1) {
-                items[rmt_i] = one;
-            } else {
-                items[rmt_i] = zero;
-            }
-            rmt_i += 1;
-        }
 
-        // Same thing with green
-        for (bit = 8; bit > 0; bit--) {
-            if ((buf[i].g >> (bit - 1)) & 1) {
-                items[rmt_i] = one;
-            } else {
-                items[rmt_i] = zero;
-            }
-            rmt_i += 1;
-        }
+// Publishes the trace on subject, see trace.h for the format. Tracing
+// stops while it goes out, so that the dump is consistent.
+static void nats_publish_trace (
+    int sockfd,
+    const char * subject
+)
+{
+    char header[NATS_SUBJECT_LEN + 32];
+    int n;
+
+    n = snprintf(header, sizeof(header), "PUB %s " NATS_PUB_TRACE_LEN "\r\n", subject);
+    trace.paused = 1;
+    if (n != write(sockfd, header, n) ||
+        sizeof(trace) != write(sockfd, &trace, sizeof(trace)) ||
+        2 != write(sockfd, "\r\n", 2))
+    {
+        ESP_LOGE("nats_task", "could not publish %s", subject);
+        telemetry.publish_failures++;
+    }
+    trace.paused = 0;
+}
 
-        // And blue
-        for (bit = 8; bit > 0; bit--) {
-            if ((buf[i].b >> (bit - 1)) & 1) {
-                items[rmt_i] = one;
-            } else {
-                items[rmt_i] = zero;
-            }
-            rmt_i += 1;
-        }
 
-        spi_device_queue_trans(spi, &(spi_transaction_t) {
-            .tx_buffer = &rmt_items[rmt_i-24],
-            .length = 32*24,
-            .rxlength = 0
-        }, 0);
+// Samples every task there is into task_stats, including the ones ESP-IDF
+// starts. Needs FreeRTOS's trace facility and run time stats, see
+// sdkconfig.
+static void nats_sample_tasks (
+    void
+)
+{
+    static TaskStatus_t status[TASK_STATS_MAX];
+    struct task_stats_task_s * task;
+    uint32_t time;
+    UBaseType_t n;
+
+    n = uxTaskGetSystemState(status, TASK_STATS_MAX, &time);
+    if (0 == n) {
+        ESP_LOGE("nats_task", "more than %d tasks, not sampling them", TASK_STATS_MAX);
+    }
 
+    for (UBaseType_t i = 0; i < n; i++) {
+        task = &task_stats.tasks[i];
+        task->id = status[i].xTaskNumber;
+        strncpy(task->name, status[i].pcTaskName, TASK_STATS_NAME_LEN);
+        task->core = tskNO_AFFINITY == status[i].xCoreID ? -1 : status[i].xCoreID;
+        task->priority = status[i].uxCurrentPriority;
+        task->idle = task->core >= 0 && status[i].xHandle == xTaskGetIdleTaskHandleForCPU(task->core);
+        task->runtime = status[i].ulRunTimeCounter;
+        task->stack_free = status[i].usStackHighWaterMark;
     }
+    task_stats.count = n;
+    task_stats.time = time;
+}
+
 
-    // Finally, write out the buffer.
-//    printf("%u:%u ", rmt_items[8], rmt_items[9]);
-//    spi_device_transmit(spi, &(spi_transaction_t) {
-//        .tx_buffer = rmt_items,
-//        //.length = 32*24*NUM_PIXELS,
-//        .length = 32*24,
-//        .rxlength = 0
-//    });
-//    printf("(%u:%u)\n", rmt_items[8], rmt_items[9]);
+// Publishes telemetry on matrix1.stats.telemetry, latency_hist on
+// matrix1.stats.latency and task_stats on matrix1.stats.tasks. All of it
+// goes out in a single write, so that the read loop is held up once, and
+// only briefly: in practice it's well under what the TCP send buffer holds.
+static void nats_publish_stats (
+    int sockfd
+)
+{
+    static char msg[NATS_PUB_LEN];
+    static char json[NATS_STATS_JSON_LEN];
+    uint32_t used = 0;
+
+    trace_record(&trace, TRACE_PUBLISH, xPortGetCoreID(), esp_timer_get_time(), 0);
+    telemetry.uptime_s = esp_timer_get_time() / 1000000;
+    telemetry.heap_free = esp_get_free_heap_size();
+    telemetry.heap_min = esp_get_minimum_free_heap_size();
+    telemetry.stack_free[TELEMETRY_TASK_LED] = uxTaskGetStackHighWaterMark(led_task_handle);
+    telemetry.stack_free[TELEMETRY_TASK_ENCODE] = uxTaskGetStackHighWaterMark(encode_task_handle);
+    telemetry.stack_free[TELEMETRY_TASK_NATS] = uxTaskGetStackHighWaterMark(NULL);
+    telemetry.stack_free[TELEMETRY_TASK_LOG] = uxTaskGetStackHighWaterMark(log_task_handle);
+    telemetry.log_dropped = log_ring.limited + log_ring.full;
+    nats_sample_tasks();
+
+    if (0 != nats_pub_add(msg, &used, "matrix1.stats.telemetry",
+                json, telemetry_json(&telemetry, json, sizeof(json))) ||
+        0 != nats_pub_add(msg, &used, "matrix1.stats.latency",
+                json, latency_hist_json(&latency_hist, json, sizeof(json))) ||
+        0 != nats_pub_add(msg, &used, "matrix1.stats.tasks",
+                json, task_stats_json(&task_stats, json, sizeof(json))) ||
+        used != write(sockfd, msg, used))
+    {
+        ESP_LOGE("nats_task", "could not publish stats");
+        telemetry.publish_failures++;
+    }
+    task_stats_next(&task_stats);
 }
 
 
@@ -238,6 +1579,13 @@ static void nats_task (
     uint8_t color_i = 0;
     uint8_t tv_sec_i = 0;
     uint8_t tv_nsec_i = 0;
+    char subject[NATS_SUBJECT_LEN];
+    uint8_t subject_i = 0;
+    uint32_t payload_len = 0;
+    uint32_t payload_i = 0;
+    int64_t read_us = 0;
+    int64_t published_us = 0;
+    bool subscribed = false;
 
     union {
         long tv_sec;
@@ -265,10 +1613,23 @@ static void nats_task (
                 ESP_LOGE("nats_task", "Failed to subscribe to matrix1.in!");
                 esp_restart();
             }
+            bytes_written = write(sockfd, "SUB matrix1.ctl.> 2\r\n", strlen("SUB matrix1.ctl.> 2\r\n"));
+            if (-1 == bytes_written || 0 == bytes_written) {
+                ESP_LOGE("nats_task", "Failed to subscribe to matrix1.ctl.>!");
+                esp_restart();
+            }
+            bytes_written = write(sockfd, "SUB matrix1.frame16 3\r\n", strlen("SUB matrix1.frame16 3\r\n"));
+            if (-1 == bytes_written || 0 == bytes_written) {
+                ESP_LOGE("nats_task", "Failed to subscribe to matrix1.frame16!");
+                esp_restart();
+            }
+            subscribed = true;
+            published_us = esp_timer_get_time();
         }
 
         action pong {
-            ESP_LOGI("nats_task", "PONG");
+            MATRIX_LOG('I', 1, "nats_task", "PONG");
+            trace_record(&trace, TRACE_PING, xPortGetCoreID(), esp_timer_get_time(), 0);
             bytes_written = write(sockfd, "PONG\r\n", strlen("PONG\r\n"));
             if (-1 == bytes_written || 0 == bytes_written) {
                 ESP_LOGE("nats_task", "Failed to PONG!");
@@ -289,7 +1650,54 @@ static void nats_task (
         }
 
         action display {
-            xQueueSend(event_queue, &display_event, 0);
+            display_event.read_us = nats_msg_read_us;
+            nats_queue_display_event(&display_event);
+        }
+
+        action subject_start {
+            subject_i = 0;
+        }
+
+        action copy_subject {
+            if (subject_i < NATS_SUBJECT_LEN - 1) {
+                subject[subject_i++] = *p;
+            }
+        }
+
+        action payload_len_start {
+            payload_len = 0;
+        }
+
+        action copy_payload_len {
+            payload_len = payload_len * 10 + (*p - '0');
+        }
+
+        action payload_start {
+            subject[subject_i] = '\0';
+            payload_i = 0;
+            if (0 == payload_len) {
+                fgoto msg_end;
+            }
+            fgoto msg_payload;
+        }
+
+        action copy_payload {
+            if (payload_i < NATS_PAYLOAD_LEN) {
+                nats_payload[payload_i] = *p;
+            }
+            payload_i += 1;
+            if (payload_i == payload_len) {
+                fgoto msg_end;
+            }
+        }
+
+        action dispatch {
+            if (payload_len > NATS_PAYLOAD_LEN) {
+                MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "dropping %u byte message", payload_len);
+                telemetry.dropped++;
+            } else {
+                nats_dispatch(subject, nats_payload, payload_len);
+            }
         }
 
         action zero_tv_sec {
@@ -316,38 +1724,61 @@ static void nats_task (
             display_event.tv.tv_nsec = my_tv_nsec.tv_nsec;
         }
 
+        # Errors anywhere in here, not just in the trailing CRLF, go back to
+        # loop: a matrix1.in with the wrong length, or a subject outside of
+        # matrix1., would otherwise leave the parser in the error state for
+        # good.
         msg := 
-            ' matrix1.in 1 163\r\n' @{ color_i = 0; }
-                any{8} >to(zero_tv_sec) $copy_tv_sec @fin_tv_sec
-                any{8} >to(zero_tv_nsec) $copy_tv_nsec @fin_tv_nsec
-                (
-                  any $copy_red 
-                  any $copy_green
-                  any $copy_blue @{ color_i += 1; }
-                ){49}
-              '\r\n' @display @{ fgoto loop; }
-              $err{ ESP_LOGE("nats_task_msg", "err: %c (0x%02x)", *p, *p); fgoto loop; };
-
-        ping := '\r\n' @pong $err{ ESP_LOGE("nats_task_ping", "err: %c (0x%02x)", *p, *p); fgoto loop; } @{ fgoto loop; };
+            (
+              ' matrix1.'
+              (
+                'in 1 163\r\n' @{ color_i = 0; }
+                  any{8} >to(zero_tv_sec) $copy_tv_sec @fin_tv_sec
+                  any{8} >to(zero_tv_nsec) $copy_tv_nsec @fin_tv_nsec
+                  (
+                    any $copy_red 
+                    any $copy_green
+                    any $copy_blue @{ color_i += 1; }
+                  ){49}
+                '\r\n' @display @{ fgoto loop; }
+              |
+                # Any other subject goes through the generic path.
+                ([a-z0-9._] - 'i') @{ fhold; fgoto msg_subject; }
+              )
+            ) $err{ telemetry.parse_errors[TELEMETRY_NATS_MSG]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_msg", "err: %c (0x%02x)", *p, *p); fgoto loop; };
+
+        msg_subject :=
+            (
+              [a-z0-9._]+ >subject_start $copy_subject
+              ' ' digit+
+              ' ' digit+ >payload_len_start $copy_payload_len
+              '\r\n' @payload_start
+            ) $err{ telemetry.parse_errors[TELEMETRY_NATS_MSG_SUBJECT]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_msg_subject", "err: %c (0x%02x)", *p, *p); fgoto loop; };
+
+        msg_payload := ( any $copy_payload )*;
+
+        msg_end := '\r\n' @dispatch @{ fgoto loop; } $err{ telemetry.parse_errors[TELEMETRY_NATS_MSG_END]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_msg_end", "err: %c (0x%02x)", *p, *p); fgoto loop; };
+
+        ping := '\r\n' @pong $err{ telemetry.parse_errors[TELEMETRY_NATS_PING]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_ping", "err: %c (0x%02x)", *p, *p); fgoto loop; } @{ fgoto loop; };
 
         info := ' {'
                 (any - '}')*
                 '}'
                 ' '?
-                '\r\n' $err{ ESP_LOGE("nats_task_info", "err: %c (0x%02x)", *p, *p); fgoto loop; }
+                '\r\n' $err{ telemetry.parse_errors[TELEMETRY_NATS_INFO]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task_info", "err: %c (0x%02x)", *p, *p); fgoto loop; }
                 @{ fgoto loop; };
 
         loop :=
             ( 'INFO' @{ fgoto info; }
             | 'PING' @{ fgoto ping; }
-            | 'MSG' @{ fgoto msg; }
-            ) $err{ ESP_LOGE("nats_task", "err in loop: %c (0x%02x) in state %d", *p, *p, cs); fgoto loop; };
+            | 'MSG' @{ nats_msg_read_us = read_us; trace_record(&trace, TRACE_MSG, xPortGetCoreID(), read_us, 0); fgoto msg; }
+            ) $err{ telemetry.parse_errors[TELEMETRY_NATS_LOOP]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "err in loop: %c (0x%02x) in state %d", *p, *p, cs); fgoto loop; };
 
         main := 'INFO {'
                 (any - '}')*
                 '}'
                 ' '?
-                '\r\n' @subscribe $err{ ESP_LOGE("nats_task", "err: %c (0x%02x)", *p, *p); }
+                '\r\n' @subscribe $err{ telemetry.parse_errors[TELEMETRY_NATS_MAIN]++; MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "nats_task", "err: %c (0x%02x)", *p, *p); }
                 '+OK\r\n' @{ fgoto loop; };
 
         write data;
@@ -411,11 +1842,23 @@ static void nats_task (
         }
 
         ESP_LOGI("nats_task", "Connected to NATS!");
+        telemetry.connects++;
+
+        if (0 != setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &(struct timeval) {
+                    .tv_sec = NATS_READ_TIMEOUT_MS / 1000,
+                    .tv_usec = NATS_READ_TIMEOUT_MS % 1000 * 1000
+                }, sizeof(struct timeval)))
+        {
+            ESP_LOGE("nats_task", "could not set a read timeout, stats only go out when something comes in");
+        }
 
         // Read loop on nats
         do {
             bytes_read = read(sockfd, buf, NATS_BUF_LEN);
-            if (-1 == bytes_read) {
+            read_us = esp_timer_get_time();
+            if (-1 == bytes_read && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+                // Nothing came in, just check whether stats are due.
+            } else if (-1 == bytes_read) {
                 ESP_LOGE("nats_task", "read returned -1");
                 // todo: reset, or retry.
                 esp_restart();
@@ -426,6 +1869,32 @@ static void nats_task (
                 esp_restart();
             }
 
+            // Stats wait for the end of the message being read, so that
+            // they don't hold up a frame halfway through, unless that keeps
+            // them waiting for another whole period.
+            if (subscribed && 0 != telemetry.period_ms &&
+                read_us - published_us >= (int64_t)telemetry.period_ms * 1000 &&
+                (nats_en_loop == cs || read_us - published_us >= (int64_t)telemetry.period_ms * 2000))
+            {
+                nats_publish_stats(sockfd);
+                published_us = read_us;
+            }
+
+            // A trace that survived a crash goes out as soon as possible,
+            // and then tracing starts over.
+            if (subscribed && trace_crashed) {
+                nats_publish_trace(sockfd, "matrix1.stats.trace.crash");
+                trace_init(&trace);
+                trace_crashed = false;
+            }
+            if (nats_trace_requested && nats_en_loop == cs) {
+                nats_publish_trace(sockfd, "matrix1.stats.trace");
+                nats_trace_requested = false;
+            }
+            if (-1 == bytes_read) {
+                continue;
+            }
+
             p = buf;
             pe = buf + bytes_read;
             %% write exec;
@@ -437,6 +1906,77 @@ static void nats_task (
 }
 
 
+// Loads the color calibration saved in nvs, if there is any.
+static void color_cal_restore (
+    struct color_cal_s * cal,
+    uint8_t * data
+)
+{
+    nvs_handle_t nvs;
+    size_t len = NATS_PAYLOAD_LEN;
+    esp_err_t ret;
+
+    ret = nvs_open(COLOR_CAL_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (ESP_OK != ret) {
+        return;
+    }
+    ret = nvs_get_blob(nvs, COLOR_CAL_NVS_KEY, data, &len);
+    nvs_close(nvs);
+    if (ESP_OK != ret) {
+        return;
+    }
+
+    if (0 != color_cal_load(cal, NUM_PIXELS, data, len)) {
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "color calibration in nvs is bad, ignoring its %u bytes", len);
+        return;
+    }
+    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "loaded %u bytes of color calibration from nvs", len);
+}
+
+
+// Saves the color calibration to nvs, or removes it if len is 0.
+static void color_cal_save (
+    const uint8_t * data,
+    uint32_t len
+)
+{
+    nvs_handle_t nvs;
+    esp_err_t ret;
+
+    ret = nvs_open(COLOR_CAL_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ESP_OK != ret) {
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "nvs_open() returned %d", ret);
+        return;
+    }
+
+    if (0 == len) {
+        ret = nvs_erase_key(nvs, COLOR_CAL_NVS_KEY);
+        if (ESP_ERR_NVS_NOT_FOUND == ret) {
+            ret = ESP_OK;
+        }
+    } else {
+        ret = nvs_set_blob(nvs, COLOR_CAL_NVS_KEY, data, len);
+    }
+    if (ESP_OK == ret) {
+        ret = nvs_commit(nvs);
+    }
+    if (ESP_OK != ret) {
+        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "could not save color calibration: %d", ret);
+    }
+    nvs_close(nvs);
+}
+
+
+// Encoded frames are sent from where frame_cache keeps them, so they have
+// to be in memory the SPI DMA can get at.
+static void * matrix_cache_alloc (
+    size_t size
+)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_DMA);
+}
+
+
 static void led_task (
     void * arg
 )
@@ -448,11 +1988,411 @@ static void led_task (
     int64_t tv_sec_diff;
     int64_t tv_nsec_diff;
     uint32_t sleep_ms;
+    uint32_t wait_ms;
+    int64_t tick_us = 0;
+    int64_t dequeued_us = 0;
+    int64_t delay_us;
+
+    // These are too big for the stack of this task.
+    static struct control_event_s control_event;
+    static struct shader_vm_s shader_vm;
+    static struct matrix_rgb_s shown[NUM_PIXELS];
+    static uint16_t pixel_map[NUM_PIXELS];
+    static struct color_lut_s color_lut;
+    static uint8_t dither[NUM_PIXELS][3];
+    static uint8_t wire[NUM_PIXELS][3];
+    static struct matrix_rgb16_s shown16[NUM_PIXELS];
+    static struct power_limit_s power_limit;
+    static struct color_cal_s color_cal;
+    static uint8_t color_cal_segment[NUM_PIXELS];
+    static struct frame_skip_s frame_skip;
+    static struct frame_prefix_s frame_prefix;
+    static uint8_t frame_prefix_last[NUM_PIXELS][3];
+    static struct frame_cache_s frame_cache;
+    static struct frame_clock_s frame_clock;
+    struct matrix_encode_s encoder = {
+        .map = pixel_map,
+        .lut = &color_lut,
+        .cal = &color_cal,
+        .dither = dither,
+        .wire = wire,
+        .power = &power_limit,
+        .prefix = &frame_prefix,
+        .cache = &frame_cache
+    };
+    uint32_t power_report_ms = 0;
+    bool shown_wide = false;
+    bool shader_loaded = false;
+    bool redraw = false;
+    bool dirty;
+    uint32_t now_ms;
+    uint16_t gamma[3];
+    uint16_t rate_hz;
+    char driver_order[5];
+    struct led_driver_s driver;
+    static const struct matrix_output_s * outputs[] = {
+        &matrix_output_spi,
+        &matrix_output_rmt,
+        &matrix_output_i2s,
+        &matrix_output_split
+    };
+    struct led_split_s split;
+
+    // Until told otherwise, frames are in the same order as the strip.
+    pixel_map_build(pixel_map, MATRIX_WIDTH, MATRIX_HEIGHT, &(struct pixel_map_layout_s){0});
+    color_lut_init(&color_lut);
+    power_limit_init(&power_limit);
+    color_cal_init(&color_cal, color_cal_segment);
+    color_cal_restore(&color_cal, control_event.data);
+    frame_skip_init(&frame_skip);
+    frame_prefix_init(&frame_prefix, frame_prefix_last);
+    frame_cache_init(&frame_cache, matrix_cache_alloc, heap_caps_free);
+    frame_clock_init(&frame_clock);
 
 
     while(1) {
-        qres = xQueueReceive(event_queue, &display_event, portMAX_DELAY);
+        while (pdTRUE == xQueueReceive(control_queue, &control_event, 0)) {
+
+            // Most control messages change how frames are encoded, so to be
+            // safe, none of the encoded frames kept so far are used again.
+            frame_cache_invalidate(&frame_cache);
+
+            trace_record(&trace, TRACE_CONTROL, xPortGetCoreID(), esp_timer_get_time(), control_event.type);
+            switch (control_event.type) {
+                case CONTROL_SHADER_LOAD:
+                    if (0 != shader_vm_load(&shader_vm, control_event.data, control_event.len)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting malformed shader of %u bytes", control_event.len);
+                        break;
+                    }
+                    shader_loaded = true;
+                    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "loaded shader with %u instructions", shader_vm.len);
+                    break;
+
+                case CONTROL_SHADER_CLEAR:
+                    shader_loaded = false;
+                    break;
+
+                // Payload is struct pixel_map_layout_s.
+                case CONTROL_MAP_LAYOUT:
+                    if (sizeof(struct pixel_map_layout_s) != control_event.len ||
+                        0 != pixel_map_build(pixel_map, MATRIX_WIDTH, MATRIX_HEIGHT,
+                                (struct pixel_map_layout_s *)control_event.data))
+                    {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad pixel map layout of %u bytes", control_event.len);
+                        break;
+                    }
+                    redraw = true;
+                    break;
+
+                case CONTROL_MAP_TABLE:
+                    if (0 != pixel_map_load(pixel_map, NUM_PIXELS, control_event.data, control_event.len)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad pixel map table of %u bytes", control_event.len);
+                        break;
+                    }
+                    redraw = true;
+                    break;
+
+                // Payload is the gamma of r, g and b in hundredths, as
+                // little-endian uint16_t.
+                case CONTROL_GAMMA:
+                    if (6 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad gamma of %u bytes", control_event.len);
+                        break;
+                    }
+                    for (int c = 0; c < 3; c++) {
+                        gamma[c] = control_event.data[c*2] | (control_event.data[c*2 + 1] << 8);
+                    }
+                    if (0 != color_lut_set_gamma(&color_lut, gamma)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad gamma %u %u %u", gamma[0], gamma[1], gamma[2]);
+                        break;
+                    }
+                    redraw = true;
+                    break;
+
+                // Payload is the brightness, optionally followed by how many
+                // milliseconds to ramp to it over, as a little-endian
+                // uint16_t.
+                case CONTROL_BRIGHTNESS:
+                    if (1 != control_event.len && 3 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad brightness of %u bytes", control_event.len);
+                        break;
+                    }
+                    color_lut_set_brightness(&color_lut, control_event.data[0],
+                            3 == control_event.len ? control_event.data[1] | (control_event.data[2] << 8) : 0,
+                            xTaskGetTickCount() * portTICK_PERIOD_MS);
+                    redraw = true;
+                    break;
+
+                // Payload is the budget in mA as a little-endian uint32_t,
+                // optionally followed by the mA of the r, g and b channels at
+                // full brightness and the idle mA of one LED, as
+                // little-endian uint16_t.
+                case CONTROL_POWER:
+                    if (4 != control_event.len && 12 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad power budget of %u bytes", control_event.len);
+                        break;
+                    }
+                    power_limit.budget_ma = control_event.data[0] | (control_event.data[1] << 8) |
+                        (control_event.data[2] << 16) | ((uint32_t)control_event.data[3] << 24);
+                    if (12 == control_event.len) {
+                        for (int c = 0; c < 3; c++) {
+                            power_limit.channel_ma[c] = control_event.data[4 + c*2] | (control_event.data[5 + c*2] << 8);
+                        }
+                        power_limit.idle_ma = control_event.data[10] | (control_event.data[11] << 8);
+                    }
+                    redraw = true;
+                    break;
+
+                // See color_cal_load for the payload. It is kept in nvs, so
+                // that the wall stays calibrated across reboots.
+                case CONTROL_CAL:
+                    if (0 != color_cal_load(&color_cal, NUM_PIXELS, control_event.data, control_event.len)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad color calibration of %u bytes", control_event.len);
+                        break;
+                    }
+                    color_cal_save(control_event.data, control_event.len);
+                    redraw = true;
+                    break;
+
+                // Payload is the chipset (enum led_driver_type_e), optionally
+                // followed by the order of its channels, as in "grb".
+                case CONTROL_DRIVER:
+                    if (0 == control_event.len || control_event.len > 5) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad driver of %u bytes", control_event.len);
+                        break;
+                    }
+                    memcpy(driver_order, &control_event.data[1], control_event.len - 1);
+                    driver_order[control_event.len - 1] = '\0';
+                    if (0 != led_driver_init(&driver, control_event.data[0], 1 == control_event.len ? NULL : driver_order) ||
+                        0 != matrix_display_reconfigure(&driver, matrix_output))
+                    {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad driver %u", control_event.data[0]);
+                        break;
+                    }
+                    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "now driving chipset %u", led_driver.type);
+                    frame_prefix_invalidate(&frame_prefix);
+
+                    // Frames may take longer to go out now.
+                    frame_clock_set_rate(&frame_clock, frame_clock.rate_hz,
+                            led_driver_frame_us(&led_driver, NUM_PIXELS), esp_timer_get_time());
+                    redraw = true;
+                    break;
+
+                // Payload is 0 for SPI, 1 for RMT, 2 for I2S, 3 for SPI2,
+                // SPI3 and RMT together.
+                case CONTROL_OUTPUT:
+                    if (1 != control_event.len || control_event.data[0] >= sizeof(outputs) / sizeof(outputs[0]) ||
+                        0 != matrix_display_reconfigure(&led_driver, outputs[control_event.data[0]]))
+                    {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad output %u", control_event.data[0]);
+                        break;
+                    }
+                    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "now driving the strip over output %u", control_event.data[0]);
+                    frame_prefix_invalidate(&frame_prefix);
+                    redraw = true;
+                    break;
+
+                // See led_split_load for the payload.
+                case CONTROL_SPLIT:
+                    split = led_split;
+                    if (0 != led_split_load(&split, NUM_PIXELS, control_event.data, control_event.len) ||
+                        !GPIO_IS_VALID_OUTPUT_GPIO(split.pin[0]) ||
+                        !GPIO_IS_VALID_OUTPUT_GPIO(split.pin[1]) ||
+                        !GPIO_IS_VALID_OUTPUT_GPIO(split.pin[2]))
+                    {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad split of %u bytes", control_event.len);
+                        break;
+                    }
+                    if (&matrix_output_split != matrix_output) {
+                        led_split = split;
+                        break;
+                    }
+                    matrix_output->wait();
+                    matrix_output->close();
+                    led_split = split;
+                    if (ESP_OK != matrix_output->open()) {
+                        esp_restart();
+                    }
+                    redraw = true;
+                    break;
+
+                // See frame_skip_load for the payload.
+                case CONTROL_SKIP:
+                    if (0 != frame_skip_load(&frame_skip, control_event.data, control_event.len)) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad frame skip settings of %u bytes", control_event.len);
+                    }
+                    break;
+
+                // Payload is 1 to send only as much of the strip as changed,
+                // 0 to send all of it.
+                case CONTROL_PREFIX:
+                    if (1 != control_event.len || control_event.data[0] > 1) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad prefix setting of %u bytes", control_event.len);
+                        break;
+                    }
+                    frame_prefix.enabled = control_event.data[0];
+                    break;
+
+                // Payload is how much memory encoded frames may take up, as
+                // a little-endian uint32_t, in bytes. 0 turns the cache off.
+                case CONTROL_CACHE:
+                    if (4 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad cache budget of %u bytes", control_event.len);
+                        break;
+                    }
+                    // The frame going out may be one that's thrown out.
+                    matrix_output->wait();
+                    frame_cache_set_budget(&frame_cache, control_event.data[0] | (control_event.data[1] << 8) |
+                            (control_event.data[2] << 16) | ((uint32_t)control_event.data[3] << 24));
+                    break;
+
+                // Payload is the rate to present frames at, in Hz, as a
+                // little-endian uint16_t. 0 stops the clock, so that the strip
+                // is only drawn when something changes.
+                case CONTROL_REFRESH:
+                    if (2 != control_event.len) {
+                        MATRIX_LOG('E', MATRIX_LOG_ERRORS_PER_S, "led_task", "rejecting bad refresh rate of %u bytes", control_event.len);
+                        break;
+                    }
+                    rate_hz = frame_clock_set_rate(&frame_clock, control_event.data[0] | (control_event.data[1] << 8),
+                            led_driver_frame_us(&led_driver, NUM_PIXELS), esp_timer_get_time());
+                    MATRIX_LOG('I', MATRIX_LOG_ERRORS_PER_S, "led_task", "refreshing at %u Hz", rate_hz);
+                    break;
+            }
+        }
+
+        // Don't block forever, so that control messages get handled, and a
+        // loaded shader or brightness ramp keeps going while no frames come
+        // in. A 16 bit frame is redrawn over and over, for the dithering.
+        // With the refresh clock running, wait for its next tick instead.
+        // A tick that's due goes first, so that frames coming in can't hold
+        // it up.
+        if (0 != frame_clock.period_us) {
+            wait_ms = (frame_clock_wait_us(&frame_clock, esp_timer_get_time()) + 999) / 1000;
+            qres = 0 == wait_ms ? pdFALSE : xQueueReceive(event_queue, &display_event, wait_ms / portTICK_PERIOD_MS);
+        } else {
+            qres = xQueueReceive(event_queue, &display_event,
+                    (shown_wide ? DITHER_REFRESH_PERIOD_MS : LED_STRIP_REFRESH_PERIOD_MS) / portTICK_PERIOD_MS);
+        }
+
+        // Only frames that just came in are timed, see matrix_latency_s.
+        matrix_latency.dequeued_us = 0;
+        if (pdTRUE == qres) {
+            dequeued_us = esp_timer_get_time();
+            latency_hist_record(&latency_hist, xPortGetCoreID(), LATENCY_QUEUE,
+                    dequeued_us - display_event.queued_us);
+            trace_record(&trace, TRACE_DEQUEUED, xPortGetCoreID(), dequeued_us, display_event.seq);
+        }
+
+        now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        if (now_ms - power_report_ms >= POWER_LIMIT_REPORT_PERIOD_MS) {
+            if (0 != power_limit.limited_frames) {
+                MATRIX_LOG('W', 1, "led_task", "power limit: %u of %u frames limited, to %u%% on average and %u%% at worst",
+                        power_limit.limited_frames,
+                        power_limit.frames,
+                        power_limit.scale_sum * 100 / 256 / power_limit.limited_frames,
+                        power_limit.min_scale * 100 / 256);
+                MATRIX_LOG('W', 1, "led_task", "power limit: peak %u mA, budget %u mA",
+                        power_limit.max_ma,
+                        power_limit.budget_ma);
+            }
+            telemetry.power_frames += power_limit.frames;
+            telemetry.power_limited += power_limit.limited_frames;
+            telemetry.power_scale_sum += power_limit.scale_sum;
+            if (power_limit.min_scale < telemetry.power_min_scale) {
+                telemetry.power_min_scale = power_limit.min_scale;
+            }
+            if (power_limit.max_ma > telemetry.power_max_ma) {
+                telemetry.power_max_ma = power_limit.max_ma;
+            }
+            power_limit_reset_stats(&power_limit);
+            if (0 != frame_skip.skipped) {
+                MATRIX_LOG('I', 1, "led_task", "skipped %u of %u frames as unchanged, saving %u ms of encoding",
+                        frame_skip.skipped,
+                        frame_skip.frames,
+                        (uint32_t)(frame_skip.saved_us / 1000));
+            }
+            telemetry.skipped += frame_skip.skipped;
+            frame_skip_reset_stats(&frame_skip);
+            if (0 != frame_prefix.truncated) {
+                MATRIX_LOG('I', 1, "led_task", "truncated %u of %u frames, sending %u%% of the pixels",
+                        frame_prefix.truncated,
+                        frame_prefix.frames,
+                        (uint32_t)(frame_prefix.pixels_sent * 100 / frame_prefix.pixels));
+            }
+            telemetry.prefix_bytes_saved += led_driver_frame_len(&led_driver, frame_prefix.pixels - frame_prefix.pixels_sent) -
+                    led_driver_frame_len(&led_driver, 0);
+            frame_prefix_reset_stats(&frame_prefix);
+            if (0 != frame_cache.lookups) {
+                MATRIX_LOG('I', 1, "led_task", "frame cache: %u of %u frames hit, saving %u kB of encoding, %u bytes used",
+                        frame_cache.hits,
+                        frame_cache.lookups,
+                        (uint32_t)(frame_cache.bytes_saved / 1024),
+                        frame_cache.used);
+            }
+            telemetry.cache_lookups += frame_cache.lookups;
+            telemetry.cache_hits += frame_cache.hits;
+            telemetry.cache_bytes_saved += (uint32_t)frame_cache.bytes_saved;
+            telemetry.cache_used = frame_cache.used;
+            frame_cache_reset_stats(&frame_cache);
+            if (0 != frame_clock.missed || 0 != frame_clock.overruns) {
+                MATRIX_LOG('W', 1, "led_task", "refresh clock: %u ticks, %u missed, %u took longer than a tick, up to %u us",
+                        frame_clock.ticks,
+                        frame_clock.missed,
+                        frame_clock.overruns,
+                        frame_clock.max_us);
+            }
+            telemetry.clock_ticks += frame_clock.ticks;
+            telemetry.clock_missed += frame_clock.missed;
+            telemetry.clock_overruns += frame_clock.overruns;
+            if (frame_clock.max_us > telemetry.clock_max_us) {
+                telemetry.clock_max_us = frame_clock.max_us;
+            }
+            frame_clock_reset_stats(&frame_clock);
+            power_report_ms = now_ms;
+        }
+
         if (pdFALSE == qres) {
+
+            // With the refresh clock running, this is where its ticks are
+            // handled, and every one of them presents the whole frame again.
+            if (0 != frame_clock.period_us) {
+                tick_us = esp_timer_get_time();
+                if (!frame_clock_due(&frame_clock, tick_us)) {
+                    continue;
+                }
+                trace_record(&trace, TRACE_TICK, xPortGetCoreID(), tick_us, 0);
+                frame_prefix_invalidate(&frame_prefix);
+                redraw = true;
+            }
+
+            if (frame_skip_refresh_due(&frame_skip, now_ms)) {
+                frame_prefix_invalidate(&frame_prefix);
+                redraw = true;
+            }
+            if (color_lut_update(&color_lut, now_ms)) {
+                frame_cache_invalidate(&frame_cache);
+                redraw = true;
+            }
+            if (shown_wide) {
+                frame_skip_drawn(&frame_skip, now_ms,
+                        matrix_display_draw_rgb(rmt_items, &encoder, NULL, shown16, NUM_PIXELS));
+                redraw = false;
+            } else {
+                if (shader_loaded) {
+                    shader_vm_run(&shader_vm, shown, MATRIX_WIDTH, MATRIX_HEIGHT, now_ms, SHADER_VM_FRAME_BUDGET);
+                    redraw = true;
+                }
+                if (redraw) {
+                    frame_skip_drawn(&frame_skip, now_ms,
+                            matrix_display_draw_rgb(rmt_items, &encoder, shown, NULL, NUM_PIXELS));
+                    redraw = false;
+                }
+            }
+
+            if (0 != frame_clock.period_us) {
+                frame_clock_tick(&frame_clock, tick_us, esp_timer_get_time() - tick_us);
+            }
             continue;
         }
 
@@ -463,18 +2403,72 @@ static void led_task (
 
         if (tv_sec_diff < 0 || (0 == tv_sec_diff && tv_nsec_diff < 0)) {
             // We already missed this event - just skip it.
-            printf("missed event - supposed to be at %ld, but we're at %ld\n", display_event.tv.tv_sec, tv.tv_sec);
+            telemetry_missed(&telemetry, -(tv_sec_diff * 1000 + tv_nsec_diff / 1000000));
+            trace_record(&trace, TRACE_MISSED, xPortGetCoreID(), esp_timer_get_time(), display_event.seq);
+            MATRIX_LOG('W', MATRIX_LOG_ERRORS_PER_S, "led_task", "missed event - supposed to be at %d, but we're at %d",
+                    (int)display_event.tv.tv_sec, (int)tv.tv_sec);
             continue;
         }
 
         sleep_ms = tv_sec_diff*1000 + tv_nsec_diff/1000000;
         if (sleep_ms > 3000) sleep_ms = 3000;
 
+        delay_us = esp_timer_get_time();
         vTaskDelay(sleep_ms / portTICK_PERIOD_MS);
 
+        // The frame asked for the wait, so it doesn't count as latency.
+        delay_us = esp_timer_get_time() - delay_us;
+        matrix_latency.read_us = display_event.read_us + delay_us;
+        matrix_latency.dequeued_us = dequeued_us + delay_us;
+        matrix_latency.seq = display_event.seq;
+        trace_record(&trace, TRACE_DEADLINE, xPortGetCoreID(), esp_timer_get_time(), display_event.seq);
+
+        now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        dirty = redraw;
+        redraw = false;
+        if (color_lut_update(&color_lut, now_ms)) {
+            frame_cache_invalidate(&frame_cache);
+            dirty = true;
+        }
+        if (frame_skip_refresh_due(&frame_skip, now_ms)) {
+            frame_prefix_invalidate(&frame_prefix);
+        }
+
+        // The shader only works on 8 bit frames.
+        if (display_event.wide) {
+            if (shown_wide && frame_skip_check(&frame_skip, display_event.display_buf16, shown16,
+                        sizeof(shown16), dirty, now_ms))
+            {
+                trace_record(&trace, TRACE_SKIPPED, xPortGetCoreID(), esp_timer_get_time(), display_event.seq);
+                continue;
+            }
+            frame_skip_drawn(&frame_skip, now_ms,
+                    matrix_display_draw_rgb(rmt_items, &encoder, NULL, display_event.display_buf16, NUM_PIXELS));
+            memcpy(shown16, display_event.display_buf16, sizeof(shown16));
+            shown_wide = true;
+            continue;
+        }
+
+        if (shader_loaded) {
+            shader_vm_run(&shader_vm, display_event.display_buf, MATRIX_WIDTH, MATRIX_HEIGHT,
+                    now_ms, SHADER_VM_FRAME_BUDGET);
+        }
+
+        // A shader that moves makes every frame different, so this only
+        // skips frames it left alone.
+        if (!shown_wide && frame_skip_check(&frame_skip, display_event.display_buf, shown,
+                    sizeof(shown), dirty, now_ms))
+        {
+            trace_record(&trace, TRACE_SKIPPED, xPortGetCoreID(), esp_timer_get_time(), display_event.seq);
+            continue;
+        }
+
         //vTaskSuspendAll();
-        matrix_display_draw_rgb(rmt_items, display_event.display_buf, NUM_PIXELS);
+        frame_skip_drawn(&frame_skip, now_ms,
+                matrix_display_draw_rgb(rmt_items, &encoder, display_event.display_buf, NULL, NUM_PIXELS));
         //xTaskResumeAll();
+        memcpy(shown, display_event.display_buf, sizeof(shown));
+        shown_wide = false;
     }
 }
 
@@ -497,44 +2491,27 @@ void app_main (
     // Initialize queue
     event_queue = xQueueCreate(128, sizeof(struct display_event_s));
     // TODO: error check
-
-
-    ret = spi_bus_initialize(
-        /* spi_host_device_t host = */ SPI2_HOST,
-        /* spi_bus_config_t * config = */ &(spi_bus_config_t) {
-            .miso_io_num = -1,
-            .mosi_io_num = SPI_CHANNEL_1_MOSI,
-            .sclk_io_num = SPI_CHANNEL_1_SCLK,
-            .quadwp_io_num = -1,
-            .quadhd_io_num = -1,
-            .max_transfer_sz = 8192
-        },
-        /* dma_chan = */ 1
-    );
-    if (ESP_OK != ret) {
-        ESP_LOGE(__func__, "Could not initialize SPI bus.");
-        return -1;
+    control_queue = xQueueCreate(4, sizeof(struct control_event_s));
+
+    latency_hist_init(&latency_hist);
+    telemetry_init(&telemetry);
+    log_ring_init(&log_ring);
+    task_stats_init(&task_stats);
+
+    // A trace from before anything but a power cycle is kept until it's
+    // been published, see nats_task.
+    if (ESP_RST_POWERON != esp_reset_reason() && trace_survived(&trace)) {
+        trace.paused = 1;
+        trace_crashed = true;
+    } else {
+        trace_init(&trace);
     }
 
-    ret = spi_bus_add_device(
-        /* spi_host_device_t host = */ SPI2_HOST,
-        /* spi_device_interface_config_t * config = */ &(spi_device_interface_config_t) {
-            .command_bits = 0,
-            .address_bits = 0,
-            .dummy_bits = 0,
-            .clock_speed_hz = 25641025,
-            .mode = 1,
-            .spics_io_num = -1,
-            .queue_size = NUM_PIXELS,
-            .cs_ena_posttrans = 0,
-            .cs_ena_pretrans = 0,
-            .flags = SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_3WIRE,
-            .input_delay_ns = 0
-        },
-        /* spi_device_handle_t * handle = */ &spi
-    );
+
+    // The wall has always been sent r, g, b in that order.
+    led_driver_init(&led_driver, LED_DRIVER_WS2812, "rgb");
+    ret = matrix_output->open();
     if (ESP_OK != ret) {
-        ESP_LOGE(__func__, "spi_bus_add_device() returned %d", ret);
         return -1;
     }
 
@@ -549,25 +2526,47 @@ void app_main (
 
 
     // Core 0 gets wifi interrupts
+    // led_task itself takes up to 1.6 kB (-fstack-usage), see stack_free.
     xTaskCreatePinnedToCore(
         led_task,
         "ledtask",
-        2096,
+        4096,
         NULL,
         1,
-        NULL,
+        &led_task_handle,
         1
     );
 
+    // Above nats_task, so that led_task doesn't wait for it.
+    xTaskCreatePinnedToCore(
+        encode_task,
+        "encodetask",
+        2048,
+        NULL,
+        1,
+        &encode_task_handle,
+        0
+    );
+
     xTaskCreatePinnedToCore(
         nats_task,
-        "ledtask",
+        "natstask",
         4096,
         NULL,
         0,
         NULL,
         0
     );
+
+    xTaskCreatePinnedToCore(
+        log_task,
+        "logtask",
+        2560,
+        NULL,
+        0,
+        &log_task_handle,
+        0
+    );
    wifi_init_sta();
 
 }
@@ -0,0 +1,24 @@
+#pragma once
+
+// Things shared between matrix.c and the modules that work on frames. Nothing
+// in here may depend on ESP-IDF, so that the modules can also be built on the
+// host (see host/).
+
+#include <stdint.h>
+
+#define MATRIX_WIDTH 7
+#define MATRIX_HEIGHT 7
+#define NUM_PIXELS 49
+
+struct matrix_rgb_s {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+
+};
+
+struct matrix_rgb16_s {
+    uint16_t r;
+    uint16_t g;
+    uint16_t b;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+// What happens to a pixel between the frame and the bits on the wire: it is
+// looked up through the pixel map, corrected by the color tables and the
+// calibration of its LED and, for 16 bit frames, dithered down to 8 bits.
+// matrix_display_draw_rgb runs matrix_encode_range over the strip, in one
+// piece or split between the cores, summing up the power estimate as it
+// goes, and then applies the power limit while it writes out the bits.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "matrix.h"
+#include "color_lut.h"
+#include "color_cal.h"
+#include "power_limit.h"
+#include "frame_prefix.h"
+#include "frame_cache.h"
+
+struct matrix_encode_s {
+    // Frame index of each pixel on the strip, see pixel_map.h.
+    const uint16_t * map;
+
+    const struct color_lut_s * lut;
+
+    const struct color_cal_s * cal;
+
+    // Rounding error carried over between refreshes of 16 bit frames, per
+    // pixel on the strip and channel.
+    uint8_t (* dither)[3];
+
+    // The pixels as they go out, per pixel on the strip, before the power
+    // limit. The limit is only known once the whole frame is encoded, and
+    // frame_prefix, and outputs that don't write out pixels as they go,
+    // take them from here.
+    uint8_t (* wire)[3];
+
+    // Scales down frames that would draw too much current.
+    struct power_limit_s * power;
+
+    // Leaves out the end of the strip when it didn't change.
+    struct frame_prefix_s * prefix;
+
+    // Keeps encoded frames around, for when they come again.
+    struct frame_cache_s * cache;
+};
+
+
+// Temporal dithering: turns a 16 bit value into 8 bits and carries what
+// was rounded off over to the next refresh of the same pixel, so that
+// over a few refreshes the average comes out right.
+static inline uint8_t matrix_encode_dither (
+    uint16_t v,
+    uint8_t * err
+)
+{
+    // Scale to 0..65280 (255 << 8) first, so that adding the error can't
+    // overflow 8 bits.
+    uint32_t acc = v - (v >> 8) + *err;
+    *err = acc & 0xff;
+    return acc >> 8;
+}
+
+
+// Writes the 8 bit r, g, b of pixel i on the strip to out.
+static inline void matrix_encode_rgb (
+    const struct matrix_encode_s * enc,
+    const struct matrix_rgb_s * buf,
+    uint32_t i,
+    uint8_t * out
+)
+{
+    const struct matrix_rgb_s * px = &buf[enc->map[i]];
+    uint32_t v[3];
+
+    if (0 == enc->cal->num_matrices) {
+        out[0] = enc->lut->lut[0][px->r];
+        out[1] = enc->lut->lut[1][px->g];
+        out[2] = enc->lut->lut[2][px->b];
+        return;
+    }
+
+    v[0] = enc->lut->lut[0][px->r];
+    v[1] = enc->lut->lut[1][px->g];
+    v[2] = enc->lut->lut[2][px->b];
+    color_cal_apply(enc->cal, i, v, 255);
+    out[0] = v[0];
+    out[1] = v[1];
+    out[2] = v[2];
+}
+
+
+// Same thing for a 16 bit frame.
+static inline void matrix_encode_rgb16 (
+    const struct matrix_encode_s * enc,
+    const struct matrix_rgb16_s * buf,
+    uint32_t i,
+    uint8_t * out
+)
+{
+    const struct matrix_rgb16_s * px = &buf[enc->map[i]];
+    uint32_t v[3];
+
+    v[0] = color_lut_lookup16(enc->lut, 0, px->r);
+    v[1] = color_lut_lookup16(enc->lut, 1, px->g);
+    v[2] = color_lut_lookup16(enc->lut, 2, px->b);
+    if (0 != enc->cal->num_matrices) {
+        color_cal_apply(enc->cal, i, v, 65535);
+    }
+
+    out[0] = matrix_encode_dither(v[0], &enc->dither[i][0]);
+    out[1] = matrix_encode_dither(v[1], &enc->dither[i][1]);
+    out[2] = matrix_encode_dither(v[2], &enc->dither[i][2]);
+}
+
+
+// Encodes pixels first .. first + len - 1 on the strip, from either buf or
+// buf16, into wire, and adds up what every channel comes to in sum. Pixels
+// don't depend on each other, so separate ranges can be encoded at the same
+// time.
+static inline void matrix_encode_range (
+    const struct matrix_encode_s * enc,
+    const struct matrix_rgb_s * buf,
+    const struct matrix_rgb16_s * buf16,
+    uint8_t (* wire)[3],
+    uint32_t first,
+    uint32_t len,
+    uint32_t sum[3]
+)
+{
+    for (uint32_t i = first; i < first + len; i++) {
+        if (NULL != buf16) {
+            matrix_encode_rgb16(enc, buf16, i, wire[i]);
+        } else {
+            matrix_encode_rgb(enc, buf, i, wire[i]);
+        }
+        sum[0] += wire[i][0];
+        sum[1] += wire[i][1];
+        sum[2] += wire[i][2];
+    }
+}
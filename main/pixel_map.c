@@ -0,0 +1,93 @@
+#include "pixel_map.h"
+
+int pixel_map_build (
+    uint16_t * map,
+    uint32_t width,
+    uint32_t height,
+    const struct pixel_map_layout_s * layout
+)
+{
+    uint32_t tile_width = layout->tile_width ? layout->tile_width : width;
+    uint32_t tile_height = layout->tile_height ? layout->tile_height : height;
+    uint32_t tile_len = tile_width * tile_height;
+    uint32_t tiles_x;
+    uint32_t tile, tile_x, tile_y;
+    uint32_t major, minor;
+    uint32_t x, y;
+
+    if (0 == tile_len || 0 != width % tile_width || 0 != height % tile_height) {
+        return -1;
+    }
+    tiles_x = width / tile_width;
+
+    for (uint32_t i = 0; i < width * height; i++) {
+
+        // Where is this pixel within its tile?
+        if (layout->flags & PIXEL_MAP_COLUMNS) {
+            major = (i % tile_len) / tile_height;
+            minor = (i % tile_len) % tile_height;
+            if ((layout->flags & PIXEL_MAP_SERPENTINE) && (major & 1)) {
+                minor = tile_height - 1 - minor;
+            }
+            x = major;
+            y = minor;
+        } else {
+            major = (i % tile_len) / tile_width;
+            minor = (i % tile_len) % tile_width;
+            if ((layout->flags & PIXEL_MAP_SERPENTINE) && (major & 1)) {
+                minor = tile_width - 1 - minor;
+            }
+            x = minor;
+            y = major;
+        }
+
+        if (layout->flags & PIXEL_MAP_FLIP_X) {
+            x = tile_width - 1 - x;
+        }
+        if (layout->flags & PIXEL_MAP_FLIP_Y) {
+            y = tile_height - 1 - y;
+        }
+
+        // And where is the tile?
+        tile = i / tile_len;
+        tile_x = tile % tiles_x;
+        tile_y = tile / tiles_x;
+        if ((layout->flags & PIXEL_MAP_TILES_SERPENTINE) && (tile_y & 1)) {
+            tile_x = tiles_x - 1 - tile_x;
+        }
+
+        x += tile_x * tile_width;
+        y += tile_y * tile_height;
+        map[i] = y * width + x;
+    }
+
+    return 0;
+}
+
+
+int pixel_map_load (
+    uint16_t * map,
+    uint32_t len,
+    const uint8_t * table,
+    uint32_t table_len
+)
+{
+    uint16_t index;
+
+    if (table_len != len * 2) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        index = table[i*2] | (table[i*2 + 1] << 8);
+        if (index >= len) {
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        map[i] = table[i*2] | (table[i*2 + 1] << 8);
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// Maps the position of a pixel on the strip (its wire index) to its position
+// in the frame (y * width + x), so that producers can send frames in plain
+// row-major order regardless of how the wall is wired.
+//
+// A map is a table with one entry per pixel, which the encoder looks up as it
+// walks the strip. Tables are either built from a layout, or uploaded as-is.
+//
+// A layout describes the wall as a grid of identical tiles, chained in
+// row-major order. Within a tile, pixels are wired in rows (or columns, with
+// PIXEL_MAP_COLUMNS) starting in the top left corner. The flags combine, so
+// e.g. a tile rotated by 90 degrees is PIXEL_MAP_COLUMNS | PIXEL_MAP_FLIP_X,
+// and by 180 degrees is PIXEL_MAP_FLIP_X | PIXEL_MAP_FLIP_Y.
+
+#include <stdint.h>
+
+#define PIXEL_MAP_SERPENTINE        (1 << 0)  // every other row runs backwards
+#define PIXEL_MAP_COLUMNS           (1 << 1)  // wired in columns, not rows
+#define PIXEL_MAP_FLIP_X            (1 << 2)  // mirror each tile horizontally
+#define PIXEL_MAP_FLIP_Y            (1 << 3)  // mirror each tile vertically
+#define PIXEL_MAP_TILES_SERPENTINE  (1 << 4)  // every other row of tiles runs backwards
+
+struct pixel_map_layout_s {
+    uint8_t flags;
+
+    // The size of one tile. 0 means the whole frame is one tile.
+    uint8_t tile_width;
+    uint8_t tile_height;
+};
+
+
+// Fills map (width*height entries) from a layout. Returns -1 if the tiles
+// don't evenly cover the frame.
+int pixel_map_build (
+    uint16_t * map,
+    uint32_t width,
+    uint32_t height,
+    const struct pixel_map_layout_s * layout
+);
+
+
+// Fills map (len entries) from a table of little-endian uint16_t frame
+// indexes. Returns -1 if the table has the wrong length or points outside
+// the frame.
+int pixel_map_load (
+    uint16_t * map,
+    uint32_t len,
+    const uint8_t * table,
+    uint32_t table_len
+);
@@ -0,0 +1,84 @@
+#include "power_limit.h"
+
+// A WS2812 draws about 20 mA per channel at full brightness, and about 1 mA
+// when it's off.
+#define POWER_LIMIT_CHANNEL_MA 20
+#define POWER_LIMIT_IDLE_MA 1
+
+void power_limit_init (
+    struct power_limit_s * power
+)
+{
+    *power = (struct power_limit_s) {
+        .channel_ma = { POWER_LIMIT_CHANNEL_MA, POWER_LIMIT_CHANNEL_MA, POWER_LIMIT_CHANNEL_MA },
+        .idle_ma = POWER_LIMIT_IDLE_MA,
+        .budget_ma = 0,
+        .min_scale = 256
+    };
+}
+
+
+void power_limit_count (
+    struct power_limit_s * power,
+    uint16_t scale,
+    uint32_t ma
+)
+{
+    power->frames += 1;
+    if (ma > power->max_ma) {
+        power->max_ma = ma;
+    }
+    if (scale >= 256) {
+        return;
+    }
+
+    power->limited_frames += 1;
+    power->scale_sum += scale;
+    if (scale < power->min_scale) {
+        power->min_scale = scale;
+    }
+}
+
+
+uint16_t power_limit_scale (
+    struct power_limit_s * power,
+    uint32_t num_pixels,
+    const uint32_t sum[3]
+)
+{
+    uint64_t dynamic_ma;
+    uint32_t idle_ma;
+    uint32_t scale;
+
+    // In 1/255 mA, so we only have to divide once.
+    dynamic_ma = 0;
+    for (int c = 0; c < 3; c++) {
+        dynamic_ma += (uint64_t)sum[c] * power->channel_ma[c];
+    }
+    idle_ma = num_pixels * power->idle_ma;
+    power->last_ma = idle_ma + dynamic_ma / 255;
+
+    if (0 == power->budget_ma || power->last_ma <= power->budget_ma) {
+        scale = 256;
+    } else if (idle_ma >= power->budget_ma) {
+        // Only the dynamic part scales, the idle current is always there.
+        scale = 0;
+    } else {
+        scale = (uint64_t)(power->budget_ma - idle_ma) * 255 * 256 / dynamic_ma;
+    }
+    power_limit_count(power, scale, power->last_ma);
+
+    return scale;
+}
+
+
+void power_limit_reset_stats (
+    struct power_limit_s * power
+)
+{
+    power->frames = 0;
+    power->limited_frames = 0;
+    power->scale_sum = 0;
+    power->min_scale = 256;
+    power->max_ma = 0;
+}
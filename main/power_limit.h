@@ -0,0 +1,59 @@
+#pragma once
+
+// Keeps frames within what the power supply can deliver.
+//
+// While the encoder walks a frame it sums up the values it sends on each
+// channel. From those sums and the current each channel draws at full
+// brightness we estimate the current of the whole frame, and if that is over
+// the budget, the frame is scaled down just enough to fit before it goes out.
+
+#include <stdint.h>
+
+struct power_limit_s {
+    // Current drawn by one LED with a channel at 255, per channel (r, g, b),
+    // and by one LED that's off. In mA.
+    uint16_t channel_ma[3];
+    uint16_t idle_ma;
+
+    // What the supply can deliver, in mA. 0 means no limit.
+    uint32_t budget_ma;
+
+    // The estimate of the last frame, before limiting.
+    uint32_t last_ma;
+
+    // Telemetry, since the last power_limit_reset_stats.
+    uint32_t frames;
+    uint32_t limited_frames;
+    uint32_t scale_sum;     // of the limited frames, to get the average
+    uint16_t min_scale;
+    uint32_t max_ma;        // highest estimate, before limiting
+};
+
+
+void power_limit_init (
+    struct power_limit_s * power
+);
+
+
+// Returns the factor (0..256, where 256 is full) to scale the frame with,
+// given the sum of the values of each channel over its num_pixels pixels.
+uint16_t power_limit_scale (
+    struct power_limit_s * power,
+    uint32_t num_pixels,
+    const uint32_t sum[3]
+);
+
+
+// Counts a frame in the telemetry, scaled by scale with an estimate of ma.
+// power_limit_scale counts the frames it works out; this is for the ones
+// that go out again the way they did before, see frame_cache.h.
+void power_limit_count (
+    struct power_limit_s * power,
+    uint16_t scale,
+    uint32_t ma
+);
+
+
+void power_limit_reset_stats (
+    struct power_limit_s * power
+);
@@ -0,0 +1,232 @@
+#include <string.h>
+#include "shader_vm.h"
+
+static const uint8_t shader_vm_sin8[256] = {
+    128, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158, 162, 165, 167, 170, 173,
+    176, 179, 182, 185, 188, 190, 193, 196, 198, 201, 203, 206, 208, 211, 213, 215,
+    218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 238, 240, 241, 243, 244,
+    245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+    255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+    245, 244, 243, 241, 240, 238, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+    218, 215, 213, 211, 208, 206, 203, 201, 198, 196, 193, 190, 188, 185, 182, 179,
+    176, 173, 170, 167, 165, 162, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131,
+    128, 124, 121, 118, 115, 112, 109, 106, 103, 100,  97,  93,  90,  88,  85,  82,
+     79,  76,  73,  70,  67,  65,  62,  59,  57,  54,  52,  49,  47,  44,  42,  40,
+     37,  35,  33,  31,  29,  27,  25,  23,  21,  20,  18,  17,  15,  14,  12,  11,
+     10,   9,   7,   6,   5,   5,   4,   3,   2,   2,   1,   1,   1,   0,   0,   0,
+      0,   0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   5,   6,   7,   9,
+     10,  11,  12,  14,  15,  17,  18,  20,  21,  23,  25,  27,  29,  31,  33,  35,
+     37,  40,  42,  44,  47,  49,  52,  54,  57,  59,  62,  65,  67,  70,  73,  76,
+     79,  82,  85,  88,  90,  93,  97, 100, 103, 106, 109, 112, 115, 118, 121, 124,
+};
+
+
+int shader_vm_load (
+    struct shader_vm_s * vm,
+    const uint8_t * code,
+    uint32_t code_len
+)
+{
+    uint32_t len = code_len / 4;
+    const struct shader_vm_insn_s * insn;
+
+    if (0 != code_len % 4 || len > SHADER_VM_MAX_INSNS) {
+        return -1;
+    }
+
+    // Check everything here, so that the interpreter doesn't have to.
+    for (uint32_t i = 0; i < len; i++) {
+        insn = (const struct shader_vm_insn_s *)&code[i*4];
+
+        if (insn->op >= SHADER_VM_OP_COUNT || insn->d >= SHADER_VM_NUM_REGS) {
+            return -1;
+        }
+
+        switch (insn->op) {
+            case SHADER_VM_OP_LDI:
+            case SHADER_VM_OP_HALT:
+                break;
+
+            case SHADER_VM_OP_JMP:
+            case SHADER_VM_OP_JZ:
+            case SHADER_VM_OP_JNZ:
+                // Jumping to len lands on the HALT we add at the end.
+                if (i + 1 + insn->a > len) {
+                    return -1;
+                }
+                break;
+
+            case SHADER_VM_OP_ADDI:
+            case SHADER_VM_OP_MOV:
+            case SHADER_VM_OP_SIN:
+                if (insn->a >= SHADER_VM_NUM_REGS) {
+                    return -1;
+                }
+                break;
+
+            case SHADER_VM_OP_SHL:
+            case SHADER_VM_OP_SHR:
+                if (insn->a >= SHADER_VM_NUM_REGS || insn->b > 31) {
+                    return -1;
+                }
+                break;
+
+            default:
+                if (insn->a >= SHADER_VM_NUM_REGS || insn->b >= SHADER_VM_NUM_REGS) {
+                    return -1;
+                }
+                break;
+        }
+    }
+
+    memcpy(vm->insns, code, len * 4);
+    vm->insns[len] = (struct shader_vm_insn_s){ .op = SHADER_VM_OP_HALT };
+    vm->len = len;
+    vm->cursor = 0;
+
+    return 0;
+}
+
+
+static inline void shader_vm_eval (
+    const struct shader_vm_insn_s * ip,
+    int32_t * r
+)
+{
+    while (1) {
+        switch (ip->op) {
+            case SHADER_VM_OP_HALT:
+                return;
+            case SHADER_VM_OP_LDI:
+                r[ip->d] = (int16_t)(ip->a | (ip->b << 8));
+                break;
+            case SHADER_VM_OP_MOV:
+                r[ip->d] = r[ip->a];
+                break;
+            case SHADER_VM_OP_ADD:
+                r[ip->d] = (int32_t)((uint32_t)r[ip->a] + (uint32_t)r[ip->b]);
+                break;
+            case SHADER_VM_OP_ADDI:
+                r[ip->d] = (int32_t)((uint32_t)r[ip->a] + (uint32_t)(int8_t)ip->b);
+                break;
+            case SHADER_VM_OP_SUB:
+                r[ip->d] = (int32_t)((uint32_t)r[ip->a] - (uint32_t)r[ip->b]);
+                break;
+            case SHADER_VM_OP_MUL:
+                r[ip->d] = (int32_t)((uint32_t)r[ip->a] * (uint32_t)r[ip->b]);
+                break;
+            case SHADER_VM_OP_MULQ:
+                r[ip->d] = (int32_t)(((int64_t)r[ip->a] * r[ip->b]) >> 8);
+                break;
+            // Dividing by -1 is special-cased, since INT32_MIN / -1 traps.
+            case SHADER_VM_OP_DIV:
+                if (0 == r[ip->b]) r[ip->d] = 0;
+                else if (-1 == r[ip->b]) r[ip->d] = (int32_t)(0U - (uint32_t)r[ip->a]);
+                else r[ip->d] = r[ip->a] / r[ip->b];
+                break;
+            case SHADER_VM_OP_MOD:
+                if (0 == r[ip->b] || -1 == r[ip->b]) r[ip->d] = 0;
+                else r[ip->d] = r[ip->a] % r[ip->b];
+                break;
+            case SHADER_VM_OP_AND:
+                r[ip->d] = r[ip->a] & r[ip->b];
+                break;
+            case SHADER_VM_OP_OR:
+                r[ip->d] = r[ip->a] | r[ip->b];
+                break;
+            case SHADER_VM_OP_XOR:
+                r[ip->d] = r[ip->a] ^ r[ip->b];
+                break;
+            case SHADER_VM_OP_SHL:
+                r[ip->d] = (int32_t)((uint32_t)r[ip->a] << ip->b);
+                break;
+            case SHADER_VM_OP_SHR:
+                r[ip->d] = r[ip->a] >> ip->b;
+                break;
+            case SHADER_VM_OP_MIN:
+                r[ip->d] = r[ip->a] < r[ip->b] ? r[ip->a] : r[ip->b];
+                break;
+            case SHADER_VM_OP_MAX:
+                r[ip->d] = r[ip->a] > r[ip->b] ? r[ip->a] : r[ip->b];
+                break;
+            case SHADER_VM_OP_LT:
+                r[ip->d] = r[ip->a] < r[ip->b];
+                break;
+            case SHADER_VM_OP_SIN:
+                r[ip->d] = shader_vm_sin8[r[ip->a] & 255];
+                break;
+            case SHADER_VM_OP_JMP:
+                ip += ip->a;
+                break;
+            case SHADER_VM_OP_JZ:
+                if (0 == r[ip->d]) ip += ip->a;
+                break;
+            case SHADER_VM_OP_JNZ:
+                if (0 != r[ip->d]) ip += ip->a;
+                break;
+        }
+        ip++;
+    }
+}
+
+
+static inline uint8_t shader_vm_clamp (
+    int32_t v
+)
+{
+    if (v < 0) return 0;
+    if (v > 255) return 255;
+    return v;
+}
+
+
+uint32_t shader_vm_run (
+    struct shader_vm_s * vm,
+    struct matrix_rgb_s * frame,
+    uint32_t width,
+    uint32_t height,
+    uint32_t t,
+    uint32_t budget
+)
+{
+    uint32_t num_pixels = width * height;
+    uint32_t count;
+    uint32_t i;
+    int32_t r[SHADER_VM_NUM_REGS];
+
+    if (0 == num_pixels) {
+        return 0;
+    }
+
+    // Every pixel costs at most len + 1 instructions (the +1 is the HALT),
+    // so we know up front how many pixels fit in the budget.
+    count = budget / (vm->len + 1);
+    if (count > num_pixels) {
+        count = num_pixels;
+    }
+
+    i = vm->cursor < num_pixels ? vm->cursor : 0;
+    for (uint32_t n = 0; n < count; n++) {
+        memset(r, 0, sizeof(r));
+        r[0] = i % width;
+        r[1] = i / width;
+        r[2] = t;
+        r[3] = frame[i].r;
+        r[4] = frame[i].g;
+        r[5] = frame[i].b;
+
+        shader_vm_eval(vm->insns, r);
+
+        frame[i].r = shader_vm_clamp(r[3]);
+        frame[i].g = shader_vm_clamp(r[4]);
+        frame[i].b = shader_vm_clamp(r[5]);
+
+        i += 1;
+        if (i == num_pixels) {
+            i = 0;
+        }
+    }
+    vm->cursor = i;
+
+    return count;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+// A small register based bytecode VM for per-pixel shaders.
+//
+// A program is a list of 4 byte instructions { op, d, a, b }, uploaded on
+// matrix1.ctl.shader. It is run once for every pixel with these registers
+// set up:
+//
+//   r0 = x, r1 = y, r2 = t (milliseconds), r3/r4/r5 = previous r/g/b
+//
+// and all other registers set to zero. When the program halts, r3/r4/r5 are
+// clamped to 0..255 and become the new color of the pixel.
+//
+// Branches can only jump forward, so a pixel can never execute more than
+// len instructions. On top of that, every frame has an instruction budget;
+// pixels that don't fit in the budget keep their old value and are picked
+// up first on the next frame.
+
+#include <stdint.h>
+#include "matrix.h"
+
+#define SHADER_VM_NUM_REGS 16
+#define SHADER_VM_MAX_INSNS 64
+
+enum shader_vm_op_e {
+    SHADER_VM_OP_HALT = 0,
+    SHADER_VM_OP_LDI,   // rd = (int16_t)(a | b << 8)
+    SHADER_VM_OP_MOV,   // rd = ra
+    SHADER_VM_OP_ADD,   // rd = ra + rb
+    SHADER_VM_OP_ADDI,  // rd = ra + (int8_t)b
+    SHADER_VM_OP_SUB,   // rd = ra - rb
+    SHADER_VM_OP_MUL,   // rd = ra * rb
+    SHADER_VM_OP_MULQ,  // rd = (ra * rb) >> 8
+    SHADER_VM_OP_DIV,   // rd = ra / rb, or 0 if rb is 0
+    SHADER_VM_OP_MOD,   // rd = ra % rb, or 0 if rb is 0
+    SHADER_VM_OP_AND,   // rd = ra & rb
+    SHADER_VM_OP_OR,    // rd = ra | rb
+    SHADER_VM_OP_XOR,   // rd = ra ^ rb
+    SHADER_VM_OP_SHL,   // rd = ra << b
+    SHADER_VM_OP_SHR,   // rd = ra >> b
+    SHADER_VM_OP_MIN,   // rd = min(ra, rb)
+    SHADER_VM_OP_MAX,   // rd = max(ra, rb)
+    SHADER_VM_OP_LT,    // rd = ra < rb
+    SHADER_VM_OP_SIN,   // rd = 128 + 127 * sin(2pi * (ra & 255) / 256)
+    SHADER_VM_OP_JMP,   // skip the next a instructions
+    SHADER_VM_OP_JZ,    // skip the next a instructions if rd == 0
+    SHADER_VM_OP_JNZ,   // skip the next a instructions if rd != 0
+    SHADER_VM_OP_COUNT
+};
+
+struct shader_vm_insn_s {
+    uint8_t op;
+    uint8_t d;
+    uint8_t a;
+    uint8_t b;
+};
+
+struct shader_vm_s {
+    // One extra slot for the HALT that shader_vm_load puts after the program.
+    struct shader_vm_insn_s insns[SHADER_VM_MAX_INSNS + 1];
+    uint32_t len;
+
+    // Where the next frame starts evaluating, if the last one ran out of
+    // budget.
+    uint32_t cursor;
+};
+
+
+// Validates and loads a program. Returns 0 on success and -1 if the program
+// is malformed, in which case vm is left untouched.
+int shader_vm_load (
+    struct shader_vm_s * vm,
+    const uint8_t * code,
+    uint32_t code_len
+);
+
+
+// Runs the program over a width*height frame in row-major order, using at
+// most budget instructions. Returns the number of pixels that were evaluated.
+uint32_t shader_vm_run (
+    struct shader_vm_s * vm,
+    struct matrix_rgb_s * frame,
+    uint32_t width,
+    uint32_t height,
+    uint32_t t,
+    uint32_t budget
+);
@@ -0,0 +1,97 @@
+#include <string.h>
+#include "task_stats.h"
+#include "telemetry.h"
+
+void task_stats_init (
+    struct task_stats_s * ts
+)
+{
+    memset(ts, 0, sizeof(*ts));
+}
+
+
+uint32_t task_stats_cpu (
+    const struct task_stats_s * ts,
+    uint32_t i
+)
+{
+    const struct task_stats_task_s * task = &ts->tasks[i];
+    uint32_t runtime = task->runtime;
+    uint32_t period = ts->time - ts->last_time;
+    uint64_t cpu;
+
+    // Tasks that weren't there last time ran only since.
+    for (uint32_t j = 0; j < ts->last_count; j++) {
+        if (ts->last[j].id == task->id) {
+            runtime -= ts->last[j].runtime;
+            break;
+        }
+    }
+
+    if (0 == period) {
+        return 0;
+    }
+    cpu = (uint64_t)runtime * 1000 / period;
+
+    return cpu > 1000 ? 1000 : cpu;
+}
+
+
+uint32_t task_stats_json (
+    const struct task_stats_s * ts,
+    char * buf,
+    uint32_t len
+)
+{
+    uint32_t cpu[TASK_STATS_MAX];
+    uint32_t busy[TASK_STATS_CORES] = { 0 };
+    bool idle[TASK_STATS_CORES] = { false };
+    uint8_t order[TASK_STATS_MAX];
+    const struct task_stats_task_s * task;
+    uint32_t used = 0;
+    uint8_t t;
+
+    // Insertion sort, there are only a few dozen.
+    for (uint32_t i = 0; i < ts->count; i++) {
+        cpu[i] = task_stats_cpu(ts, i);
+        task = &ts->tasks[i];
+        if (task->core >= 0 && task->core < TASK_STATS_CORES && !idle[task->core]) {
+            if (task->idle) {
+                idle[task->core] = true;
+                busy[task->core] = 1000 - cpu[i];
+            } else {
+                busy[task->core] += cpu[i];
+            }
+        }
+
+        order[i] = i;
+        for (uint32_t j = i; j > 0 && cpu[order[j - 1]] < cpu[order[j]]; j--) {
+            t = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = t;
+        }
+    }
+
+    telemetry_append(buf, len, &used, "{\"period_ms\":%u,\"busy\":[%u,%u],\"tasks\":[",
+            (ts->time - ts->last_time) / 1000, busy[0], busy[1]);
+    for (uint32_t i = 0; i < ts->count; i++) {
+        task = &ts->tasks[order[i]];
+        telemetry_append(buf, len, &used, "%s{\"name\":\"%.*s\",\"core\":%d,\"prio\":%u,\"cpu\":%u,\"stack_free\":%u}",
+                0 == i ? "" : ",", TASK_STATS_NAME_LEN, task->name, task->core, task->priority,
+                cpu[order[i]], task->stack_free);
+    }
+    telemetry_append(buf, len, &used, "]}");
+
+    return used >= len ? 0 : used;
+}
+
+
+void task_stats_next (
+    struct task_stats_s * ts
+)
+{
+    memcpy(ts->last, ts->tasks, sizeof(ts->last));
+    ts->last_count = ts->count;
+    ts->last_time = ts->time;
+    ts->count = 0;
+}
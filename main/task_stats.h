@@ -0,0 +1,77 @@
+#pragma once
+
+// How busy every task is, and how close it came to the end of its stack,
+// for every task there is: ours, and the ones ESP-IDF starts (wifi, tcpip,
+// the timer task, the idle tasks). nats_task samples FreeRTOS's run time
+// stats into a task_stats_s and publishes it with the other stats.
+//
+// Run times are FreeRTOS's counters, which count microseconds from boot and
+// wrap every 71 minutes; CPU use is the difference between two samples. A
+// core is as busy as its idle task isn't, or, without one, as the tasks
+// pinned to it are.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TASK_STATS_MAX 32
+#define TASK_STATS_CORES 2
+#define TASK_STATS_NAME_LEN 16
+
+struct task_stats_task_s {
+    uint32_t id;                // FreeRTOS's task number, never reused
+    char name[TASK_STATS_NAME_LEN];
+    int8_t core;                // -1 if it isn't pinned
+    uint8_t priority;
+    bool idle;                  // the idle task of its core
+    uint32_t runtime;
+    uint32_t stack_free;        // least there ever was, in bytes
+};
+
+struct task_stats_s {
+    // The sample being filled in and the one before. Times are in run time
+    // counter ticks.
+    struct task_stats_task_s tasks[TASK_STATS_MAX];
+    uint32_t count;
+    uint32_t time;
+
+    struct task_stats_task_s last[TASK_STATS_MAX];
+    uint32_t last_count;
+    uint32_t last_time;
+};
+
+
+void task_stats_init (
+    struct task_stats_s * ts
+);
+
+
+// Per mille of a core the i-th task of the current sample used since the
+// last one, or since boot if it's the first.
+uint32_t task_stats_cpu (
+    const struct task_stats_s * ts,
+    uint32_t i
+);
+
+
+// Writes the current sample to buf as one JSON object, with how busy each
+// core was and then every task, highest CPU first:
+//
+//   {"period_ms":10000,"busy":[412,187],"tasks":[
+//    {"name":"ledtask","core":1,"prio":1,"cpu":180,"stack_free":812},
+//    {"name":"wifi","core":0,"prio":23,"cpu":95,"stack_free":1900},...]}
+//
+// Returns the length, or 0 if it doesn't fit in len bytes.
+// TASK_STATS_JSON_LEN is always enough.
+#define TASK_STATS_JSON_LEN (64 + TASK_STATS_MAX * (TASK_STATS_NAME_LEN + 80))
+
+uint32_t task_stats_json (
+    const struct task_stats_s * ts,
+    char * buf,
+    uint32_t len
+);
+
+
+// Makes the current sample the last one, to take the next sample against.
+void task_stats_next (
+    struct task_stats_s * ts
+);
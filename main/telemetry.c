@@ -0,0 +1,89 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "telemetry.h"
+
+void telemetry_init (
+    struct telemetry_s * tel
+)
+{
+    memset(tel, 0, sizeof(*tel));
+    tel->period_ms = TELEMETRY_DEFAULT_PERIOD_MS;
+    tel->power_min_scale = 256;
+}
+
+
+void telemetry_append (
+    char * buf,
+    uint32_t len,
+    uint32_t * used,
+    const char * fmt,
+    ...
+)
+{
+    va_list args;
+    int n;
+
+    if (*used >= len) {
+        return;
+    }
+
+    va_start(args, fmt);
+    n = vsnprintf(buf + *used, len - *used, fmt, args);
+    va_end(args);
+
+    if (n < 0 || (uint32_t)n >= len - *used) {
+        *used = len;
+        return;
+    }
+    *used += n;
+}
+
+
+static void telemetry_append_array (
+    char * buf,
+    uint32_t len,
+    uint32_t * used,
+    const char * name,
+    const uint32_t * values,
+    uint32_t num_values
+)
+{
+    telemetry_append(buf, len, used, ",\"%s\":[", name);
+    for (uint32_t i = 0; i < num_values; i++) {
+        telemetry_append(buf, len, used, "%s%u", 0 == i ? "" : ",", values[i]);
+    }
+    telemetry_append(buf, len, used, "]");
+}
+
+
+uint32_t telemetry_json (
+    const struct telemetry_s * tel,
+    char * buf,
+    uint32_t len
+)
+{
+    uint32_t used = 0;
+
+    telemetry_append(buf, len, &used, "{\"uptime_s\":%u,\"frames\":%u,\"queue_full\":%u,\"queue_high\":%u,\"dropped\":%u",
+            tel->uptime_s, tel->frames, tel->queue_full, tel->queue_high, tel->dropped);
+    telemetry_append_array(buf, len, &used, "parse_errors", tel->parse_errors, TELEMETRY_NATS_MACHINES);
+    telemetry_append(buf, len, &used, ",\"connects\":%u,\"publish_failures\":%u,\"wifi_reconnects\":%u,\"missed\":%u",
+            tel->connects, tel->publish_failures, tel->wifi_reconnects, tel->missed);
+    telemetry_append_array(buf, len, &used, "late_ms", tel->late, TELEMETRY_LATE_BUCKETS);
+    telemetry_append(buf, len, &used, ",\"send_errors\":%u", tel->send_errors);
+    telemetry_append(buf, len, &used, ",\"power_frames\":%u,\"power_limited\":%u,\"power_scale_sum\":%u,\"power_min_scale\":%u,\"power_max_ma\":%u",
+            tel->power_frames, tel->power_limited, tel->power_scale_sum, tel->power_min_scale, tel->power_max_ma);
+    telemetry_append(buf, len, &used, ",\"cache_lookups\":%u,\"cache_hits\":%u,\"cache_bytes_saved\":%u,\"cache_used\":%u",
+            tel->cache_lookups, tel->cache_hits, tel->cache_bytes_saved, tel->cache_used);
+    telemetry_append(buf, len, &used, ",\"skipped\":%u,\"prefix_bytes_saved\":%u",
+            tel->skipped, tel->prefix_bytes_saved);
+    telemetry_append(buf, len, &used, ",\"clock_ticks\":%u,\"clock_missed\":%u,\"clock_overruns\":%u,\"clock_max_us\":%u",
+            tel->clock_ticks, tel->clock_missed, tel->clock_overruns, tel->clock_max_us);
+    telemetry_append(buf, len, &used, ",\"log_dropped\":%u,\"heap_free\":%u,\"heap_min\":%u",
+            tel->log_dropped, tel->heap_free, tel->heap_min);
+    telemetry_append_array(buf, len, &used, "stack_free", tel->stack_free, TELEMETRY_TASKS);
+    telemetry_append(buf, len, &used, "}");
+
+    return used >= len ? 0 : used;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+// Counters that tell how a wall is doing without a serial cable: how full
+// event_queue gets, frames that were dropped or missed and how late they
+// were, parse errors per state machine, failed transfers, reconnects, how
+// often the power limit stepped in, how well the frame cache does, how
+// many frames were skipped or cut short, how the refresh clock keeps up,
+// and how much heap and stack is left. nats_task publishes them every
+// period_ms, see telemetry_json.
+//
+// Like latency_hist, every counter has one writer (the task named next to
+// it), and they all run from boot, so nothing needs a lock.
+
+#include <stdint.h>
+
+// Late-by buckets are powers of two, in ms: bucket 0 counts anything under
+// 2 ms, bucket i anything from 2^i to 2^(i+1) ms, and the last one
+// everything later.
+#define TELEMETRY_LATE_BUCKETS 12
+
+#define TELEMETRY_DEFAULT_PERIOD_MS 10000U
+
+// The machines of the NATS parser, for parse errors.
+enum telemetry_machine_e {
+    TELEMETRY_NATS_MAIN,
+    TELEMETRY_NATS_LOOP,
+    TELEMETRY_NATS_INFO,
+    TELEMETRY_NATS_PING,
+    TELEMETRY_NATS_MSG,
+    TELEMETRY_NATS_MSG_SUBJECT,
+    TELEMETRY_NATS_MSG_END,
+    TELEMETRY_NATS_MACHINES
+};
+
+// Tasks whose stack is watched.
+enum telemetry_task_e {
+    TELEMETRY_TASK_LED,
+    TELEMETRY_TASK_ENCODE,
+    TELEMETRY_TASK_NATS,
+    TELEMETRY_TASK_LOG,
+    TELEMETRY_TASKS
+};
+
+struct telemetry_s {
+    // How often to publish, 0 for never. nats_task.
+    uint32_t period_ms;
+
+    // nats_task
+    uint32_t frames;            // queued for led_task
+    uint32_t queue_full;        // dropped because event_queue was full
+    uint32_t queue_high;        // most frames event_queue ever held
+    uint32_t dropped;           // bad or too long messages, full control_queue
+    uint32_t parse_errors[TELEMETRY_NATS_MACHINES];
+    uint32_t connects;
+    uint32_t publish_failures;
+
+    // The wifi event handler.
+    uint32_t wifi_reconnects;
+
+    // led_task
+    uint32_t missed;            // frames that came in after their time
+    uint32_t late[TELEMETRY_LATE_BUCKETS];
+    uint32_t send_errors;       // transfers that couldn't be started
+
+    // led_task, added up from power_limit_s every time it reports
+    uint32_t power_frames;
+    uint32_t power_limited;     // frames that were scaled down
+    uint32_t power_scale_sum;   // of the limited frames, in 256ths
+    uint32_t power_min_scale;   // the lowest, 256 if none was limited
+    uint32_t power_max_ma;      // the highest estimate, before limiting
+
+    // led_task, added up from frame_cache_s every time it reports
+    uint32_t cache_lookups;
+    uint32_t cache_hits;
+    uint32_t cache_bytes_saved; // of encoding, wraps after 4 GB
+    uint32_t cache_used;        // bytes, as of the last report
+
+    // led_task, added up from frame_skip_s, frame_prefix_s and
+    // frame_clock_s every time it reports
+    uint32_t skipped;           // frames that were the same as the one shown
+    uint32_t prefix_bytes_saved; // on the wire, past the last pixel that changed
+    uint32_t clock_ticks;
+    uint32_t clock_missed;
+    uint32_t clock_overruns;    // ticks that took longer than a tick
+    uint32_t clock_max_us;      // the longest a tick took
+
+    // Sampled by nats_task right before publishing.
+    uint32_t uptime_s;
+    uint32_t heap_free;
+    uint32_t heap_min;
+    uint32_t stack_free[TELEMETRY_TASKS];   // least there ever was, in bytes
+    uint32_t log_dropped;       // lines over their limit or with no room, see log_ring.h
+};
+
+
+void telemetry_init (
+    struct telemetry_s * tel
+);
+
+
+// Counts a frame that was missed by late_ms.
+static inline void telemetry_missed (
+    struct telemetry_s * tel,
+    uint32_t late_ms
+)
+{
+    uint32_t bucket = 0;
+
+    if (late_ms >= 2) {
+        bucket = 31 - __builtin_clz(late_ms);
+        if (bucket >= TELEMETRY_LATE_BUCKETS) {
+            bucket = TELEMETRY_LATE_BUCKETS - 1;
+        }
+    }
+    tel->missed++;
+    tel->late[bucket]++;
+}
+
+
+// Appends to buf like snprintf, keeping track of *used. Once something
+// doesn't fit, *used is set past len and stays there.
+void telemetry_append (
+    char * buf,
+    uint32_t len,
+    uint32_t * used,
+    const char * fmt,
+    ...
+);
+
+
+// Writes tel to buf as one JSON object, with the arrays in the order of
+// their enums:
+//
+//   {"uptime_s":120,"frames":3600,"queue_full":0,"queue_high":3,
+//    "dropped":0,"parse_errors":[0,0,0,0,1,0,0],"connects":1,
+//    "publish_failures":0,"wifi_reconnects":0,"missed":2,
+//    "late_ms":[1,1,0,...],"send_errors":0,"power_frames":3600,
+//    "power_limited":120,"power_scale_sum":26880,"power_min_scale":200,
+//    "power_max_ma":2900,"cache_lookups":3600,"cache_hits":1800,
+//    "cache_bytes_saved":8467200,"cache_used":28224,"skipped":600,
+//    "prefix_bytes_saved":1881600,"clock_ticks":12000,"clock_missed":3,
+//    "clock_overruns":1,"clock_max_us":2100,"log_dropped":0,
+//    "heap_free":81234,"heap_min":79000,"stack_free":[812,1200,2400,900]}
+//
+// Returns the length, or 0 if it doesn't fit in len bytes.
+// TELEMETRY_JSON_LEN is always enough.
+#define TELEMETRY_JSON_LEN (512 + (TELEMETRY_NATS_MACHINES + TELEMETRY_LATE_BUCKETS + TELEMETRY_TASKS + 28) * 11)
+
+uint32_t telemetry_json (
+    const struct telemetry_s * tel,
+    char * buf,
+    uint32_t len
+);
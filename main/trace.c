@@ -0,0 +1,60 @@
+#include <stddef.h>
+#include <string.h>
+#include "trace.h"
+
+static const char * const trace_type_names[TRACE_TYPES] = {
+    [TRACE_MSG] = "msg",
+    [TRACE_QUEUED] = "queued",
+    [TRACE_QUEUE_FULL] = "queue full",
+    [TRACE_DEQUEUED] = "dequeued",
+    [TRACE_MISSED] = "missed",
+    [TRACE_DEADLINE] = "deadline",
+    [TRACE_SKIPPED] = "skipped",
+    [TRACE_SENT] = "sent",
+    [TRACE_DONE] = "done",
+    [TRACE_PING] = "ping",
+    [TRACE_CONTROL] = "control",
+    [TRACE_TICK] = "tick",
+    [TRACE_PUBLISH] = "publish"
+};
+
+
+void trace_init (
+    struct trace_s * trace
+)
+{
+    memset(trace, 0, sizeof(*trace));
+    trace->magic = TRACE_MAGIC;
+}
+
+
+bool trace_survived (
+    const struct trace_s * trace
+)
+{
+    if (TRACE_MAGIC != trace->magic) {
+        return false;
+    }
+
+    // Memory that was never written can start with the magic by chance,
+    // but then the events are unlikely to make sense too.
+    for (uint32_t i = 0; i < TRACE_LEN && i < trace->head; i++) {
+        if (trace->events[i].type >= TRACE_TYPES || trace->events[i].core > 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+const char * trace_type_name (
+    uint8_t type
+)
+{
+    if (type >= TRACE_TYPES) {
+        return NULL;
+    }
+
+    return trace_type_names[type];
+}
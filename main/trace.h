@@ -0,0 +1,103 @@
+#pragma once
+
+// Event-level tracing: every frame's way through nats_task and led_task
+// (read, queued, taken off the queue, its time reached, sent, on the
+// strip), and what else goes on around it, as 8 byte records in a RAM ring.
+// Aggregates like latency_hist say how often something is slow; this says
+// what happened the one time it was.
+//
+// Recording takes a timestamp the caller already has and one atomic add to
+// claim a slot, so it's fine for ISRs and either core.
+//
+// Dumps are the struct trace_s as it is in memory, little-endian, and
+// host/trace_decode turns them into Chrome trace JSON for chrome://tracing
+// or Perfetto.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A power of two.
+#define TRACE_LEN 1024
+
+#define TRACE_MAGIC 0x31435254  // "TRC1"
+
+// Frame events carry the frame's sequence number as their arg.
+#define TRACE_NO_FRAME 0xffff
+
+enum trace_type_e {
+    TRACE_NONE,
+    TRACE_MSG,          // read() returned the start of a MSG
+    TRACE_QUEUED,       // frame queued for led_task, arg: frame
+    TRACE_QUEUE_FULL,   // frame dropped, event_queue was full, arg: frame
+    TRACE_DEQUEUED,     // led_task took a frame, arg: frame
+    TRACE_MISSED,       // frame came after its time, arg: frame
+    TRACE_DEADLINE,     // a frame's time came, arg: frame
+    TRACE_SKIPPED,      // frame was the same as the strip, arg: frame
+    TRACE_SENT,         // a transfer started, arg: frame or TRACE_NO_FRAME
+    TRACE_DONE,         // the transfer finished, arg: frame or TRACE_NO_FRAME
+    TRACE_PING,         // PING answered
+    TRACE_CONTROL,      // control message handled, arg: enum control_type_e
+    TRACE_TICK,         // refresh clock tick
+    TRACE_PUBLISH,      // stats published
+    TRACE_TYPES
+};
+
+struct trace_event_s {
+    uint32_t time_us;   // esp_timer_get_time(), wraps every 71 minutes
+    uint16_t arg;
+    uint8_t type;
+    uint8_t core;
+};
+
+struct trace_s {
+    uint32_t magic;
+
+    // How many events were ever recorded. The next one goes in
+    // events[head % TRACE_LEN].
+    uint32_t head;
+
+    // Nothing is recorded while this isn't 0, so that a dump is consistent.
+    uint32_t paused;
+
+    struct trace_event_s events[TRACE_LEN];
+};
+
+
+void trace_init (
+    struct trace_s * trace
+);
+
+
+// Whether trace holds events from before a reset, for memory that isn't
+// cleared at boot.
+bool trace_survived (
+    const struct trace_s * trace
+);
+
+
+static inline void trace_record (
+    struct trace_s * trace,
+    enum trace_type_e type,
+    int core,
+    int64_t time_us,
+    uint16_t arg
+)
+{
+    struct trace_event_s * e;
+
+    if (0 != trace->paused) {
+        return;
+    }
+
+    e = &trace->events[__atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED) & (TRACE_LEN - 1)];
+    e->time_us = time_us;
+    e->arg = arg;
+    e->type = type;
+    e->core = core;
+}
+
+
+// Returns the name of an event type, or NULL if there's no such type.
+const char * trace_type_name (
+    uint8_t type
+);